@@ -0,0 +1,212 @@
+/**
+ * @file channel.cc
+ * @brief 协程channel和select实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "channel.h"
+#include <vector>
+#include "scheduler.h"
+
+namespace sylar {
+
+void ChannelWaitList::push(ChannelWaitNode *node) {
+    node->prev   = m_tail;
+    node->next   = nullptr;
+    node->linked = true;
+    if (m_tail) {
+        m_tail->next = node;
+    } else {
+        m_head = node;
+    }
+    m_tail = node;
+}
+
+void ChannelWaitList::remove(ChannelWaitNode *node) {
+    if (!node->linked) {
+        return;
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        m_head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        m_tail = node->prev;
+    }
+    node->prev = node->next = nullptr;
+    node->linked            = false;
+}
+
+bool ChannelWaitList::fireOne(FiberWaiter &waiter) {
+    while (m_head) {
+        ChannelWaitNode *node = m_head;
+        remove(node);
+        int expected = -1;
+        // select的另一个case已经唤醒了它，跳过
+        if (!node->selector->fired.compare_exchange_strong(expected, node->index)) {
+            continue;
+        }
+        // 被标记之后等待方要等到wake()才会继续，这里拷出来的信息不会失效
+        waiter.scheduler = node->selector->waiter.scheduler;
+        waiter.fiber     = node->selector->waiter.fiber;
+        waiter.sem       = node->selector->waiter.sem;
+        return true;
+    }
+    return false;
+}
+
+int ChannelBase::tryOnce(bool send, void *value) {
+    FiberWaiter waiter;
+    m_spin.lock();
+    int rt = tryLocked(send, value, waiter);
+    m_spin.unlock();
+    if (waiter.fiber || waiter.sem) {
+        waiter.wake();
+    }
+    return rt;
+}
+
+void ChannelBase::close() {
+    std::vector<FiberWaiter> waiters;
+    m_spin.lock();
+    m_closed = true;
+    FiberWaiter waiter;
+    while (m_recvWaiters.fireOne(waiter) || m_sendWaiters.fireOne(waiter)) {
+        waiters.push_back(std::move(waiter));
+        waiter = FiberWaiter();
+    }
+    m_spin.unlock();
+    for (auto &i : waiters) {
+        i.wake();
+    }
+}
+
+/// 同时就绪时从哪个case开始检查，每次挪一位
+static thread_local uint32_t t_select_start = 0;
+
+int Select(SelectCase *cases, size_t n, bool block) {
+    SYLAR_ASSERT(n > 0);
+    size_t start = n > 1 ? t_select_start++ % n : 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t k = (start + i) % n;
+        int rt   = cases[k].channel->tryOnce(cases[k].send, cases[k].value);
+        if (rt) {
+            cases[k].ok = rt > 0;
+            return k;
+        }
+    }
+    if (!block) {
+        return -1;
+    }
+
+    // 挂起期间别的协程要访问等待者和节点，共享栈协程切出后栈会被覆盖，放到堆上
+    Fiber *cur   = Scheduler::GetThis() ? Fiber::GetThis().get() : nullptr;
+    bool on_heap = cur && cur->isSharedStack();
+    ChannelSelector local_selector;
+    ChannelWaitNode local_nodes[4];
+    std::unique_ptr<ChannelSelector> heap_selector;
+    std::unique_ptr<ChannelWaitNode[]> heap_nodes;
+    ChannelSelector *selector = &local_selector;
+    ChannelWaitNode *nodes    = local_nodes;
+    if (on_heap) {
+        heap_selector.reset(new ChannelSelector);
+        selector = heap_selector.get();
+    }
+    if (on_heap || n > 4) {
+        heap_nodes.reset(new ChannelWaitNode[n]);
+        nodes = heap_nodes.get();
+    }
+
+    while (true) {
+        Semaphore sem;
+        selector->fired  = -1;
+        selector->waiter = FiberWaiter();
+        bool is_fiber    = selector->waiter.initFiber();
+        if (!is_fiber) {
+            selector->waiter.sem = &sem;
+        }
+
+        // 逐个channel检查并挂上去，一个case在同一把锁里检查和入队，不会漏掉唤醒
+        int done       = -1;
+        int rt         = 0;
+        size_t checked = 0;
+        for (; checked < n; checked++) {
+            size_t k      = (start + checked) % n;
+            SelectCase &c = cases[k];
+            FiberWaiter waiter;
+            c.channel->m_spin.lock();
+            rt = c.channel->tryLocked(c.send, c.value, waiter);
+            if (!rt) {
+                nodes[k].selector = selector;
+                nodes[k].index    = k;
+                c.channel->waiters(c.send).push(&nodes[k]);
+            }
+            c.channel->m_spin.unlock();
+            if (waiter.fiber || waiter.sem) {
+                waiter.wake();
+            }
+            if (rt) {
+                done = k;
+                break;
+            }
+        }
+
+        int fired = -1;
+        if (done < 0) {
+            if (is_fiber) {
+                // 唤醒可能发生在yield之前，调度器看到协程还是RUNNING状态会稍后再试
+                cur->yield();
+            } else {
+                sem.wait();
+            }
+            fired = selector->fired;
+        } else if (selector->fired.compare_exchange_strong(fired, -2)) {
+            // 没人唤醒，自己撤销外部等待的登记
+            if (is_fiber) {
+                selector->waiter.scheduler->delExternalWaiter();
+            }
+        } else {
+            // 前面挂上去的channel已经唤醒了我们，wake()一定会来，要把它消化掉
+            if (is_fiber) {
+                cur->yield();
+            } else {
+                sem.wait();
+            }
+        }
+
+        for (size_t i = 0; i < checked; i++) {
+            size_t k = (start + i) % n;
+            Spinlock::Lock lock(cases[k].channel->m_spin);
+            cases[k].channel->waiters(cases[k].send).remove(&nodes[k]);
+        }
+
+        if (done >= 0) {
+            if (fired >= 0) {
+                // 唤醒我们的那个channel的状态变化没有被用掉，转交给它上面的下一个等待者
+                SelectCase &c = cases[fired];
+                FiberWaiter waiter;
+                c.channel->m_spin.lock();
+                c.channel->waiters(c.send).fireOne(waiter);
+                c.channel->m_spin.unlock();
+                if (waiter.fiber || waiter.sem) {
+                    waiter.wake();
+                }
+            }
+            cases[done].ok = rt > 0;
+            return done;
+        }
+
+        // 先试唤醒我们的那个，被别人抢先了就重新全部检查一遍
+        SelectCase &c = cases[fired];
+        rt            = c.channel->tryOnce(c.send, c.value);
+        if (rt) {
+            c.ok = rt > 0;
+            return fired;
+        }
+    }
+}
+
+} // namespace sylar
@@ -0,0 +1,300 @@
+/**
+ * @file channel.h
+ * @brief 协程channel，类似go的chan
+ * @details 协程之间传递数据，缓冲区满时send、空时recv只挂起当前协程，不阻塞调度线程；
+ *          缓冲区是RingBuffer，有界时一次分配好，收发只是挪下标；
+ *          close之后send失败，recv取完剩下的数据后返回false；
+ *          Select可以同时等多个channel上的收发，哪个先就绪就完成哪个。
+ *          不在协程里(普通线程、调度协程)时用线程信号量等待，线程和协程之间也可以收发
+ * @note 和go不同，容量至少为1，没有无缓冲的同步channel
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_CHANNEL_H__
+#define __SYLAR_CHANNEL_H__
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "fiber_mutex.h"
+#include "macro.h"
+
+namespace sylar {
+
+/**
+ * @brief 一次阻塞的收发或select，可能同时挂在多个channel上
+ */
+struct ChannelSelector {
+    /// 被哪个case唤醒，-1表示还在等，-2表示已经结束不再接受唤醒
+    std::atomic<int> fired = {-1};
+    /// 挂起的协程或线程
+    FiberWaiter waiter;
+};
+
+/**
+ * @brief 挂在channel等待链表上的节点，select的每个case一个
+ */
+struct ChannelWaitNode {
+    /// 所属的等待者
+    ChannelSelector *selector = nullptr;
+    /// 在select里的下标
+    int index = 0;
+    /// 是否还在链表上
+    bool linked = false;
+    ChannelWaitNode *prev = nullptr;
+    ChannelWaitNode *next = nullptr;
+};
+
+/**
+ * @brief channel上的等待链表，侵入式，由channel的自旋锁保护
+ * @details select结束时要把自己从没触发的channel上摘掉，需要能从中间删除，所以不用FiberWaitQueue
+ */
+class ChannelWaitList : Noncopyable {
+public:
+    /**
+     * @brief 节点加到链表尾
+     */
+    void push(ChannelWaitNode *node);
+
+    /**
+     * @brief 摘掉节点，已经被唤醒方摘掉的忽略
+     */
+    void remove(ChannelWaitNode *node);
+
+    /**
+     * @brief 从表头开始找一个还在等的等待者把它标记为被唤醒，跳过已经被别的channel唤醒的
+     * @param[out] waiter 要唤醒的等待者，调用方放开锁之后再wake()
+     * @return 没有在等的返回false
+     */
+    bool fireOne(FiberWaiter &waiter);
+
+    /**
+     * @brief 是否为空
+     */
+    bool empty() const { return !m_head; }
+
+private:
+    ChannelWaitNode *m_head = nullptr;
+    ChannelWaitNode *m_tail = nullptr;
+};
+
+class ChannelBase;
+
+/**
+ * @brief select的一个case
+ */
+struct SelectCase {
+    /// 收发的channel
+    ChannelBase *channel = nullptr;
+    /// true为发送，false为接收
+    bool send = false;
+    /// 发送时是要发的值(成功后被move走)，接收时是接收的变量，类型为channel的元素类型
+    void *value = nullptr;
+    /// 完成后的结果，false表示channel已关闭(接收时是关闭且已取完)
+    bool ok = false;
+};
+
+/**
+ * @brief 同时等多个channel，完成其中一个收发
+ * @param[in] cases 要等的收发，同一个channel可以出现多次
+ * @param[in] n case个数
+ * @param[in] block 都没就绪时是否等待，为false时相当于go select的default分支
+ * @return 完成的case下标，结果在cases[i].ok里；不等待且都没就绪时返回-1
+ * @details 多个case同时就绪时轮流从不同的位置开始检查，不会总是选中前面的
+ */
+int Select(SelectCase *cases, size_t n, bool block = true);
+
+/**
+ * @brief channel基类，Select通过它操作不同元素类型的channel
+ */
+class ChannelBase : Noncopyable {
+public:
+    virtual ~ChannelBase() {}
+
+    /**
+     * @brief 关闭channel，唤醒所有在等的收发方
+     * @details 关闭后send都失败，recv继续取缓冲区里剩下的数据，取完后返回false
+     */
+    void close();
+
+    /**
+     * @brief 是否已关闭
+     */
+    bool isClosed() const { return m_closed; }
+
+protected:
+    friend int Select(SelectCase *cases, size_t n, bool block);
+
+    /**
+     * @brief 持有m_spin时尝试收发一次
+     * @param[in] send 是否发送
+     * @param[in] value 发送的值或接收的变量
+     * @param[out] waiter 收发成功后要唤醒的对端等待者
+     * @return 1表示成功，0表示需要等待，-1表示已关闭
+     */
+    virtual int tryLocked(bool send, void *value, FiberWaiter &waiter) = 0;
+
+    /**
+     * @brief 发送或接收方向的等待链表
+     */
+    ChannelWaitList &waiters(bool send) { return send ? m_sendWaiters : m_recvWaiters; }
+
+    /**
+     * @brief 尝试收发一次，不等待，返回值同tryLocked
+     */
+    int tryOnce(bool send, void *value);
+
+protected:
+    /// 保护缓冲区和等待链表
+    Spinlock m_spin;
+    /// 是否已关闭
+    std::atomic<bool> m_closed = {false};
+    /// 等待发送的(缓冲区满)
+    ChannelWaitList m_sendWaiters;
+    /// 等待接收的(缓冲区空)
+    ChannelWaitList m_recvWaiters;
+};
+
+/**
+ * @brief 协程channel
+ */
+template <class T>
+class Channel : public ChannelBase {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    /// 无界channel的容量，send永远不会等待
+    static const size_t UNBOUNDED = (size_t)-1;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 缓冲区容量，至少为1，UNBOUNDED表示不限
+     */
+    explicit Channel(size_t capacity = UNBOUNDED)
+        : m_capacity(capacity) {
+        SYLAR_ASSERT2(capacity > 0, "channel capacity must be at least 1");
+        // 有界时一次分配好，很大的等用到了再扩
+        m_buffer.reserve(std::min<size_t>(capacity, 4096));
+    }
+
+    /**
+     * @brief 发送，缓冲区满时挂起当前协程
+     * @return channel已关闭返回false
+     */
+    bool send(T &&v) {
+        int rt = tryOnce(true, &v);
+        if (rt) {
+            return rt > 0;
+        }
+        SelectCase c = sendCase(v);
+        Select(&c, 1);
+        return c.ok;
+    }
+
+    bool send(const T &v) {
+        T tmp(v);
+        return send(std::move(tmp));
+    }
+
+    /**
+     * @brief 接收，缓冲区空时挂起当前协程
+     * @return channel已关闭并且数据都取完了返回false
+     */
+    bool recv(T &v) {
+        int rt = tryOnce(false, &v);
+        if (rt) {
+            return rt > 0;
+        }
+        SelectCase c = recvCase(v);
+        Select(&c, 1);
+        return c.ok;
+    }
+
+    /**
+     * @brief 尝试发送，不等待
+     * @return 缓冲区满或已关闭时返回false，v保持不变
+     */
+    bool trySend(T &&v) { return tryOnce(true, &v) > 0; }
+
+    bool trySend(const T &v) {
+        T tmp(v);
+        return trySend(std::move(tmp));
+    }
+
+    /**
+     * @brief 尝试接收，不等待
+     * @return 缓冲区空时返回false
+     */
+    bool tryRecv(T &v) { return tryOnce(false, &v) > 0; }
+
+    /**
+     * @brief 生成select的发送case，发送成功后v被move走
+     */
+    SelectCase sendCase(T &v) {
+        SelectCase c;
+        c.channel = this;
+        c.send    = true;
+        c.value   = &v;
+        return c;
+    }
+
+    /**
+     * @brief 生成select的接收case
+     */
+    SelectCase recvCase(T &v) {
+        SelectCase c;
+        c.channel = this;
+        c.value   = &v;
+        return c;
+    }
+
+    /**
+     * @brief 缓冲区里的数据个数
+     */
+    size_t size() {
+        Spinlock::Lock lock(m_spin);
+        return m_buffer.size();
+    }
+
+    /**
+     * @brief 容量
+     */
+    size_t getCapacity() const { return m_capacity; }
+
+protected:
+    int tryLocked(bool send, void *value, FiberWaiter &waiter) override {
+        if (send) {
+            if (m_closed) {
+                return -1;
+            }
+            if (m_buffer.size() >= m_capacity) {
+                return 0;
+            }
+            m_buffer.push_back(std::move(*static_cast<T *>(value)));
+            m_recvWaiters.fireOne(waiter);
+            return 1;
+        }
+        if (m_buffer.empty()) {
+            return m_closed ? -1 : 0;
+        }
+        *static_cast<T *>(value) = m_buffer.take_front();
+        if (m_capacity != UNBOUNDED) {
+            m_sendWaiters.fireOne(waiter);
+        }
+        return 1;
+    }
+
+private:
+    /// 容量
+    const size_t m_capacity;
+    /// 缓冲区
+    RingBuffer<T> m_buffer;
+};
+
+template <class T>
+const size_t Channel<T>::UNBOUNDED;
+
+} // namespace sylar
+
+#endif
@@ -7,6 +7,7 @@
  * @date 2021-06-21
  */
 #include "fd_manager.h"
+#include "config.h"
 #include "hook.h"
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -14,12 +15,18 @@
 
 namespace sylar {
 
+static ConfigVar<bool>::ptr g_pipe_nonblock =
+    Config::Lookup<bool>("hook.pipe_nonblock", false, "set O_NONBLOCK on hooked pipes and eventfds so their reads and writes suspend the fiber, the flag is shared with forked children");
+
 FdCtx::FdCtx(int fd)
     :m_isInit(false)
     ,m_isSocket(false)
+    ,m_isFile(false)
+    ,m_isPollable(false)
     ,m_sysNonblock(false)
     ,m_userNonblock(false)
     ,m_isClosed(false)
+    ,m_generation(0)
     ,m_fd(fd)
     ,m_recvTimeout(-1)
     ,m_sendTimeout(-1) {
@@ -40,22 +47,32 @@ bool FdCtx::init() {
     if(-1 == fstat(m_fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isFile = false;
+        m_isPollable = false;
     } else {
         m_isInit = true;
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        m_isFile = S_ISREG(fd_stat.st_mode);
+        // eventfd/timerfd/signalfd这类匿名句柄没有文件类型；
+        // O_NONBLOCK设在文件描述上，fork出去的子进程共用，管道常被交给子进程当stdin/stdout，所以默认不动它们
+        m_isPollable = m_isSocket || (g_pipe_nonblock->getValue()
+            && (S_ISFIFO(fd_stat.st_mode) || (fd_stat.st_mode & S_IFMT) == 0));
     }
 
-    if(m_isSocket) {
+    m_userNonblock = false;
+    if(m_isPollable) {
         int flags = fcntl_f(m_fd, F_GETFL, 0);
         if(!(flags & O_NONBLOCK)) {
             fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+        } else {
+            // 创建时就带了SOCK_NONBLOCK/O_NONBLOCK/EFD_NONBLOCK，是用户自己要的非阻塞
+            m_userNonblock = true;
         }
         m_sysNonblock = true;
     } else {
         m_sysNonblock = false;
     }
 
-    m_userNonblock = false;
     m_isClosed = false;
     return m_isInit;
 }
@@ -77,40 +94,66 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
+FdManager::~FdManager() {
+    m_datas.foreach([](FdCtx *ctx) { delete ctx; });
+    m_retired.foreach([](FdCtx *ctx) { delete ctx; });
+}
+
+FdCtx *FdManager::get(int fd, bool auto_create) {
     if(fd == -1) {
         return nullptr;
     }
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        if(auto_create == false) {
-            return nullptr;
-        }
+    FdCtx *ctx = m_datas.get(fd);
+    if(ctx || !auto_create) {
+        return ctx;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    ctx = m_datas.get(fd);
+    if(ctx) {
+        return ctx;
+    }
+    ctx = m_retired.exchange(fd, nullptr);
+    if(ctx) {
+        ctx->m_isInit = false;
+        ctx->init();
     } else {
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
-        }
+        ctx = new FdCtx(fd);
+    }
+    if(m_datas.exchange(fd, ctx) == ctx) {
+        // 超出容量，没放进表里
+        delete ctx;
+        return nullptr;
     }
-    lock.unlock();
+    return ctx;
+}
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+FdCtx *FdManager::dup(int oldfd, int newfd) {
+    FdCtx *old = get(oldfd);
+    if(!old) {
+        return nullptr;
+    }
+    FdCtx *ctx = get(newfd, true);
+    if(ctx) {
+        // 文件状态标志是两个fd共享的，O_NONBLOCK已经被设置过，init()会误以为是用户设置的
+        ctx->m_userNonblock = old->m_userNonblock;
+        ctx->m_recvTimeout = old->m_recvTimeout;
+        ctx->m_sendTimeout = old->m_sendTimeout;
     }
-    m_datas[fd] = ctx;
     return ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
+    if(fd == -1) {
         return;
     }
-    m_datas[fd].reset();
+    MutexType::Lock lock(m_mutex);
+    FdCtx *ctx = m_datas.exchange(fd, nullptr);
+    if(ctx) {
+        m_retired.exchange(fd, ctx);
+    }
 }
 
 }
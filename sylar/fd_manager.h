@@ -9,10 +9,11 @@
 #ifndef __FD_MANAGER_H__
 #define __FD_MANAGER_H__
 
-#include <memory>
-#include <vector>
-#include "thread.h"
+#include <atomic>
+#include "noncopyable.h"
+#include "mutex.h"
 #include "singleton.h"
+#include "fd_table.h"
 
 namespace sylar {
 
@@ -20,10 +21,11 @@ namespace sylar {
  * @brief 文件句柄上下文类
  * @details 管理文件句柄类型(是否socket)
  *          是否阻塞,是否关闭,读/写超时时间
+ *          对象归FdManager所有，fd关闭后也不释放，同一个fd号再次创建时复用，
+ *          所以hook里拿到的裸指针在FdManager的生命周期内一直有效
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdCtx : Noncopyable {
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
     /**
      * @brief 通过文件句柄构造FdCtx
      */
@@ -43,11 +45,35 @@ public:
      */
     bool isSocket() const { return m_isSocket;}
 
+    /**
+     * @brief 是否普通文件，普通文件的读写由FileIoPool代为执行
+     */
+    bool isFile() const { return m_isFile;}
+
+    /**
+     * @brief 读写是否挂起协程等待：socket，配置项hook.pipe_nonblock为true时还有管道以及eventfd这类匿名句柄
+     * @details 这类句柄在hook里被设为非阻塞，读写遇到EAGAIN时挂起协程等待事件；
+     *          非阻塞标志设在文件描述上，fork之后子进程拿到的管道也是非阻塞的，所以管道默认不设，
+     *          读写照常阻塞线程，poll/select/epoll_wait等待它们时仍然只挂起协程
+     */
+    bool isPollable() const { return m_isPollable;}
+
     /**
      * @brief 是否已关闭
      */
     bool isClose() const { return m_isClosed;}
 
+    /**
+     * @brief 标记为已关闭，阻塞在该fd上的协程被唤醒后据此返回EBADF，不会再去等一个快要关闭的fd
+     */
+    void setClose() { ++m_generation; m_isClosed = true;}
+
+    /**
+     * @brief 关闭次数，挂起前记下，醒来后不相等说明fd在等待期间被关闭过
+     * @details 关闭后FdCtx会被复用，dup2/dup3覆盖时新的fd马上就重新初始化了，只看关闭标志会漏掉
+     */
+    uint32_t getGeneration() const { return m_generation;}
+
     /**
      * @brief 设置用户主动设置非阻塞
      * @param[in] v 是否阻塞
@@ -84,21 +110,29 @@ public:
      */
     uint64_t getTimeout(int type);
 private:
+    friend class FdManager;
     /**
      * @brief 初始化
      */
     bool init();
 private:
+    // 不用位域：复用时在创建线程上重新初始化，其他线程可能同时在读关闭标志
     /// 是否初始化
-    bool m_isInit: 1;
+    bool m_isInit;
     /// 是否socket
-    bool m_isSocket: 1;
+    bool m_isSocket;
+    /// 是否普通文件
+    bool m_isFile;
+    /// 读写是否挂起协程等待
+    bool m_isPollable;
     /// 是否hook非阻塞
-    bool m_sysNonblock: 1;
+    bool m_sysNonblock;
     /// 是否用户主动设置非阻塞
-    bool m_userNonblock: 1;
+    bool m_userNonblock;
     /// 是否关闭
-    bool m_isClosed: 1;
+    std::atomic<bool> m_isClosed;
+    /// 关闭次数
+    std::atomic<uint32_t> m_generation;
     /// 文件句柄
     int m_fd;
     /// 读超时时间毫秒
@@ -109,33 +143,49 @@ private:
 
 /**
  * @brief 文件句柄管理类
+ * @details 查找走FdTable，不加锁也不碰引用计数；创建和删除只发生在socket/accept/close里，用互斥锁串行化
  */
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
     /**
      * @brief 无参构造函数
      */
     FdManager();
 
+    /**
+     * @brief 析构函数
+     */
+    ~FdManager();
+
     /**
      * @brief 获取/创建文件句柄类FdCtx
      * @param[in] fd 文件句柄
      * @param[in] auto_create 是否自动创建
-     * @return 返回对应文件句柄类FdCtx::ptr
+     * @return 返回对应文件句柄类FdCtx，fd超出FdTable容量时返回nullptr
+     */
+    FdCtx *get(int fd, bool auto_create = false);
+
+    /**
+     * @brief 为dup出来的newfd创建FdCtx
+     * @details 两个fd共享同一个打开的文件，非阻塞和超时设置都从oldfd复制
+     * @return oldfd没有登记过时不创建，返回nullptr
      */
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    FdCtx *dup(int oldfd, int newfd);
 
     /**
      * @brief 删除文件句柄类
+     * @details FdCtx不释放，放到回收表里留给同一个fd号下次创建时复用
      * @param[in] fd 文件句柄
      */
     void del(int fd);
 private:
-    /// 读写锁
-    RWMutexType m_mutex;
-    /// 文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    /// 保护创建和删除
+    MutexType m_mutex;
+    /// 正在使用的文件句柄
+    FdTable<FdCtx> m_datas;
+    /// 已经删除、等待复用的文件句柄
+    FdTable<FdCtx> m_retired;
 };
 
 /// 文件句柄单例
@@ -0,0 +1,150 @@
+/**
+ * @file fd_table.h
+ * @brief 以fd为下标的分段无锁表
+ * @details 两级结构：固定大小的段指针数组 + 按需分配的段，段分配之后直到表析构都不会移动或释放，
+ *          所以查找不需要加锁，也不会像std::vector扩容那样让别的线程拿到的指针失效；
+ *          表里只存裸指针，元素的生命周期由使用方管理，表本身不delete元素
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_FD_TABLE_H__
+#define __SYLAR_FD_TABLE_H__
+
+#include <stddef.h>
+#include <atomic>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 以fd为下标的分段无锁表
+ * @tparam T 元素类型
+ * @tparam SegmentBits 每段2^SegmentBits个槽位
+ * @tparam MaxSegments 段的最大数量，默认容量2^20，和Linux默认的nr_open一致
+ */
+template <class T, size_t SegmentBits = 8, size_t MaxSegments = 4096>
+class FdTable : Noncopyable {
+public:
+    static const size_t SEGMENT_SIZE = (size_t)1 << SegmentBits;
+    static const size_t CAPACITY     = SEGMENT_SIZE * MaxSegments;
+
+    FdTable() {
+        for (auto &seg : m_segments) {
+            seg.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable() {
+        for (auto &seg : m_segments) {
+            delete seg.load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 查找fd对应的元素，不加锁
+     * @return 越界或者还没有设置时返回nullptr
+     */
+    T *get(int fd) const {
+        if ((size_t)fd >= CAPACITY) {
+            return nullptr;
+        }
+        Segment *seg = m_segments[fd >> SegmentBits].load(std::memory_order_acquire);
+        if (!seg) {
+            return nullptr;
+        }
+        return seg->slots[fd & (SEGMENT_SIZE - 1)].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 替换fd对应的元素
+     * @return 原来的元素，越界时什么都不做并返回v
+     */
+    T *exchange(int fd, T *v) {
+        std::atomic<T *> *slot = getSlot(fd);
+        if (!slot) {
+            return v;
+        }
+        return slot->exchange(v, std::memory_order_acq_rel);
+    }
+
+    /**
+     * @brief 查找fd对应的元素，不存在时用create()创建一个
+     * @details 并发创建时只有一个会放进表里，其余的用destroy()销毁，返回表里的那个
+     * @return 越界时返回nullptr
+     */
+    template <class Create, class Destroy>
+    T *getOrCreate(int fd, Create create, Destroy destroy) {
+        T *v = get(fd);
+        if (v) {
+            return v;
+        }
+        std::atomic<T *> *slot = getSlot(fd);
+        if (!slot) {
+            return nullptr;
+        }
+        T *nv = create();
+        if (slot->compare_exchange_strong(v, nv, std::memory_order_acq_rel)) {
+            return nv;
+        }
+        destroy(nv);
+        return v;
+    }
+
+    /**
+     * @brief 遍历所有非空元素，非线程安全，用于析构前的清理
+     */
+    template <class Func>
+    void foreach(Func func) {
+        for (auto &s : m_segments) {
+            Segment *seg = s.load(std::memory_order_acquire);
+            if (!seg) {
+                continue;
+            }
+            for (auto &slot : seg->slots) {
+                T *v = slot.load(std::memory_order_acquire);
+                if (v) {
+                    func(v);
+                }
+            }
+        }
+    }
+
+private:
+    struct Segment {
+        Segment() {
+            for (auto &slot : slots) {
+                slot.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        std::atomic<T *> slots[SEGMENT_SIZE];
+    };
+
+    /**
+     * @brief 返回fd对应的槽位，所在的段不存在时分配一个
+     */
+    std::atomic<T *> *getSlot(int fd) {
+        if ((size_t)fd >= CAPACITY) {
+            return nullptr;
+        }
+        std::atomic<Segment *> &s = m_segments[fd >> SegmentBits];
+        Segment *seg              = s.load(std::memory_order_acquire);
+        if (!seg) {
+            Segment *nseg = new Segment;
+            if (s.compare_exchange_strong(seg, nseg, std::memory_order_acq_rel)) {
+                seg = nseg;
+            } else {
+                delete nseg;
+            }
+        }
+        return &seg->slots[fd & (SEGMENT_SIZE - 1)];
+    }
+
+private:
+    /// 段指针数组
+    std::atomic<Segment *> m_segments[MaxSegments];
+};
+
+} // namespace sylar
+
+#endif
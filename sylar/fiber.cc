@@ -6,11 +6,13 @@
  */
 
 #include <atomic>
+#include <string.h>
 #include "fiber.h"
 #include "config.h"
 #include "log.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 
 namespace sylar {
 
@@ -26,20 +28,70 @@ static thread_local Fiber *t_fiber = nullptr;
 /// 线程局部变量，当前线程的主协程，切换到这个协程，就相当于切换到了主线程中运行，智能指针形式
 static thread_local Fiber::ptr t_thread_fiber = nullptr;
 
-//协程栈大小，可通过配置文件获取，默认128k
-static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
-    Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
+//每个线程的共享栈数量和大小
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4, "shared fiber stack count per thread");
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 1024 * 1024, "shared fiber stack size");
+
+struct Fiber::SharedStack {
+    /// 栈的起始地址(低地址)
+    void *stack = nullptr;
+    /// 栈大小
+    size_t size = 0;
+    /// 栈上当前是哪个协程的数据
+    Fiber *occupant = nullptr;
+    /// 所属线程
+    int thread = -1;
+    /// 线程的共享栈池和绑定在上面的协程各持有一个引用，协程可能比线程活得久
+    std::atomic<uint32_t> refs = {1};
+
+    ~SharedStack() {
+        StackAllocator::Lookup("mmap")->dealloc(stack, size);
+    }
+
+    void release() {
+        if (--refs == 0) {
+            delete this;
+        }
+    }
+};
 
 /**
- * @brief malloc栈内存分配器
+ * @brief 线程的共享栈池，共享栈协程第一次运行时轮流从中选择一个共享栈
  */
-class MallocStackAllocator {
-public:
-    static void *Alloc(size_t size) { return malloc(size); }
-    static void Dealloc(void *vp, size_t size) { return free(vp); }
+struct SharedStackPool {
+    std::vector<Fiber::SharedStack *> stacks;
+    size_t next = 0;
+
+    ~SharedStackPool() {
+        // 还绑定着协程的共享栈等最后一个协程析构时再释放
+        for (auto i : stacks) {
+            i->release();
+        }
+    }
+
+    Fiber::SharedStack *acquire() {
+        if (stacks.empty()) {
+            uint32_t count = std::max(g_fiber_shared_stack_count->getValue(), (uint32_t)1);
+            size_t size    = g_fiber_shared_stack_size->getValue();
+            // 共享栈直接使用带保护页的mmap分配器，不参与池化
+            StackAllocator *allocator = StackAllocator::Lookup("mmap");
+            for (uint32_t i = 0; i < count; i++) {
+                Fiber::SharedStack *shared = new Fiber::SharedStack;
+                shared->stack  = allocator->alloc(size);
+                shared->size   = size;
+                shared->thread = sylar::GetThreadId();
+                stacks.push_back(shared);
+            }
+        }
+        Fiber::SharedStack *shared = stacks[next++ % stacks.size()];
+        ++shared->refs;
+        return shared;
+    }
 };
 
-using StackAllocator = MallocStackAllocator;
+static thread_local SharedStackPool t_shared_stack_pool;
 
 uint64_t Fiber::GetFiberId() {
     if (t_fiber) {
@@ -52,9 +104,7 @@ Fiber::Fiber() {
     SetThis(this);
     m_state = RUNNING;
 
-    if (getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
-    }
+    m_ctx.init();
 
     ++s_fiber_count;
     m_id = s_fiber_id++; // 协程id从0开始，用完加1
@@ -83,23 +133,21 @@ Fiber::ptr Fiber::GetThis() {
 /**
  * 带参数的构造函数用于创建其他协程，需要分配栈
  */
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
+Fiber::Fiber(Task cb, size_t stacksize, bool run_in_scheduler,
+             bool use_shared_stack)
     : m_id(s_fiber_id++)
-    , m_cb(cb)
-    , m_runInScheduler(run_in_scheduler) {
+    , m_cb(std::move(cb))
+    , m_runInScheduler(run_in_scheduler)
+    , m_useSharedStack(use_shared_stack) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    m_stack     = StackAllocator::Alloc(m_stacksize);
+    if (!m_useSharedStack) {
+        m_stacksize = stacksize ? stacksize : StackAllocator::GetDefaultStackSize();
+        m_allocator = StackAllocator::GetDefault();
+        m_stack     = m_allocator->alloc(m_stacksize);
 
-    if (getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
     }
-
-    m_ctx.uc_link          = nullptr;
-    m_ctx.uc_stack.ss_sp   = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    // 共享栈协程的上下文要等第一次resume，确定了共享栈之后再创建
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() id = " << m_id;
 }
@@ -110,10 +158,19 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
 Fiber::~Fiber() {
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::~Fiber() id = " << m_id;
     --s_fiber_count;
-    if (m_stack) {
+    if (m_useSharedStack) {
+        SYLAR_ASSERT(m_state == TERM);
+        if (m_sharedStack) {
+            if (m_sharedStack->occupant == this) {
+                m_sharedStack->occupant = nullptr;
+            }
+            m_sharedStack->release();
+        }
+        free(m_saveBuffer);
+    } else if (m_stack) {
         // 有栈，说明是子协程，需要确保子协程一定是结束状态
         SYLAR_ASSERT(m_state == TERM);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        m_allocator->dealloc(m_stack, m_stacksize);
         SYLAR_LOG_DEBUG(g_logger) << "dealloc stack, id = " << m_id;
     } else {
         // 没有栈，说明是线程的主协程
@@ -130,57 +187,104 @@ Fiber::~Fiber() {
 /**
  * 这里为了简化状态管理，强制只有TERM状态的协程才可以重置，但其实刚创建好但没执行过的协程也应该允许重置的
  */
-void Fiber::reset(std::function<void()> cb) {
-    SYLAR_ASSERT(m_stack);
+void Fiber::reset(Task cb) {
+    SYLAR_ASSERT(m_stack || m_useSharedStack);
     SYLAR_ASSERT(m_state == TERM);
-    m_cb = cb;
-    if (getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
+    m_cb = std::move(cb);
+    if (m_useSharedStack) {
+        m_saveSize = 0;
+    } else {
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
     }
+    m_state = READY;
+}
 
-    m_ctx.uc_link          = nullptr;
-    m_ctx.uc_stack.ss_sp   = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+int Fiber::getBoundThread() const {
+    return m_sharedStack ? m_sharedStack->thread : -1;
+}
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = READY;
+void Fiber::switchInSharedStack() {
+    if (!m_sharedStack) {
+        m_sharedStack = t_shared_stack_pool.acquire();
+    }
+    SYLAR_ASSERT2(m_sharedStack->thread == sylar::GetThreadId(),
+                  "shared stack fiber id=" << m_id << " bound to thread " << m_sharedStack->thread);
+
+    Fiber *occupant = m_sharedStack->occupant;
+    if (occupant == this) {
+        return;
+    }
+    if (occupant) {
+        occupant->saveSharedStack();
+    }
+    m_sharedStack->occupant = this;
+
+    if (m_saveSize) {
+        memcpy((char *)m_sharedStack->stack + m_sharedStack->size - m_saveSize, m_saveBuffer, m_saveSize);
+    } else {
+        // 第一次运行，或者reset之后重新运行
+        m_ctx.make(m_sharedStack->stack, m_sharedStack->size, &Fiber::MainFunc);
+    }
+}
+
+/**
+ * 保存区按实际使用的栈大小分配，栈用量明显变小时也重新分配，避免一次深调用之后一直占着大块内存
+ */
+void Fiber::saveSharedStack() {
+    char *bottom = (char *)m_sharedStack->stack + m_sharedStack->size;
+    char *sp     = (char *)m_ctx.getStackPointer();
+    if (!sp) {
+        sp = (char *)m_sharedStack->stack;
+    }
+    size_t used = bottom - sp;
+    if (used > m_saveCapacity || used * 2 < m_saveCapacity) {
+        free(m_saveBuffer);
+        m_saveBuffer   = (char *)malloc(used);
+        m_saveCapacity = used;
+        SYLAR_ASSERT2(m_saveBuffer, "malloc shared stack save buffer fail, size=" << used);
+    }
+    memcpy(m_saveBuffer, sp, used);
+    m_saveSize = used;
 }
 
 void Fiber::resume() {
     SYLAR_ASSERT(m_state != TERM && m_state != RUNNING);
+    if (m_useSharedStack) {
+        switchInSharedStack();
+    }
     SetThis(this);
     m_state = RUNNING;
 
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
-        if (swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx);
     } else {
-        if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx)) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&(t_thread_fiber->m_ctx), &m_ctx);
+    }
+
+    // 协程yield回来了，这时它的上下文已经完整保存，才能把状态改成READY
+    // 如果在yield里切换之前就改，其他线程看到READY会立即resume，用到的是还没保存完的上下文
+    if (m_state == RUNNING) {
+        m_state = READY;
     }
 }
 
 void Fiber::yield() {
     /// 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束状态
     SYLAR_ASSERT(m_state == RUNNING || m_state == TERM);
-    if (m_state != TERM) {
-        m_state = READY;
+    if (m_state == TERM && m_useSharedStack) {
+        // 已结束的协程不需要保存栈数据，直接让出共享栈
+        m_sharedStack->occupant = nullptr;
+        m_saveSize              = 0;
     }
 
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
         SetThis(Scheduler::GetMainFiber());
-        if (swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx));
     } else {
         SetThis(t_thread_fiber.get());
-        if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx))) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&m_ctx, &(t_thread_fiber->m_ctx));
     }
 }
 
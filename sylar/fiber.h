@@ -1,7 +1,7 @@
 /**
  * @file fiber.h
  * @brief 协程模块
- * @details 基于ucontext_t实现，非对称协程
+ * @details 非对称协程，上下文切换由FiberContext实现，可选汇编或ucontext_t
  * @version 0.1
  * @date 2021-06-15
  */
@@ -11,11 +11,14 @@
 
 #include <functional>
 #include <memory>
-#include <ucontext.h>
+#include "fiber_context.h"
+#include "task.h"
 #include "thread.h"
 
 namespace sylar {
 
+class StackAllocator;
+
 /**
  * @brief 协程类
  */
@@ -49,11 +52,16 @@ private:
 public:
     /**
      * @brief 构造函数，用于创建用户协程
-     * @param[in] cb 协程入口函数
-     * @param[in] stacksize 栈大小
+     * @param[in] cb 协程入口函数，只移动不拷贝
+     * @param[in] stacksize 栈大小，使用共享栈时忽略
      * @param[in] run_in_scheduler 本协程是否参与调度器调度，默认为true
+     * @param[in] use_shared_stack 是否使用共享栈，默认为false
+     * @details 共享栈协程不单独分配栈，第一次resume时绑定到当前线程的一个共享栈上运行，
+     * 切出之后，只有在同一个共享栈要运行其他协程时，才把本协程已使用的那部分栈拷贝到按需分配的保存区里，
+     * 适合大量连接长时间挂起的场景。共享栈协程绑定之后只能在绑定的线程上resume
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+    Fiber(Task cb, size_t stacksize = 0, bool run_in_scheduler = true,
+          bool use_shared_stack = false);
 
     /**
      * @brief 析构函数
@@ -62,9 +70,9 @@ public:
 
     /**
      * @brief 重置协程状态和入口函数，复用栈空间，不重新创建栈
-     * @param[in] cb 
+     * @param[in] cb 新的入口函数
      */
-    void reset(std::function<void()> cb);
+    void reset(Task cb);
 
     /**
      * @brief 将当前协程切到到执行状态
@@ -88,6 +96,26 @@ public:
      */
     State getState() const { return m_state; }
 
+    /**
+     * @brief 是否使用共享栈
+     */
+    bool isSharedStack() const { return m_useSharedStack; }
+
+    /**
+     * @brief 返回协程绑定的线程id，只有已经运行过的共享栈协程才会绑定线程，未绑定返回-1
+     */
+    int getBoundThread() const;
+
+    /**
+     * @brief 调度优先级，取值见Scheduler::Priority，没设置过时为-1，按普通优先级调度
+     */
+    int getPriority() const { return m_priority; }
+
+    /**
+     * @brief 设置调度优先级，之后这个协程被唤醒时都按这个优先级排队
+     */
+    void setPriority(int priority) { m_priority = priority; }
+
 public:
     /**
      * @brief 设置当前正在运行的协程，即设置线程局部变量t_fiber的值
@@ -118,6 +146,25 @@ public:
      */
     static uint64_t GetFiberId();
 
+private:
+    friend struct SharedStackPool;
+
+    /**
+     * @brief 共享栈
+     */
+    struct SharedStack;
+
+    /**
+     * @brief 共享栈协程resume之前准备好共享栈
+     * @details 如果共享栈上是别的协程的数据，先把它保存起来，再恢复本协程的数据或者创建上下文
+     */
+    void switchInSharedStack();
+
+    /**
+     * @brief 把共享栈上本协程已使用的部分拷贝到保存区
+     */
+    void saveSharedStack();
+
 private:
     /// 协程id
     uint64_t m_id        = 0;
@@ -126,13 +173,27 @@ private:
     /// 协程状态
     State m_state        = READY;
     /// 协程上下文
-    ucontext_t m_ctx;
+    FiberContext m_ctx;
     /// 协程栈地址
     void *m_stack = nullptr;
+    /// 分配协程栈的分配器，释放时要用同一个分配器
+    StackAllocator *m_allocator = nullptr;
     /// 协程入口函数
-    std::function<void()> m_cb;
+    Task m_cb;
     /// 本协程是否参与调度器调度
     bool m_runInScheduler;
+    /// 是否使用共享栈
+    bool m_useSharedStack = false;
+    /// 调度优先级
+    int m_priority = -1;
+    /// 共享栈协程绑定的共享栈
+    SharedStack *m_sharedStack = nullptr;
+    /// 共享栈协程切出后保存的栈数据
+    char *m_saveBuffer = nullptr;
+    /// 保存的栈数据大小
+    size_t m_saveSize = 0;
+    /// 保存区容量
+    size_t m_saveCapacity = 0;
 };
 
 } // namespace sylar
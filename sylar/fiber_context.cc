@@ -0,0 +1,109 @@
+/**
+ * @file fiber_context.cc
+ * @brief 协程上下文切换实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "fiber_context.h"
+#include "macro.h"
+
+#ifdef SYLAR_FIBER_CONTEXT_ASM
+/**
+ * @brief 汇编实现的上下文切换，见fiber_context_asm.S
+ * @details 把callee-saved寄存器压到当前栈上，栈顶指针保存到*from_sp，然后切到to_sp指向的栈，
+ *          弹出寄存器之后ret，返回地址就是目标上下文上次切出的位置
+ */
+extern "C" void sylar_swap_context(void **from_sp, void *to_sp);
+#endif
+
+namespace sylar {
+
+#ifdef SYLAR_FIBER_CONTEXT_ASM
+
+void FiberContext::init() {
+    sp = nullptr;
+}
+
+/**
+ * 在栈顶伪造一个sylar_swap_context切出时留下的栈帧，第一次切换过来时弹出的寄存器全为0，
+ * ret的返回地址是fn，fn看到的栈满足ABI要求的对齐
+ */
+void FiberContext::make(void *stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+    // 从低到高: mxcsr(4字节) + x87控制字(2字节)，r15，r14，r13，r12，rbx，rbp，返回地址fn，fn的伪返回地址
+    // fn入口处rsp = top - 8，满足(rsp + 8) % 16 == 0
+    uint64_t *frame = (uint64_t *)(top - 9 * sizeof(uint64_t));
+    memset(frame, 0, 9 * sizeof(uint64_t));
+    uint32_t mxcsr = 0x1F80;
+    uint16_t fpucw = 0x037F;
+    memcpy((char *)frame, &mxcsr, sizeof(mxcsr));
+    memcpy((char *)frame + 4, &fpucw, sizeof(fpucw));
+    frame[7] = (uint64_t)fn;
+#elif defined(__aarch64__)
+    // x19-x28，x29(fp)，x30(lr)，d8-d15，共176字节，lr为fn，fn入口处sp = top
+    uint64_t *frame = (uint64_t *)(top - 176);
+    memset(frame, 0, 176);
+    frame[11] = (uint64_t)fn;
+#endif
+    sp = frame;
+}
+
+void *FiberContext::getStackPointer() const {
+    return sp;
+}
+
+void FiberContext::Swap(FiberContext *from, FiberContext *to) {
+    sylar_swap_context(&from->sp, to->sp);
+}
+
+const char *FiberContext::GetBackendName() {
+    return "asm";
+}
+
+#else
+
+void FiberContext::init() {
+    if (getcontext(&ctx)) {
+        SYLAR_ASSERT2(false, "getcontext");
+    }
+}
+
+void FiberContext::make(void *stack, size_t size, void (*fn)()) {
+    if (getcontext(&ctx)) {
+        SYLAR_ASSERT2(false, "getcontext");
+    }
+
+    ctx.uc_link          = nullptr;
+    ctx.uc_stack.ss_sp   = stack;
+    ctx.uc_stack.ss_size = size;
+
+    makecontext(&ctx, fn, 0);
+}
+
+void *FiberContext::getStackPointer() const {
+#if defined(__x86_64__)
+    return (void *)ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (void *)ctx.uc_mcontext.sp;
+#else
+    return nullptr;
+#endif
+}
+
+void FiberContext::Swap(FiberContext *from, FiberContext *to) {
+    if (swapcontext(&from->ctx, &to->ctx)) {
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+}
+
+const char *FiberContext::GetBackendName() {
+    return "ucontext";
+}
+
+#endif
+
+} // namespace sylar
@@ -0,0 +1,68 @@
+/**
+ * @file fiber_context.h
+ * @brief 协程上下文切换
+ * @details 提供两种实现，编译时通过CMake选项SYLAR_FIBER_ASM_CONTEXT选择：
+ *          1. 手写汇编实现(x86-64/aarch64)，只保存callee-saved寄存器，切换时不会有系统调用
+ *          2. ucontext实现，glibc的swapcontext每次切换都要调用一次rt_sigprocmask，作为不支持的平台上的后备方案
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_FIBER_CONTEXT_H__
+#define __SYLAR_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+
+#if defined(SYLAR_FIBER_ASM_CONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define SYLAR_FIBER_CONTEXT_ASM 1
+#else
+#include <ucontext.h>
+#endif
+
+namespace sylar {
+
+/**
+ * @brief 协程上下文
+ */
+struct FiberContext {
+#ifdef SYLAR_FIBER_CONTEXT_ASM
+    /// 切出时的栈顶指针，寄存器都保存在栈上
+    void *sp = nullptr;
+#else
+    /// ucontext上下文
+    ucontext_t ctx;
+#endif
+
+    /**
+     * @brief 初始化线程主协程的上下文
+     */
+    void init();
+
+    /**
+     * @brief 在指定的栈上创建上下文，切换到该上下文时从fn开始执行
+     * @param[in] stack 栈的起始地址(低地址)
+     * @param[in] size 栈大小
+     * @param[in] fn 入口函数，不允许返回
+     */
+    void make(void *stack, size_t size, void (*fn)());
+
+    /**
+     * @brief 返回上下文切出时的栈顶指针
+     * @details 共享栈协程切出后，只需要保存[栈顶指针, 栈底)这一段，取不到时返回nullptr
+     */
+    void *getStackPointer() const;
+
+    /**
+     * @brief 保存当前上下文到from，并切换到to
+     */
+    static void Swap(FiberContext *from, FiberContext *to);
+
+    /**
+     * @brief 返回编译时选择的上下文切换实现的名称，asm或ucontext
+     */
+    static const char *GetBackendName();
+};
+
+} // namespace sylar
+
+#endif
@@ -0,0 +1,302 @@
+/**
+ * @file fiber_mutex.cc
+ * @brief 协程锁实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "fiber_mutex.h"
+#include <unistd.h>
+#include "config.h"
+#include "macro.h"
+#include "scheduler.h"
+
+namespace sylar {
+
+static ConfigVar<uint32_t>::ptr g_mutex_spin =
+    Config::Lookup<uint32_t>("fiber.mutex_spin", 100, "spin iterations before a fiber lock parks the waiting fiber, ignored on single cpu hosts");
+
+static std::atomic<uint32_t> s_spin_count = {g_mutex_spin->getValue()};
+
+struct _FiberMutexIniter {
+    _FiberMutexIniter() {
+        g_mutex_spin->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_spin_count = new_value;
+        });
+    }
+};
+
+static _FiberMutexIniter s_fiber_mutex_initer;
+
+/**
+ * @brief 挂起前先自旋，期间try()成功就返回true
+ * @details 单核时持有锁的一方不可能在自旋期间释放锁，直接挂起
+ */
+template <class Try>
+static bool spin_then_try(Try try_acquire) {
+    static const bool s_multi_cpu = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    if (!s_multi_cpu) {
+        return false;
+    }
+    for (uint32_t i = s_spin_count; i > 0; i--) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        if (try_acquire()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FiberWaiter::wake() {
+    if (fiber) {
+        Scheduler *sc = scheduler;
+        sc->schedule(std::move(fiber));
+        sc->delExternalWaiter();
+    } else {
+        sem->notify();
+    }
+}
+
+bool FiberWaiter::initFiber() {
+    Scheduler *sc = Scheduler::GetThis();
+    if (!sc) {
+        return false;
+    }
+    Fiber::ptr cur = Fiber::GetThis();
+    if (cur.get() == Scheduler::GetMainFiber()) {
+        return false;
+    }
+    // 挂起期间调度器上可能没有别的任务，登记一下，stop()会等它被唤醒
+    sc->addExternalWaiter();
+    scheduler = sc;
+    fiber     = std::move(cur);
+    return true;
+}
+
+void FiberWaitQueue::wait(Spinlock &lock, FiberMutex *mutex) {
+    FiberWaiter waiter;
+    if (waiter.initFiber()) {
+        Fiber::ptr fiber = waiter.fiber;
+        m_waiters.push_back(std::move(waiter));
+        lock.unlock();
+        if (mutex) {
+            mutex->unlock();
+        }
+        // 唤醒可能发生在yield之前，调度器看到协程还是RUNNING状态会稍后再试
+        fiber->yield();
+        return;
+    }
+
+    Semaphore sem;
+    waiter.sem = &sem;
+    m_waiters.push_back(std::move(waiter));
+    lock.unlock();
+    if (mutex) {
+        mutex->unlock();
+    }
+    sem.wait();
+}
+
+bool FiberWaitQueue::pop(FiberWaiter &waiter) {
+    if (m_waiters.empty()) {
+        return false;
+    }
+    waiter = m_waiters.take_front();
+    return true;
+}
+
+void FiberWaitQueue::popAll(RingBuffer<FiberWaiter> &waiters) {
+    while (!m_waiters.empty()) {
+        waiters.push_back(m_waiters.take_front());
+    }
+}
+
+bool FiberMutex::tryLock() {
+    bool expected = false;
+    return m_locked.compare_exchange_strong(expected, true, std::memory_order_acquire);
+}
+
+void FiberMutex::lock() {
+    if (tryLock() || spin_then_try([this]() {
+            return !m_locked.load(std::memory_order_relaxed) && tryLock();
+        })) {
+        return;
+    }
+    m_spin.lock();
+    // 先登记再试一次：解锁方先清标志再看登记数，两边至少有一方能看到对方
+    ++m_waiting;
+    if (tryLock()) {
+        --m_waiting;
+        m_spin.unlock();
+        return;
+    }
+    // 醒来时锁已经交到手上
+    m_waiters.wait(m_spin);
+}
+
+void FiberMutex::unlock() {
+    SYLAR_ASSERT(m_locked);
+    m_locked.store(false);
+    if (!m_waiting) {
+        return;
+    }
+    FiberWaiter waiter;
+    m_spin.lock();
+    // 登记了的等待者入队前一直持有m_spin，这里看到的队列是完整的；锁已经被别人抢走时由那一方解锁时交接
+    if (!m_waiters.empty() && tryLock()) {
+        m_waiters.pop(waiter);
+        --m_waiting;
+    }
+    m_spin.unlock();
+    if (waiter.fiber || waiter.sem) {
+        waiter.wake();
+    }
+}
+
+bool FiberRWMutex::tryRdlock() {
+    Spinlock::Lock lock(m_spin);
+    if (!canRead()) {
+        return false;
+    }
+    ++m_readers;
+    return true;
+}
+
+bool FiberRWMutex::tryWrlock() {
+    Spinlock::Lock lock(m_spin);
+    if (!canWrite()) {
+        return false;
+    }
+    m_writer = true;
+    return true;
+}
+
+void FiberRWMutex::rdlock() {
+    if (tryRdlock() || spin_then_try([this]() {
+            return !m_writer.load(std::memory_order_relaxed) && tryRdlock();
+        })) {
+        return;
+    }
+    m_spin.lock();
+    if (canRead()) {
+        ++m_readers;
+        m_spin.unlock();
+        return;
+    }
+    // 放行时读者计数已经替我们加上了
+    m_readWaiters.wait(m_spin);
+}
+
+void FiberRWMutex::wrlock() {
+    if (tryWrlock() || spin_then_try([this]() {
+            return !m_writer.load(std::memory_order_relaxed) && !m_readers.load(std::memory_order_relaxed) && tryWrlock();
+        })) {
+        return;
+    }
+    m_spin.lock();
+    if (canWrite()) {
+        m_writer = true;
+        m_spin.unlock();
+        return;
+    }
+    m_writeWaiters.wait(m_spin);
+}
+
+void FiberRWMutex::unlock() {
+    FiberWaiter waiter;
+    RingBuffer<FiberWaiter> readers;
+    m_spin.lock();
+    if (m_writer) {
+        m_writer = false;
+        // 写者之后先轮到在等的读者
+        if (!m_readWaiters.empty()) {
+            m_readWaiters.popAll(readers);
+            m_readers += readers.size();
+        } else if (m_writeWaiters.pop(waiter)) {
+            m_writer = true;
+        }
+    } else {
+        SYLAR_ASSERT(m_readers > 0);
+        if (--m_readers == 0 && m_writeWaiters.pop(waiter)) {
+            m_writer = true;
+        }
+    }
+    m_spin.unlock();
+
+    if (waiter.fiber || waiter.sem) {
+        waiter.wake();
+    }
+    while (!readers.empty()) {
+        readers.take_front().wake();
+    }
+}
+
+void FiberCondition::wait(FiberMutex &mutex) {
+    m_spin.lock();
+    // 先入队再释放mutex，notify只能在拿到mutex之后调用，不会漏掉
+    m_waiters.wait(m_spin, &mutex);
+    mutex.lock();
+}
+
+void FiberCondition::notifyOne() {
+    FiberWaiter waiter;
+    m_spin.lock();
+    bool found = m_waiters.pop(waiter);
+    m_spin.unlock();
+    if (found) {
+        waiter.wake();
+    }
+}
+
+void FiberCondition::notifyAll() {
+    RingBuffer<FiberWaiter> waiters;
+    m_spin.lock();
+    m_waiters.popAll(waiters);
+    m_spin.unlock();
+    while (!waiters.empty()) {
+        waiters.take_front().wake();
+    }
+}
+
+bool FiberSemaphore::tryWait() {
+    uint32_t count = m_count.load(std::memory_order_relaxed);
+    while (count) {
+        if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FiberSemaphore::wait() {
+    if (tryWait() || spin_then_try([this]() {
+            return m_count.load(std::memory_order_relaxed) && tryWait();
+        })) {
+        return;
+    }
+    m_spin.lock();
+    // 计数只在m_spin里增加，这里看到0之后入队，notify一定能看到这个等待者
+    if (tryWait()) {
+        m_spin.unlock();
+        return;
+    }
+    m_waiters.wait(m_spin);
+}
+
+void FiberSemaphore::notify(uint32_t n) {
+    while (n) {
+        FiberWaiter waiter;
+        m_spin.lock();
+        if (!m_waiters.pop(waiter)) {
+            m_count += n;
+            m_spin.unlock();
+            return;
+        }
+        m_spin.unlock();
+        waiter.wake();
+        --n;
+    }
+}
+
+} // namespace sylar
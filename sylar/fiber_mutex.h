@@ -0,0 +1,268 @@
+/**
+ * @file fiber_mutex.h
+ * @brief 协程互斥锁、读写锁、条件变量和信号量
+ * @details mutex.h里的锁都基于pthread，协程在上面阻塞时整个调度线程跟着阻塞，线程上排队的其他协程也跑不了。
+ *          这里的锁等待时只挂起当前协程，把它放进锁的等待队列，释放锁时再通过协程所属的调度器schedule回来；
+ *          挂起前先自旋一小会儿(配置项fiber.mutex_spin，单核机器上不自旋)，临界区很短时不用切换协程。
+ *          不在协程里(普通线程、调度协程)调用时退化为用线程信号量等待，所以线程和协程之间也可以共用
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_FIBER_MUTEX_H__
+#define __SYLAR_FIBER_MUTEX_H__
+
+#include <atomic>
+#include "fiber.h"
+#include "mutex.h"
+#include "ring_buffer.h"
+
+namespace sylar {
+
+class Scheduler;
+class FiberMutex;
+
+/**
+ * @brief 挂起在锁上的协程或线程
+ */
+struct FiberWaiter {
+    /// 协程所属的调度器，线程等待时为nullptr
+    Scheduler *scheduler = nullptr;
+    /// 挂起的协程
+    Fiber::ptr fiber;
+    /// 线程等待时用的信号量，在等待线程的栈上
+    Semaphore *sem = nullptr;
+
+    /**
+     * @brief 在调度器的协程里时记下调度器和当前协程，并登记为调度器的外部等待者
+     * @return 不在协程里(普通线程、调度协程)时返回false，调用方改用信号量等待
+     */
+    bool initFiber();
+
+    /**
+     * @brief 唤醒，协程放回所属的调度器，线程通知信号量
+     */
+    void wake();
+};
+
+/**
+ * @brief 等待队列，先进先出
+ * @details 非线程安全，由使用方的自旋锁保护；等待者的信息按值存在队列里而不是等待方的栈上，
+ *          共享栈协程切出后栈内容会被覆盖，也能挂起在这里
+ */
+class FiberWaitQueue : Noncopyable {
+public:
+    /**
+     * @brief 当前协程(或线程)加到队尾并挂起，直到被pop出来wake()
+     * @param[in] lock 调用方持有的自旋锁，入队之后、挂起之前释放，返回时不再持有
+     * @param[in] mutex 非空时在释放lock之后、挂起之前一并释放，条件变量用
+     */
+    void wait(Spinlock &lock, FiberMutex *mutex = nullptr);
+
+    /**
+     * @brief 取出队头的等待者，调用方持有锁，应在放开锁之后再wake()
+     * @return 队列为空时返回false
+     */
+    bool pop(FiberWaiter &waiter);
+
+    /**
+     * @brief 取出所有等待者
+     */
+    void popAll(RingBuffer<FiberWaiter> &waiters);
+
+    /**
+     * @brief 是否没有等待者
+     */
+    bool empty() const { return m_waiters.empty(); }
+
+    /**
+     * @brief 等待者个数
+     */
+    size_t size() const { return m_waiters.size(); }
+
+private:
+    /// 等待者
+    RingBuffer<FiberWaiter> m_waiters;
+};
+
+/**
+ * @brief 协程互斥锁
+ * @details 没有等待者时加解锁都只是一次原子操作；释放时有等待者就替队头把锁加上再唤醒它，
+ *          等待者醒来时已经持有锁，排队的按先来后到，只有释放的瞬间正好来抢的才可能插队
+ */
+class FiberMutex : Noncopyable {
+public:
+    /// 局部锁
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    /**
+     * @brief 加锁，锁被占用时挂起当前协程
+     */
+    void lock();
+
+    /**
+     * @brief 尝试加锁，不等待
+     */
+    bool tryLock();
+
+    /**
+     * @brief 解锁
+     */
+    void unlock();
+
+private:
+    /// 保护等待队列
+    Spinlock m_spin;
+    /// 是否已加锁
+    std::atomic<bool> m_locked = {false};
+    /// 登记了要排队的等待者个数，为0时解锁不用碰m_spin
+    std::atomic<uint32_t> m_waiting = {0};
+    /// 等待加锁的协程
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程读写锁
+ * @details 有写者在等时新来的读者也排队，写锁释放时先放行所有在等的读者，最后一个读者释放时再交给下一个写者，
+ *          读写两边轮流，谁都不会饿死
+ */
+class FiberRWMutex : Noncopyable {
+public:
+    /// 局部读锁
+    typedef ReadScopedLockImpl<FiberRWMutex> ReadLock;
+    /// 局部写锁
+    typedef WriteScopedLockImpl<FiberRWMutex> WriteLock;
+
+    /**
+     * @brief 上读锁
+     */
+    void rdlock();
+
+    /**
+     * @brief 上写锁
+     */
+    void wrlock();
+
+    /**
+     * @brief 尝试上读锁，不等待
+     */
+    bool tryRdlock();
+
+    /**
+     * @brief 尝试上写锁，不等待
+     */
+    bool tryWrlock();
+
+    /**
+     * @brief 解锁，读锁写锁都用这个
+     */
+    void unlock();
+
+private:
+    /**
+     * @brief 持有m_spin时判断能否直接上读锁
+     */
+    bool canRead() const { return !m_writer && m_writeWaiters.empty(); }
+
+    /**
+     * @brief 持有m_spin时判断能否直接上写锁
+     */
+    bool canWrite() const { return !m_writer && !m_readers; }
+
+private:
+    /// 保护下面所有成员
+    Spinlock m_spin;
+    /// 持有读锁的个数，自旋时不加锁先看一眼
+    std::atomic<uint32_t> m_readers = {0};
+    /// 是否有写者持有锁
+    std::atomic<bool> m_writer = {false};
+    /// 等待读锁的协程
+    FiberWaitQueue m_readWaiters;
+    /// 等待写锁的协程
+    FiberWaitQueue m_writeWaiters;
+};
+
+/**
+ * @brief 协程条件变量，配合FiberMutex使用
+ */
+class FiberCondition : Noncopyable {
+public:
+    /**
+     * @brief 释放mutex并挂起，被唤醒后重新加锁再返回，调用前必须持有mutex
+     * @note 和std::condition_variable一样可能被notifyAll多唤醒，调用方应在循环里检查条件
+     */
+    void wait(FiberMutex &mutex);
+
+    /**
+     * @brief 一直等到pred()为true
+     */
+    template <class Predicate>
+    void wait(FiberMutex &mutex, Predicate pred) {
+        while (!pred()) {
+            wait(mutex);
+        }
+    }
+
+    /**
+     * @brief 唤醒一个等待者
+     */
+    void notifyOne();
+
+    /**
+     * @brief 唤醒所有等待者
+     */
+    void notifyAll();
+
+private:
+    /// 保护等待队列
+    Spinlock m_spin;
+    /// 等待的协程
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程信号量
+ * @details 释放时有等待者就把计数直接交给队头，不会被后来者抢走
+ */
+class FiberSemaphore : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] count 初始计数
+     */
+    explicit FiberSemaphore(uint32_t count = 0)
+        : m_count(count) {}
+
+    /**
+     * @brief 获取信号量，计数为0时挂起当前协程
+     */
+    void wait();
+
+    /**
+     * @brief 尝试获取信号量，不等待
+     */
+    bool tryWait();
+
+    /**
+     * @brief 释放信号量
+     * @param[in] n 释放的个数
+     */
+    void notify(uint32_t n = 1);
+
+    /**
+     * @brief 当前计数
+     */
+    uint32_t getCount() const { return m_count; }
+
+private:
+    /// 保护等待队列，计数增加也在锁里进行
+    Spinlock m_spin;
+    /// 当前计数
+    std::atomic<uint32_t> m_count;
+    /// 等待的协程
+    FiberWaitQueue m_waiters;
+};
+
+} // namespace sylar
+
+#endif
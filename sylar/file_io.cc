@@ -0,0 +1,103 @@
+/**
+ * @file file_io.cc
+ * @brief 阻塞IO线程池实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "file_io.h"
+#include "config.h"
+#include "fiber.h"
+#include "scheduler.h"
+#include "hook.h"
+#include "log.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_fileio_threads =
+    Config::Lookup<uint32_t>("fileio.threads", 2, "threads executing hooked regular file io for fibers, 0 means run it on the calling thread");
+
+FileIoPool::FileIoPool() {
+    m_target = g_fileio_threads->getValue();
+    g_fileio_threads->addListener([this](const uint32_t &old_value, const uint32_t &new_value) {
+        SYLAR_LOG_INFO(g_logger) << "fileio.threads changed from " << old_value << " to " << new_value;
+        m_target = new_value;
+    });
+}
+
+FileIoPool::~FileIoPool() {
+    {
+        MutexType::Lock lock(m_mutex);
+        resize(0);
+    }
+    for (auto &thr : m_threads) {
+        thr->join();
+    }
+}
+
+bool FileIoPool::canExecute() const {
+    if (!m_target || !is_hook_enable() || !Scheduler::GetThis()) {
+        return false;
+    }
+    Fiber::ptr fiber = Fiber::GetThis();
+    // 调度协程自己不能挂起
+    return fiber.get() != Scheduler::GetMainFiber() && !fiber->isSharedStack();
+}
+
+void FileIoPool::execute(const std::function<void()> &cb) {
+    Fiber::ptr fiber = Fiber::GetThis();
+    Scheduler *sc    = Scheduler::GetThis();
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_threadCount != m_target) {
+            resize(m_target);
+        }
+        if (!m_threadCount) {
+            // 刚被配置成0，没有线程可用了
+            lock.unlock();
+            cb();
+            return;
+        }
+        sc->addExternalWaiter();
+        m_tasks.push_back([&cb, fiber, sc]() {
+            cb();
+            sc->schedule(fiber);
+            sc->delExternalWaiter();
+        });
+    }
+    m_sem.notify();
+    fiber->yield();
+}
+
+void FileIoPool::resize(size_t count) {
+    while (m_threadCount < count) {
+        m_threads.push_back(std::make_shared<Thread>(std::bind(&FileIoPool::run, this),
+                                                     "fileio_" + std::to_string(m_threads.size())));
+        ++m_threadCount;
+    }
+    while (m_threadCount > count) {
+        m_tasks.push_back(nullptr);
+        m_sem.notify();
+        --m_threadCount;
+    }
+}
+
+void FileIoPool::run() {
+    set_hook_enable(false);
+    while (true) {
+        m_sem.wait();
+        std::function<void()> cb;
+        {
+            MutexType::Lock lock(m_mutex);
+            cb = m_tasks.take_front();
+        }
+        if (!cb) {
+            break;
+        }
+        cb();
+        ++m_taskCount;
+    }
+}
+
+} // namespace sylar
@@ -0,0 +1,94 @@
+/**
+ * @file file_io.h
+ * @brief 普通文件阻塞IO的线程池
+ * @details 普通文件不能用epoll等待，hook后的read/write/open等在协程里直接调用会卡住整个调度线程，
+ *          这里把这些调用交给专门的阻塞IO线程执行，发起的协程挂起，执行完再调度回来；
+ *          线程数由配置项fileio.threads控制，第一次使用时才创建线程，为0时不转交，直接在当前线程执行
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_FILE_IO_H__
+#define __SYLAR_FILE_IO_H__
+
+#include <functional>
+#include <vector>
+#include <atomic>
+#include "mutex.h"
+#include "thread.h"
+#include "singleton.h"
+#include "ring_buffer.h"
+
+namespace sylar {
+
+/**
+ * @brief 阻塞IO线程池
+ */
+class FileIoPool : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    FileIoPool();
+
+    /**
+     * @brief 析构函数，等待所有线程执行完队列里的任务后退出
+     */
+    ~FileIoPool();
+
+    /**
+     * @brief 当前协程能否把阻塞调用转交给线程池
+     * @details 要求在IOManager的协程里，线程池已启用，并且不是共享栈协程：
+     *          共享栈协程切出后栈上的缓冲区会被别的协程覆盖，池里的线程不能再读写它
+     */
+    bool canExecute() const;
+
+    /**
+     * @brief 在线程池里执行cb，当前协程挂起直到cb执行完
+     * @details cb可以引用调用方栈上的变量，返回前cb一定已经执行完；调用前应先检查canExecute()
+     */
+    void execute(const std::function<void()> &cb);
+
+    /**
+     * @brief 当前的线程数
+     */
+    size_t getThreadCount() const { return m_threadCount; }
+
+    /**
+     * @brief 累计执行的任务数
+     */
+    uint64_t getTaskCount() const { return m_taskCount; }
+
+private:
+    /**
+     * @brief 线程数调整到count，多出来的线程执行完手上的任务后退出
+     */
+    void resize(size_t count);
+
+    /**
+     * @brief 线程主函数
+     */
+    void run();
+
+private:
+    /// 保护任务队列和线程列表
+    MutexType m_mutex;
+    /// 有任务时通知空闲线程
+    Semaphore m_sem;
+    /// 任务队列，空的回调表示让一个线程退出
+    RingBuffer<std::function<void()>> m_tasks;
+    /// 创建过的线程，退出的线程也留在这里，析构时统一join
+    std::vector<Thread::ptr> m_threads;
+    /// 目标线程数
+    std::atomic<size_t> m_target = {0};
+    /// 当前的线程数
+    std::atomic<size_t> m_threadCount = {0};
+    /// 累计执行的任务数
+    std::atomic<uint64_t> m_taskCount = {0};
+};
+
+/// 阻塞IO线程池单例
+typedef Singleton<FileIoPool> FileIoMgr;
+
+} // namespace sylar
+
+#endif
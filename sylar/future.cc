@@ -0,0 +1,101 @@
+/**
+ * @file future.cc
+ * @brief Future共享状态和WaitGroup实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "future.h"
+
+namespace sylar {
+
+void FutureStateBase::wait() {
+    if (isReady()) {
+        return;
+    }
+    m_spin.lock();
+    // markReady()在m_spin里置位，这里看到没就绪后入队，一定会被唤醒
+    if (isReady()) {
+        m_spin.unlock();
+        return;
+    }
+    m_waiters.wait(m_spin);
+}
+
+void FutureStateBase::addCallback(Callback cb) {
+    if (!isReady()) {
+        Spinlock::Lock lock(m_spin);
+        if (!isReady()) {
+            m_callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+bool FutureStateBase::trySatisfy() {
+    return !m_satisfied.exchange(true);
+}
+
+void FutureStateBase::setException(std::exception_ptr error) {
+    m_error = error;
+}
+
+void FutureStateBase::markReady() {
+    RingBuffer<FiberWaiter> waiters;
+    std::vector<Callback> callbacks;
+    m_spin.lock();
+    m_ready.store(true, std::memory_order_release);
+    m_waiters.popAll(waiters);
+    callbacks.swap(m_callbacks);
+    m_spin.unlock();
+    while (!waiters.empty()) {
+        waiters.take_front().wake();
+    }
+    for (auto &cb : callbacks) {
+        cb();
+    }
+}
+
+void FutureStateBase::rethrowIfError() const {
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void FutureStateBase::delPromise() {
+    if (--m_promises == 0 && trySatisfy()) {
+        setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        markReady();
+    }
+}
+
+void WaitGroup::add(uint32_t n) {
+    m_count += n;
+}
+
+void WaitGroup::done() {
+    RingBuffer<FiberWaiter> waiters;
+    m_spin.lock();
+    SYLAR_ASSERT(m_count > 0);
+    if (--m_count == 0) {
+        m_waiters.popAll(waiters);
+    }
+    m_spin.unlock();
+    while (!waiters.empty()) {
+        waiters.take_front().wake();
+    }
+}
+
+void WaitGroup::wait() {
+    if (!m_count) {
+        return;
+    }
+    m_spin.lock();
+    if (!m_count) {
+        m_spin.unlock();
+        return;
+    }
+    m_waiters.wait(m_spin);
+}
+
+} // namespace sylar
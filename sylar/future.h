@@ -0,0 +1,382 @@
+/**
+ * @file future.h
+ * @brief 协程Future/Promise、when_all/when_any和WaitGroup
+ * @details 并发调用多个后端时，用Scheduler::async()把每个调用放到单独的协程里，拿到Future后再等结果，
+ *          总耗时取决于最慢的一个而不是所有调用之和；等待只挂起当前协程，不阻塞调度线程。
+ *          Future可以拷贝，多个协程可以等同一个结果；回调在设置结果的协程里执行，不要在里面做耗时操作
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_FUTURE_H__
+#define __SYLAR_FUTURE_H__
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "fiber_mutex.h"
+#include "macro.h"
+
+namespace sylar {
+
+/**
+ * @brief Future共享状态中与值类型无关的部分
+ */
+class FutureStateBase : Noncopyable {
+public:
+    typedef std::function<void()> Callback;
+
+    virtual ~FutureStateBase() {}
+
+    /**
+     * @brief 结果(值或异常)是否已经设置
+     */
+    bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 等到结果设置，在协程里只挂起当前协程
+     */
+    void wait();
+
+    /**
+     * @brief 结果设置后执行cb，已经设置了就立即执行
+     */
+    void addCallback(Callback cb);
+
+    /**
+     * @brief 占用设置结果的资格，只有第一次调用返回true，防止重复设置
+     */
+    bool trySatisfy();
+
+    /**
+     * @brief 设置异常，调用前必须trySatisfy()成功
+     */
+    void setException(std::exception_ptr error);
+
+    /**
+     * @brief 标记结果已设置，唤醒等待者并执行回调，调用前必须trySatisfy()成功
+     */
+    void markReady();
+
+    /**
+     * @brief 结果是异常时重新抛出
+     */
+    void rethrowIfError() const;
+
+    /**
+     * @brief 登记一个Promise
+     */
+    void addPromise() { ++m_promises; }
+
+    /**
+     * @brief 注销一个Promise，最后一个Promise析构时还没设置结果就设置broken_promise异常
+     */
+    void delPromise();
+
+private:
+    /// 保护等待队列和回调
+    Spinlock m_spin;
+    /// 是否已经有人开始设置结果
+    std::atomic<bool> m_satisfied = {false};
+    /// 结果是否已经设置
+    std::atomic<bool> m_ready = {false};
+    /// 还在的Promise个数
+    std::atomic<uint32_t> m_promises = {0};
+    /// 异常
+    std::exception_ptr m_error;
+    /// 等结果的协程
+    FiberWaitQueue m_waiters;
+    /// 结果设置后执行的回调
+    std::vector<Callback> m_callbacks;
+};
+
+/**
+ * @brief 按值类型区分的存储，void没有值
+ */
+template <class T>
+struct FutureValue {
+    typedef const T &Result;
+
+    template <class... Args>
+    void emplace(Args &&...args) { value.reset(new T(std::forward<Args>(args)...)); }
+
+    Result get() const { return *value; }
+
+    std::unique_ptr<T> value;
+};
+
+template <>
+struct FutureValue<void> {
+    typedef void Result;
+
+    void emplace() {}
+
+    void get() const {}
+};
+
+/**
+ * @brief Future共享状态
+ */
+template <class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    /**
+     * @brief 设置值，重复设置返回false
+     */
+    template <class... Args>
+    bool setValue(Args &&...args) {
+        if (!trySatisfy()) {
+            return false;
+        }
+        m_value.emplace(std::forward<Args>(args)...);
+        markReady();
+        return true;
+    }
+
+    /**
+     * @brief 设置异常，重复设置返回false
+     */
+    bool setError(std::exception_ptr error) {
+        if (!trySatisfy()) {
+            return false;
+        }
+        setException(error);
+        markReady();
+        return true;
+    }
+
+    /**
+     * @brief 取值，调用前必须已经ready
+     */
+    typename FutureValue<T>::Result get() const {
+        rethrowIfError();
+        return m_value.get();
+    }
+
+private:
+    /// 值
+    FutureValue<T> m_value;
+};
+
+/**
+ * @brief 异步结果
+ */
+template <class T>
+class Future {
+public:
+    Future() {}
+
+    explicit Future(typename FutureState<T>::ptr state)
+        : m_state(std::move(state)) {}
+
+    /**
+     * @brief 是否关联了共享状态，默认构造的Future无效
+     */
+    bool valid() const { return !!m_state; }
+
+    /**
+     * @brief 结果是否已经设置
+     */
+    bool isReady() const { return m_state->isReady(); }
+
+    /**
+     * @brief 等到结果设置，在协程里只挂起当前协程
+     */
+    void wait() const { m_state->wait(); }
+
+    /**
+     * @brief 等到结果设置后返回值，结果是异常时抛出
+     * @note 返回的引用指向共享状态，所有关联的Future都析构后失效，不要对临时的Future取引用
+     */
+    typename FutureValue<T>::Result get() const {
+        m_state->wait();
+        return m_state->get();
+    }
+
+    /**
+     * @brief 结果设置后执行cb，已经设置了就立即执行
+     */
+    void onReady(std::function<void()> cb) const { m_state->addCallback(std::move(cb)); }
+
+private:
+    /// 共享状态
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 设置异步结果的一方
+ * @details 可以拷贝，所有拷贝都析构时还没设置结果，Future会得到std::future_errc::broken_promise异常
+ */
+template <class T>
+class Promise {
+public:
+    Promise()
+        : m_state(std::make_shared<FutureState<T>>()) {
+        m_state->addPromise();
+    }
+
+    Promise(const Promise &rhs)
+        : m_state(rhs.m_state) {
+        m_state->addPromise();
+    }
+
+    Promise(Promise &&rhs)
+        : m_state(std::move(rhs.m_state)) {}
+
+    Promise &operator=(Promise rhs) {
+        std::swap(m_state, rhs.m_state);
+        return *this;
+    }
+
+    ~Promise() {
+        if (m_state) {
+            m_state->delPromise();
+        }
+    }
+
+    /**
+     * @brief 关联的Future
+     */
+    Future<T> getFuture() const { return Future<T>(m_state); }
+
+    /**
+     * @brief 设置值，重复设置返回false
+     */
+    template <class... Args>
+    bool setValue(Args &&...args) { return m_state->setValue(std::forward<Args>(args)...); }
+
+    /**
+     * @brief 设置异常，重复设置返回false
+     */
+    bool setException(std::exception_ptr error) { return m_state->setError(error); }
+
+    /**
+     * @brief 执行fn，用返回值或抛出的异常设置结果
+     */
+    template <class F>
+    void setWith(F &fn) {
+        try {
+            invoke(fn, std::is_void<T>());
+        } catch (...) {
+            setException(std::current_exception());
+        }
+    }
+
+private:
+    template <class F>
+    void invoke(F &fn, std::false_type) { setValue(fn()); }
+
+    template <class F>
+    void invoke(F &fn, std::true_type) {
+        fn();
+        setValue();
+    }
+
+private:
+    /// 共享状态
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 所有Future都就绪后就绪，值是传入的Future本身，逐个get()取结果
+ */
+template <class T>
+Future<std::vector<Future<T>>> when_all(std::vector<Future<T>> futures) {
+    Promise<std::vector<Future<T>>> promise;
+    Future<std::vector<Future<T>>> result = promise.getFuture();
+    if (futures.empty()) {
+        promise.setValue(std::move(futures));
+        return result;
+    }
+    // 计数多加1，全部登记完回调之后再减，避免登记到一半就凑齐了
+    std::shared_ptr<std::atomic<size_t>> remain = std::make_shared<std::atomic<size_t>>(futures.size() + 1);
+    std::shared_ptr<std::vector<Future<T>>> all = std::make_shared<std::vector<Future<T>>>(std::move(futures));
+    auto on_one = [promise, remain, all]() mutable {
+        if (--*remain == 0) {
+            promise.setValue(std::move(*all));
+        }
+    };
+    for (auto &f : *all) {
+        f.onReady(on_one);
+    }
+    on_one();
+    return result;
+}
+
+/**
+ * @brief when_any的结果
+ */
+template <class T>
+struct WhenAnyResult {
+    /// 第一个就绪的下标
+    size_t index;
+    /// 传入的Future
+    std::vector<Future<T>> futures;
+};
+
+/**
+ * @brief 任一Future就绪后就绪
+ */
+template <class T>
+Future<WhenAnyResult<T>> when_any(std::vector<Future<T>> futures) {
+    SYLAR_ASSERT2(!futures.empty(), "when_any needs at least one future");
+    Promise<WhenAnyResult<T>> promise;
+    Future<WhenAnyResult<T>> result = promise.getFuture();
+    std::shared_ptr<WhenAnyResult<T>> any = std::make_shared<WhenAnyResult<T>>();
+    std::shared_ptr<std::atomic<bool>> fired = std::make_shared<std::atomic<bool>>(false);
+    any->futures = futures;
+    for (size_t i = 0; i < futures.size(); i++) {
+        // 只有第一个就绪的能拿走结果，回调可能在登记时就同步执行，所以遍历的是参数而不是any里的
+        futures[i].onReady([promise, any, fired, i]() mutable {
+            if (!fired->exchange(true)) {
+                any->index = i;
+                promise.setValue(std::move(*any));
+            }
+        });
+    }
+    return result;
+}
+
+/**
+ * @brief 等待一组协程结束，类似go的sync.WaitGroup
+ */
+class WaitGroup : Noncopyable {
+public:
+    /**
+     * @brief 增加要等的个数，应在启动协程之前调用
+     */
+    void add(uint32_t n = 1);
+
+    /**
+     * @brief 完成一个
+     */
+    void done();
+
+    /**
+     * @brief 等到计数归零，在协程里只挂起当前协程
+     */
+    void wait();
+
+    /**
+     * @brief 还没完成的个数
+     */
+    uint32_t getCount() const { return m_count; }
+
+private:
+    /// 保护等待队列
+    Spinlock m_spin;
+    /// 还没完成的个数
+    std::atomic<uint32_t> m_count = {0};
+    /// 等待的协程
+    FiberWaitQueue m_waiters;
+};
+
+} // namespace sylar
+
+#endif
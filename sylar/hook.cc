@@ -1,11 +1,18 @@
 #include "hook.h"
 #include <dlfcn.h>
+#include <string.h>
+#include <linux/io_uring.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <vector>
 
 #include "config.h"
 #include "log.h"
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "file_io.h"
 #include "macro.h"
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
@@ -23,6 +30,7 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(read) \
     XX(readv) \
     XX(recv) \
@@ -34,6 +42,24 @@ static thread_local bool t_hook_enable = false;
     XX(sendto) \
     XX(sendmsg) \
     XX(close) \
+    XX(poll) \
+    XX(ppoll) \
+    XX(select) \
+    XX(epoll_wait) \
+    XX(dup) \
+    XX(dup2) \
+    XX(dup3) \
+    XX(pipe) \
+    XX(pipe2) \
+    XX(eventfd) \
+    XX(open) \
+    XX(pread) \
+    XX(pwrite) \
+    XX(fsync) \
+    XX(sendfile) \
+    XX(splice) \
+    XX(tee) \
+    XX(copy_file_range) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
@@ -75,9 +101,25 @@ void set_hook_enable(bool flag) {
 
 }
 
-struct timer_info {
-    int cancelled = 0;
-};
+/**
+ * @brief 普通文件上的阻塞调用交给FileIoPool执行，当前协程挂起等待
+ */
+template<typename OriginFun, typename... Args>
+static ssize_t do_file_io(int fd, OriginFun fun, Args&&... args) {
+    if(!sylar::FileIoMgr::GetInstance()->canExecute()) {
+        return fun(fd, std::forward<Args>(args)...);
+    }
+    ssize_t n = 0;
+    int err = 0;
+    sylar::FileIoMgr::GetInstance()->execute([&]() {
+        n = fun(fd, args...);
+        err = errno;
+    });
+    errno = err;
+    return n;
+}
+
+static int follow_event(sylar::IOManager* iom, int fd, sylar::IOManager::Event event, uint64_t timeout_ms);
 
 template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
@@ -86,7 +128,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
     if(!ctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -96,12 +138,16 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return -1;
     }
 
-    if(!ctx->isSocket() || ctx->getUserNonblock()) {
+    if(ctx->isFile()) {
+        return do_file_io(fd, fun, std::forward<Args>(args)...);
+    }
+
+    if(!ctx->isPollable() || ctx->getUserNonblock()) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    uint32_t gen = ctx->getGeneration();
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
@@ -109,36 +155,35 @@ retry:
         n = fun(fd, std::forward<Args>(args)...);
     }
     if(n == -1 && errno == EAGAIN) {
+        // 超时由fd上复用的定时器负责，挂起等待的路上不分配内存
         sylar::IOManager* iom = sylar::IOManager::GetThis();
-        sylar::Timer::ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        if(to != (uint64_t)-1) {
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-            }, winfo);
-        }
-
-        int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
-        if(SYLAR_UNLIKELY(rt)) {
+        int rt = iom->waitEvent(fd, (sylar::IOManager::Event)(event), to);
+        if(rt == 1) {
+            // 持久注册模式下EAGAIN之后事件已经就绪，不用挂起，直接重试
+            goto retry;
+        } else if(rt == ETIMEDOUT) {
+            errno = ETIMEDOUT;
+            return -1;
+        } else if(rt == -1 && errno == EEXIST) {
+            // 别的协程已经在这个fd上等同一个事件(比如第三方库在poll它)，排在它后面，它等完了醒来重试
+            if(follow_event(iom, fd, (sylar::IOManager::Event)(event), to) == ETIMEDOUT) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            if(ctx->getGeneration() != gen) {
+                errno = EBADF;
+                return -1;
+            }
+            goto retry;
+        } else if(SYLAR_UNLIKELY(rt)) {
             SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
-            if(timer) {
-                timer->cancel();
-            }
             return -1;
         } else {
-            sylar::Fiber::GetThis()->yield();
-            if(timer) {
-                timer->cancel();
-            }
-            if(tinfo->cancelled) {
-                errno = tinfo->cancelled;
+            // 被close唤醒的，这时fd可能还没真正关闭，再试一次会重新等在这个fd上，永远等不到；
+            // 被dup2覆盖时同一个FdCtx已经给新的fd重新初始化了，所以比较关闭次数而不是关闭标志
+            if(ctx->getGeneration() != gen) {
+                errno = EBADF;
                 return -1;
             }
             goto retry;
@@ -148,6 +193,382 @@ retry:
     return n;
 }
 
+/**
+ * @brief 判断fd上的这次调用能否走io_uring，能的话返回当前的IOManager
+ * @details 共享栈协程切出时栈内容会被拷走，内核不能直接读写栈上的缓冲区，所以共享栈协程只走epoll
+ */
+static sylar::IOManager* get_uring(int fd, sylar::FdCtx*& ctx) {
+    if(!sylar::t_hook_enable) {
+        return nullptr;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || !iom->isIoUring() || sylar::Fiber::GetThis()->isSharedStack()) {
+        return nullptr;
+    }
+    ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+        return nullptr;
+    }
+    return iom;
+}
+
+/**
+ * @brief 通过io_uring执行请求，当前协程挂起直到请求完成
+ * @param[out] n 请求结果，同对应系统调用的返回值，失败时设置errno
+ * @return 内核对非阻塞socket直接返回EAGAIN(不支持替它等待)时返回false，由调用方走epoll
+ */
+static bool uring_submit(sylar::IOManager* iom, sylar::FdCtx* ctx, int fd, uint32_t event,
+        const io_uring_sqe& sqe, uint64_t to, ssize_t& n) {
+    uint32_t gen = ctx->getGeneration();
+    while(true) {
+        int rt = iom->submitIo(fd, (sylar::IOManager::Event)event, sqe, to);
+        if(rt == -ECANCELED) {
+            // 被close取消的直接返回，否则和epoll路径一样重试
+            if(ctx->getGeneration() != gen) {
+                errno = EBADF;
+                n = -1;
+                return true;
+            }
+            continue;
+        }
+        if(rt == -EAGAIN) {
+            return false;
+        }
+        if(rt < 0) {
+            errno = -rt;
+            n = -1;
+        } else {
+            n = rt;
+        }
+        return true;
+    }
+}
+
+/**
+ * @brief recv/send类请求走io_uring
+ */
+static bool uring_rw(int fd, uint8_t opcode, const void* buf, size_t len, int flags,
+        uint32_t event, int timeout_so, ssize_t& n) {
+    sylar::FdCtx* ctx = nullptr;
+    sylar::IOManager* iom = get_uring(fd, ctx);
+    if(!iom) {
+        return false;
+    }
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode    = opcode;
+    sqe.fd        = fd;
+    sqe.addr      = (uint64_t)buf;
+    sqe.len       = len;
+    sqe.msg_flags = flags;
+    return uring_submit(iom, ctx, fd, event, sqe, ctx->getTimeout(timeout_so), n);
+}
+
+/**
+ * @brief 普通文件上的read/write/fsync类请求走io_uring
+ * @param[in] offset 文件偏移，-1表示使用并推进文件当前的偏移
+ */
+static bool uring_file(int fd, uint8_t opcode, const void* buf, size_t len, uint64_t offset, ssize_t& n) {
+    if(!sylar::t_hook_enable) {
+        return false;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || !iom->isIoUring() || sylar::Fiber::GetThis()->isSharedStack()) {
+        return false;
+    }
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->isClose() || !ctx->isFile()) {
+        return false;
+    }
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd     = fd;
+    sqe.addr   = (uint64_t)buf;
+    sqe.len    = len;
+    sqe.off    = offset;
+    uint32_t event = opcode == IORING_OP_READ ? sylar::IOManager::READ : sylar::IOManager::WRITE;
+    return uring_submit(iom, ctx, fd, event, sqe, ~0ull, n);
+}
+
+/**
+ * @brief fd即将被关闭(close或者被dup2/dup3覆盖)，唤醒等在上面的协程并删除FdCtx
+ */
+static void fd_closing(int fd) {
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(ctx) {
+        ctx->setClose();
+    }
+    // 没有FdCtx的fd(比如epoll_create出来的)也可能被poll等待过，持久注册模式下要清掉注册标志，
+    // 否则同号的新fd不会再加进epoll
+    auto iom = sylar::IOManager::GetThis();
+    if(iom) {
+        iom->cancelAll(fd);
+        iom->setFdPriority(fd, sylar::Scheduler::PRIORITY_AUTO);
+    }
+    if(ctx) {
+        sylar::FdMgr::GetInstance()->del(fd);
+    }
+}
+
+/**
+ * @brief 返回能挂起当前协程等待事件的IOManager，hook没开、不在IOManager里或者在调度协程里时返回nullptr
+ */
+static sylar::IOManager* get_poll_iom() {
+    if(!sylar::t_hook_enable) {
+        return nullptr;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || sylar::Fiber::GetThis().get() == sylar::Scheduler::GetMainFiber()) {
+        return nullptr;
+    }
+    return iom;
+}
+
+/**
+ * @brief poll类调用里等待的协程，被任一事件回调或超时定时器唤醒，只会被调度一次
+ */
+struct PollWaiter {
+    PollWaiter(sylar::IOManager* i)
+        :iom(i)
+        ,fiber(sylar::Fiber::GetThis())
+        ,woken(false) {
+    }
+
+    void wake(bool timeout = false) {
+        if(!woken.exchange(true)) {
+            timedOut = timeout;
+            iom->schedule(fiber);
+        }
+    }
+
+    sylar::IOManager* iom;
+    sylar::Fiber::ptr fiber;
+    std::atomic<bool> woken;
+    /// 是不是被超时定时器唤醒的，只有唤醒者写一次
+    bool timedOut = false;
+};
+
+/**
+ * @brief 排在fd上已经在等同一个事件的协程后面，挂起到它等完或者超时
+ * @param[in] timeout_ms 超时时间，~0ull表示一直等
+ * @return 超时返回ETIMEDOUT，否则返回0，这时调用方应该重试IO
+ */
+static int follow_event(sylar::IOManager* iom, int fd, sylar::IOManager::Event event, uint64_t timeout_ms) {
+    std::shared_ptr<PollWaiter> waiter = std::make_shared<PollWaiter>(iom);
+    if(!iom->followEvent(fd, event, [waiter]() {
+            waiter->wake();
+        })) {
+        // 前一个等待者刚好等完了
+        return 0;
+    }
+    sylar::Timer::ptr timer;
+    if(timeout_ms != ~0ull) {
+        timer = iom->addTimer(timeout_ms, [waiter]() {
+            waiter->wake(true);
+        });
+    }
+    sylar::Fiber::GetThis()->yield();
+    if(timer) {
+        timer->cancel();
+    }
+    return waiter->timedOut ? ETIMEDOUT : 0;
+}
+
+/**
+ * @brief 协程版的poll：查一次没有就绪的fd，就把关心的事件挂到IOManager上，挂起到任一事件就绪或超时再查
+ * @details 每一轮用新的PollWaiter，上一轮迟到的事件回调只会碰到已经唤醒过的waiter，不会把协程多调度一次；
+ *          别的协程(hook的读写、poll、epoll_wait)已经在等同一个fd的同一个事件时用followEvent排在它后面
+ * @param[in] timeout_us 超时时间，~0ull表示一直等
+ * @return 同poll，有fd不能放进epoll时退回到阻塞的poll
+ */
+static int fiber_poll(sylar::IOManager* iom, struct pollfd* fds, nfds_t nfds, uint64_t timeout_us) {
+    uint64_t deadline = timeout_us == ~0ull ? ~0ull : sylar::GetElapsedUS() + timeout_us;
+    // 同一个fd可能在数组里出现多次，按fd合并要等的事件，每个fd的每个事件只加一次
+    std::vector<std::pair<int, int>> wanted;
+    for(nfds_t i = 0; i < nfds; ++i) {
+        if(fds[i].fd < 0) {
+            continue;
+        }
+        int events = 0;
+        if(fds[i].events & (POLLIN | POLLPRI | POLLRDNORM | POLLRDBAND)) {
+            events |= sylar::IOManager::READ;
+        }
+        if(fds[i].events & (POLLOUT | POLLWRNORM | POLLWRBAND)) {
+            events |= sylar::IOManager::WRITE;
+        }
+        if(!events) {
+            // 只关心POLLHUP/POLLERR，epoll总会报告这两个，挂在读事件上等
+            events = sylar::IOManager::READ;
+        }
+        wanted.push_back(std::make_pair(fds[i].fd, events));
+    }
+    std::sort(wanted.begin(), wanted.end());
+    size_t n = 0;
+    for(size_t i = 0; i < wanted.size(); ++i) {
+        if(n && wanted[n - 1].first == wanted[i].first) {
+            wanted[n - 1].second |= wanted[i].second;
+        } else {
+            wanted[n++] = wanted[i];
+        }
+    }
+    wanted.resize(n);
+
+    std::vector<std::pair<int, sylar::IOManager::Event>> added;
+    while(true) {
+        int rt = poll_f(fds, nfds, 0);
+        if(rt != 0) {
+            return rt;
+        }
+        uint64_t now = sylar::GetElapsedUS();
+        if(now >= deadline) {
+            return 0;
+        }
+
+        std::shared_ptr<PollWaiter> waiter = std::make_shared<PollWaiter>(iom);
+        std::function<void()> cb = [waiter]() {
+            waiter->wake();
+        };
+        // 1: 持久注册模式下事件已经就绪，-1: 有fd加不进epoll
+        int state = 0;
+        added.clear();
+        for(auto it = wanted.begin(); it != wanted.end() && !state; ++it) {
+            for(auto event : {sylar::IOManager::READ, sylar::IOManager::WRITE}) {
+                if(!(it->second & event)) {
+                    continue;
+                }
+                // 别的协程已经在等这个事件时排在它后面，它等完时本协程也被唤醒，重新检查一遍
+                int r = 0;
+                bool followed = false;
+                while((r = iom->addEvent(it->first, event, cb)) == -1 && errno == EEXIST) {
+                    if(iom->followEvent(it->first, event, cb)) {
+                        followed = true;
+                        break;
+                    }
+                }
+                if(followed) {
+                    continue;
+                }
+                if(r) {
+                    state = r == 1 ? 1 : -1;
+                    break;
+                }
+                added.push_back(std::make_pair(it->first, event));
+            }
+        }
+
+        sylar::Timer::ptr timer;
+        if(!state) {
+            if(deadline != ~0ull) {
+                timer = iom->addTimerUS(deadline - now, cb);
+            }
+            sylar::Fiber::GetThis()->yield();
+        }
+        if(timer) {
+            timer->cancel();
+        }
+        for(auto& i : added) {
+            iom->delEvent(i.first, i.second);
+        }
+        if(state && waiter->woken.exchange(true)) {
+            // 没有挂起，但已经加上的事件触发过并调度了本协程，要把这次调度消化掉
+            sylar::Fiber::GetThis()->yield();
+        }
+        if(state == -1) {
+            now = sylar::GetElapsedUS();
+            int timeout_ms = deadline == ~0ull ? -1 : (int)((std::max(deadline, now) - now + 999) / 1000);
+            return poll_f(fds, nfds, timeout_ms);
+        }
+    }
+}
+
+
+/**
+ * @brief 不挂起地看一眼fd上的事件是否就绪
+ */
+static bool fd_ready(int fd, short events) {
+    struct pollfd pfd = {fd, events, 0};
+    return poll_f(&pfd, 1, 0) == 1;
+}
+
+/**
+ * @brief 两端都可能阻塞的调用(splice/tee/copy_file_range)
+ * @details 每次EAGAIN之后用poll_f看一眼哪一端还没就绪，只等那一端：管道->socket时等socket可写，
+ *          socket->管道时等管道可写，不会挂在已经就绪的一端上反复醒来重试；
+ *          两端都不能用epoll等待时按单个fd处理，普通文件由do_io交给FileIoPool
+ */
+template<typename OriginFun>
+static ssize_t do_io2(int fd_in, int fd_out, OriginFun fun, const char* hook_fun_name) {
+    sylar::FdCtx* in = sylar::FdMgr::GetInstance()->get(fd_in);
+    sylar::FdCtx* out = sylar::FdMgr::GetInstance()->get(fd_out);
+    bool in_poll = in && in->isPollable();
+    bool out_poll = out && out->isPollable();
+    sylar::IOManager* iom = get_poll_iom();
+    if(!in_poll && !out_poll) {
+        return do_io(out ? fd_out : fd_in, [&](int) {
+            return fun();
+        }, hook_fun_name, sylar::IOManager::WRITE, SO_SNDTIMEO);
+    }
+    if(!iom || (in_poll && in->getUserNonblock()) || (out_poll && out->getUserNonblock())) {
+        return fun();
+    }
+    if((in_poll && in->isClose()) || (out_poll && out->isClose())) {
+        errno = EBADF;
+        return -1;
+    }
+
+    uint32_t in_gen = in_poll ? in->getGeneration() : 0;
+    uint32_t out_gen = out_poll ? out->getGeneration() : 0;
+    uint64_t start = sylar::GetElapsedMS();
+    while(true) {
+        ssize_t n = fun();
+        while(n == -1 && errno == EINTR) {
+            n = fun();
+        }
+        if(n != -1 || errno != EAGAIN) {
+            return n;
+        }
+
+        // 只等还没就绪的一端，超时取它们里最短的
+        struct pollfd pfds[2];
+        nfds_t waits = 0;
+        uint64_t to = ~0ull;
+        if(in_poll && !fd_ready(fd_in, POLLIN)) {
+            pfds[waits++] = {fd_in, POLLIN, 0};
+            to = std::min(to, in->getTimeout(SO_RCVTIMEO));
+        }
+        if(out_poll && !fd_ready(fd_out, POLLOUT)) {
+            pfds[waits++] = {fd_out, POLLOUT, 0};
+            to = std::min(to, out->getTimeout(SO_SNDTIMEO));
+        }
+        if(!waits) {
+            // 两端看起来都就绪了还是EAGAIN，让出一次再试
+            iom->schedule(sylar::Fiber::GetThis());
+            sylar::Fiber::GetThis()->yield();
+            continue;
+        }
+        uint64_t timeout_us = ~0ull;
+        if(to != ~0ull) {
+            uint64_t used = sylar::GetElapsedMS() - start;
+            if(used >= to) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            timeout_us = (to - used) * 1000;
+        }
+        int rt = fiber_poll(iom, pfds, waits, timeout_us);
+        if(rt == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        } else if(rt < 0) {
+            return -1;
+        }
+        if((in_poll && in->getGeneration() != in_gen) || (out_poll && out->getGeneration() != out_gen)) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+}
 
 extern "C" {
 #define XX(name) name ## _fun name ## _f = nullptr;
@@ -155,43 +576,45 @@ extern "C" {
 #undef XX
 
 unsigned int sleep(unsigned int seconds) {
-    if(!sylar::t_hook_enable) {
+    // 只有IO协程调度器才有定时器，普通的协程调度器里还是直接睡眠
+    if(!sylar::t_hook_enable || !sylar::IOManager::GetThis()) {
         return sleep_f(seconds);
     }
 
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(seconds * 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+    iom->addTimer(seconds * 1000, [iom, fiber]() {
+        iom->schedule(fiber);
+    });
     sylar::Fiber::GetThis()->yield();
     return 0;
 }
 
 int usleep(useconds_t usec) {
-    if(!sylar::t_hook_enable) {
+    if(!sylar::t_hook_enable || !sylar::IOManager::GetThis()) {
         return usleep_f(usec);
     }
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+    iom->addTimerUS(usec, [iom, fiber]() {
+        iom->schedule(fiber);
+    });
     sylar::Fiber::GetThis()->yield();
     return 0;
 }
 
 int nanosleep(const struct timespec *req, struct timespec *rem) {
-    if(!sylar::t_hook_enable) {
+    if(!sylar::t_hook_enable || !sylar::IOManager::GetThis()) {
         return nanosleep_f(req, rem);
     }
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 /1000;
+    // 不足1微秒的部分向上取整，不会比请求的睡得短
+    uint64_t timeout_us = req->tv_sec * 1000000ull + (req->tv_nsec + 999) / 1000;
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(timeout_ms, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+    iom->addTimerUS(timeout_us, [iom, fiber]() {
+        iom->schedule(fiber);
+    });
     sylar::Fiber::GetThis()->yield();
     return 0;
 }
@@ -212,7 +635,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(!sylar::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
     if(!ctx || ctx->isClose()) {
         errno = EBADF;
         return -1;
@@ -226,43 +649,35 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    int n = connect_f(fd, addr, addrlen);
+    int n = 0;
+    ssize_t un = 0;
+    sylar::FdCtx* uctx = nullptr;
+    sylar::IOManager* uring = get_uring(fd, uctx);
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_CONNECT;
+    sqe.fd     = fd;
+    sqe.addr   = (uint64_t)addr;
+    sqe.off    = addrlen;
+    if(uring && uring_submit(uring, uctx, fd, sylar::IOManager::WRITE, sqe, timeout_ms, un)) {
+        // 内核替我们等到了连接结果，老内核返回EINPROGRESS时继续走下面的epoll等待
+        n = un;
+    } else {
+        n = connect_f(fd, addr, addrlen);
+    }
     if(n == 0) {
         return 0;
     } else if(n != -1 || errno != EINPROGRESS) {
         return n;
     }
 
+    // rt为1表示已经可写，连接结果直接看SO_ERROR
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    sylar::Timer::ptr timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    if(timeout_ms != (uint64_t)-1) {
-        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                iom->cancelEvent(fd, sylar::IOManager::WRITE);
-        }, winfo);
-    }
-
-    int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
-    if(rt == 0) {
-        sylar::Fiber::GetThis()->yield();
-        if(timer) {
-            timer->cancel();
-        }
-        if(tinfo->cancelled) {
-            errno = tinfo->cancelled;
-            return -1;
-        }
-    } else {
-        if(timer) {
-            timer->cancel();
-        }
+    int rt = iom->waitEvent(fd, sylar::IOManager::WRITE, timeout_ms);
+    if(rt == ETIMEDOUT) {
+        errno = ETIMEDOUT;
+        return -1;
+    } else if(rt == -1) {
         SYLAR_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
@@ -284,14 +699,40 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    return accept4(s, addr, addrlen, 0);
+}
+
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    ssize_t fd = 0;
+    sylar::FdCtx* ctx = nullptr;
+    sylar::IOManager* uring = get_uring(s, ctx);
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.fd     = s;
+    sqe.addr   = (uint64_t)addr;
+    sqe.addr2  = (uint64_t)addrlen;
+    sqe.accept_flags = flags;
+    if(!uring || !uring_submit(uring, ctx, s, sylar::IOManager::READ, sqe, ctx->getTimeout(SO_RCVTIMEO), fd)) {
+        if(flags) {
+            fd = do_io(s, accept4_f, "accept4", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+        } else {
+            fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+        }
+    }
     if(fd >= 0) {
+        // 带SOCK_NONBLOCK时init()会把它记成用户设置的非阻塞
         sylar::FdMgr::GetInstance()->get(fd, true);
     }
     return fd;
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
+    ssize_t n = 0;
+    if(uring_rw(fd, IORING_OP_RECV, buf, count, 0, sylar::IOManager::READ, SO_RCVTIMEO, n)
+            || uring_file(fd, IORING_OP_READ, buf, count, -1, n)) {
+        return n;
+    }
     return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
@@ -300,6 +741,10 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+    ssize_t n = 0;
+    if(uring_rw(sockfd, IORING_OP_RECV, buf, len, flags, sylar::IOManager::READ, SO_RCVTIMEO, n)) {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
@@ -312,6 +757,11 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
+    ssize_t n = 0;
+    if(uring_rw(fd, IORING_OP_SEND, buf, count, 0, sylar::IOManager::WRITE, SO_SNDTIMEO, n)
+            || uring_file(fd, IORING_OP_WRITE, buf, count, -1, n)) {
+        return n;
+    }
     return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
@@ -320,6 +770,10 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
+    ssize_t n = 0;
+    if(uring_rw(s, IORING_OP_SEND, msg, len, flags, sylar::IOManager::WRITE, SO_SNDTIMEO, n)) {
+        return n;
+    }
     return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
@@ -331,20 +785,273 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+int open(const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    if((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, int);
+        va_end(va);
+    }
+    if(!sylar::t_hook_enable) {
+        return open_f(pathname, flags, mode);
+    }
+
+    // 路径解析和打开本身也可能阻塞在磁盘上
+    int fd = -1;
+    if(sylar::FileIoMgr::GetInstance()->canExecute()) {
+        int err = 0;
+        sylar::FileIoMgr::GetInstance()->execute([&]() {
+            fd = open_f(pathname, flags, mode);
+            err = errno;
+        });
+        errno = err;
+    } else {
+        fd = open_f(pathname, flags, mode);
+    }
+    if(fd >= 0) {
+        sylar::FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    ssize_t n = 0;
+    if(uring_file(fd, IORING_OP_READ, buf, count, offset, n)) {
+        return n;
+    }
+    return do_io(fd, pread_f, "pread", sylar::IOManager::READ, SO_RCVTIMEO, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    ssize_t n = 0;
+    if(uring_file(fd, IORING_OP_WRITE, buf, count, offset, n)) {
+        return n;
+    }
+    return do_io(fd, pwrite_f, "pwrite", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count, offset);
+}
+
+int fsync(int fd) {
+    ssize_t n = 0;
+    if(uring_file(fd, IORING_OP_FSYNC, nullptr, 0, 0, n)) {
+        return n;
+    }
+    return do_io(fd, fsync_f, "fsync", sylar::IOManager::WRITE, SO_SNDTIMEO);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    if(!sylar::t_hook_enable) {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    return do_io2(fd_in, fd_out, [=]() {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }, "splice");
+}
+
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags) {
+    if(!sylar::t_hook_enable) {
+        return tee_f(fd_in, fd_out, len, flags);
+    }
+    return do_io2(fd_in, fd_out, [=]() {
+        return tee_f(fd_in, fd_out, len, flags);
+    }, "tee");
+}
+
+ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    if(!sylar::t_hook_enable) {
+        return copy_file_range_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    return do_io2(fd_in, fd_out, [=]() {
+        return copy_file_range_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }, "copy_file_range");
+}
+
 int close(int fd) {
     if(!sylar::t_hook_enable) {
         return close_f(fd);
     }
 
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
-    if(ctx) {
-        auto iom = sylar::IOManager::GetThis();
-        if(iom) {
-            iom->cancelAll(fd);
+    fd_closing(fd);
+    return close_f(fd);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    sylar::IOManager* iom = get_poll_iom();
+    if(!iom || timeout == 0) {
+        return poll_f(fds, nfds, timeout);
+    }
+    return fiber_poll(iom, fds, nfds, timeout < 0 ? ~0ull : timeout * 1000ull);
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask) {
+    sylar::IOManager* iom = get_poll_iom();
+    // 挂起期间没法原子地替换信号掩码，带sigmask的调用直接阻塞
+    if(!iom || sigmask) {
+        return ppoll_f(fds, nfds, tmo_p, sigmask);
+    }
+    uint64_t timeout_us = tmo_p ? tmo_p->tv_sec * 1000000ull + (tmo_p->tv_nsec + 999) / 1000 : ~0ull;
+    return fiber_poll(iom, fds, nfds, timeout_us);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    sylar::IOManager* iom = get_poll_iom();
+    if(!iom || (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0)) {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+
+    std::vector<struct pollfd> pfds;
+    for(int fd = 0; fd < nfds; ++fd) {
+        short events = 0;
+        if(readfds && FD_ISSET(fd, readfds)) {
+            events |= POLLIN;
+        }
+        if(writefds && FD_ISSET(fd, writefds)) {
+            events |= POLLOUT;
+        }
+        if(exceptfds && FD_ISSET(fd, exceptfds)) {
+            events |= POLLPRI;
+        }
+        if(events) {
+            pfds.push_back({fd, events, 0});
         }
-        sylar::FdMgr::GetInstance()->del(fd);
     }
-    return close_f(fd);
+
+    uint64_t timeout_us = timeout ? timeout->tv_sec * 1000000ull + timeout->tv_usec : ~0ull;
+    uint64_t start = sylar::GetElapsedUS();
+    int rt = fiber_poll(iom, pfds.data(), pfds.size(), timeout_us);
+    if(rt < 0) {
+        return rt;
+    }
+
+    int n = 0;
+    for(auto& pfd : pfds) {
+        if(pfd.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    for(auto sets : {readfds, writefds, exceptfds}) {
+        if(sets) {
+            FD_ZERO(sets);
+        }
+    }
+    for(auto& pfd : pfds) {
+        if(readfds && (pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(pfd.fd, readfds);
+            ++n;
+        }
+        if(writefds && (pfd.revents & (POLLOUT | POLLERR))) {
+            FD_SET(pfd.fd, writefds);
+            ++n;
+        }
+        if(exceptfds && (pfd.revents & POLLPRI)) {
+            FD_SET(pfd.fd, exceptfds);
+            ++n;
+        }
+    }
+    if(timeout) {
+        // 和Linux一样把剩余时间写回去
+        uint64_t used = sylar::GetElapsedUS() - start;
+        uint64_t left = used < timeout_us ? timeout_us - used : 0;
+        timeout->tv_sec = left / 1000000;
+        timeout->tv_usec = left % 1000000;
+    }
+    return n;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    sylar::IOManager* iom = get_poll_iom();
+    if(!iom || timeout == 0) {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+    // epoll句柄本身可以被poll，有事件就绪时可读
+    uint64_t deadline = timeout < 0 ? ~0ull : sylar::GetElapsedUS() + timeout * 1000ull;
+    while(true) {
+        int rt = epoll_wait_f(epfd, events, maxevents, 0);
+        if(rt != 0) {
+            return rt;
+        }
+        uint64_t now = sylar::GetElapsedUS();
+        if(now >= deadline) {
+            return 0;
+        }
+        struct pollfd pfd = {epfd, POLLIN, 0};
+        rt = fiber_poll(iom, &pfd, 1, deadline == ~0ull ? ~0ull : deadline - now);
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+}
+
+int dup(int oldfd) {
+    int fd = dup_f(oldfd);
+    if(fd >= 0 && sylar::t_hook_enable) {
+        sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+    }
+    return fd;
+}
+
+int dup2(int oldfd, int newfd) {
+    if(!sylar::t_hook_enable || oldfd == newfd) {
+        return dup2_f(oldfd, newfd);
+    }
+    // newfd原来打开着的话会被内核悄悄关掉，先按close处理；oldfd无效时dup2失败，newfd保持不变
+    if(fcntl_f(oldfd, F_GETFD) == -1) {
+        errno = EBADF;
+        return -1;
+    }
+    fd_closing(newfd);
+    int fd = dup2_f(oldfd, newfd);
+    if(fd >= 0) {
+        sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+    }
+    return fd;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+    if(!sylar::t_hook_enable || oldfd == newfd) {
+        return dup3_f(oldfd, newfd, flags);
+    }
+    if(fcntl_f(oldfd, F_GETFD) == -1) {
+        errno = EBADF;
+        return -1;
+    }
+    fd_closing(newfd);
+    int fd = dup3_f(oldfd, newfd, flags);
+    if(fd >= 0) {
+        sylar::FdMgr::GetInstance()->dup(oldfd, fd);
+    }
+    return fd;
+}
+
+int pipe(int pipefd[2]) {
+    int rt = pipe_f(pipefd);
+    if(rt == 0 && sylar::t_hook_enable) {
+        sylar::FdMgr::GetInstance()->get(pipefd[0], true);
+        sylar::FdMgr::GetInstance()->get(pipefd[1], true);
+    }
+    return rt;
+}
+
+int pipe2(int pipefd[2], int flags) {
+    int rt = pipe2_f(pipefd, flags);
+    if(rt == 0 && sylar::t_hook_enable) {
+        sylar::FdMgr::GetInstance()->get(pipefd[0], true);
+        sylar::FdMgr::GetInstance()->get(pipefd[1], true);
+    }
+    return rt;
+}
+
+int eventfd(unsigned int initval, int flags) {
+    int fd = eventfd_f(initval, flags);
+    if(fd >= 0 && sylar::t_hook_enable) {
+        sylar::FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
 }
 
 int fcntl(int fd, int cmd, ... /* arg */ ) {
@@ -355,8 +1062,8 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
-                if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
+                if(!ctx || ctx->isClose() || !ctx->isPollable()) {
                     return fcntl_f(fd, cmd, arg);
                 }
                 ctx->setUserNonblock(arg & O_NONBLOCK);
@@ -372,8 +1079,8 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
-                if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
+                if(!ctx || ctx->isClose() || !ctx->isPollable()) {
                     return arg;
                 }
                 if(ctx->getUserNonblock()) {
@@ -385,6 +1092,16 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             break;
         case F_DUPFD:
         case F_DUPFD_CLOEXEC:
+            {
+                int arg = va_arg(va, int);
+                va_end(va);
+                int newfd = fcntl_f(fd, cmd, arg);
+                if(newfd >= 0 && sylar::t_hook_enable) {
+                    sylar::FdMgr::GetInstance()->dup(fd, newfd);
+                }
+                return newfd;
+            }
+            break;
         case F_SETFD:
         case F_SETOWN:
         case F_SETSIG:
@@ -442,8 +1159,8 @@ int ioctl(int d, unsigned long int request, ...) {
 
     if(FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(d);
-        if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(d);
+        if(!ctx || ctx->isClose() || !ctx->isPollable()) {
             return ioctl_f(d, request, arg);
         }
         ctx->setUserNonblock(user_nonblock);
@@ -461,7 +1178,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     }
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(sockfd);
             if(ctx) {
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
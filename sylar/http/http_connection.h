@@ -14,6 +14,7 @@
 #include "http.h"
 #include "../uri.h"
 #include "../thread.h"
+#include "../fiber_mutex.h"
 
 #include <list>
 
@@ -211,7 +212,8 @@ private:
 class HttpConnectionPool {
 public:
     typedef std::shared_ptr<HttpConnectionPool> ptr;
-    typedef Mutex MutexType;
+    /// 在协程里取放连接，锁被占用时只挂起当前协程
+    typedef FiberMutex MutexType;
 
     /**
      * @brief 构建HTTP请求池
@@ -0,0 +1,160 @@
+/**
+ * @file io_uring.cc
+ * @brief io_uring封装实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "io_uring.h"
+#include <errno.h>
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "log.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static int io_uring_setup(unsigned entries, io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+IoUring::~IoUring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = io_uring_setup(entries, &p);
+    if (m_fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno
+                                 << " errstr=" << strerror(errno);
+        return false;
+    }
+    // 没有fast poll时，socket上读不到数据的请求会占用内核的io-wq线程阻塞，不如epoll
+    if (!(p.features & IORING_FEAT_FAST_POLL) || !(p.features & IORING_FEAT_NODROP)) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring features=" << p.features << " lack fast poll";
+        return false;
+    }
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes     = (io_uring_sqe *)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char *sq    = (char *)m_sqRing;
+    m_sqHead    = (unsigned *)(sq + p.sq_off.head);
+    m_sqTail    = (unsigned *)(sq + p.sq_off.tail);
+    m_sqFlags   = (unsigned *)(sq + p.sq_off.flags);
+    m_sqMask    = *(unsigned *)(sq + p.sq_off.ring_mask);
+    m_sqEntries = p.sq_entries;
+    m_sqeTail   = *m_sqTail;
+    // SQE和提交队列的下标一一对应，array只需要初始化一次
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < m_sqEntries; i++) {
+        array[i] = i;
+    }
+
+    char *cq = (char *)m_cqRing;
+    m_cqHead = (unsigned *)(cq + p.cq_off.head);
+    m_cqTail = (unsigned *)(cq + p.cq_off.tail);
+    m_cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes   = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+uint32_t IoUring::sqSpace() const {
+    return m_sqEntries - (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE));
+}
+
+io_uring_sqe *IoUring::getSqe() {
+    if (sqSpace() == 0) {
+        return nullptr;
+    }
+    io_uring_sqe *sqe = &m_sqes[m_sqeTail & m_sqMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+uint32_t IoUring::pendingSubmit() const {
+    return m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::submit() {
+    // 发布新的尾指针，之后内核就能看到这些SQE
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    unsigned to_submit = pendingSubmit();
+    if (!to_submit) {
+        return 0;
+    }
+    int rt = 0;
+    do {
+        rt = io_uring_enter(m_fd, to_submit, 0, 0);
+    } while (rt < 0 && errno == EINTR);
+    if (rt < 0) {
+        // EAGAIN/EBUSY时SQE还留在队列里，下次submit再提交
+        SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << m_fd << ", " << to_submit << ") errno=" << errno
+                                  << " errstr=" << strerror(errno);
+        return -errno;
+    }
+    return rt;
+}
+
+size_t IoUring::reap(io_uring_cqe *cqes, size_t max) {
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    size_t n      = 0;
+    while (head != tail && n < max) {
+        cqes[n++] = m_cqes[head & m_cqMask];
+        ++head;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+    // 完成队列满过，内核把多出来的CQE暂存在溢出链表里，需要主动让内核搬回完成队列
+    if (n && (__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)) {
+        io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    }
+    return n;
+}
+
+} // namespace sylar
@@ -0,0 +1,103 @@
+/**
+ * @file io_uring.h
+ * @brief io_uring提交队列和完成队列的封装
+ * @details 直接使用io_uring_setup/io_uring_enter系统调用和mmap出来的共享环，不依赖liburing
+ *          非线程安全，由使用方加锁
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief io_uring实例
+ */
+class IoUring : Noncopyable {
+public:
+    IoUring() {}
+
+    ~IoUring();
+
+    /**
+     * @brief 创建io_uring实例并映射共享环
+     * @param[in] entries 提交队列大小，内核会向上取整到2的幂
+     * @return 内核不支持io_uring或者不支持fast poll(5.7之前的内核)时返回false
+     */
+    bool init(uint32_t entries);
+
+    /**
+     * @brief io_uring的文件句柄，有完成事件时可读，可以加入epoll
+     */
+    int getFd() const { return m_fd; }
+
+    /**
+     * @brief 提交队列的空位数
+     */
+    uint32_t sqSpace() const;
+
+    /**
+     * @brief 取一个空闲的SQE，内容已清零
+     * @return 提交队列满了返回nullptr，需要先submit()
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * @brief 已经填好但还没提交给内核的SQE数量
+     */
+    uint32_t pendingSubmit() const;
+
+    /**
+     * @brief 把填好的SQE一次性提交给内核，不等待完成
+     * @return 提交的数量，失败返回-errno
+     */
+    int submit();
+
+    /**
+     * @brief 从完成队列取出CQE
+     * @param[out] cqes 存放CQE的数组
+     * @param[in] max 数组大小
+     * @return 取出的数量
+     */
+    size_t reap(io_uring_cqe *cqes, size_t max);
+
+private:
+    /// io_uring句柄
+    int m_fd = -1;
+    /// 提交队列环的映射
+    void *m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    /// 完成队列环的映射，内核支持IORING_FEAT_SINGLE_MMAP时和m_sqRing是同一块
+    void *m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    /// SQE数组的映射
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    /// 提交队列的头尾指针和掩码，头由内核推进，尾由用户推进
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    /// 内核设置的标志，比如完成队列溢出
+    unsigned *m_sqFlags = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    /// 已经调用getSqe()分配出去的位置，submit()时才写到m_sqTail让内核看见
+    unsigned m_sqeTail = 0;
+
+    /// 完成队列的头尾指针和掩码，头由用户推进，尾由内核推进
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+};
+
+} // namespace sylar
+
+#endif
@@ -5,17 +5,65 @@
  * @date 2021-06-16
  */
 
-#include <unistd.h>    // for pipe()
-#include <sys/epoll.h> // for epoll_xxx()
-#include <fcntl.h>     // for fcntl()
+#include <unistd.h>      // for read()/write()
+#include <sys/epoll.h>   // for epoll_xxx()
+#include <sys/eventfd.h> // for eventfd()
+#include <sys/timerfd.h> // for timerfd_xxx()
 #include "iomanager.h"
+#include "config.h"
+#include "io_uring.h"
 #include "log.h"
 #include "macro.h"
+#include "hook.h"
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_multi_reactor =
+    Config::Lookup<bool>("iomanager.multi_reactor", false, "one epoll instance per worker thread");
+
+static ConfigVar<bool>::ptr g_persistent_registration =
+    Config::Lookup<bool>("iomanager.persistent_registration", false, "register socket fd to epoll once with EPOLLIN|EPOLLOUT|EPOLLET instead of add/del per event");
+
+static ConfigVar<uint64_t>::ptr g_timeout_slack =
+    Config::Lookup<uint64_t>("iomanager.timeout_slack", 0, "slack in ms for hooked socket io timeouts, timeouts within the same window fire together");
+
+static ConfigVar<bool>::ptr g_io_uring =
+    Config::Lookup<bool>("iomanager.io_uring", false, "submit hooked socket io through io_uring, fall back to epoll if unsupported");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.io_uring.entries", 256, "io_uring submission queue size");
+
+/// 提交队列里攒够这么多请求就立即提交，不等idle
+static const uint32_t s_io_submit_batch = 32;
+
+/// linked timeout请求的user_data在IoRequest指针上打这个标记
+static const uint64_t s_io_timeout_tag = 1;
+
+/**
+ * @brief 一个正在进行的io_uring请求，存放在发起请求的协程栈上，请求完成之前协程不会返回
+ */
+struct IOManager::IoRequest {
+    /// 发起请求的协程
+    Fiber::ptr fiber;
+    /// 请求的句柄上下文
+    FdContext *fd_ctx = nullptr;
+    /// 请求的事件类型
+    Event event = NONE;
+    /// 请求结果
+    int res = 0;
+    /// 还要等几个cqe，带超时的请求是两个
+    int waiting = 1;
+    /// 是否是超时导致的取消
+    bool timedout = false;
+    /// linked timeout的超时时间，内核在提交时读取
+    __kernel_timespec ts;
+    /// fd_ctx上的请求链表
+    IoRequest *prev = nullptr;
+    IoRequest *next = nullptr;
+};
+
 enum EpollCtlOp {
 };
 
@@ -81,7 +129,21 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx) {
     ctx.cb = nullptr;
 }
 
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::wakeFollowers(EventContext &ctx, std::vector<Scheduler::ScheduleTask> *batch) {
+    if (SYLAR_LIKELY(ctx.followers.empty())) {
+        return;
+    }
+    for (auto &i : ctx.followers) {
+        if (batch && ctx.scheduler == Scheduler::GetThis()) {
+            batch->emplace_back(std::move(i), -1, priority);
+        } else {
+            ctx.scheduler->schedule(std::move(i), -1, priority);
+        }
+    }
+    ctx.followers.clear();
+}
+
+void IOManager::FdContext::triggerEvent(IOManager::Event event, std::vector<Scheduler::ScheduleTask> *batch) {
     // 待触发的事件必须已被注册过
     SYLAR_ASSERT(events & event);
     /**
@@ -91,101 +153,184 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     events = (Event)(events & ~event);
     // 调度对应的协程
     EventContext &ctx = getEventContext(event);
-    if (ctx.cb) {
-        ctx.scheduler->schedule(ctx.cb);
+    if (batch && ctx.scheduler == Scheduler::GetThis()) {
+        if (ctx.cb) {
+            batch->emplace_back(std::move(ctx.cb), -1, priority);
+        } else {
+            batch->emplace_back(&ctx.fiber, -1, priority);
+        }
+    } else if (ctx.cb) {
+        ctx.scheduler->schedule(std::move(ctx.cb), -1, priority);
     } else {
-        ctx.scheduler->schedule(ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, -1, priority);
     }
+    wakeFollowers(ctx, batch);
     resetEventContext(ctx);
     return;
 }
 
 IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
     : Scheduler(threads, use_caller, name) {
-    m_epfd = epoll_create(5000);
-    SYLAR_ASSERT(m_epfd > 0);
-
-    int rt = pipe(m_tickleFds);
-    SYLAR_ASSERT(!rt);
-
-    // 关注pipe读句柄的可读事件，用于tickle协程
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events  = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
-
-    // 非阻塞方式，配合边缘触发
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    SYLAR_ASSERT(!rt);
+    // 只有一个调度线程时多reactor没有意义
+    m_multiReactor = g_multi_reactor->getValue() && getWorkerCount() > 1;
+    // Reactor里有原子变量，不能拷贝移动，只能一次构造好
+    std::vector<Reactor>(m_multiReactor ? getWorkerCount() : 1).swap(m_reactors);
+    m_persistent = g_persistent_registration->getValue();
+    m_timeoutSlack = g_timeout_slack->getValue();
+    // 多reactor模式下每个调度线程管理自己的定时器，epoll_wait的超时也只看自己的
+    if (m_multiReactor) {
+        setTimerShards(m_reactors.size());
+    }
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(!rt);
+    for (auto &reactor : m_reactors) {
+        reactor.epfd = epoll_create(5000);
+        SYLAR_ASSERT(reactor.epfd > 0);
+
+        // 非阻塞方式，配合边缘触发；用原函数创建，不让hook把它登记成普通的可等待fd
+        // 否则idle协程里的read会在EAGAIN时被挂起
+        reactor.tickleFd = eventfd_f(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(reactor.tickleFd >= 0);
+
+        // 关注eventfd的可读事件，用于tickle协程
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events  = EPOLLIN | EPOLLET;
+        event.data.fd = reactor.tickleFd;
+
+        int rt = epollCtl(reactor.epfd, EPOLL_CTL_ADD, reactor.tickleFd, &event);
+        SYLAR_ASSERT(!rt);
+
+        // timerfd只用相对时间设置，和定时器用的CLOCK_MONOTONIC_RAW之间的速率差在几秒内可以忽略
+        reactor.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (reactor.timerFd >= 0) {
+            memset(&event, 0, sizeof(epoll_event));
+            event.events  = EPOLLIN | EPOLLET;
+            event.data.fd = reactor.timerFd;
+            rt            = epollCtl(reactor.epfd, EPOLL_CTL_ADD, reactor.timerFd, &event);
+            SYLAR_ASSERT(!rt);
+        } else {
+            SYLAR_LOG_WARN(g_logger) << "timerfd_create fail errno=" << errno << ", timers fall back to ms precision";
+        }
+    }
 
-    contextResize(32);
+    if (g_io_uring->getValue()) {
+        m_uring.reset(new IoUring);
+        if (m_uring->init(g_io_uring_entries->getValue())) {
+            // 所有reactor都关注io_uring句柄，EPOLLEXCLUSIVE保证一次完成事件只唤醒一个线程去收割
+            for (auto &reactor : m_reactors) {
+                epoll_event event;
+                memset(&event, 0, sizeof(epoll_event));
+                event.events  = EPOLLIN | EPOLLET | (m_multiReactor ? EPOLLEXCLUSIVE : 0);
+                event.data.fd = m_uring->getFd();
+                int rt        = epollCtl(reactor.epfd, EPOLL_CTL_ADD, m_uring->getFd(), &event);
+                SYLAR_ASSERT(!rt);
+            }
+        } else {
+            SYLAR_LOG_WARN(g_logger) << "io_uring unavailable, fall back to epoll";
+            m_uring.reset();
+        }
+    }
 
     start();
 }
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    m_uring.reset();
+    for (auto &reactor : m_reactors) {
+        close(reactor.epfd);
+        close(reactor.tickleFd);
+        if (reactor.timerFd >= 0) {
+            close(reactor.timerFd);
         }
     }
+
+    m_fdContexts.foreach([](FdContext *fd_ctx) { delete fd_ctx; });
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
+IOManager::FdContext *IOManager::getFdContext(int fd) {
+    return m_fdContexts.getOrCreate(fd,
+        [fd]() {
+            FdContext *fd_ctx = new FdContext;
+            fd_ctx->fd        = fd;
+            return fd_ctx;
+        },
+        [](FdContext *fd_ctx) { delete fd_ctx; });
+}
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (!m_fdContexts[i]) {
-            m_fdContexts[i]     = new FdContext;
-            m_fdContexts[i]->fd = i;
+IOManager::Reactor &IOManager::getReactor(FdContext *fd_ctx) {
+    if (!m_multiReactor) {
+        return m_reactors[0];
+    }
+    if (fd_ctx->reactor < 0) {
+        // use caller时caller线程只在stop()里才进入调度循环，平时不能把fd分给它，否则事件要等到stop()才有人处理
+        size_t first = isUseCaller() ? 1 : 0;
+        int idx      = getCurrentWorker();
+        if (idx < (int)first) {
+            idx = first + m_nextReactor++ % (m_reactors.size() - first);
         }
+        fd_ctx->reactor = idx;
     }
+    return m_reactors[fd_ctx->reactor];
 }
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     // 找到fd对应的FdContext，如果不存在，那就分配一个
-    FdContext *fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext *fd_ctx = getFdContext(fd);
+    if (SYLAR_UNLIKELY(!fd_ctx)) {
+        errno = EMFILE;
+        return -1;
     }
 
-    // 同一个fd不允许重复添加相同的事件
+    // 同一个fd的同一个事件同时只能有一个等待者，已经有人在等时交给调用方处理
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (SYLAR_UNLIKELY(fd_ctx->events & event)) {
-        SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
+        SYLAR_LOG_DEBUG(g_logger) << "addEvent busy fd=" << fd
                                   << " event=" << (EPOLL_EVENTS)event
                                   << " fd_ctx.event=" << (EPOLL_EVENTS)fd_ctx->events;
-        SYLAR_ASSERT(!(fd_ctx->events & event));
+        errno = EEXIST;
+        return -1;
     }
 
-    // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    if (m_persistent && (fd_ctx->ready & event)) {
+        // 上次等待之后已经来过这个事件的边沿，不会再有通知了，消费掉就绪标志让调用方直接重试
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        if (!cb) {
+            return 1;
+        }
+        Scheduler *sc = Scheduler::GetThis();
+        (sc ? sc : this)->schedule(std::move(cb), -1, fd_ctx->priority);
+        return 0;
+    }
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                                  << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+    // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
+    // 持久注册模式下只有第一次需要，两个方向一起注册，之后一直留在epoll里
+    if (!m_persistent || !fd_ctx->registered) {
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events   = m_persistent ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLET | fd_ctx->events | event);
+        epevent.data.ptr = fd_ctx;
+
+        // 其他线程给fd添加事件时直接操作fd所属reactor的epoll，epoll_ctl本身是线程安全的，事件会在所属线程的epoll_wait上返回
+        Reactor &reactor = getReactor(fd_ctx);
+        int rt           = epollCtl(reactor.epfd, op, fd, &epevent);
+        if (rt && m_persistent && errno == EEXIST) {
+            // 没经过hook的close关掉了fd但文件还有dup出来的句柄，旧的注册还在
+            op = EPOLL_CTL_MOD;
+            rt = epollCtl(reactor.epfd, op, fd, &epevent);
+        }
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << reactor.epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                                      << (EPOLL_EVENTS)fd_ctx->events;
+            return -1;
+        }
+        if (m_persistent) {
+            // 注册之前残留的就绪标志属于同号的旧fd，注册时内核会按当前状态重新报告一次
+            fd_ctx->registered = true;
+            fd_ctx->ready      = NONE;
+        }
     }
 
     // 待执行IO事件数加1
@@ -207,14 +352,59 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     return 0;
 }
 
+int IOManager::waitEvent(int fd, Event event, uint64_t timeout_ms) {
+    int rt = addEvent(fd, event);
+    if (rt) {
+        return rt;
+    }
+    if (timeout_ms == ~0ull) {
+        Fiber::GetThis()->yield();
+        return 0;
+    }
+
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+
+    // 同一时刻一个fd的一个事件只有一个等待者，deadline只由它创建和启动
+    FdContext::EventContext *event_ctx = nullptr;
+    {
+        FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+        event_ctx           = &fd_ctx->getEventContext(event);
+        event_ctx->expire   = GetElapsedMS() + timeout_ms;
+        event_ctx->timedOut = false;
+    }
+    if (!event_ctx->deadline) {
+        event_ctx->deadline = createTimer(std::bind(&IOManager::onDeadline, this, fd_ctx, event), m_timeoutSlack);
+    }
+    event_ctx->deadline->start(timeout_ms);
+
+    Fiber::GetThis()->yield();
+
+    // 已经触发的定时器回调看到expire为0就什么都不做
+    event_ctx->deadline->cancel();
+    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    bool timed_out      = event_ctx->timedOut;
+    event_ctx->expire   = 0;
+    event_ctx->timedOut = false;
+    return timed_out ? ETIMEDOUT : 0;
+}
+
+void IOManager::onDeadline(FdContext *fd_ctx, Event event) {
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
+    if (!(fd_ctx->events & event) || !event_ctx.expire || GetElapsedMS() < event_ctx.expire) {
+        return;
+    }
+    event_ctx.timedOut = true;
+    lock.unlock();
+    cancelEvent(fd_ctx->fd, event);
+}
+
 bool IOManager::delEvent(int fd, Event event) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
@@ -222,56 +412,76 @@ bool IOManager::delEvent(int fd, Event event) {
     }
 
     // 清除指定的事件，表示不关心这个事件了，如果清除之后结果为0，则从epoll_wait中删除该文件描述符
+    // 持久注册模式下fd留在epoll里，只清除等待者
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if (!m_persistent) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        Reactor &reactor = getReactor(fd_ctx);
+        int rt           = epollCtl(reactor.epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << reactor.epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     // 待执行事件数减1
     --m_pendingEventCount;
-    // 重置该fd对应的event事件上下文
+    // 重置该fd对应的event事件上下文，排在后面的等待者要重新检查，不然没人替它们等了
     fd_ctx->events                     = new_events;
     FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
+    fd_ctx->wakeFollowers(event_ctx);
     fd_ctx->resetEventContext(event_ctx);
     return true;
 }
 
+bool IOManager::followEvent(int fd, Event event, std::function<void()> cb) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
+        return false;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (!(fd_ctx->events & event)) {
+        return false;
+    }
+    fd_ctx->getEventContext(event).followers.push_back(std::move(cb));
+    return true;
+}
+
 bool IOManager::cancelEvent(int fd, Event event) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    bool io_cancelled = fd_ctx->ioRequests && cancelIo(fd_ctx, event);
     if (SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
-        return false;
+        return io_cancelled;
     }
 
-    // 删除事件
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    // 删除事件，持久注册模式下不用动epoll
+    if (!m_persistent) {
+        Event new_events = (Event)(fd_ctx->events & ~event);
+        int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        Reactor &reactor = getReactor(fd_ctx);
+        int rt           = epollCtl(reactor.epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << reactor.epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     // 删除之前触发一次事件
@@ -283,27 +493,31 @@ bool IOManager::cancelEvent(int fd, Event event) {
 
 bool IOManager::cancelAll(int fd) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (!fd_ctx->events) {
-        return false;
+    bool io_cancelled = fd_ctx->ioRequests && cancelIo(fd_ctx, (Event)(READ | WRITE));
+    if (!fd_ctx->events && !fd_ctx->registered) {
+        // hook的close会走到这里，fd关闭后号码可能被复用，重新分配reactor
+        fd_ctx->reactor = -1;
+        return io_cancelled;
     }
 
-    // 删除全部事件
+    // 删除全部事件，持久注册的fd也在这里移出epoll，同号的新fd会重新注册
     int op = EPOLL_CTL_DEL;
     epoll_event epevent;
     epevent.events   = 0;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    Reactor &reactor = getReactor(fd_ctx);
+    int rt           = epollCtl(reactor.epfd, op, fd, &epevent);
+    fd_ctx->registered = false;
+    fd_ctx->ready      = NONE;
     if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << reactor.epfd << ", "
                                   << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
                                   << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -320,9 +534,166 @@ bool IOManager::cancelAll(int fd) {
     }
 
     SYLAR_ASSERT(fd_ctx->events == 0);
+    fd_ctx->reactor = -1;
     return true;
 }
 
+bool IOManager::setFdPriority(int fd, int priority) {
+    // 清除标记时不用为没用过的fd创建FdContext
+    FdContext *fd_ctx = priority < 0 ? m_fdContexts.get(fd) : getFdContext(fd);
+    if (!fd_ctx) {
+        return priority < 0;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    fd_ctx->priority = priority < 0 ? -1 : std::min<int>(priority, PRIORITY_COUNT - 1);
+    return true;
+}
+
+int IOManager::getFdPriority(int fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
+        return PRIORITY_AUTO;
+    }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    return fd_ctx->priority;
+}
+
+int IOManager::submitIo(int fd, Event event, const io_uring_sqe &sqe, uint64_t timeout_ms) {
+    SYLAR_ASSERT(m_uring && Scheduler::GetThis() == this);
+    FdContext *fd_ctx = getFdContext(fd);
+    if (SYLAR_UNLIKELY(!fd_ctx)) {
+        return -EMFILE;
+    }
+
+    IoRequest req;
+    req.fiber  = Fiber::GetThis();
+    req.fd_ctx = fd_ctx;
+    req.event  = event;
+    if (timeout_ms != ~0ull) {
+        req.waiting    = 2;
+        req.ts.tv_sec  = timeout_ms / 1000;
+        req.ts.tv_nsec = timeout_ms % 1000 * 1000000;
+    }
+
+    {
+        FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+        req.next = fd_ctx->ioRequests;
+        if (req.next) {
+            req.next->prev = &req;
+        }
+        fd_ctx->ioRequests = &req;
+
+        Mutex::Lock lock3(m_uringMutex);
+        if (m_uring->sqSpace() < (uint32_t)req.waiting) {
+            m_uring->submit();
+        }
+        io_uring_sqe *op = m_uring->getSqe();
+        SYLAR_ASSERT(op);
+        *op           = sqe;
+        op->user_data = (uint64_t)&req;
+        if (req.waiting == 2) {
+            op->flags |= IOSQE_IO_LINK;
+            io_uring_sqe *to = m_uring->getSqe();
+            SYLAR_ASSERT(to);
+            to->opcode    = IORING_OP_LINK_TIMEOUT;
+            to->fd        = -1;
+            to->addr      = (uint64_t)&req.ts;
+            to->len       = 1;
+            to->user_data = (uint64_t)&req | s_io_timeout_tag;
+        }
+        ++m_pendingEventCount;
+        if (m_uring->pendingSubmit() >= s_io_submit_batch) {
+            m_uring->submit();
+        }
+    }
+
+    // 和addEvent一样，请求完成时协程可能还没yield出去，调度器会把还在运行的协程放回队列
+    Fiber::GetThis()->yield();
+    if (req.timedout && req.res == -ECANCELED) {
+        return -ETIMEDOUT;
+    }
+    return req.res;
+}
+
+bool IOManager::cancelIo(FdContext *fd_ctx, Event event) {
+    bool cancelled = false;
+    Mutex::Lock lock(m_uringMutex);
+    for (IoRequest *req = fd_ctx->ioRequests; req; req = req->next) {
+        if (!(req->event & event)) {
+            continue;
+        }
+        if (!m_uring->sqSpace()) {
+            m_uring->submit();
+        }
+        io_uring_sqe *sqe = m_uring->getSqe();
+        SYLAR_ASSERT(sqe);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd     = -1;
+        sqe->addr   = (uint64_t)req;
+        cancelled   = true;
+    }
+    // 取消要立即生效，比如close之后不能让请求继续挂在内核里
+    if (cancelled) {
+        m_uring->submit();
+    }
+    return cancelled;
+}
+
+void IOManager::flushIo() {
+    Mutex::Lock lock(m_uringMutex);
+    if (m_uring->pendingSubmit()) {
+        m_uring->submit();
+    }
+}
+
+int IOManager::reapIo(std::vector<ScheduleTask> &batch) {
+    int done = 0;
+    io_uring_cqe cqes[64];
+    while (true) {
+        size_t n = 0;
+        {
+            Mutex::Lock lock(m_uringMutex);
+            n = m_uring->reap(cqes, sizeof(cqes) / sizeof(cqes[0]));
+        }
+        if (!n) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            // 取消请求的cqe不需要处理
+            if (!cqes[i].user_data) {
+                continue;
+            }
+            IoRequest *req = (IoRequest *)(cqes[i].user_data & ~s_io_timeout_tag);
+            FdContext *fd_ctx = req->fd_ctx;
+            int priority      = -1;
+            {
+                FdContext::MutexType::Lock lock(fd_ctx->mutex);
+                priority = fd_ctx->priority;
+                if (cqes[i].user_data & s_io_timeout_tag) {
+                    req->timedout = (cqes[i].res == -ETIME);
+                } else {
+                    req->res = cqes[i].res;
+                }
+                if (--req->waiting) {
+                    continue;
+                }
+                if (req->prev) {
+                    req->prev->next = req->next;
+                } else {
+                    fd_ctx->ioRequests = req->next;
+                }
+                if (req->next) {
+                    req->next->prev = req->prev;
+                }
+            }
+            // 这之后req所在的协程随时可能被调度，不能再访问req
+            batch.emplace_back(&req->fiber, -1, priority);
+            ++done;
+        }
+    }
+    return done;
+}
+
 IOManager *IOManager::GetThis() {
     return dynamic_cast<IOManager *>(Scheduler::GetThis());
 }
@@ -334,11 +705,90 @@ IOManager *IOManager::GetThis() {
  */
 void IOManager::tickle() {
     SYLAR_LOG_DEBUG(g_logger) << "tickle";
+    m_tickleCount.fetch_add(1, std::memory_order_relaxed);
     if(!hasIdleThreads()) {
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    SYLAR_ASSERT(rt == 1);
+    if (!m_multiReactor) {
+        wakeup(m_reactors[0]);
+        return;
+    }
+    // 多reactor模式下轮流挑一个空闲的调度线程唤醒，都不空闲说明它们刚好在退出idle，随便唤醒一个也无妨
+    size_t n     = m_reactors.size();
+    size_t start = m_nextTickle++;
+    for (size_t i = 0; i < n; i++) {
+        size_t idx = (start + i) % n;
+        if (isWorkerIdle(idx)) {
+            wakeup(m_reactors[idx]);
+            return;
+        }
+    }
+    wakeup(m_reactors[start % n]);
+}
+
+void IOManager::tickleWorker(size_t idx) {
+    if (!m_multiReactor) {
+        tickle();
+        return;
+    }
+    m_tickleCount.fetch_add(1, std::memory_order_relaxed);
+    // 不在idle里的线程回到调度循环时自己会看到任务
+    if (isWorkerIdle(idx)) {
+        wakeup(m_reactors[idx]);
+    }
+}
+
+int IOManager::epollCtl(int epfd, int op, int fd, epoll_event *event) {
+    m_epollCtlCount.fetch_add(1, std::memory_order_relaxed);
+    return epoll_ctl(epfd, op, fd, event);
+}
+
+void IOManager::wakeup(Reactor &reactor) {
+    // 先看一眼再exchange，风暴时大部分tickle在这里只读不写，不会争抢缓存行
+    if (reactor.wakeupPending.load(std::memory_order_relaxed) || reactor.wakeupPending.exchange(true)) {
+        return;
+    }
+    m_wakeupCount.fetch_add(1, std::memory_order_relaxed);
+    uint64_t one = 1;
+    int rt       = write_f(reactor.tickleFd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
+}
+
+int IOManager::armTimer(Reactor &reactor, uint64_t timeout_us) {
+    // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
+    static const int MAX_TIMEOUT = 5000;
+    if (timeout_us == 0) {
+        return 0;
+    }
+    if (timeout_us >= MAX_TIMEOUT * 1000ull) {
+        return MAX_TIMEOUT;
+    }
+    if (reactor.timerFd < 0) {
+        return (timeout_us + 999) / 1000;
+    }
+
+    uint64_t now      = GetElapsedUS();
+    uint64_t deadline = now + timeout_us;
+    uint64_t armed    = reactor.timerArmed.load(std::memory_order_relaxed);
+    if (armed > now && armed <= deadline) {
+        return MAX_TIMEOUT;
+    }
+    // 判断和设置在同一把锁里，避免一个线程按旧的定时器算出的较晚时间覆盖掉别的线程刚设置的较早时间
+    Spinlock::Lock lock(reactor.timerMutex);
+    armed = reactor.timerArmed.load(std::memory_order_relaxed);
+    if (armed > now && armed <= deadline) {
+        return MAX_TIMEOUT;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = timeout_us / 1000000;
+    its.it_value.tv_nsec = timeout_us % 1000000 * 1000;
+    if (timerfd_settime(reactor.timerFd, 0, &its, nullptr)) {
+        SYLAR_LOG_ERROR(g_logger) << "timerfd_settime fail errno=" << errno << " errstr=" << strerror(errno);
+        return (timeout_us + 999) / 1000;
+    }
+    reactor.timerArmed.store(deadline, std::memory_order_relaxed);
+    return MAX_TIMEOUT;
 }
 
 bool IOManager::stopping() {
@@ -349,8 +799,10 @@ bool IOManager::stopping() {
 bool IOManager::stopping(uint64_t &timeout) {
     // 对于IOManager而言，必须等所有待调度的IO事件都执行完了才可以退出
     // 增加定时器功能后，还应该保证没有剩余的定时器待触发
-    timeout = getNextTimer();
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    // 定时器分片模式下getNextTimer()只看本线程的分片，还要确认其他分片也没有定时器
+    timeout = getNextTimerUS();
+    return timeout == ~0ull && (!isTimerSharded() || !hasTimer()) && m_pendingEventCount == 0 &&
+           Scheduler::stopping();
 }
 
 /**
@@ -367,6 +819,11 @@ void IOManager::idle() {
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event *ptr) {
         delete[] ptr;
     });
+    // 超时的定时器回调和就绪的IO事件先收集起来，最后一次性批量调度，两个数组在idle协程的整个生命周期里复用
+    std::vector<std::function<void()>> cbs;
+    std::vector<ScheduleTask> batch;
+    // 只等待本线程的reactor
+    Reactor &reactor = m_multiReactor ? m_reactors[getCurrentWorker()] : m_reactors[0];
 
     while (true) {
         // 获取下一个定时器的超时时间，顺便判断调度器是否停止
@@ -376,17 +833,16 @@ void IOManager::idle() {
             break;
         }
 
+        // 本轮调度攒下的io_uring请求一次性提交
+        if (m_uring) {
+            flushIo();
+        }
+
         // 阻塞在epoll_wait上，等待事件发生或定时器超时
         int rt = 0;
+        int timeout_ms = armTimer(reactor, next_timeout);
         do{
-            // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
-            static const int MAX_TIMEOUT = 5000;
-            if(next_timeout != ~0ull) {
-                next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
-            } else {
-                next_timeout = MAX_TIMEOUT;
-            }
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
+            rt = epoll_wait_f(reactor.epfd, events, MAX_EVNETS, timeout_ms);
             if(rt < 0 && errno == EINTR) {
                 continue;
             } else {
@@ -395,44 +851,93 @@ void IOManager::idle() {
         } while(true);
 
         // 收集所有已超时的定时器，执行回调函数
-        std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            for(const auto &cb : cbs) {
-                schedule(cb);
-            }
-            cbs.clear();
-        }
-        
-        // 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
-        for (int i = 0; i < rt; ++i) {
-            epoll_event &event = events[i];
-            if (event.data.fd == m_tickleFds[0]) {
-                // ticklefd[0]用于通知协程调度，这时只需要把管道里的内容读完即可
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
-                    ;
-                continue;
-            }
+        for(auto &cb : cbs) {
+            batch.emplace_back(std::move(cb), -1);
+        }
+        cbs.clear();
+        int triggered = dispatchEvents(reactor, events, rt, batch, false);
+
+        // 先入队再减少待处理事件数，避免其他线程在任务入队前看到stopping()为true
+        if (!batch.empty()) {
+            scheduleBatch(batch.data(), batch.size());
+            batch.clear();
+        }
+        m_pendingEventCount -= triggered;
+
+        /**
+         * 一旦处理完所有的事件，idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
+         * 上面triggerEvent实际也只是把对应的fiber重新加入调度，要执行的话还要等idle协程退出
+         */ 
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr   = cur.get();
+        cur.reset();
+
+        raw_ptr->yield();
+    } // end while(true)
+}
 
-            FdContext *fd_ctx = (FdContext *)event.data.ptr;
-            FdContext::MutexType::Lock lock(fd_ctx->mutex);
-            /**
-             * EPOLLERR: 出错，比如写读端已经关闭的pipe
-             * EPOLLHUP: 套接字对端关闭
-             * 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
-             */ 
-            if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+int IOManager::dispatchEvents(Reactor &reactor, epoll_event *events, int n, std::vector<ScheduleTask> &batch, bool busy) {
+    int triggered = 0;
+    // 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
+    for (int i = 0; i < n; ++i) {
+        epoll_event &event = events[i];
+        if (event.data.fd == reactor.tickleFd) {
+            // eventfd用于通知协程调度，读一次就清零了；之后的tickle要重新写
+            // 清除标志之后idle会yield回调度循环检查任务，所以在这之前入队的任务不会漏掉
+            uint64_t dummy;
+            int rt2 = read_f(reactor.tickleFd, &dummy, sizeof(dummy));
+            (void)rt2;
+            reactor.wakeupPending.store(false);
+            if (busy && !m_multiReactor) {
+                // 共享reactor上的tickle是给idle线程的，忙碌的线程不需要，重新发一次
+                tickle();
             }
-            int real_events = NONE;
-            if (event.events & EPOLLIN) {
-                real_events |= READ;
+            continue;
+        }
+        if (event.data.fd == reactor.timerFd) {
+            // 到期的定时器调用方已经收集了，下一轮idle重新设置
+            uint64_t dummy;
+            int rt2 = read_f(reactor.timerFd, &dummy, sizeof(dummy));
+            (void)rt2;
+            reactor.timerArmed.store(~0ull);
+            continue;
+        }
+        if (m_uring && event.data.fd == m_uring->getFd()) {
+            triggered += reapIo(batch);
+            continue;
+        }
+
+        FdContext *fd_ctx = (FdContext *)event.data.ptr;
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        /**
+         * EPOLLERR: 出错，比如写读端已经关闭的pipe
+         * EPOLLHUP: 套接字对端关闭
+         * 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
+         */ 
+        if (event.events & (EPOLLERR | EPOLLHUP)) {
+            event.events |= m_persistent ? (EPOLLIN | EPOLLOUT) : ((EPOLLIN | EPOLLOUT) & fd_ctx->events);
+        }
+        int real_events = NONE;
+        if (event.events & EPOLLIN) {
+            real_events |= READ;
+        }
+        if (event.events & EPOLLOUT) {
+            real_events |= WRITE;
+        }
+
+        if (m_persistent) {
+            // fd已经被cancelAll移出epoll，这是移出之前返回的旧事件
+            if (!fd_ctx->registered) {
+                continue;
             }
-            if (event.events & EPOLLOUT) {
-                real_events |= WRITE;
+            // 没人等的事件记下来，边沿触发不会再通知第二次；fd不用移出epoll
+            fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+            real_events &= fd_ctx->events;
+            if (real_events == NONE) {
+                continue;
             }
-
+        } else {
             if ((fd_ctx->events & real_events) == NONE) {
                 continue;
             }
@@ -442,39 +947,68 @@ void IOManager::idle() {
             int op          = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
             event.events    = EPOLLET | left_events;
 
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            int rt2 = epollCtl(reactor.epfd, op, fd_ctx->fd, &event);
             if (rt2) {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << reactor.epfd << ", "
                                           << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
                                           << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
                 continue;
             }
+        }
 
-            // 处理已经发生的事件，也就是让调度器调度指定的函数或协程
-            if (real_events & READ) {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
-            }
-            if (real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
-            }
-        } // end for
-
-        /**
-         * 一旦处理完所有的事件，idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
-         * 上面triggerEvent实际也只是把对应的fiber重新加入调度，要执行的话还要等idle协程退出
-         */ 
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr   = cur.get();
-        cur.reset();
+        // 处理已经发生的事件，也就是让调度器调度指定的函数或协程
+        if (real_events & READ) {
+            fd_ctx->triggerEvent(READ, &batch);
+            ++triggered;
+        }
+        if (real_events & WRITE) {
+            fd_ctx->triggerEvent(WRITE, &batch);
+            ++triggered;
+        }
+    }
+    return triggered;
+}
 
-        raw_ptr->yield();
-    } // end while(true)
+void IOManager::busyPoll() {
+    Reactor &reactor = m_multiReactor ? m_reactors[getCurrentWorker()] : m_reactors[0];
+    if (m_uring) {
+        flushIo();
+    }
+    epoll_event events[64];
+    int rt = epoll_wait_f(reactor.epfd, events, sizeof(events) / sizeof(events[0]), 0);
+
+    std::vector<std::function<void()>> cbs;
+    std::vector<ScheduleTask> batch;
+    listExpiredCb(cbs);
+    for (auto &cb : cbs) {
+        batch.emplace_back(std::move(cb), -1);
+    }
+    int triggered = rt > 0 ? dispatchEvents(reactor, events, rt, batch, true) : 0;
+    if (!batch.empty()) {
+        scheduleBatch(batch.data(), batch.size());
+    }
+    m_pendingEventCount -= triggered;
 }
 
 void IOManager::onTimerInsertedAtFront() {
     tickle();
 }
 
+void IOManager::onShardMessage(size_t shard) {
+    tickleWorker(shard);
+}
+
+int IOManager::getTimerShard() {
+    return m_multiReactor ? getCurrentWorker() : -1;
+}
+
+size_t IOManager::selectTimerShard() {
+    size_t first = isUseCaller() ? 1 : 0;
+    int idx      = getCurrentWorker();
+    if (idx >= (int)first) {
+        return idx;
+    }
+    return first + m_nextTimerShard++ % (m_reactors.size() - first);
+}
+
 } // end namespace sylar
\ No newline at end of file
@@ -10,9 +10,15 @@
 
 #include "scheduler.h"
 #include "timer.h"
+#include "fd_table.h"
+
+struct io_uring_sqe;
+struct epoll_event;
 
 namespace sylar {
 
+class IoUring;
+
 class IOManager : public Scheduler, public TimerManager {
 public:
     typedef std::shared_ptr<IOManager> ptr;
@@ -32,6 +38,8 @@ public:
     };
 
 private:
+    struct IoRequest;
+
     /**
      * @brief socket fd上下文类
      * @details 每个socket fd都对应一个FdContext，包括fd的值，fd上的事件，以及fd的读写事件上下文
@@ -50,6 +58,14 @@ private:
             Fiber::ptr fiber;
             /// 事件回调函数
             std::function<void()> cb;
+            /// waitEvent()的超时定时器，第一次带超时等待时创建，之后一直复用
+            Timer::ptr deadline;
+            /// 本次等待的截止时间(毫秒)，0表示没有在带超时等待
+            uint64_t expire = 0;
+            /// 本次等待是否因为超时被唤醒
+            bool timedOut = false;
+            /// 排在这次等待后面的其他等待者，这次等待结束(触发、删除或取消)时一起调度，见followEvent()
+            std::vector<std::function<void()>> followers;
         };
 
         /**
@@ -65,12 +81,20 @@ private:
          */
         void resetEventContext(EventContext &ctx);
 
+        /**
+         * @brief 调度排在事件上的其他等待者，并清空列表
+         * @param[in, out] ctx 事件上下文，scheduler还没有被重置
+         * @param[out] batch 同triggerEvent
+         */
+        void wakeFollowers(EventContext &ctx, std::vector<Scheduler::ScheduleTask> *batch = nullptr);
+
         /**
          * @brief 触发事件
          * @details 根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
          * @param[in] event 事件类型
+         * @param[out] batch 不为空并且事件的调度器就是当前线程的调度器时，任务放入batch，由调用方统一批量调度
          */
-        void triggerEvent(Event event);
+        void triggerEvent(Event event, std::vector<Scheduler::ScheduleTask> *batch = nullptr);
 
         /// 读事件上下文
         EventContext read;
@@ -78,18 +102,50 @@ private:
         EventContext write;
         /// 事件关联的句柄
         int fd = 0;
+        /// 多reactor模式下fd归属的reactor下标，第一次添加事件时确定，fd关闭时重置为-1
+        int reactor = -1;
+        /// 该fd上还没完成的io_uring请求链表
+        IoRequest *ioRequests = nullptr;
         /// 该fd添加了哪些事件的回调函数，或者说该fd关心哪些事件
         Event events = NONE;
+        /// 持久注册模式下fd是否已经加入epoll
+        bool registered = false;
+        /// 持久注册模式下，没有人等待时到达的就绪事件，下次addEvent时直接返回而不用等下一个边沿
+        Event ready = NONE;
+        /// 事件触发时按这个优先级调度，见Scheduler::Priority，-1表示不指定
+        int priority = -1;
         /// 事件的Mutex
         MutexType mutex;
     };
 
+    /**
+     * @brief reactor，一个epoll实例加一个用于tickle的eventfd和一个用于定时器的timerfd
+     * @details 默认所有调度线程共用一个reactor，多reactor模式下每个调度线程一个
+     */
+    struct Reactor {
+        /// epoll 文件句柄
+        int epfd = -1;
+        /// eventfd 文件句柄，写入即唤醒阻塞在epfd上的idle协程
+        int tickleFd = -1;
+        /// 已经写过eventfd但idle还没读走，这期间的tickle都合并掉，不再写
+        std::atomic<bool> wakeupPending = {false};
+        /// timerfd 文件句柄，设置为最近一个定时器的到期时间，创建失败时为-1，退回按毫秒的epoll_wait超时
+        int timerFd = -1;
+        /// timerfd当前设置的到期时间(微秒)，~0ull表示没有设置或者已经到期
+        std::atomic<uint64_t> timerArmed = {~0ull};
+        /// 共享模式下多个调度线程都会设置timerfd，判断和设置要一起做
+        Spinlock timerMutex;
+    };
+
 public:
     /**
      * @brief 构造函数
      * @param[in] threads 线程数量
      * @param[in] use_caller 是否将调用线程包含进去
      * @param[in] name 调度器的名称
+     * @details 配置项iomanager.multi_reactor为true时开启多reactor模式，每个调度线程有自己的epoll和tickle pipe，
+     *          fd归属于第一次给它添加事件的调度线程(外部线程添加时轮流分配)，之后这个fd的事件都只在该线程上等待和触发
+     *          配置项iomanager.persistent_registration为true时开启持久注册模式，见addEvent()
      */
     IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
 
@@ -104,15 +160,43 @@ public:
      * @param[in] fd socket句柄
      * @param[in] event 事件类型
      * @param[in] cb 事件回调函数，如果为空，则默认把当前协程作为回调执行体
-     * @return 添加成功返回0,失败返回-1
+     * @details 持久注册模式下fd第一次添加事件时以EPOLLIN|EPOLLOUT|EPOLLET加入epoll，之后一直留在epoll里，
+     *          事件触发和删除都不再调用epoll_ctl，没有人等待时到达的事件记在fd的就绪标志里
+     * @return 添加成功返回0,失败返回-1，fd上已经有人在等这个事件时也返回-1并且errno为EEXIST；
+     *         持久注册模式下事件已经就绪时返回1，
+     *         这时不会注册事件，调用方应该直接重试IO而不是挂起(cb不为空时cb已被调度，返回0)
      */
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
+    /**
+     * @brief 当前协程等待fd上的事件，最多等待timeout_ms毫秒
+     * @details 超时用fd事件上下文里复用的定时器实现，每次等待不创建定时器，也不分配内存；
+     *          配置项iomanager.timeout_slack不为0时超时可能推迟最多这么多毫秒，换取批量触发
+     * @param[in] fd socket句柄
+     * @param[in] event 事件类型
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 事件触发或被取消返回0，超时返回ETIMEDOUT，添加事件失败返回-1，
+     *         持久注册模式下事件已经就绪时返回1，这时不会挂起
+     */
+    int waitEvent(int fd, Event event, uint64_t timeout_ms);
+
+    /**
+     * @brief 排在已经有人在等的事件后面
+     * @details 一个fd的一个事件同时只能有一个addEvent的等待者，其他协程用这个接口排在它后面，
+     *          这次等待结束时(事件触发、delEvent或cancelEvent)cb被调度一次，醒来后应该重新检查fd，
+     *          还没就绪就再addEvent或followEvent；排上的cb撤销不了，调用方超时离开后cb仍可能被调用
+     * @param[in] fd socket句柄
+     * @param[in] event 事件类型
+     * @param[in] cb 回调函数
+     * @return 事件正有人在等、cb已经排上时返回true，没有人在等时返回false，这时应改用addEvent
+     */
+    bool followEvent(int fd, Event event, std::function<void()> cb);
+
     /**
      * @brief 删除事件
      * @param[in] fd socket句柄
      * @param[in] event 事件类型
-     * @attention 不会触发事件
+     * @attention 不会触发事件，但排在这次等待后面的followEvent()回调会被调度
      * @return 是否删除成功
      */
     bool delEvent(int fd, Event event);
@@ -134,6 +218,65 @@ public:
      */
     bool cancelAll(int fd);
 
+    /**
+     * @brief 给fd打上调度优先级
+     * @details 之后这个fd上的事件触发时，回调函数和等待的协程都按这个优先级调度；协程会一直带着这个优先级，
+     *          比如监听socket标成PRIORITY_HIGH，accept它的协程以及从这个协程派生出的函数都优先于普通请求运行。
+     *          hook的close()会清除标记，fd号复用时不会继承
+     * @param[in] priority Scheduler::Priority，PRIORITY_AUTO表示清除标记
+     * @return fd超出FdTable容量时返回false
+     */
+    bool setFdPriority(int fd, int priority);
+
+    /**
+     * @brief fd的调度优先级，没有标记时返回PRIORITY_AUTO
+     */
+    int getFdPriority(int fd);
+
+    /**
+     * @brief 是否是多reactor模式
+     */
+    bool isMultiReactor() const { return m_multiReactor; }
+
+    /**
+     * @brief 是否是持久注册模式
+     */
+    bool isPersistentRegistration() const { return m_persistent; }
+
+    /**
+     * @brief 返回累计调用epoll_ctl的次数，用来观察不同注册模式下的系统调用开销
+     */
+    uint64_t getEpollCtlCount() const { return m_epollCtlCount; }
+
+    /**
+     * @brief 返回累计的tickle请求次数，包括tickle()和tickleWorker()
+     */
+    uint64_t getTickleCount() const { return m_tickleCount; }
+
+    /**
+     * @brief 返回累计真正写eventfd唤醒idle的次数，和getTickleCount()的差就是被合并掉的tickle
+     */
+    uint64_t getWakeupCount() const { return m_wakeupCount; }
+
+    /**
+     * @brief 是否启用了io_uring
+     * @details 配置项iomanager.io_uring为true并且内核支持时启用，否则仍然走epoll
+     */
+    bool isIoUring() const { return m_uring != nullptr; }
+
+    /**
+     * @brief 通过io_uring执行一个IO请求，当前协程挂起直到请求完成
+     * @details 请求先放进提交队列，调度线程进入idle时把攒下的请求一次性提交，攒够一批时也会立即提交；
+     *          完成事件通过io_uring句柄上的epoll事件通知，在idle协程里收割
+     * @param[in] fd 请求操作的句柄，cancelEvent/cancelAll会取消该句柄上的请求
+     * @param[in] event 请求对应的事件类型，cancelEvent按事件类型取消
+     * @param[in] sqe 填好opcode/fd/addr/len等字段的请求，user_data和flags由IOManager设置
+     * @param[in] timeout_ms 超时时间，~0ull表示不超时，超时通过linked timeout交给内核处理
+     * @return 同cqe的res，失败为-errno，超时为-ETIMEDOUT，被取消为-ECANCELED
+     * @attention 只能在isIoUring()为true时，在本调度器的协程里调用
+     */
+    int submitIo(int fd, Event event, const io_uring_sqe &sqe, uint64_t timeout_ms = ~0ull);
+
     /**
      * @brief 返回当前的IOManager
      */
@@ -142,10 +285,16 @@ public:
 protected:
     /**
      * @brief 通知调度器有任务要调度
-     * @details 写pipe让idle协程从epoll_wait退出，待idle协程yield之后Scheduler::run就可以调度其他任务
+     * @details 写eventfd让idle协程从epoll_wait退出，待idle协程yield之后Scheduler::run就可以调度其他任务
      */
     void tickle() override;
 
+    /**
+     * @brief 通知指定的调度线程
+     * @details 多reactor模式下写该线程自己的eventfd，共享模式下等同于tickle()
+     */
+    void tickleWorker(size_t idx) override;
+
     /**
      * @brief 判断是否可以停止
      * @details 判断条件是Scheduler::stopping()外加IOManager的m_pendingEventCount为0，表示没有IO事件可调度了
@@ -158,9 +307,15 @@ protected:
      */
     void idle() override;
 
+    /**
+     * @brief 不阻塞地epoll_wait一次，调度已经就绪的IO事件和到期的定时器
+     * @details 调度线程一直有任务时，打了高优先级标记的fd上的事件靠这里及时进入队列
+     */
+    void busyPoll() override;
+
     /**
      * @brief 判断是否可以停止，同时获取最近一个定时器的超时时间
-     * @param[out] timeout 最近一个定时器的超时时间，用于idle协程的epoll_wait
+     * @param[out] timeout 最近一个定时器的超时时间(微秒)，用于idle协程设置timerfd和epoll_wait
      * @return 返回是否可以停止
      */
     bool stopping(uint64_t& timeout);
@@ -171,22 +326,110 @@ protected:
     void onTimerInsertedAtFront() override;
 
     /**
-     * @brief 重置socket句柄上下文的容器大小
-     * @param[in] size 容量大小
+     * @brief waitEvent()的定时器到期，截止时间确实已到并且还在等待时取消事件，唤醒等待的协程
+     * @details 定时器回调可能晚于下一次等待开始才执行，所以要看截止时间而不是只看定时器
+     */
+    void onDeadline(FdContext *fd_ctx, Event event);
+
+    /**
+     * @brief 多reactor模式下定时器分片归调度线程所有，只唤醒分片的归属线程
+     */
+    void onShardMessage(size_t shard) override;
+
+    /**
+     * @brief 多reactor模式下返回当前调度线程的下标，否则返回-1
+     */
+    int getTimerShard() override;
+
+    /**
+     * @brief 调度线程添加的定时器放在自己的分片里，其他线程添加的轮流分给调度线程
+     * @details 和getReactor()一样，use caller时不分给caller线程
+     */
+    size_t selectTimerShard() override;
+
+    /**
+     * @brief 返回fd对应的FdContext，不存在时创建一个，不加锁
+     * @return fd超出FdTable容量时返回nullptr
+     */
+    FdContext *getFdContext(int fd);
+
+    /**
+     * @brief 返回fd归属的reactor，fd还没有归属时为其分配一个，调用方需持有fd_ctx->mutex
+     */
+    Reactor &getReactor(FdContext *fd_ctx);
+
+    /**
+     * @brief 调用epoll_ctl并计数
+     */
+    int epollCtl(int epfd, int op, int fd, epoll_event *event);
+
+    /**
+     * @brief 写reactor的eventfd，唤醒阻塞在它上面的idle协程
+     * @details 上一次唤醒还没被idle处理时直接返回，每个reactor同时最多只有一次唤醒在路上
+     */
+    void wakeup(Reactor &reactor);
+
+    /**
+     * @brief 按最近一个定时器的超时时间设置reactor的timerfd
+     * @details 已经设置了不晚于这个时间的到期时间时不再调用timerfd_settime
+     * @param[in] timeout_us 最近一个定时器的超时时间(微秒)，~0ull表示没有定时器
+     * @return epoll_wait的超时时间(毫秒)
+     */
+    int armTimer(Reactor &reactor, uint64_t timeout_us);
+
+    /**
+     * @brief 取消fd上指定事件类型的io_uring请求，调用方需持有fd_ctx->mutex
+     * @return 是否有请求被取消
+     */
+    bool cancelIo(FdContext *fd_ctx, Event event);
+
+    /**
+     * @brief 把攒下的io_uring请求提交给内核
+     */
+    void flushIo();
+
+    /**
+     * @brief 收割io_uring的完成事件，完成的请求对应的协程放入batch
+     * @return 完成的请求数
+     */
+    int reapIo(std::vector<ScheduleTask> &batch);
+
+    /**
+     * @brief 处理epoll_wait返回的事件，要调度的任务放入batch
+     * @param[in] busy 是否是busyPoll()收到的事件，这时读走的tickle本来是要唤醒idle线程的，要转交出去
+     * @return 触发的IO事件数，调度完batch之后从m_pendingEventCount里减掉
      */
-    void contextResize(size_t size);
+    int dispatchEvents(Reactor &reactor, epoll_event *events, int n, std::vector<ScheduleTask> &batch, bool busy);
 
 private:
-    /// epoll 文件句柄
-    int m_epfd = 0;
-    /// pipe 文件句柄，fd[0]读端，fd[1]写端
-    int m_tickleFds[2];
+    /// 是否是多reactor模式
+    bool m_multiReactor = false;
+    /// 是否是持久注册模式
+    bool m_persistent = false;
+    /// waitEvent()超时定时器的slack(毫秒)，大量连接的读超时可以合并到同一批触发
+    uint64_t m_timeoutSlack = 0;
+    /// epoll_ctl调用次数
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    /// tickle请求次数
+    std::atomic<uint64_t> m_tickleCount = {0};
+    /// 写eventfd的次数
+    std::atomic<uint64_t> m_wakeupCount = {0};
+    /// reactor数组，共享模式下只有一个，多reactor模式下下标和调度线程下标一一对应
+    std::vector<Reactor> m_reactors;
+    /// 外部线程添加事件时，下一个分配的reactor
+    std::atomic<size_t> m_nextReactor = {0};
+    /// 外部线程添加定时器时，下一个分配的定时器分片
+    std::atomic<size_t> m_nextTimerShard = {0};
+    /// 多reactor模式下tickle()从哪个调度线程开始找空闲线程
+    std::atomic<size_t> m_nextTickle = {0};
+    /// io_uring实例，没有启用时为空
+    std::unique_ptr<IoUring> m_uring;
+    /// 保护m_uring的提交队列和完成队列
+    Mutex m_uringMutex;
     /// 当前等待执行的IO事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    /// IOManager的Mutex
-    RWMutexType m_mutex;
-    /// socket事件上下文的容器
-    std::vector<FdContext *> m_fdContexts;
+    /// socket事件上下文的容器，FdContext创建后直到IOManager析构都不释放
+    FdTable<FdContext> m_fdContexts;
 };
 
 } // end namespace sylar
@@ -15,6 +15,8 @@
 #include <stdint.h>
 #include <atomic>
 #include <list>
+#include <string>
+#include <stdexcept>
 
 #include "noncopyable.h"
 
@@ -0,0 +1,37 @@
+/**
+ * @file parallel.cc
+ * @brief 并行算法的块划分
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "parallel.h"
+
+namespace sylar {
+
+ParallelState::ParallelState(size_t total, size_t grain, size_t workers)
+    : m_total(total)
+    , m_grain(grain)
+    , m_workers(workers) {
+}
+
+bool ParallelState::claim(size_t &begin, size_t &end) {
+    size_t cur = m_next.load(std::memory_order_relaxed);
+    while (cur < m_total) {
+        size_t left = m_total - cur;
+        size_t n    = std::min(left, std::max(m_grain, left / (2 * m_workers)));
+        if (m_next.compare_exchange_weak(cur, cur + n, std::memory_order_relaxed)) {
+            begin = cur;
+            end   = cur + n;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParallelState::finish(size_t n) {
+    if (m_finished.fetch_add(n, std::memory_order_acq_rel) + n == m_total) {
+        m_done.notify();
+    }
+}
+
+} // namespace sylar
@@ -0,0 +1,228 @@
+/**
+ * @file parallel.h
+ * @brief 基于协程调度器的并行算法：parallel_for、parallel_reduce、parallel_sort
+ * @details 区间按guided方式切块：每次领取剩余部分的1/(2*线程数)，不少于grain，开始时块大、分摊领取的开销，
+ *          快结束时块小、各线程差不多同时做完；调度器的每个线程上放一个领块的协程，调用方自己也领块，
+ *          做完后等其他线程手上的块，等待只挂起当前协程。调度器线程都在忙别的时，调用方一个人也能做完，
+ *          后启动的协程领不到块直接退出
+ * @note 其他线程会访问调用方栈上的函数对象和数据，不能在共享栈协程里调用
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_PARALLEL_H__
+#define __SYLAR_PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include "fiber_mutex.h"
+#include "scheduler.h"
+
+namespace sylar {
+
+/**
+ * @brief 一次并行执行的共享状态，调用方和各线程上的协程一起领块
+ */
+class ParallelState : Noncopyable {
+public:
+    typedef std::shared_ptr<ParallelState> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] total 总个数，块用[0, total)里的下标表示
+     * @param[in] grain 每块的最小个数
+     * @param[in] workers 参与的线程数
+     */
+    ParallelState(size_t total, size_t grain, size_t workers);
+
+    /**
+     * @brief 领取下一块
+     * @param[out] begin 块的起始下标
+     * @param[out] end 块的结束下标(不含)
+     * @return 已经领完了返回false
+     */
+    bool claim(size_t &begin, size_t &end);
+
+    /**
+     * @brief 报告完成了n个，全部完成时唤醒wait()
+     * @details 领块的一方在自己领的块都处理完、结果也合并好之后再调用
+     */
+    void finish(size_t n);
+
+    /**
+     * @brief 等所有块都完成
+     */
+    void wait() { m_done.wait(); }
+
+private:
+    /// 总个数
+    const size_t m_total;
+    /// 每块的最小个数
+    const size_t m_grain;
+    /// 参与的线程数
+    const size_t m_workers;
+    /// 下一块的起始下标
+    std::atomic<size_t> m_next = {0};
+    /// 已完成的个数
+    std::atomic<size_t> m_finished = {0};
+    /// 全部完成时通知
+    FiberSemaphore m_done;
+};
+
+/**
+ * @brief 在调度器的所有线程上并行执行worker，调用方也参与，返回时所有块都已完成
+ * @param[in] sc 调度器，为nullptr时只在当前线程上执行
+ * @param[in] total 总个数
+ * @param[in] grain 每块的最小个数
+ * @param[in] worker 可调用对象，worker(ParallelState&, begin, end)处理领到的第一块，
+ *            之后继续claim()直到领完，最后finish()自己处理的个数
+ */
+template <class Worker>
+void ParallelRun(Scheduler *sc, size_t total, size_t grain, Worker &worker) {
+    if (!total) {
+        return;
+    }
+    grain          = std::max<size_t>(grain, 1);
+    size_t threads = sc ? sc->getWorkerCount() : 1;
+    // 调用方是调度器自己的线程时占一个名额
+    size_t helpers = !sc ? 0 : sc == Scheduler::GetThis() ? threads - 1 : threads;
+    helpers        = std::min(helpers, (total + grain - 1) / grain - 1);
+    ParallelState::ptr state(new ParallelState(total, grain, helpers + 1));
+    for (size_t i = 0; i < helpers; i++) {
+        // 领到块之后调用方一定还在等，worker的引用有效；领不到就不碰worker
+        sc->schedule([state, &worker]() {
+            size_t begin, end;
+            if (state->claim(begin, end)) {
+                worker(*state, begin, end);
+            }
+        });
+    }
+    size_t begin, end;
+    if (state->claim(begin, end)) {
+        worker(*state, begin, end);
+    }
+    state->wait();
+}
+
+/**
+ * @brief 并行执行func(i)，i取[begin, end)
+ * @param[in] grain 每块的最小个数，每次迭代很轻时调大一些
+ */
+template <class Index, class Func>
+void parallel_for(Scheduler *sc, Index begin, Index end, const Func &func, size_t grain = 1) {
+    if (!(begin < end)) {
+        return;
+    }
+    auto worker = [begin, &func](ParallelState &state, size_t b, size_t e) {
+        size_t count = 0;
+        do {
+            for (size_t i = b; i < e; i++) {
+                func(begin + i);
+            }
+            count += e - b;
+        } while (state.claim(b, e));
+        state.finish(count);
+    };
+    ParallelRun(sc, end - begin, grain, worker);
+}
+
+/**
+ * @brief 并行map-reduce
+ * @param[in] identity 归约的单位元，每个线程的局部结果从它开始
+ * @param[in] map map(b, e)返回[b, e)这一段的结果
+ * @param[in] reduce reduce(a, b)合并两个结果，需满足结合律
+ * @details 每个线程先在本地合并自己处理的段，最后各合并一次到总结果，合并顺序不固定，reduce需要满足交换律
+ */
+template <class Index, class T, class Map, class Reduce>
+T parallel_reduce(Scheduler *sc, Index begin, Index end, T identity, const Map &map, const Reduce &reduce, size_t grain = 1) {
+    if (!(begin < end)) {
+        return identity;
+    }
+    T result = identity;
+    Spinlock mutex;
+    auto worker = [begin, &identity, &result, &mutex, &map, &reduce](ParallelState &state, size_t b, size_t e) {
+        size_t count = 0;
+        T local      = identity;
+        do {
+            local = reduce(local, map(begin + b, begin + e));
+            count += e - b;
+        } while (state.claim(b, e));
+        {
+            Spinlock::Lock lock(mutex);
+            result = reduce(result, local);
+        }
+        state.finish(count);
+    };
+    ParallelRun(sc, end - begin, grain, worker);
+    return result;
+}
+
+/**
+ * @brief 并行排序，不稳定
+ * @details 先切成若干块各自std::sort，再两两归并，每轮的归并也并行，需要一块和输入一样大的临时缓冲
+ * @param[in] grain 小于这个长度的块不再切分
+ */
+template <class RandomIt, class Compare>
+void parallel_sort(Scheduler *sc, RandomIt first, RandomIt last, Compare comp, size_t grain = 4096) {
+    typedef typename std::iterator_traits<RandomIt>::value_type Value;
+    size_t n = last - first;
+    grain    = std::max<size_t>(grain, 1);
+    // 块数取线程数的2倍并向上取到2的幂，两两归并正好归并成一块
+    size_t threads = sc ? sc->getWorkerCount() : 1;
+    size_t blocks  = 1;
+    while (blocks < threads * 2 && n / (blocks * 2) >= grain) {
+        blocks *= 2;
+    }
+    if (blocks == 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+    std::vector<size_t> bounds(blocks + 1);
+    for (size_t i = 0; i <= blocks; i++) {
+        bounds[i] = n * i / blocks;
+    }
+    parallel_for(sc, (size_t)0, blocks, [&](size_t i) {
+        std::sort(first + bounds[i], first + bounds[i + 1], comp);
+    });
+
+    // 在输入和缓冲之间来回归并
+    std::vector<Value> buffer(std::make_move_iterator(first), std::make_move_iterator(last));
+    bool in_buffer = true;
+    for (size_t width = 1; width < blocks; width *= 2) {
+        size_t pairs = blocks / (width * 2);
+        if (in_buffer) {
+            parallel_for(sc, (size_t)0, pairs, [&](size_t p) {
+                size_t b = bounds[p * width * 2], m = bounds[p * width * 2 + width], e = bounds[(p + 1) * width * 2];
+                std::merge(std::make_move_iterator(buffer.begin() + b), std::make_move_iterator(buffer.begin() + m),
+                           std::make_move_iterator(buffer.begin() + m), std::make_move_iterator(buffer.begin() + e),
+                           first + b, comp);
+            });
+        } else {
+            parallel_for(sc, (size_t)0, pairs, [&](size_t p) {
+                size_t b = bounds[p * width * 2], m = bounds[p * width * 2 + width], e = bounds[(p + 1) * width * 2];
+                std::merge(std::make_move_iterator(first + b), std::make_move_iterator(first + m),
+                           std::make_move_iterator(first + m), std::make_move_iterator(first + e),
+                           buffer.begin() + b, comp);
+            });
+        }
+        in_buffer = !in_buffer;
+    }
+    if (in_buffer) {
+        std::move(buffer.begin(), buffer.end(), first);
+    }
+}
+
+/**
+ * @brief 按operator<并行排序
+ */
+template <class RandomIt>
+void parallel_sort(Scheduler *sc, RandomIt first, RandomIt last) {
+    parallel_sort(sc, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+} // namespace sylar
+
+#endif
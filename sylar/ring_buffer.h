@@ -0,0 +1,152 @@
+/**
+ * @file ring_buffer.h
+ * @brief 环形队列
+ * @details 容量按2的幂增长，只增不减，进入稳定状态之后入队出队都不会再分配内存，
+ *          用来替代std::list/std::deque做任务队列，std::list每个节点一次分配，std::deque跨块时也会分配和释放
+ *          非线程安全，由使用方加锁
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_RING_BUFFER_H__
+#define __SYLAR_RING_BUFFER_H__
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <utility>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 环形队列
+ * @tparam T 元素类型，需要支持移动构造
+ */
+template <class T>
+class RingBuffer : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 初始容量，会向上取整到2的幂，为0时第一次入队再分配
+     */
+    explicit RingBuffer(size_t capacity = 0) {
+        if (capacity) {
+            reserve(capacity);
+        }
+    }
+
+    ~RingBuffer() {
+        clear();
+        free(m_data);
+    }
+
+    /**
+     * @brief 元素个数
+     */
+    size_t size() const { return m_tail - m_head; }
+
+    /**
+     * @brief 是否为空
+     */
+    bool empty() const { return m_tail == m_head; }
+
+    /**
+     * @brief 当前容量
+     */
+    size_t capacity() const { return m_data ? m_mask + 1 : 0; }
+
+    /**
+     * @brief 队头元素
+     */
+    T &front() { return m_data[m_head & m_mask]; }
+
+    /**
+     * @brief 队尾元素
+     */
+    T &back() { return m_data[(m_tail - 1) & m_mask]; }
+
+    /**
+     * @brief 从队头开始的第i个元素
+     */
+    T &operator[](size_t i) { return m_data[(m_head + i) & m_mask]; }
+
+    /**
+     * @brief 入队，容量不够时翻倍
+     */
+    void push_back(T &&v) {
+        if (!m_data || size() == capacity()) {
+            reserve(m_data ? capacity() * 2 : 16);
+        }
+        new (&m_data[m_tail & m_mask]) T(std::move(v));
+        ++m_tail;
+    }
+
+    /**
+     * @brief 出队，队列不能为空
+     */
+    void pop_front() {
+        m_data[m_head & m_mask].~T();
+        ++m_head;
+    }
+
+    /**
+     * @brief 移出队头元素，队列不能为空
+     */
+    T take_front() {
+        T v(std::move(front()));
+        pop_front();
+        return v;
+    }
+
+    /**
+     * @brief 清空，不释放内存
+     */
+    void clear() {
+        while (!empty()) {
+            pop_front();
+        }
+    }
+
+    /**
+     * @brief 预留容量，会向上取整到2的幂
+     */
+    void reserve(size_t n) {
+        if (m_data && n <= capacity()) {
+            return;
+        }
+        size_t cap = 16;
+        while (cap < n) {
+            cap <<= 1;
+        }
+        T *data = static_cast<T *>(malloc(cap * sizeof(T)));
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        size_t count = size();
+        for (size_t i = 0; i < count; i++) {
+            T &v = (*this)[i];
+            new (&data[i]) T(std::move(v));
+            v.~T();
+        }
+        free(m_data);
+        m_data = data;
+        m_mask = cap - 1;
+        m_head = 0;
+        m_tail = count;
+    }
+
+private:
+    /// 元素数组
+    T *m_data = nullptr;
+    /// 容量-1，容量是2的幂，下标用&代替%
+    size_t m_mask = 0;
+    /// 队头位置，只增不减，取下标时&m_mask
+    size_t m_head = 0;
+    /// 队尾位置
+    size_t m_tail = 0;
+};
+
+} // namespace sylar
+
+#endif
@@ -5,6 +5,7 @@
  * @date 2021-06-15
  */
 #include "scheduler.h"
+#include "config.h"
 #include "macro.h"
 #include "hook.h"
 
@@ -16,6 +17,38 @@ static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 static thread_local Scheduler *t_scheduler = nullptr;
 /// 当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+/// 当前线程在t_scheduler里的本地队列下标，非调度线程为-1
+static thread_local int t_worker_index = -1;
+/// 窃取时选择目标线程用的随机数状态
+static thread_local uint32_t t_steal_seed = 0;
+/// 当前线程是否正在执行idle协程
+static thread_local bool t_in_idle = false;
+/// 当前线程正在运行的任务的优先级，不在运行任务时为-1，PRIORITY_AUTO的函数任务沿用它
+static thread_local int t_task_priority = -1;
+
+/// 每调度这么多次优先检查一次全局队列，避免本地队列一直有任务时全局队列里的任务饿死
+static const uint64_t s_global_check_interval = 61;
+/// 从全局队列一次最多搬到本地队列的任务数
+static const size_t s_global_batch = 32;
+/// 一直有任务时每隔这么多微秒调用一次busyPoll()
+static const uint64_t s_busy_poll_interval = 1000;
+/// 一直有任务时每运行这么多个任务才看一次时钟，决定要不要busyPoll()
+static const uint64_t s_busy_poll_check = 16;
+
+static ConfigVar<uint32_t>::ptr g_starvation_limit =
+    Config::Lookup<uint32_t>("scheduler.starvation_limit", 16, "run one lower priority task after skipping its queue this many times in a row");
+
+static std::atomic<uint32_t> s_starvation_limit = {g_starvation_limit->getValue()};
+
+struct _SchedulerIniter {
+    _SchedulerIniter() {
+        g_starvation_limit->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_starvation_limit = new_value;
+        });
+    }
+};
+
+static _SchedulerIniter s_scheduler_initer;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
     SYLAR_ASSERT(threads > 0);
@@ -23,6 +56,11 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
     m_useCaller = use_caller;
     m_name      = name;
 
+    m_workers.resize(threads);
+    for (auto &i : m_workers) {
+        i.reset(new WorkerQueue);
+    }
+
     if (use_caller) {
         --threads;
         sylar::Fiber::GetThis();
@@ -39,6 +77,10 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
         t_scheduler_fiber = m_rootFiber.get();
         m_rootThread      = sylar::GetThreadId();
         m_threadIds.push_back(m_rootThread);
+
+        t_worker_index = 0;
+        m_workers[0]->threadId = m_rootThread;
+        m_nextWorker           = 1;
     } else {
         m_rootThread = -1;
     }
@@ -61,7 +103,8 @@ Scheduler::~Scheduler() {
     SYLAR_LOG_DEBUG(g_logger) << "Scheduler::~Scheduler()";
     SYLAR_ASSERT(m_stopping);
     if (GetThis() == this) {
-        t_scheduler = nullptr;
+        t_scheduler    = nullptr;
+        t_worker_index = -1;
     }
 }
 
@@ -79,11 +122,18 @@ void Scheduler::start() {
                                       m_name + "_" + std::to_string(i)));
         m_threadIds.push_back(m_threads[i]->getId());
     }
+    StallWatchdogMgr::GetInstance()->add(this);
 }
 
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_taskCount == 0 && m_activeThreadCount == 0 && m_externalWaiters == 0;
+}
+
+void Scheduler::delExternalWaiter() {
+    // 调度线程可能已经因为这个计数不为0而回到idle里等待了，stop()期间要叫醒它重新检查
+    if (--m_externalWaiters == 0 && m_stopping) {
+        tickle();
+    }
 }
 
 void Scheduler::tickle() { 
@@ -133,6 +183,342 @@ void Scheduler::stop() {
     for (auto &i : thrs) {
         i->join();
     }
+    StallWatchdogMgr::GetInstance()->del(this);
+}
+
+RunSliceHistogram Scheduler::getRunSliceHistogram() const {
+    RunSliceHistogram rt;
+    for (auto &i : m_workers) {
+        rt.merge(i->slices);
+    }
+    return rt;
+}
+
+RunSliceHistogram Scheduler::getWaitHistogram(int priority) const {
+    RunSliceHistogram rt;
+    for (auto &i : m_workers) {
+        rt.merge(i->waits[priority]);
+    }
+    return rt;
+}
+
+void Scheduler::checkStalls(uint64_t now_us, uint64_t budget_us,
+                            const std::function<void(int, uint64_t, uint64_t)> &cb) {
+    for (auto &i : m_workers) {
+        WorkerQueue &worker = *i;
+        uint64_t start      = worker.sliceStart;
+        uint64_t fiber_id   = worker.sliceFiber;
+        // 两次读之间协程可能已经换了，开始时间没变才说明协程id是这段运行的
+        if (!start || start != worker.sliceStart || start == worker.stallReported ||
+            now_us < start + budget_us) {
+            continue;
+        }
+        worker.stallReported = start;
+        cb(worker.threadId, fiber_id, now_us - start);
+    }
+}
+
+void Scheduler::runSlice(WorkerQueue &worker, Fiber *fiber, int priority, uint64_t enqueued) {
+    // 关闭时每个任务只多一次原子变量的读，不读时钟
+    if (!StallWatchdog::IsSliceTimingEnabled()) {
+        fiber->resume();
+        return;
+    }
+    uint64_t start = GetElapsedUS();
+    // 入队时还没打开统计的任务没有入队时间
+    if (enqueued) {
+        worker.waits[priority].add(start > enqueued ? start - enqueued : 0);
+    }
+    // 检测线程只需要最终看到，不用全序的存储，先写协程id再写开始时间
+    worker.sliceFiber.store(fiber->getId(), std::memory_order_relaxed);
+    worker.sliceStart.store(start, std::memory_order_release);
+    fiber->resume();
+    worker.sliceStart.store(0, std::memory_order_relaxed);
+    worker.slices.add(GetElapsedUS() - start);
+}
+
+int Scheduler::getWorkerIndex(int thread) const {
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        if (m_workers[i]->threadId == thread) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int Scheduler::getCurrentWorker() const {
+    return t_scheduler == this ? t_worker_index : -1;
+}
+
+void Scheduler::prepareTask(ScheduleTask &task) {
+    if (task.fiber) {
+        if (task.thread == -1) {
+            // 共享栈协程只能在绑定的线程上运行
+            task.thread = task.fiber->getBoundThread();
+        }
+        // 协程的优先级跟着协程走，IO事件、定时器把它放回来时不用再指定
+        if (task.priority == PRIORITY_AUTO) {
+            task.priority = task.fiber->getPriority();
+        } else {
+            task.fiber->setPriority(task.priority);
+        }
+    } else if (task.priority == PRIORITY_AUTO) {
+        // 任务里派生出来的函数沿用任务的优先级
+        task.priority = t_task_priority;
+    }
+    if (task.priority < 0 || task.priority >= PRIORITY_COUNT) {
+        task.priority = PRIORITY_NORMAL;
+    }
+    // 关闭统计时不读时钟
+    task.enqueued = StallWatchdog::IsSliceTimingEnabled() ? GetElapsedUS() : 0;
+}
+
+void Scheduler::scheduleTask(ScheduleTask &task) {
+    if (!task.fiber && !task.cb) {
+        return;
+    }
+    prepareTask(task);
+
+    int idx = -1;
+    if (task.thread != -1) {
+        idx = getWorkerIndex(task.thread);
+    } else if (t_scheduler == this) {
+        idx = t_worker_index;
+    }
+
+    // 先加计数再入队，保证计数不会比实际任务数少，stopping()不会误判
+    bool need_tickle = (m_taskCount++ == 0);
+    bool pinned      = (task.thread != -1);
+    ++m_queued[task.priority];
+    if (idx >= 0) {
+        WorkerQueue &worker = *m_workers[idx];
+        MutexType::Lock lock(worker.mutex);
+        worker.push(std::move(task));
+    } else {
+        // 外部线程添加的任务，或者指定的线程还没开始调度
+        MutexType::Lock lock(m_mutex);
+        m_tasks[task.priority].push_back(std::move(task));
+    }
+
+    if (pinned && idx >= 0) {
+        if (idx != t_worker_index || t_scheduler != this) {
+            tickleWorker(idx);
+        }
+    } else if (need_tickle) {
+        tickle(); // 唤醒idle协程
+    }
+}
+
+void Scheduler::scheduleBatch(ScheduleTask *tasks, size_t n) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        ScheduleTask &task = tasks[i];
+        if (!task.fiber && !task.cb) {
+            continue;
+        }
+        prepareTask(task);
+        ++m_queued[task.priority];
+        ++count;
+    }
+    if (!count) {
+        return;
+    }
+
+    m_taskCount += count;
+    // 进了全局队列或者调用方本地队列的任务数，指定线程的任务单独唤醒它的线程，不算在里面
+    size_t shared    = count;
+    int self         = (t_scheduler == this) ? t_worker_index : -1;
+    {
+        // 未指定线程的任务一次加锁全部入队
+        WorkerQueue *worker = self >= 0 ? m_workers[self].get() : nullptr;
+        MutexType::Lock lock(worker ? worker->mutex : m_mutex);
+        for (size_t i = 0; i < n; i++) {
+            ScheduleTask &task = tasks[i];
+            if ((!task.fiber && !task.cb) || task.thread != -1) {
+                continue;
+            }
+            if (worker) {
+                worker->push(std::move(task));
+            } else {
+                m_tasks[task.priority].push_back(std::move(task));
+            }
+            task.reset();
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        ScheduleTask &task = tasks[i];
+        if (!task.fiber && !task.cb) {
+            continue;
+        }
+        int idx = getWorkerIndex(task.thread);
+        if (idx >= 0) {
+            {
+                WorkerQueue &worker = *m_workers[idx];
+                MutexType::Lock lock(worker.mutex);
+                worker.push(std::move(task));
+            }
+            if (idx != self) {
+                tickleWorker(idx);
+            }
+            --shared;
+        } else {
+            MutexType::Lock lock(m_mutex);
+            m_tasks[task.priority].push_back(std::move(task));
+        }
+        task.reset();
+    }
+
+    // 调用方自己是空闲的调度线程时，它回到调度循环就会取一个任务，不用唤醒自己
+    size_t idle = m_idleThreadCount;
+    if (self >= 0 && t_in_idle && idle > 0 && shared > 0) {
+        --idle;
+        --shared;
+    }
+    size_t wake = std::min(shared, idle);
+    while (wake--) {
+        tickle();
+    }
+}
+
+int Scheduler::pickLevel(const WorkerQueue &worker) const {
+    int first = -1;
+    for (int i = 0; i < PRIORITY_COUNT; i++) {
+        if (m_queued[i] == 0) {
+            continue;
+        }
+        if (first < 0) {
+            first = i;
+        } else if (worker.skipped[i] >= s_starvation_limit) {
+            // 更高的优先级一直有任务，这个优先级已经被连续跳过太多次了，插一个
+            return i;
+        }
+    }
+    return first;
+}
+
+bool Scheduler::popLocal(size_t idx, ScheduleTask &task, int level) {
+    WorkerQueue &worker = *m_workers[idx];
+    if (worker.size == 0 && worker.pinnedSize == 0) {
+        return false;
+    }
+    int begin = level < 0 ? 0 : level;
+    int end   = level < 0 ? PRIORITY_COUNT : level + 1;
+    MutexType::Lock lock(worker.mutex);
+    for (int i = begin; i < end; i++) {
+        if (!worker.pinned[i].empty()) {
+            task = worker.pinned[i].take_front();
+            --worker.pinnedSize;
+            return true;
+        }
+        if (!worker.tasks[i].empty()) {
+            task = worker.tasks[i].take_front();
+            --worker.levelSize[i];
+            --worker.size;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::popGlobal(size_t idx, ScheduleTask &task, bool &tickle_me, int level) {
+    WorkerQueue &worker = *m_workers[idx];
+    int begin = level < 0 ? 0 : level;
+    int end   = level < 0 ? PRIORITY_COUNT : level + 1;
+    {
+        MutexType::Lock lock(m_mutex);
+        // 一次只搬一个优先级的任务
+        for (int p = begin; p < end && worker.transfer.empty(); p++) {
+            RingBuffer<ScheduleTask> &tasks = m_tasks[p];
+            if (tasks.empty()) {
+                continue;
+            }
+            // 按线程数平分全局队列，最多搬s_global_batch个
+            size_t want  = std::min(tasks.size() / m_workers.size() + 1, s_global_batch);
+            size_t count = tasks.size();
+            for (size_t i = 0; i < count && worker.transfer.size() < want; i++) {
+                ScheduleTask t = tasks.take_front();
+                if (t.thread != -1 && t.thread != sylar::GetThreadId()) {
+                    // 指定了其他线程，但那个线程添加任务时还没开始调度，放回队尾，通知一下其他线程
+                    tasks.push_back(std::move(t));
+                    tickle_me = true;
+                    continue;
+                }
+                worker.transfer.push_back(std::move(t));
+            }
+        }
+    }
+    if (worker.transfer.empty()) {
+        return false;
+    }
+    takeTransfer(idx, task);
+    return true;
+}
+
+bool Scheduler::steal(size_t idx, ScheduleTask &task, int level) {
+    size_t n = m_workers.size();
+    if (n <= 1) {
+        return false;
+    }
+    if (t_steal_seed == 0) {
+        t_steal_seed = (idx + 1) * 2654435761u;
+    }
+    // xorshift32
+    t_steal_seed ^= t_steal_seed << 13;
+    t_steal_seed ^= t_steal_seed >> 17;
+    t_steal_seed ^= t_steal_seed << 5;
+    size_t start = t_steal_seed % n;
+    int begin    = level < 0 ? 0 : level;
+    int end      = level < 0 ? PRIORITY_COUNT : level + 1;
+
+    WorkerQueue &worker = *m_workers[idx];
+    for (size_t i = 0; i < n && worker.transfer.empty(); i++) {
+        size_t victim_idx = (start + i) % n;
+        if (victim_idx == idx) {
+            continue;
+        }
+        WorkerQueue &victim = *m_workers[victim_idx];
+        if (victim.size == 0) {
+            continue;
+        }
+        for (int p = begin; p < end && worker.transfer.empty(); p++) {
+            if (victim.levelSize[p] == 0) {
+                continue;
+            }
+            MutexType::Lock lock(victim.mutex);
+            // 取一半，从队头取，和原线程的取任务顺序保持一致
+            size_t count = (victim.tasks[p].size() + 1) / 2;
+            for (size_t j = 0; j < count; j++) {
+                worker.transfer.push_back(victim.tasks[p].take_front());
+            }
+            victim.levelSize[p] -= count;
+            victim.size -= count;
+        }
+    }
+    if (worker.transfer.empty()) {
+        return false;
+    }
+    // 先放开被窃取线程的锁再锁自己，否则两个线程互相窃取时会死锁
+    takeTransfer(idx, task);
+    return true;
+}
+
+void Scheduler::takeTransfer(size_t idx, ScheduleTask &task) {
+    WorkerQueue &worker = *m_workers[idx];
+    task = worker.transfer.take_front();
+    if (!worker.transfer.empty()) {
+        MutexType::Lock lock(worker.mutex);
+        while (!worker.transfer.empty()) {
+            worker.push(worker.transfer.take_front());
+        }
+    }
+}
+
+void Scheduler::requeue(size_t idx, ScheduleTask &task) {
+    WorkerQueue &worker = *m_workers[idx];
+    ++m_taskCount;
+    ++m_queued[task.priority];
+    MutexType::Lock lock(worker.mutex);
+    worker.push(std::move(task));
 }
 
 void Scheduler::run() {
@@ -141,51 +527,77 @@ void Scheduler::run() {
     setThis();
     if (sylar::GetThreadId() != m_rootThread) {
         t_scheduler_fiber = sylar::Fiber::GetThis().get();
+        t_worker_index    = m_nextWorker++;
+        SYLAR_ASSERT(t_worker_index < (int)m_workers.size());
+        m_workers[t_worker_index]->threadId = sylar::GetThreadId();
     }
+    size_t idx          = t_worker_index;
+    WorkerQueue &worker = *m_workers[idx];
 
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
 
     ScheduleTask task;
+    uint64_t tick     = 0;
+    bool busy         = false; // 上次离开idle之后是否一直在运行任务
     while (true) {
         task.reset();
         bool tickle_me = false; // 是否tickle其他线程进行任务调度
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_tasks.begin();
-            // 遍历所有调度任务
-            while (it != m_tasks.end()) {
-                if (it->thread != -1 && it->thread != sylar::GetThreadId()) {
-                    // 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，然后跳过这个任务，继续下一个
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
+        bool found     = false;
 
-                // 找到一个未指定线程，或是指定了当前线程的任务
-                SYLAR_ASSERT(it->fiber || it->cb);
+        // 一直有任务时进不了idle，隔一段时间收集一次就绪的事件，让它们按自己的优先级排队
+        if (busy && tick % s_busy_poll_check == 0) {
+            uint64_t now = GetElapsedUS();
+            if (now - worker.lastPoll >= s_busy_poll_interval) {
+                worker.lastPoll = now;
+                busyPoll();
+            }
+        }
 
-                // if (it->fiber) {
-                //     // 任务队列时的协程一定是READY状态，谁会把RUNNING或TERM状态的协程加入调度呢？
-                //     SYLAR_ASSERT(it->fiber->getState() == Fiber::READY);
-                // }
+        // 先选优先级，同一优先级里取任务的顺序: 本地队列 -> 全局队列 -> 窃取其他线程；
+        // 选中的优先级哪里都没取到(计数和队列之间有时间差)时不分优先级再取一遍；每隔一段时间先看一次全局队列
+        if (++tick % s_global_check_interval == 0) {
+            found = popGlobal(idx, task, tickle_me, -1);
+        }
+        if (!found) {
+            int level = pickLevel(worker);
+            found     = level >= 0 && (popLocal(idx, task, level) || popGlobal(idx, task, tickle_me, level) || steal(idx, task, level));
+        }
+        found = found || popLocal(idx, task, -1) || popGlobal(idx, task, tickle_me, -1) || steal(idx, task, -1);
 
-                // [BUG FIX]: hook IO相关的系统调用时，在检测到IO未就绪的情况下，会先添加对应的读写事件，再yield当前协程，等IO就绪后再resume当前协程
-                // 多线程高并发情境下，有可能发生刚添加事件就被触发的情况，如果此时当前协程还未来得及yield，则这里就有可能出现协程状态仍为RUNNING的情况
-                // 这里简单地跳过这种情况，以损失一点性能为代价，否则整个协程框架都要大改
-                if(it->fiber && it->fiber->getState() == Fiber::RUNNING) {
-                    ++it;
-                    continue;
+        if (found) {
+            SYLAR_ASSERT(task.fiber || task.cb);
+            // 当前调度线程找到一个任务，准备开始调度，活动线程数先加1再减任务数，避免stopping()误判
+            ++m_activeThreadCount;
+            --m_taskCount;
+            --m_queued[task.priority];
+
+            // [BUG FIX]: hook IO相关的系统调用时，在检测到IO未就绪的情况下，会先添加对应的读写事件，再yield当前协程，等IO就绪后再resume当前协程
+            // 多线程高并发情境下，有可能发生刚添加事件就被触发的情况，如果此时当前协程还未来得及yield，则这里就有可能出现协程状态仍为RUNNING的情况
+            // 这里把任务放回本地队列稍后再试，其他线程很快就会把它yield出去
+            if (task.fiber && task.fiber->getState() == Fiber::RUNNING) {
+                requeue(idx, task);
+                --m_activeThreadCount;
+                continue;
+            }
+
+            // 更低的优先级有任务却没轮到，记一次跳过，攒够了pickLevel()会插一个
+            for (int i = task.priority + 1; i < PRIORITY_COUNT; i++) {
+                if (m_queued[i] > 0) {
+                    ++worker.skipped[i];
+                }
+            }
+            worker.skipped[task.priority] = 0;
+
+            // 当前线程拿完一个任务后，发现本地队列还有剩余，那么tickle一下其他线程来窃取
+            tickle_me |= (worker.size > 0);
+        } else {
+            // 有指定给其他线程的任务，通知一下，让对应的线程从idle里出来
+            for (size_t i = 0; i < m_workers.size(); i++) {
+                if (i != idx && m_workers[i]->pinnedSize > 0) {
+                    tickleWorker(i);
                 }
-                
-                // 当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除，活动线程数加1
-                task = *it;
-                m_tasks.erase(it++);
-                ++m_activeThreadCount;
-                break;
             }
-            // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
-            tickle_me |= (it != m_tasks.end());
         }
 
         if (tickle_me) {
@@ -194,28 +606,49 @@ void Scheduler::run() {
 
         if (task.fiber) {
             // resume协程，resume返回时，协程要么执行完了，要么半路yield了，总之这个任务就算完成了，活跃线程数减一
-            task.fiber->resume();
+            t_task_priority = task.priority;
+            runSlice(worker, task.fiber.get(), task.priority, task.enqueued);
+            busy = true;
+            t_task_priority = -1;
             --m_activeThreadCount;
             task.reset();
         } else if (task.cb) {
             if (cb_fiber) {
-                cb_fiber->reset(task.cb);
+                cb_fiber->reset(std::move(task.cb));
             } else {
-                cb_fiber.reset(new Fiber(task.cb));
+                cb_fiber.reset(new Fiber(std::move(task.cb)));
             }
+            // 半路yield出去的话，之后按这个优先级放回来
+            cb_fiber->setPriority(task.priority);
+            t_task_priority   = task.priority;
+            uint64_t enqueued = task.enqueued;
             task.reset();
-            cb_fiber->resume();
+            runSlice(worker, cb_fiber.get(), t_task_priority, enqueued);
+            busy = true;
+            t_task_priority = -1;
             --m_activeThreadCount;
-            cb_fiber.reset();
+            // 执行完了并且没有别人持有，留着给下一个函数任务复用，避免每个任务都创建协程
+            // 半路yield出去的协程已经交给IO事件或定时器了，这里放手
+            if (cb_fiber->getState() != Fiber::TERM || cb_fiber.use_count() != 1) {
+                cb_fiber.reset();
+            }
         } else {
             // 进到这个分支情况一定是任务队列空了，调度idle协程即可
             if (idle_fiber->getState() == Fiber::TERM) {
                 // 如果调度器没有调度任务，那么idle协程会不停地resume/yield，不会结束，如果idle协程结束了，那一定是调度器停止了
                 SYLAR_LOG_DEBUG(g_logger) << "idle fiber term";
+                // stop()发出的tickle可能在其他线程进入idle之前就被消费掉了，退出前再唤醒一次，让还在idle的线程也能退出
+                tickle();
                 break;
             }
             ++m_idleThreadCount;
+            t_in_idle            = true;
+            m_workers[idx]->idle = true;
             idle_fiber->resume();
+            busy                 = false;
+            worker.lastPoll      = GetElapsedUS();
+            m_workers[idx]->idle = false;
+            t_in_idle            = false;
             --m_idleThreadCount;
         }
     }
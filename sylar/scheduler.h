@@ -9,12 +9,16 @@
 #define __SYLAR_SCHEDULER_H__
 
 #include <functional>
-#include <list>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include "fiber.h"
+#include "future.h"
 #include "log.h"
+#include "ring_buffer.h"
+#include "task.h"
 #include "thread.h"
+#include "watchdog.h"
 
 namespace sylar {
 
@@ -22,12 +26,76 @@ namespace sylar {
  * @brief 协程调度器
  * @details 封装的是N-M的协程调度器
  *          内部有一个线程池,支持协程在线程池里面切换
+ *          每个调度线程有自己的本地任务队列，调度线程内部添加的任务进本地队列，外部线程添加的任务进全局队列，
+ *          本地队列和全局队列都取不到任务时，随机从其他调度线程的本地队列窃取一半任务
  */
 class Scheduler {
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    /**
+     * @brief 任务优先级，数值越小越优先
+     * @details 调度线程总是先取高优先级的任务；连续跳过某个有任务的低优先级若干次(scheduler.starvation_limit)之后，
+     *          插一个低优先级的任务，低优先级不会饿死
+     */
+    enum Priority {
+        /// 协程沿用自己上次的优先级，函数沿用添加它的任务的优先级，都没有时为PRIORITY_NORMAL
+        PRIORITY_AUTO = -1,
+        /// 健康检查、管理接口这类不能排在大量请求后面的任务
+        PRIORITY_HIGH = 0,
+        /// 普通请求
+        PRIORITY_NORMAL = 1,
+        /// 批处理之类的后台任务
+        PRIORITY_LOW = 2,
+        /// 优先级个数
+        PRIORITY_COUNT = 3,
+    };
+
+    /**
+     * @brief 调度任务，协程/函数二选一，可指定在哪个线程上调度
+     * @details 只能移动，函数存放在Task的内置缓冲区里，入队出队都不分配内存
+     */
+    struct ScheduleTask {
+        Fiber::ptr fiber;
+        Task cb;
+        int thread;
+        /// 优先级，入队前确定下来，不会是PRIORITY_AUTO
+        int priority = PRIORITY_AUTO;
+        /// 入队时间(GetElapsedUS)，统计排队时长用，没打开StallWatchdog::IsSliceTimingEnabled()时为0
+        uint64_t enqueued = 0;
+
+        ScheduleTask(Fiber::ptr f, int thr, int prio = PRIORITY_AUTO) {
+            fiber    = std::move(f);
+            thread   = thr;
+            priority = prio;
+        }
+        ScheduleTask(Fiber::ptr *f, int thr, int prio = PRIORITY_AUTO) {
+            fiber.swap(*f);
+            thread   = thr;
+            priority = prio;
+        }
+        template <class F, class = typename std::enable_if<
+                               !std::is_convertible<F, Fiber::ptr>::value &&
+                               !std::is_convertible<F, Fiber::ptr *>::value>::type>
+        ScheduleTask(F &&f, int thr, int prio = PRIORITY_AUTO)
+            : cb(std::forward<F>(f)) {
+            thread   = thr;
+            priority = prio;
+        }
+        ScheduleTask() { thread = -1; }
+
+        ScheduleTask(ScheduleTask &&)            = default;
+        ScheduleTask &operator=(ScheduleTask &&) = default;
+
+        void reset() {
+            fiber    = nullptr;
+            cb       = nullptr;
+            thread   = -1;
+            priority = PRIORITY_AUTO;
+        }
+    };
+
     /**
      * @brief 创建调度器
      * @param[in] threads 线程数
@@ -46,6 +114,11 @@ public:
      */
     const std::string &getName() const { return m_name; }
 
+    /**
+     * @brief 返回调度线程总数，包括use_caller的caller线程
+     */
+    size_t getWorkerCount() const { return m_workers.size(); }
+
     /**
      * @brief 获取当前线程调度器指针
      */
@@ -58,23 +131,64 @@ public:
 
     /**
      * @brief 添加调度任务
-     * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
-     * @param[] fc 协程对象或指针
+     * @tparam FiberOrCb 调度任务类型，可以是协程对象、协程对象的指针或任意可调用对象
+     * @param[] fc 协程对象或指针，可调用对象传右值时一路移动到协程入口，不会拷贝
      * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+     * @param[] priority 优先级，见Priority，调度协程时指定了优先级会同时设置到协程上
      */
     template <class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
+    void schedule(FiberOrCb &&fc, int thread = -1, int priority = PRIORITY_AUTO) {
+        ScheduleTask task(std::forward<FiberOrCb>(fc), thread, priority);
+        scheduleTask(task);
+    }
+
+    /**
+     * @brief 在新协程里执行fn，返回它的结果
+     * @details fn的返回值或抛出的异常通过Future取回，等待只挂起等待方的协程
+     * @param[in] fn 可调用对象，不接受参数
+     * @param[in] thread 指定运行的线程号，-1表示任意线程
+     * @param[in] priority 优先级，见Priority
+     */
+    template <class F>
+    Future<typename std::result_of<typename std::decay<F>::type()>::type> async(F &&fn, int thread = -1, int priority = PRIORITY_AUTO) {
+        typedef typename std::decay<F>::type Fn;
+        typedef typename std::result_of<Fn()>::type Result;
+        Promise<Result> promise;
+        Future<Result> future = promise.getFuture();
+        Fn f(std::forward<F>(fn));
+        schedule([promise, f]() mutable {
+            promise.setWith(f);
+        }, thread, priority);
+        return future;
+    }
 
-        if (need_tickle) {
-            tickle(); // 唤醒idle协程
+    /**
+     * @brief 批量添加调度任务
+     * @details 元素会被移走，每批最多BATCH_SIZE个任务只加一次锁，并且按任务数唤醒空闲线程，而不是每个任务都tickle一次
+     * @tparam InputIterator 迭代器，元素类型是协程对象或可调用对象
+     */
+    template <class InputIterator>
+    void schedule(InputIterator begin, InputIterator end) {
+        static const size_t BATCH_SIZE = 32;
+        ScheduleTask tasks[BATCH_SIZE];
+        while (begin != end) {
+            size_t n = 0;
+            for (; begin != end && n < BATCH_SIZE; ++begin) {
+                tasks[n++] = ScheduleTask(std::move(*begin), -1);
+            }
+            scheduleBatch(tasks, n);
         }
     }
 
+    /**
+     * @brief 批量添加调度任务
+     * @details 未指定线程的任务一次加锁全部放入本地队列(调度线程内调用)或全局队列(外部线程调用)，
+     *          最后按任务数唤醒对应数量的空闲线程
+     * @param[in] tasks 任务数组，任务会被移走
+     * @param[in] n 任务个数
+     */
+    void scheduleBatch(ScheduleTask *tasks, size_t n);
+
     /**
      * @brief 启动调度器
      */
@@ -85,6 +199,44 @@ public:
      */
     void stop();
 
+    /**
+     * @brief 登记一个挂起等待外部线程唤醒的协程
+     * @details 协程把自己交给调度器之外的线程(如FileIoPool)，由对方完成后再schedule回来，
+     *          这期间调度器上可能既没有任务也没有IO事件，登记之后stop()会等它回来再退出
+     */
+    void addExternalWaiter() { ++m_externalWaiters; }
+
+    /**
+     * @brief 注销外部等待的协程，应在把协程schedule回来之后调用
+     */
+    void delExternalWaiter();
+
+    /**
+     * @brief 所有调度线程上协程单次运行时长的分布
+     */
+    RunSliceHistogram getRunSliceHistogram() const;
+
+    /**
+     * @brief 某个优先级排队中的任务数，包括全局队列和所有调度线程的本地队列
+     */
+    size_t getQueueDepth(int priority) const { return m_queued[priority]; }
+
+    /**
+     * @brief 某个优先级的任务从入队到开始运行的等待时长分布
+     * @details 和运行时长一样，只在StallWatchdog::IsSliceTimingEnabled()时统计
+     */
+    RunSliceHistogram getWaitHistogram(int priority) const;
+
+    /**
+     * @brief 找出当前协程已经连续运行超过budget_us的调度线程，由StallWatchdog定期调用
+     * @details 同一段运行只回调一次
+     * @param[in] now_us 当前时间，GetElapsedUS()
+     * @param[in] budget_us 允许连续运行的微秒数
+     * @param[in] cb 回调，参数是线程id、协程id和已经运行的微秒数
+     */
+    void checkStalls(uint64_t now_us, uint64_t budget_us,
+                     const std::function<void(int, uint64_t, uint64_t)> &cb);
+
 protected:
     /**
      * @brief 通知协程调度器有任务了
@@ -101,6 +253,12 @@ protected:
      */
     virtual void idle();
 
+    /**
+     * @brief 调度线程一直有任务、进不了idle时，每隔一段时间调用一次
+     * @details 用来不阻塞地收集已经就绪的事件，高优先级的事件不用等积压的任务跑完才被发现，默认什么也不做
+     */
+    virtual void busyPoll() {}
+
     /**
      * @brief 返回是否可以停止
      */
@@ -117,62 +275,156 @@ protected:
      */
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
-private:
     /**
-     * @brief 添加调度任务，无锁
-     * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
-     * @param[] fc 协程对象或指针
-     * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+     * @brief 通知指定的调度线程有任务了
+     * @details 指定了线程的任务只有那个线程能执行，默认实现等同于tickle()
+     * @param[in] idx 调度线程下标
      */
-    template <class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(fc, thread);
-        if (task.fiber || task.cb) {
-            m_tasks.push_back(task);
-        }
-        return need_tickle;
-    }
+    virtual void tickleWorker(size_t idx) { tickle(); }
 
-private:
     /**
-     * @brief 调度任务，协程/函数二选一，可指定在哪个线程上调度
+     * @brief 是否use caller，是的话下标0的调度线程是caller线程，只在stop()里参与调度
      */
-    struct ScheduleTask {
-        Fiber::ptr fiber;
-        std::function<void()> cb;
-        int thread;
+    bool isUseCaller() const { return m_useCaller; }
 
-        ScheduleTask(Fiber::ptr f, int thr) {
-            fiber  = f;
-            thread = thr;
-        }
-        ScheduleTask(Fiber::ptr *f, int thr) {
-            fiber.swap(*f);
-            thread = thr;
-        }
-        ScheduleTask(std::function<void()> f, int thr) {
-            cb     = f;
-            thread = thr;
-        }
-        ScheduleTask() { thread = -1; }
+    /**
+     * @brief 返回当前线程在本调度器里的下标，不是本调度器的调度线程返回-1
+     */
+    int getCurrentWorker() const;
 
-        void reset() {
-            fiber  = nullptr;
-            cb     = nullptr;
-            thread = -1;
+    /**
+     * @brief 返回指定的调度线程是否处于idle状态
+     */
+    bool isWorkerIdle(size_t idx) const { return m_workers[idx]->idle; }
+
+private:
+    /**
+     * @brief 调度线程的本地任务队列
+     */
+    struct WorkerQueue {
+        /// 保护两组队列
+        MutexType mutex;
+        /// 未指定线程的任务，按优先级分开，其他线程可以窃取
+        RingBuffer<ScheduleTask> tasks[PRIORITY_COUNT];
+        /// 指定在本线程上运行的任务，按优先级分开，不能被窃取
+        RingBuffer<ScheduleTask> pinned[PRIORITY_COUNT];
+        /// 从全局队列搬运或者窃取任务时的临时缓冲，只有本线程使用，不用加锁
+        RingBuffer<ScheduleTask> transfer;
+        /// tasks的总长度，窃取时不加锁先看一眼
+        std::atomic<size_t> size = {0};
+        /// 各优先级tasks的长度
+        std::atomic<size_t> levelSize[PRIORITY_COUNT] = {};
+        /// pinned的总长度
+        std::atomic<size_t> pinnedSize = {0};
+        /// 各优先级有任务却被跳过的连续次数，只有本线程访问
+        uint32_t skipped[PRIORITY_COUNT] = {};
+        /// 各优先级任务的排队时长分布
+        RunSliceHistogram waits[PRIORITY_COUNT];
+        /// 上次离开idle或者调用busyPoll()的时间，只有本线程访问
+        uint64_t lastPoll = 0;
+        /// 调度线程id，线程还没开始调度时为-1
+        std::atomic<int> threadId = {-1};
+        /// 是否正在执行idle协程
+        std::atomic<bool> idle = {false};
+        /// 当前协程开始运行的时间(GetElapsedUS)，没有协程在运行时为0
+        std::atomic<uint64_t> sliceStart = {0};
+        /// 当前运行的协程id
+        std::atomic<uint64_t> sliceFiber = {0};
+        /// 已经报告过卡顿的那段运行的开始时间，只有检测线程访问
+        uint64_t stallReported = 0;
+        /// 协程单次运行时长的分布
+        RunSliceHistogram slices;
+
+        /**
+         * @brief 按是否指定了线程放入对应的队列，调用方加锁
+         */
+        void push(ScheduleTask &&task) {
+            int priority = task.priority;
+            if (task.thread != -1) {
+                pinned[priority].push_back(std::move(task));
+                ++pinnedSize;
+            } else {
+                tasks[priority].push_back(std::move(task));
+                ++levelSize[priority];
+                ++size;
+            }
         }
     };
 
+    /**
+     * @brief 把任务放入对应的队列，必要时唤醒idle线程
+     * @details 指定了线程的任务放入该线程的pinned队列并唤醒该线程，调度线程内部添加的任务放入本地队列，其他情况放入全局队列
+     */
+    void scheduleTask(ScheduleTask &task);
+
+    /**
+     * @brief 查找线程id对应的调度线程下标，找不到返回-1
+     */
+    int getWorkerIndex(int thread) const;
+
+    /**
+     * @brief 确定任务的线程和优先级，记下入队时间
+     */
+    void prepareTask(ScheduleTask &task);
+
+    /**
+     * @brief 选这次要取的优先级，连续被跳过太多次的低优先级先取，都没有任务返回-1
+     */
+    int pickLevel(const WorkerQueue &worker) const;
+
+    /**
+     * @brief 从本地队列取一个任务，同一优先级先取pinned队列
+     * @param[in] level 只取这个优先级，-1表示从高到低取第一个有任务的
+     */
+    bool popLocal(size_t idx, ScheduleTask &task, int level);
+
+    /**
+     * @brief 从全局队列取一个任务，顺便再搬一批同一优先级未指定线程的任务到本地队列
+     * @param[out] tickle_me 全局队列里有指定给其他线程的任务时置为true
+     * @param[in] level 只取这个优先级，-1表示从高到低取第一个有任务的
+     */
+    bool popGlobal(size_t idx, ScheduleTask &task, bool &tickle_me, int level);
+
+    /**
+     * @brief 随机选一个其他调度线程，窃取其本地队列里某个优先级一半的任务
+     * @param[in] level 只窃取这个优先级，-1表示从高到低取第一个有任务的
+     */
+    bool steal(size_t idx, ScheduleTask &task, int level);
+
+    /**
+     * @brief 把取出来暂时不能执行的任务放回本地队列
+     */
+    void requeue(size_t idx, ScheduleTask &task);
+
+    /**
+     * @brief 把transfer里的任务搬到本地队列，第一个任务通过task返回
+     */
+    void takeTransfer(size_t idx, ScheduleTask &task);
+
+    /**
+     * @brief resume协程，打开了StallWatchdog::IsSliceTimingEnabled()时记录这段运行的开始时间和时长
+     * @param[in] priority 任务的优先级
+     * @param[in] enqueued 任务的入队时间，不为0时用这段运行的开始时间记一次排队时长
+     */
+    void runSlice(WorkerQueue &worker, Fiber *fiber, int priority, uint64_t enqueued);
+
 private:
     /// 协程调度器名称
     std::string m_name;
-    /// 互斥锁
+    /// 互斥锁，保护全局队列和线程池
     MutexType m_mutex;
     /// 线程池
     std::vector<Thread::ptr> m_threads;
-    /// 任务队列
-    std::list<ScheduleTask> m_tasks;
+    /// 全局任务队列，按优先级分开，非调度线程添加的任务先放这里
+    RingBuffer<ScheduleTask> m_tasks[PRIORITY_COUNT];
+    /// 每个调度线程的本地队列，use_caller时下标0是caller线程
+    std::vector<std::unique_ptr<WorkerQueue>> m_workers;
+    /// 下一个开始调度的线程使用的本地队列下标
+    std::atomic<size_t> m_nextWorker = {0};
+    /// 所有队列里的任务总数
+    std::atomic<size_t> m_taskCount = {0};
+    /// 所有队列里各优先级的任务数
+    std::atomic<size_t> m_queued[PRIORITY_COUNT] = {};
     /// 线程池的线程ID数组
     std::vector<int> m_threadIds;
     /// 工作线程数量，不包含use_caller的主线程
@@ -181,6 +433,8 @@ private:
     std::atomic<size_t> m_activeThreadCount = {0};
     /// idle线程数
     std::atomic<size_t> m_idleThreadCount = {0};
+    /// 挂起等待外部线程唤醒的协程数
+    std::atomic<size_t> m_externalWaiters = {0};
 
     /// 是否use caller
     bool m_useCaller;
@@ -5,6 +5,7 @@
 #include "macro.h"
 #include "hook.h"
 #include <limits.h>
+#include <sys/sendfile.h>
 
 namespace sylar {
 
@@ -69,7 +70,7 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx *ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -84,7 +85,7 @@ void Socket::setSendTimeout(int64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx *ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -134,7 +135,7 @@ Socket::ptr Socket::accept() {
 }
 
 bool Socket::init(int sock) {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
+    FdCtx *ctx = FdMgr::GetInstance()->get(sock);
     if (ctx && ctx->isSocket() && !ctx->isClose()) {
         m_sock        = sock;
         m_isConnected = true;
@@ -271,6 +272,27 @@ int Socket::send(const iovec *buffers, size_t length, int flags) {
     return -1;
 }
 
+int64_t Socket::sendFile(int fd, uint64_t offset, size_t length) {
+    if (!isConnected()) {
+        return -1;
+    }
+    off_t off   = offset;
+    size_t left = length;
+    while (left > 0) {
+        ssize_t rt = ::sendfile(m_sock, fd, &off, left);
+        if (rt < 0) {
+            // 已经发出去一部分时返回发出的字节数，调用方可以据此续传，errno保留出错原因
+            return left < length ? (int64_t)(length - left) : -1;
+        }
+        if (rt == 0) {
+            // 文件提前结束
+            break;
+        }
+        left -= rt;
+    }
+    return length - left;
+}
+
 int Socket::sendTo(const void *buffer, size_t length, const Address::ptr to, int flags) {
     if (isConnected()) {
         return ::sendto(m_sock, buffer, length, flags, to->getAddr(), to->getAddrLen());
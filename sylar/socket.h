@@ -210,6 +210,20 @@ public:
      */
     virtual int send(const iovec *buffers, size_t length, int flags = 0);
 
+    /**
+     * @brief 零拷贝发送文件的一段内容
+     * @details 通过sendfile实现，数据不经过用户态；在协程里发送缓冲区满时挂起等待，
+     *          受发送超时控制，一直发到length字节、文件结束或出错为止，不改变fd自己的文件偏移
+     * @param[in] fd 要发送的文件
+     * @param[in] offset 文件中的起始偏移
+     * @param[in] length 要发送的字节数
+     * @return
+     *      @retval >=0 发送的字节数，文件比offset+length短时小于length；
+     *                  发出一部分之后出错或超时也返回已发送的字节数，errno为对应的错误码
+     *      @retval <0 一个字节都没发出去就出错或超时，errno为对应的错误码
+     */
+    virtual int64_t sendFile(int fd, uint64_t offset, size_t length);
+
     /**
      * @brief 发送数据
      * @param[in] buffer 待发送数据的内存
@@ -0,0 +1,246 @@
+/**
+ * @file stack_allocator.cc
+ * @brief 协程栈内存分配器实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include <sstream>
+#include <vector>
+#include "stack_allocator.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_stack_allocator =
+    Config::Lookup<std::string>("fiber.stack_allocator", "pooled", "fiber stack allocator, malloc/mmap/pooled");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_thread_cached =
+    Config::Lookup<uint32_t>("fiber.stack_pool.thread_cached", 64, "max cached fiber stacks per thread");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_max_cached =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_cached", 1024, "max cached fiber stacks of all threads");
+
+static ConfigVar<float>::ptr g_stack_pool_trim_ratio =
+    Config::Lookup<float>("fiber.stack_pool.trim_ratio", 0.5f, "ratio of thread cached stacks released when trimming");
+
+//协程栈大小，可通过配置文件获取，默认128k，池化分配器只缓存这个大小的栈
+static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
+    Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
+
+/// 统计信息，所有分配器共用
+static std::atomic<uint64_t> s_live{0};
+static std::atomic<uint64_t> s_cached{0};
+static std::atomic<uint64_t> s_peak{0};
+
+static MallocStackAllocator s_malloc_allocator;
+static MmapStackAllocator s_mmap_allocator;
+static PooledStackAllocator s_pooled_allocator;
+
+/// 配置项的缓存值，避免每次创建协程都去读配置的读写锁
+static std::atomic<StackAllocator *> s_default_allocator{&s_pooled_allocator};
+static std::atomic<uint32_t> s_thread_cached{64};
+static std::atomic<uint32_t> s_max_cached{1024};
+static std::atomic<float> s_trim_ratio{0.5f};
+static std::atomic<uint32_t> s_stack_size{g_fiber_stack_size->getValue()};
+
+static size_t GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+static size_t RoundUpToPage(size_t size) {
+    size_t page = GetPageSize();
+    return (size + page - 1) / page * page;
+}
+
+static void OnStackAlloc() {
+    uint64_t live = ++s_live;
+    uint64_t peak = s_peak;
+    while (live > peak && !s_peak.compare_exchange_weak(peak, live)) {
+    }
+}
+
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        g_stack_allocator->addListener([](const std::string &old_value, const std::string &new_value) {
+            StackAllocator *allocator = StackAllocator::Lookup(new_value);
+            if (!allocator) {
+                SYLAR_LOG_ERROR(g_logger) << "invalid fiber.stack_allocator=" << new_value;
+                return;
+            }
+            SYLAR_LOG_INFO(g_logger) << "fiber stack allocator changed from "
+                                     << old_value << " to " << new_value;
+            s_default_allocator = allocator;
+        });
+        g_stack_pool_thread_cached->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_thread_cached = new_value;
+        });
+        g_stack_pool_max_cached->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_max_cached = new_value;
+        });
+        g_stack_pool_trim_ratio->addListener([](const float &old_value, const float &new_value) {
+            s_trim_ratio = new_value;
+        });
+        g_fiber_stack_size->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_stack_size = new_value;
+        });
+    }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+StackAllocator *StackAllocator::GetDefault() {
+    return s_default_allocator;
+}
+
+uint32_t StackAllocator::GetDefaultStackSize() {
+    return s_stack_size;
+}
+
+StackAllocator *StackAllocator::Lookup(const std::string &name) {
+    if (name == "malloc") {
+        return &s_malloc_allocator;
+    } else if (name == "mmap") {
+        return &s_mmap_allocator;
+    } else if (name == "pooled") {
+        return &s_pooled_allocator;
+    }
+    return nullptr;
+}
+
+StackAllocator::Stats StackAllocator::GetStats() {
+    Stats stats;
+    stats.live   = s_live;
+    stats.cached = s_cached;
+    stats.peak   = s_peak;
+    return stats;
+}
+
+std::string StackAllocator::StatsToString() {
+    Stats stats = GetStats();
+    std::stringstream ss;
+    ss << "[allocator=" << GetDefault()->getName()
+       << " live=" << stats.live
+       << " cached=" << stats.cached
+       << " peak=" << stats.peak << "]";
+    return ss.str();
+}
+
+void *MallocStackAllocator::alloc(size_t size) {
+    void *vp = malloc(size);
+    SYLAR_ASSERT2(vp, "malloc fiber stack fail, size=" << size);
+    OnStackAlloc();
+    return vp;
+}
+
+void MallocStackAllocator::dealloc(void *vp, size_t size) {
+    --s_live;
+    free(vp);
+}
+
+void *MmapStackAllocator::alloc(size_t size) {
+    size_t page  = GetPageSize();
+    size_t total = RoundUpToPage(size) + page;
+    void *base   = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    SYLAR_ASSERT2(base != MAP_FAILED, "mmap fiber stack fail, size=" << size
+                                          << " errno=" << errno << " errstr=" << strerror(errno));
+    // 栈从高地址向低地址增长，保护页放在最低端
+    int rt = mprotect(base, page, PROT_NONE);
+    SYLAR_ASSERT2(!rt, "mprotect guard page fail, errno=" << errno << " errstr=" << strerror(errno));
+    OnStackAlloc();
+    return (char *)base + page;
+}
+
+void MmapStackAllocator::dealloc(void *vp, size_t size) {
+    size_t page = GetPageSize();
+    --s_live;
+    munmap((char *)vp - page, RoundUpToPage(size) + page);
+}
+
+/**
+ * @brief 线程本地的栈缓存
+ * @details 只缓存大小等于fiber.stack_size的栈，配置修改之后，之前缓存的栈在下一次放入时全部释放
+ */
+struct StackCache {
+    size_t size = 0;
+    std::vector<void *> stacks;
+    /// 线程退出时已析构，之后释放的栈不再进入缓存
+    bool destroyed = false;
+
+    /**
+     * @brief 释放缓存的count个栈
+     */
+    void release(size_t count) {
+        while (count-- && !stacks.empty()) {
+            void *vp = stacks.back();
+            stacks.pop_back();
+            --s_cached;
+            // 缓存的栈不算在live中，这里先加回来，由MmapStackAllocator::dealloc减掉
+            ++s_live;
+            s_mmap_allocator.dealloc(vp, size);
+        }
+    }
+
+    ~StackCache() {
+        release(stacks.size());
+        destroyed = true;
+    }
+};
+
+static thread_local StackCache t_stack_cache;
+
+void *PooledStackAllocator::alloc(size_t size) {
+    StackCache &cache = t_stack_cache;
+    if (cache.size == size && !cache.stacks.empty()) {
+        void *vp = cache.stacks.back();
+        cache.stacks.pop_back();
+        --s_cached;
+        OnStackAlloc();
+        return vp;
+    }
+    return MmapStackAllocator::alloc(size);
+}
+
+void PooledStackAllocator::dealloc(void *vp, size_t size) {
+    StackCache &cache = t_stack_cache;
+    // 指定了栈大小的协程很少，它们的栈不缓存
+    if (cache.destroyed || size != s_stack_size || s_thread_cached == 0 || s_max_cached == 0) {
+        MmapStackAllocator::dealloc(vp, size);
+        return;
+    }
+    if (cache.size != size) {
+        // fiber.stack_size改过了，旧大小的栈不会再被分配出去
+        cache.release(cache.stacks.size());
+        cache.size = size;
+    }
+
+    if (cache.stacks.size() >= s_thread_cached || s_cached >= s_max_cached) {
+        size_t count = cache.stacks.size() * s_trim_ratio;
+        cache.release(count ? count : 1);
+        if (s_cached >= s_max_cached) {
+            // 当前线程的缓存已经释放过了，全局缓存仍然是满的，那这个栈就不要再缓存了
+            MmapStackAllocator::dealloc(vp, size);
+            return;
+        }
+    }
+
+    cache.stacks.push_back(vp);
+    --s_live;
+    ++s_cached;
+}
+
+void PooledStackAllocator::Trim() {
+    t_stack_cache.release(t_stack_cache.stacks.size());
+}
+
+} // namespace sylar
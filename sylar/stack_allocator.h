@@ -0,0 +1,126 @@
+/**
+ * @file stack_allocator.h
+ * @brief 协程栈内存分配器
+ * @details 提供malloc分配器，带保护页的mmap分配器，以及在mmap分配器基础上增加线程本地缓存的池化分配器，
+ *          协程使用哪种分配器由配置项fiber.stack_allocator决定
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_STACK_ALLOCATOR_H__
+#define __SYLAR_STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace sylar {
+
+/**
+ * @brief 协程栈分配器基类
+ */
+class StackAllocator {
+public:
+    /**
+     * @brief 协程栈统计信息
+     */
+    struct Stats {
+        /// 正在被协程使用的栈数量
+        uint64_t live = 0;
+        /// 被缓存起来等待复用的栈数量
+        uint64_t cached = 0;
+        /// 正在使用的栈数量的历史峰值
+        uint64_t peak = 0;
+    };
+
+    virtual ~StackAllocator() {}
+
+    /**
+     * @brief 分配栈内存
+     * @param[in] size 栈大小
+     * @return 栈的起始地址(低地址)
+     */
+    virtual void *alloc(size_t size) = 0;
+
+    /**
+     * @brief 释放栈内存
+     * @param[in] vp alloc返回的栈地址
+     * @param[in] size 分配时的栈大小
+     */
+    virtual void dealloc(void *vp, size_t size) = 0;
+
+    /**
+     * @brief 分配器名称
+     */
+    virtual const char *getName() const = 0;
+
+public:
+    /**
+     * @brief 根据配置项fiber.stack_allocator返回当前使用的分配器
+     */
+    static StackAllocator *GetDefault();
+
+    /**
+     * @brief 协程默认的栈大小，配置项fiber.stack_size
+     */
+    static uint32_t GetDefaultStackSize();
+
+    /**
+     * @brief 按名称查找分配器，名称可以是malloc, mmap, pooled
+     * @return 找不到返回nullptr
+     */
+    static StackAllocator *Lookup(const std::string &name);
+
+    /**
+     * @brief 获取所有分配器汇总的统计信息
+     */
+    static Stats GetStats();
+
+    /**
+     * @brief 以字符串形式输出统计信息
+     */
+    static std::string StatsToString();
+};
+
+/**
+ * @brief malloc栈内存分配器
+ */
+class MallocStackAllocator : public StackAllocator {
+public:
+    void *alloc(size_t size) override;
+    void dealloc(void *vp, size_t size) override;
+    const char *getName() const override { return "malloc"; }
+};
+
+/**
+ * @brief mmap栈内存分配器
+ * @details 每个栈在低地址端多映射一个PROT_NONE的保护页，栈溢出时直接触发SIGSEGV，而不是悄悄踩坏相邻内存
+ */
+class MmapStackAllocator : public StackAllocator {
+public:
+    void *alloc(size_t size) override;
+    void dealloc(void *vp, size_t size) override;
+    const char *getName() const override { return "mmap"; }
+};
+
+/**
+ * @brief 池化的mmap栈内存分配器
+ * @details 大小等于fiber.stack_size的栈释放时不立即munmap，而是放入线程本地的空闲链表，下次分配时直接复用，
+ *          其他大小的栈和mmap分配器一样直接释放。线程缓存数超过fiber.stack_pool.thread_cached，
+ *          或全局缓存数超过fiber.stack_pool.max_cached时，按fiber.stack_pool.trim_ratio比例释放线程缓存
+ */
+class PooledStackAllocator : public MmapStackAllocator {
+public:
+    void *alloc(size_t size) override;
+    void dealloc(void *vp, size_t size) override;
+    const char *getName() const override { return "pooled"; }
+
+    /**
+     * @brief 释放当前线程缓存的全部栈
+     */
+    static void Trim();
+};
+
+} // namespace sylar
+
+#endif
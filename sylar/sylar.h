@@ -30,10 +30,19 @@
 #include "env.h"
 #include "config.h"
 #include "thread.h"
+#include "stack_allocator.h"
+#include "task.h"
+#include "ring_buffer.h"
 #include "fiber.h"
+#include "fiber_mutex.h"
+#include "channel.h"
+#include "future.h"
 #include "scheduler.h"
+#include "parallel.h"
+#include "watchdog.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "file_io.h"
 #include "hook.h"
 #include "endian.h"
 #include "address.h"
@@ -0,0 +1,196 @@
+/**
+ * @file task.h
+ * @brief 只能移动的任务函数对象
+ * @details 类似std::function<void()>，但是不可拷贝，并且内置一块小缓冲区，
+ *          大小不超过缓冲区的可调用对象(函数指针、捕获少量变量的lambda、std::bind结果等)直接构造在缓冲区里，不需要堆分配，
+ *          从Scheduler::schedule()到协程入口函数一路都只做移动
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_TASK_H__
+#define __SYLAR_TASK_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+
+/**
+ * @brief 任务函数对象
+ */
+class Task {
+public:
+    /// 内置缓冲区大小，能放下一个std::function或者捕获了两三个智能指针的lambda
+    static const size_t INLINE_SIZE = 48;
+
+    Task() {}
+
+    Task(std::nullptr_t) {}
+
+    /**
+     * @brief 从任意可调用对象构造
+     * @details 空的函数指针或std::function构造出来的Task也是空的
+     */
+    template <class F, class = typename std::enable_if<
+                           !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&f) {
+        typedef typename std::decay<F>::type Fn;
+        if (IsNull(f)) {
+            return;
+        }
+        init<Fn>(std::forward<F>(f), std::integral_constant<bool, Inline<Fn>::value>());
+    }
+
+    Task(Task &&rhs) noexcept {
+        moveFrom(rhs);
+    }
+
+    Task &operator=(Task &&rhs) noexcept {
+        if (this != &rhs) {
+            clear();
+            moveFrom(rhs);
+        }
+        return *this;
+    }
+
+    Task &operator=(std::nullptr_t) {
+        clear();
+        return *this;
+    }
+
+    Task(const Task &)            = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() {
+        clear();
+    }
+
+    /**
+     * @brief 执行任务
+     */
+    void operator()() {
+        if (!m_ops) {
+            throw std::bad_function_call();
+        }
+        m_ops->invoke(m_buf);
+    }
+
+    /**
+     * @brief 是否为空
+     */
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    /**
+     * @brief 可调用对象是否直接存放在内置缓冲区里，用于测试
+     */
+    bool isInline() const { return m_ops && m_ops->inline_stored; }
+
+private:
+    /**
+     * @brief 类型擦除后的操作表，每种可调用对象类型一份
+     */
+    struct Ops {
+        /// 调用
+        void (*invoke)(void *buf);
+        /// 从src移动构造到dst，并析构src
+        void (*move)(void *dst, void *src);
+        /// 析构
+        void (*destroy)(void *buf);
+        /// 是否存放在内置缓冲区
+        bool inline_stored;
+    };
+
+    /**
+     * @brief 能放进内置缓冲区的条件，移动构造必须是noexcept，否则Task的移动就不能是noexcept
+     */
+    template <class Fn>
+    struct Inline {
+        static const bool value = sizeof(Fn) <= INLINE_SIZE &&
+                                  alignof(Fn) <= alignof(std::max_align_t) &&
+                                  std::is_nothrow_move_constructible<Fn>::value;
+    };
+
+    template <class Fn>
+    struct InlineOps {
+        static void Invoke(void *buf) {
+            (*static_cast<Fn *>(buf))();
+        }
+        static void Move(void *dst, void *src) {
+            new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+            static_cast<Fn *>(src)->~Fn();
+        }
+        static void Destroy(void *buf) {
+            static_cast<Fn *>(buf)->~Fn();
+        }
+        static const Ops ops;
+    };
+
+    template <class Fn>
+    struct HeapOps {
+        static void Invoke(void *buf) {
+            (**static_cast<Fn **>(buf))();
+        }
+        static void Move(void *dst, void *src) {
+            *static_cast<Fn **>(dst) = *static_cast<Fn **>(src);
+        }
+        static void Destroy(void *buf) {
+            delete *static_cast<Fn **>(buf);
+        }
+        static const Ops ops;
+    };
+
+    template <class Fn>
+    static bool IsNull(const Fn &) { return false; }
+    template <class R, class... Args>
+    static bool IsNull(R (*const &f)(Args...)) { return f == nullptr; }
+    template <class Sig>
+    static bool IsNull(const std::function<Sig> &f) { return !f; }
+
+    template <class Fn, class F>
+    void init(F &&f, std::true_type) {
+        new (m_buf) Fn(std::forward<F>(f));
+        m_ops = &InlineOps<Fn>::ops;
+    }
+
+    template <class Fn, class F>
+    void init(F &&f, std::false_type) {
+        *reinterpret_cast<Fn **>(m_buf) = new Fn(std::forward<F>(f));
+        m_ops                           = &HeapOps<Fn>::ops;
+    }
+
+    void moveFrom(Task &rhs) {
+        m_ops = rhs.m_ops;
+        if (m_ops) {
+            m_ops->move(m_buf, rhs.m_buf);
+            rhs.m_ops = nullptr;
+        }
+    }
+
+    void clear() {
+        if (m_ops) {
+            const Ops *ops = m_ops;
+            m_ops          = nullptr;
+            ops->destroy(m_buf);
+        }
+    }
+
+private:
+    /// 操作表，为空表示没有任务
+    const Ops *m_ops = nullptr;
+    /// 内置缓冲区，放不下时存放堆上对象的指针
+    alignas(std::max_align_t) char m_buf[INLINE_SIZE];
+};
+
+template <class Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = {&Invoke, &Move, &Destroy, true};
+
+template <class Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = {&Invoke, &Move, &Destroy, false};
+
+} // namespace sylar
+
+#endif
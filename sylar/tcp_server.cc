@@ -73,8 +73,13 @@ void TcpServer::startAccept(Socket::ptr sock) {
         Socket::ptr client = sock->accept();
         if(client) {
             client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
+            if(m_sharedStack) {
+                m_ioWorker->schedule(Fiber::ptr(new Fiber(std::bind(&TcpServer::handleClient,
+                        shared_from_this(), client), 0, true, true)));
+            } else {
+                m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
                         shared_from_this(), client));
+            }
         } else {
             SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
@@ -116,7 +121,8 @@ std::string TcpServer::toString(const std::string& prefix) {
        << " name=" << m_name
        << " io_worker=" << (m_ioWorker ? m_ioWorker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
-       << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
+       << " recv_timeout=" << m_recvTimeout
+       << " shared_stack=" << m_sharedStack << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for(auto& i : m_socks) {
         ss << pfx << pfx << *i << std::endl;
@@ -91,6 +91,17 @@ public:
      */
     bool isStop() const { return m_isStop;}
 
+    /**
+     * @brief 设置新连接的处理协程是否使用共享栈
+     * @details 大量长时间空闲的连接挂起在读操作上时，使用共享栈可以大幅减少每个连接占用的栈内存
+     */
+    void setSharedStack(bool v) { m_sharedStack = v;}
+
+    /**
+     * @brief 新连接的处理协程是否使用共享栈
+     */
+    bool isSharedStack() const { return m_sharedStack;}
+
     /**
      * @brief 以字符串形式dump server信息
      */
@@ -122,6 +133,8 @@ protected:
     std::string m_type;
     /// 服务是否停止
     bool m_isStop;
+    /// 新连接的处理协程是否使用共享栈
+    bool m_sharedStack = false;
 };
 
 }
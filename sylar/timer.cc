@@ -1,9 +1,63 @@
 #include "timer.h"
+#include <algorithm>
+#include "config.h"
 #include "util.h"
 #include "macro.h"
 
 namespace sylar {
 
+static ConfigVar<bool>::ptr g_timer_wheel =
+    Config::Lookup<bool>("timer.wheel", false, "use hierarchical timing wheel instead of sorted set for timers");
+
+/// 时间轮第0层的槽位数和位数
+static const int WHEEL_ROOT_BITS = 8;
+static const int WHEEL_ROOT_SIZE = 1 << WHEEL_ROOT_BITS;
+/// 上层每层的槽位数和位数
+static const int WHEEL_BITS = 6;
+static const int WHEEL_SIZE = 1 << WHEEL_BITS;
+/// 上层的层数，加上第0层一共能覆盖2^32微秒(约71分钟)，更远的定时器先挂在最高层，下放时再重新挂
+static const int WHEEL_LEVELS = 4;
+static const uint64_t WHEEL_SPAN = 1ull << (WHEEL_ROOT_BITS + WHEEL_BITS * WHEEL_LEVELS);
+
+/**
+ * @brief 上层level(从1开始)第一个槽位的下标
+ */
+static inline int WheelLevelBase(int level) {
+    return WHEEL_ROOT_SIZE + (level - 1) * WHEEL_SIZE;
+}
+
+/**
+ * @brief 上层level(从1开始)的槽位对应到期时间的哪几位
+ */
+static inline int WheelLevelShift(int level) {
+    return WHEEL_ROOT_BITS + (level - 1) * WHEEL_BITS;
+}
+
+/**
+ * @brief 在nbits位的环形位图里从start开始找第一个置位的位
+ * @return 相对start的偏移，没有置位的返回-1
+ */
+static int FindNextSlot(const uint64_t* bitmap, int nbits, int start) {
+    int words = nbits / 64;
+    int first = start / 64;
+    int shift = start % 64;
+    // 多看一次start所在的字，补上绕一圈回来的低位
+    for(int i = 0; i <= words; ++i) {
+        int w = (first + i) % words;
+        uint64_t bits = bitmap[w];
+        if(i == 0) {
+            bits &= ~0ull << shift;
+        } else if(i == words) {
+            bits &= shift ? ((1ull << shift) - 1) : 0;
+        }
+        if(bits) {
+            int slot = w * 64 + __builtin_ctzll(bits);
+            return (slot - start + nbits) % nbits;
+        }
+    }
+    return -1;
+}
+
 bool Timer::Comparator::operator()(const Timer::ptr& lhs
                         ,const Timer::ptr& rhs) const {
     if(!lhs && !rhs) {
@@ -25,83 +79,477 @@ bool Timer::Comparator::operator()(const Timer::ptr& lhs
 }
 
 
-Timer::Timer(uint64_t ms, std::function<void()> cb,
-             bool recurring, TimerManager* manager)
+Timer::Timer(uint64_t us, std::function<void()> cb,
+             bool recurring, TimerManager* manager, uint64_t slack)
     :m_recurring(recurring)
-    ,m_ms(ms)
+    ,m_us(us)
+    ,m_slack(slack)
     ,m_cb(cb)
     ,m_manager(manager) {
-    m_next = sylar::GetElapsedMS() + m_ms;
+    setDue(sylar::GetElapsedUS() + m_us);
 }
 
 Timer::Timer(uint64_t next)
-    :m_next(next) {
+    :m_next(next)
+    ,m_due(next) {
 }
 
-bool Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(m_cb) {
-        m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
-        return true;
+void Timer::setDue(uint64_t due) {
+    m_due = due;
+    if(m_slack > 1) {
+        m_next = (due + m_slack - 1) / m_slack * m_slack;
+    } else {
+        m_next = due;
     }
-    return false;
+}
+
+void Timer::resetDue(uint64_t us, bool from_now) {
+    uint64_t start = 0;
+    if(from_now) {
+        start = sylar::GetElapsedUS();
+    } else {
+        start = m_due - m_us;
+    }
+    m_us = us;
+    setDue(start + m_us);
+}
+
+bool Timer::cancel() {
+    return m_manager->cancelTimer(shared_from_this());
 }
 
 bool Timer::refresh() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
-        return false;
+    return m_manager->refreshTimer(shared_from_this());
+}
+
+bool Timer::reset(uint64_t ms, bool from_now) {
+    return m_manager->resetTimer(shared_from_this(), ms * 1000, from_now);
+}
+
+void Timer::start(uint64_t ms) {
+    SYLAR_ASSERT(m_reusable);
+    m_manager->startTimer(shared_from_this(), ms * 1000);
+}
+
+/**
+ * @brief 其他线程操作分片里的定时器时投递给归属线程的消息
+ */
+struct TimerMessage {
+    enum Type {
+        ADD,
+        CANCEL,
+        REFRESH,
+        RESET,
+        START,
+    };
+
+    TimerMessage(Type t, const Timer::ptr& tm)
+        :type(t)
+        ,timer(tm) {
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
-        return false;
+
+    Type type;
+    Timer::ptr timer;
+    /// RESET的间隔，START的到期时间(微秒)
+    uint64_t us = 0;
+    bool from_now = false;
+    /// START对应的Timer::m_generation，处理时已经不是最新的就丢掉
+    uint32_t generation = 0;
+    TimerMessage* next = nullptr;
+};
+
+/**
+ * @brief 定时器分片，保存定时器的有序集合或者时间轮
+ * @details 本身不加锁，非分片模式下由TimerManager用mutex保护，分片模式下只有归属线程访问，
+ *          只有消息队列可以被任意线程写入
+ */
+class TimerShard {
+public:
+    typedef RWMutex RWMutexType;
+
+    TimerShard(bool wheel);
+
+    ~TimerShard();
+
+    /**
+     * @brief 添加定时器
+     * @return 定时器是否成了最早到期的定时器
+     */
+    bool add(const Timer::ptr& timer);
+
+    /**
+     * @brief 摘下定时器
+     * @return 定时器不在分片里时返回false
+     */
+    bool remove(const Timer::ptr& timer);
+
+    /**
+     * @brief 最近一个定时器的到期时间，时间轮模式下是下界，没有定时器返回~0ull
+     */
+    uint64_t nextExpire() const;
+
+    /**
+     * @brief 摘下到now_us为止到期的定时器放入expired
+     */
+    void expire(uint64_t now_us, std::vector<Timer::ptr>& expired);
+
+    /**
+     * @brief 是否没有定时器，任意线程可以调用
+     */
+    bool empty() const { return m_count == 0; }
+
+    /**
+     * @brief 投递消息，任意线程可以调用
+     */
+    void post(TimerMessage* msg);
+
+    /**
+     * @brief 取出所有消息，按投递顺序排列
+     */
+    TimerMessage* takeMessages();
+
+    /**
+     * @brief 是否有还没处理的消息，任意线程可以调用
+     */
+    bool hasMessages() const { return m_inbox.load(std::memory_order_acquire) != nullptr; }
+public:
+    /// 非分片模式下保护整个分片
+    RWMutexType mutex;
+    /// 是否触发onTimerInsertedAtFront
+    bool tickled = false;
+private:
+    /**
+     * @brief 检测服务器时间是否被调后了
+     */
+    bool detectClockRollover(uint64_t now_us);
+
+    /**
+     * @brief 按到期时间把定时器挂到时间轮对应的槽位上，已经过期的挂到马上要处理的槽位
+     */
+    void wheelAdd(Timer* timer);
+
+    /**
+     * @brief 把定时器从所在槽位的链表上摘下来
+     */
+    void wheelRemove(Timer* timer);
+
+    /**
+     * @brief 时间轮最近一个定时器到期时间的下界
+     * @details 第0层是精确的，上层返回槽位下放的时间，最多多醒一次
+     */
+    uint64_t wheelNextExpire() const;
+
+    /**
+     * @brief 时间轮走到now_us，到期的定时器放入expired
+     */
+    void wheelAdvance(uint64_t now_us, std::vector<Timer::ptr>& expired);
+
+    /**
+     * @brief 把上层的一个槽位整体下放
+     */
+    void wheelCascade(int slot);
+private:
+    /// 是否使用时间轮
+    bool m_useWheel = false;
+    /// 定时器集合
+    std::set<Timer::ptr, Timer::Comparator> m_timers;
+    /// 上次执行时间
+    uint64_t m_previouseTime = 0;
+    /// 时间轮所有层的槽位链表头，第0层在前
+    std::vector<Timer*> m_wheel;
+    /// 非空槽位的位图，下标和m_wheel一一对应
+    uint64_t m_wheelBitmap[8] = {0};
+    /// 时间轮下一个要处理的时间(微秒)
+    uint64_t m_wheelTime = 0;
+    /// 定时器数量
+    std::atomic<size_t> m_count = {0};
+    /// 其他线程投递的消息，后进先出的无锁链表
+    std::atomic<TimerMessage*> m_inbox = {nullptr};
+};
+
+TimerShard::TimerShard(bool wheel)
+    :m_useWheel(wheel) {
+    m_previouseTime = sylar::GetElapsedUS();
+    if(m_useWheel) {
+        m_wheel.resize(WheelLevelBase(WHEEL_LEVELS + 1), nullptr);
+        m_wheelTime = m_previouseTime;
     }
-    m_manager->m_timers.erase(it);
-    m_next = sylar::GetElapsedMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
-    return true;
 }
 
-bool Timer::reset(uint64_t ms, bool from_now) {
-    if(ms == m_ms && !from_now) {
+TimerShard::~TimerShard() {
+    TimerMessage* msg = takeMessages();
+    while(msg) {
+        TimerMessage* next = msg->next;
+        delete msg;
+        msg = next;
+    }
+    // 时间轮里的定时器持有自己的引用，要手动释放
+    for(auto& head : m_wheel) {
+        while(head) {
+            Timer* timer = head;
+            wheelRemove(timer);
+            timer->m_self.reset();
+        }
+    }
+}
+
+bool TimerShard::add(const Timer::ptr& timer) {
+    if(m_useWheel) {
+        bool at_front = timer->m_next < wheelNextExpire();
+        timer->m_self = timer;
+        wheelAdd(timer.get());
+        return at_front;
+    }
+    auto it = m_timers.insert(timer).first;
+    ++m_count;
+    return it == m_timers.begin();
+}
+
+bool TimerShard::remove(const Timer::ptr& timer) {
+    if(m_useWheel) {
+        if(timer->m_wheelSlot < 0) {
+            return false;
+        }
+        wheelRemove(timer.get());
+        timer->m_self.reset();
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
+    auto it = m_timers.find(timer);
+    if(it == m_timers.end()) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
-        return false;
+    m_timers.erase(it);
+    --m_count;
+    return true;
+}
+
+uint64_t TimerShard::nextExpire() const {
+    if(m_useWheel) {
+        return wheelNextExpire();
     }
-    m_manager->m_timers.erase(it);
-    uint64_t start = 0;
-    if(from_now) {
-        start = sylar::GetElapsedMS();
+    return m_timers.empty() ? ~0ull : (*m_timers.begin())->m_next;
+}
+
+void TimerShard::expire(uint64_t now_us, std::vector<Timer::ptr>& expired) {
+    if(m_useWheel) {
+        // 时间轮只在有定时器到期的槽位上做事，其余的槽位直接跳过
+        if(wheelNextExpire() > now_us) {
+            return;
+        }
+        wheelAdvance(now_us, expired);
+        return;
+    }
+    if(m_timers.empty()) {
+        return;
+    }
+    bool rollover = false;
+    if(SYLAR_UNLIKELY(detectClockRollover(now_us))) {
+        // 使用clock_gettime(CLOCK_MONOTONIC_RAW)，应该不可能出现时间回退的问题
+        rollover = true;
+    }
+    if(!rollover && ((*m_timers.begin())->m_next > now_us)) {
+        return;
+    }
+
+    Timer::ptr now_timer(new Timer(now_us));
+    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
+    while(it != m_timers.end() && (*it)->m_next == now_us) {
+        ++it;
+    }
+    expired.insert(expired.end(), m_timers.begin(), it);
+    m_timers.erase(m_timers.begin(), it);
+    m_count = m_timers.size();
+}
+
+void TimerShard::post(TimerMessage* msg) {
+    TimerMessage* head = m_inbox.load(std::memory_order_relaxed);
+    do {
+        msg->next = head;
+    } while(!m_inbox.compare_exchange_weak(head, msg, std::memory_order_release,
+                                           std::memory_order_relaxed));
+}
+
+TimerMessage* TimerShard::takeMessages() {
+    if(!hasMessages()) {
+        return nullptr;
+    }
+    TimerMessage* msg = m_inbox.exchange(nullptr, std::memory_order_acquire);
+    // 链表是后进先出的，翻转成投递顺序，保证同一个定时器的ADD先于其他操作处理
+    TimerMessage* ordered = nullptr;
+    while(msg) {
+        TimerMessage* next = msg->next;
+        msg->next = ordered;
+        ordered = msg;
+        msg = next;
+    }
+    return ordered;
+}
+
+bool TimerShard::detectClockRollover(uint64_t now_us) {
+    bool rollover = false;
+    if(now_us < m_previouseTime &&
+            now_us < (m_previouseTime - 60 * 60 * 1000000ull)) {
+        rollover = true;
+    }
+    m_previouseTime = now_us;
+    return rollover;
+}
+
+void TimerShard::wheelAdd(Timer* timer) {
+    if(!m_count) {
+        // 时间轮空着的时候没人推进m_wheelTime，先对齐到当前时间，免得下次推进时空转
+        m_wheelTime = std::max(m_wheelTime, sylar::GetElapsedUS());
+    }
+    uint64_t expires = std::max(timer->m_next, m_wheelTime);
+    uint64_t delta = expires - m_wheelTime;
+    int slot = 0;
+    if(delta < (uint64_t)WHEEL_ROOT_SIZE) {
+        slot = expires & (WHEEL_ROOT_SIZE - 1);
     } else {
-        start = m_next - m_ms;
+        // 超出时间轮跨度的先挂在最高层最远的槽位上，下放时再按真实的到期时间重新挂
+        if(delta >= WHEEL_SPAN) {
+            expires = m_wheelTime + WHEEL_SPAN - 1;
+            delta = WHEEL_SPAN - 1;
+        }
+        int level = 1;
+        while(delta >= (1ull << WheelLevelShift(level + 1))) {
+            ++level;
+        }
+        slot = WheelLevelBase(level) + ((expires >> WheelLevelShift(level)) & (WHEEL_SIZE - 1));
     }
-    m_ms = ms;
-    m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
-    return true;
 
+    timer->m_wheelSlot = slot;
+    timer->m_wheelPrev = nullptr;
+    timer->m_wheelNext = m_wheel[slot];
+    if(timer->m_wheelNext) {
+        timer->m_wheelNext->m_wheelPrev = timer;
+    }
+    m_wheel[slot] = timer;
+    m_wheelBitmap[slot / 64] |= 1ull << (slot % 64);
+    ++m_count;
+}
+
+void TimerShard::wheelRemove(Timer* timer) {
+    int slot = timer->m_wheelSlot;
+    if(timer->m_wheelPrev) {
+        timer->m_wheelPrev->m_wheelNext = timer->m_wheelNext;
+    } else {
+        m_wheel[slot] = timer->m_wheelNext;
+        if(!m_wheel[slot]) {
+            m_wheelBitmap[slot / 64] &= ~(1ull << (slot % 64));
+        }
+    }
+    if(timer->m_wheelNext) {
+        timer->m_wheelNext->m_wheelPrev = timer->m_wheelPrev;
+    }
+    timer->m_wheelPrev = timer->m_wheelNext = nullptr;
+    timer->m_wheelSlot = -1;
+    --m_count;
+}
+
+uint64_t TimerShard::wheelNextExpire() const {
+    if(!m_count) {
+        return ~0ull;
+    }
+    uint64_t next = ~0ull;
+    // 第0层槽位里的定时器到期时间就是槽位对应的时间
+    int offset = FindNextSlot(m_wheelBitmap, WHEEL_ROOT_SIZE, m_wheelTime & (WHEEL_ROOT_SIZE - 1));
+    if(offset >= 0) {
+        next = m_wheelTime + offset;
+    }
+    // 上层的槽位在它下放时才会挂到第0层，当前下标的槽位只有正好在边界上还没推进时才没下放
+    for(int level = 1; level <= WHEEL_LEVELS; ++level) {
+        int shift = WheelLevelShift(level);
+        uint64_t start = m_wheelTime >> shift;
+        if(m_wheelTime & ((1ull << shift) - 1)) {
+            ++start;
+        }
+        offset = FindNextSlot(&m_wheelBitmap[WheelLevelBase(level) / 64], WHEEL_SIZE,
+                              start & (WHEEL_SIZE - 1));
+        if(offset >= 0) {
+            next = std::min(next, (start + offset) << shift);
+        }
+    }
+    return next;
+}
+
+void TimerShard::wheelCascade(int slot) {
+    while(Timer* timer = m_wheel[slot]) {
+        wheelRemove(timer);
+        wheelAdd(timer);
+    }
+}
+
+void TimerShard::wheelAdvance(uint64_t now_us, std::vector<Timer::ptr>& expired) {
+    while(m_wheelTime <= now_us) {
+        if(!m_count) {
+            m_wheelTime = now_us + 1;
+            break;
+        }
+        int idx = m_wheelTime & (WHEEL_ROOT_SIZE - 1);
+        if(idx == 0) {
+            // 第0层转完一圈，下放第1层的下一个槽位，第1层也转完一圈时继续往上
+            for(int level = 1; level <= WHEEL_LEVELS; ++level) {
+                int i = (m_wheelTime >> WheelLevelShift(level)) & (WHEEL_SIZE - 1);
+                wheelCascade(WheelLevelBase(level) + i);
+                if(i) {
+                    break;
+                }
+            }
+        }
+        while(Timer* timer = m_wheel[idx]) {
+            wheelRemove(timer);
+            expired.push_back(std::move(timer->m_self));
+        }
+        ++m_wheelTime;
+        // 直接跳到第0层下一个有定时器的槽位，最远跳到下一次下放的时间
+        if(m_wheelTime & (WHEEL_ROOT_SIZE - 1)) {
+            uint64_t next = (m_wheelTime | (WHEEL_ROOT_SIZE - 1)) + 1;
+            int offset = FindNextSlot(m_wheelBitmap, WHEEL_ROOT_SIZE, m_wheelTime & (WHEEL_ROOT_SIZE - 1));
+            if(offset >= 0) {
+                next = std::min(next, m_wheelTime + offset);
+            }
+            m_wheelTime = std::min(now_us + 1, next);
+        }
+    }
 }
 
 TimerManager::TimerManager() {
-    m_previouseTime = sylar::GetElapsedMS();
+    m_useWheel = g_timer_wheel->getValue();
+    m_shards.emplace_back(new TimerShard(m_useWheel));
 }
 
 TimerManager::~TimerManager() {
 }
 
+void TimerManager::setTimerShards(size_t shards) {
+    SYLAR_ASSERT(shards > 0 && !hasTimer());
+    m_shards.clear();
+    for(size_t i = 0; i < shards; ++i) {
+        m_shards.emplace_back(new TimerShard(m_useWheel));
+    }
+    m_owned = true;
+}
+
+size_t TimerManager::selectTimerShard() {
+    int shard = getTimerShard();
+    if(shard >= 0) {
+        return shard;
+    }
+    return m_nextShard++ % m_shards.size();
+}
+
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
-                                  ,bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
-    RWMutexType::WriteLock lock(m_mutex);
-    addTimer(timer, lock);
+                                  ,bool recurring, uint64_t slack) {
+    Timer::ptr timer(new Timer(ms * 1000, cb, recurring, this, slack * 1000));
+    insertTimer(timer, true);
+    return timer;
+}
+
+Timer::ptr TimerManager::addTimerUS(uint64_t us, std::function<void()> cb
+                                    ,bool recurring) {
+    Timer::ptr timer(new Timer(us, cb, recurring, this));
+    insertTimer(timer, true);
     return timer;
 }
 
@@ -114,94 +562,388 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
 
 Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
                                     ,std::weak_ptr<void> weak_cond
-                                    ,bool recurring) {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+                                    ,bool recurring, uint64_t slack) {
+    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, slack);
+}
+
+Timer::ptr TimerManager::createTimer(std::function<void()> cb, uint64_t slack) {
+    Timer::ptr timer(new Timer(0, cb, false, this, slack * 1000));
+    timer->m_reusable = true;
+    timer->m_done = true;
+    if(m_owned) {
+        timer->m_shard = selectTimerShard();
+    }
+    return timer;
+}
+
+void TimerManager::insertTimer(const Timer::ptr& timer, bool tickle) {
+    if(!m_owned) {
+        TimerShard& shard = *m_shards[0];
+        RWMutexType::WriteLock lock(shard.mutex);
+        bool at_front = shard.add(timer) && tickle && !shard.tickled;
+        if(at_front) {
+            shard.tickled = true;
+        }
+        lock.unlock();
+
+        if(at_front) {
+            onTimerInsertedAtFront();
+        }
+        return;
+    }
+
+    timer->m_shard = selectTimerShard();
+    if((int)timer->m_shard == getTimerShard()) {
+        // 归属线程自己添加的不用通知，它回到idle时会重新计算超时
+        m_shards[timer->m_shard]->add(timer);
+        return;
+    }
+    m_shards[timer->m_shard]->post(new TimerMessage(TimerMessage::ADD, timer));
+    onShardMessage(timer->m_shard);
+}
+
+bool TimerManager::cancelTimer(const Timer::ptr& timer) {
+    if(!m_owned) {
+        TimerShard& shard = *m_shards[0];
+        RWMutexType::WriteLock lock(shard.mutex);
+        ++timer->m_generation;
+        if(timer->m_done) {
+            return false;
+        }
+        timer->m_done = true;
+        shard.remove(timer);
+        if(!timer->m_reusable) {
+            timer->m_cb = nullptr;
+        }
+        return true;
+    }
+
+    // 先让还没处理的START失效，m_done可能是被过期的那次启动触发时置上的
+    ++timer->m_generation;
+    if(timer->m_done.exchange(true)) {
+        return false;
+    }
+    if((int)timer->m_shard == getTimerShard()) {
+        m_shards[timer->m_shard]->remove(timer);
+        if(!timer->m_reusable) {
+            timer->m_cb = nullptr;
+        }
+        return true;
+    }
+    // 有了m_done标志定时器就不会再触发，归属线程收到消息后再把它摘下来，回调也在那边释放
+    m_shards[timer->m_shard]->post(new TimerMessage(TimerMessage::CANCEL, timer));
+    onShardMessage(timer->m_shard);
+    return true;
+}
+
+bool TimerManager::refreshTimer(const Timer::ptr& timer) {
+    if(!m_owned) {
+        TimerShard& shard = *m_shards[0];
+        RWMutexType::WriteLock lock(shard.mutex);
+        if(timer->m_done) {
+            return false;
+        }
+        if(!shard.remove(timer)) {
+            return false;
+        }
+        timer->setDue(sylar::GetElapsedUS() + timer->m_us);
+        shard.add(timer);
+        return true;
+    }
+
+    if(timer->m_done) {
+        return false;
+    }
+    if((int)timer->m_shard == getTimerShard()) {
+        TimerShard& shard = *m_shards[timer->m_shard];
+        if(!shard.remove(timer)) {
+            return false;
+        }
+        timer->setDue(sylar::GetElapsedUS() + timer->m_us);
+        shard.add(timer);
+        return true;
+    }
+    m_shards[timer->m_shard]->post(new TimerMessage(TimerMessage::REFRESH, timer));
+    onShardMessage(timer->m_shard);
+    return true;
+}
+
+bool TimerManager::resetTimer(const Timer::ptr& timer, uint64_t us, bool from_now) {
+    if(!m_owned) {
+        if(us == timer->m_us && !from_now) {
+            return true;
+        }
+        TimerShard& shard = *m_shards[0];
+        RWMutexType::WriteLock lock(shard.mutex);
+        if(timer->m_done) {
+            return false;
+        }
+        if(!shard.remove(timer)) {
+            return false;
+        }
+        timer->resetDue(us, from_now);
+        bool at_front = shard.add(timer) && !shard.tickled;
+        if(at_front) {
+            shard.tickled = true;
+        }
+        lock.unlock();
+
+        if(at_front) {
+            onTimerInsertedAtFront();
+        }
+        return true;
+    }
+
+    if(timer->m_done) {
+        return false;
+    }
+    if((int)timer->m_shard == getTimerShard()) {
+        if(us == timer->m_us && !from_now) {
+            return true;
+        }
+        TimerShard& shard = *m_shards[timer->m_shard];
+        if(!shard.remove(timer)) {
+            return false;
+        }
+        timer->resetDue(us, from_now);
+        shard.add(timer);
+        return true;
+    }
+    // m_us和m_next只能由归属线程修改
+    TimerMessage* msg = new TimerMessage(TimerMessage::RESET, timer);
+    msg->us = us;
+    msg->from_now = from_now;
+    m_shards[timer->m_shard]->post(msg);
+    onShardMessage(timer->m_shard);
+    return true;
+}
+
+void TimerManager::startTimer(const Timer::ptr& timer, uint64_t us) {
+    uint64_t next = sylar::GetElapsedUS() + us;
+    if(!m_owned) {
+        TimerShard& shard = *m_shards[0];
+        RWMutexType::WriteLock lock(shard.mutex);
+        shard.remove(timer);
+        timer->m_done = false;
+        timer->m_armedGeneration = ++timer->m_generation;
+        timer->m_us = us;
+        timer->setDue(next);
+        bool at_front = shard.add(timer) && !shard.tickled;
+        if(at_front) {
+            shard.tickled = true;
+        }
+        lock.unlock();
+
+        if(at_front) {
+            onTimerInsertedAtFront();
+        }
+        return;
+    }
+
+    // 先换代再清m_done：归属线程正在触发旧的那次启动时，看到代数变了就不会再把m_done置上
+    uint32_t generation = ++timer->m_generation;
+    timer->m_done = false;
+    if((int)timer->m_shard == getTimerShard()) {
+        TimerShard& shard = *m_shards[timer->m_shard];
+        shard.remove(timer);
+        timer->m_armedGeneration = generation;
+        timer->m_us = us;
+        timer->setDue(next);
+        shard.add(timer);
+        return;
+    }
+    // 定时器可能还挂在分片里，到期时间只能由归属线程修改，分片也不能换，保证和之前的CANCEL按顺序处理
+    TimerMessage* msg = new TimerMessage(TimerMessage::START, timer);
+    msg->us = next;
+    msg->generation = generation;
+    m_shards[timer->m_shard]->post(msg);
+    onShardMessage(timer->m_shard);
+}
+
+void TimerManager::handleShardMessages(TimerShard& shard) {
+    TimerMessage* msg = shard.takeMessages();
+    while(msg) {
+        Timer::ptr& timer = msg->timer;
+        switch(msg->type) {
+        case TimerMessage::ADD:
+            // 还没加进来就被取消了
+            if(timer->m_done) {
+                timer->m_cb = nullptr;
+            } else {
+                shard.add(timer);
+            }
+            break;
+        case TimerMessage::CANCEL:
+            shard.remove(timer);
+            if(!timer->m_reusable) {
+                timer->m_cb = nullptr;
+            }
+            break;
+        case TimerMessage::REFRESH:
+            if(!timer->m_done && shard.remove(timer)) {
+                timer->setDue(sylar::GetElapsedUS() + timer->m_us);
+                shard.add(timer);
+            }
+            break;
+        case TimerMessage::RESET:
+            if(!timer->m_done && shard.remove(timer)) {
+                timer->resetDue(msg->us, msg->from_now);
+                shard.add(timer);
+            }
+            break;
+        case TimerMessage::START:
+            // 之后又被启动或者取消过的就不用加了，以最后一次为准；
+            // 不能看m_done，旧的那次启动可能刚在这边触发过，把m_done置上了
+            if(msg->generation == timer->m_generation) {
+                shard.remove(timer);
+                timer->m_done = false;
+                timer->m_armedGeneration = msg->generation;
+                timer->m_us = msg->us - std::min(msg->us, sylar::GetElapsedUS());
+                timer->setDue(msg->us);
+                shard.add(timer);
+            }
+            break;
+        }
+        TimerMessage* next = msg->next;
+        delete msg;
+        msg = next;
+    }
 }
 
 uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if(m_timers.empty()) {
+    uint64_t us = getNextTimerUS();
+    if(us == ~0ull) {
+        return ~0ull;
+    }
+    // 向上取整，按毫秒等待时不会早醒
+    return (us + 999) / 1000;
+}
+
+uint64_t TimerManager::getNextTimerUS() {
+    uint64_t next = ~0ull;
+    if(!m_owned) {
+        TimerShard& shard = *m_shards[0];
+        RWMutexType::ReadLock lock(shard.mutex);
+        shard.tickled = false;
+        next = shard.nextExpire();
+    } else {
+        int idx = getTimerShard();
+        if(idx < 0) {
+            return ~0ull;
+        }
+        TimerShard& shard = *m_shards[idx];
+        handleShardMessages(shard);
+        next = shard.nextExpire();
+    }
+    if(next == ~0ull) {
         return ~0ull;
     }
 
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = sylar::GetElapsedMS();
-    if(now_ms >= next->m_next) {
+    uint64_t now_us = sylar::GetElapsedUS();
+    if(now_us >= next) {
         return 0;
     } else {
-        return next->m_next - now_ms;
+        return next - now_us;
     }
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
-    uint64_t now_ms = sylar::GetElapsedMS();
+    uint64_t now_us = sylar::GetElapsedUS();
     std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lock(m_mutex);
-        if(m_timers.empty()) {
-            return;
+    if(!m_owned) {
+        TimerShard& shard = *m_shards[0];
+        {
+            RWMutexType::ReadLock lock(shard.mutex);
+            if(shard.empty()) {
+                return;
+            }
         }
-    }
-    RWMutexType::WriteLock lock(m_mutex);
-    if(m_timers.empty()) {
+        RWMutexType::WriteLock lock(shard.mutex);
+        shard.expire(now_us, expired);
+        fireExpired(shard, now_us, expired, cbs);
         return;
     }
-    bool rollover = false;
-    if(SYLAR_UNLIKELY(detectClockRollover(now_ms))) {
-        // 使用clock_gettime(CLOCK_MONOTONIC_RAW)，应该不可能出现时间回退的问题
-        rollover = true;
-    }
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+
+    int idx = getTimerShard();
+    if(idx < 0) {
         return;
     }
+    TimerShard& shard = *m_shards[idx];
+    handleShardMessages(shard);
+    shard.expire(now_us, expired);
+    fireExpired(shard, now_us, expired, cbs);
+}
 
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
+void TimerManager::fireExpired(TimerShard& shard, uint64_t now_us
+                               ,std::vector<Timer::ptr>& expired
+                               ,std::vector<std::function<void()> >& cbs) {
+    if(expired.empty()) {
+        return;
     }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
+    // 被slack推迟过的定时器按原来的到期时间排序，不同的时间点在没有slack时各要唤醒一次
+    bool deferred = false;
+    for(auto& timer : expired) {
+        if(timer->m_due != timer->m_next) {
+            deferred = true;
+            break;
+        }
+    }
+    if(deferred) {
+        std::sort(expired.begin(), expired.end(), [](const Timer::ptr& lhs, const Timer::ptr& rhs) {
+            return lhs->m_due < rhs->m_due;
+        });
+        uint64_t saved = 0;
+        for(size_t i = 1; i < expired.size(); ++i) {
+            if(expired[i]->m_due != expired[i - 1]->m_due) {
+                ++saved;
+            }
+        }
+        m_slackSaved.fetch_add(saved, std::memory_order_relaxed);
+    }
+    m_firedCount.fetch_add(expired.size(), std::memory_order_relaxed);
+    m_batchCount.fetch_add(1, std::memory_order_relaxed);
 
+    cbs.reserve(cbs.size() + expired.size());
     for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
+        // 分片模式下其他线程可能已经取消或者重新启动了它，只是消息还没处理；
+        // 重新启动过的是过期的那次，不触发也不碰m_done，新的那次由START消息挂上
+        if(timer->m_armedGeneration != timer->m_generation) {
+            if(!timer->m_reusable) {
+                timer->m_cb = nullptr;
+            }
+            continue;
+        }
+        if(timer->m_recurring ? timer->m_done.load() : timer->m_done.exchange(true)) {
+            if(!timer->m_reusable) {
+                timer->m_cb = nullptr;
+            }
+            continue;
+        }
         if(timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            cbs.push_back(timer->m_cb);
+            timer->setDue(now_us + timer->m_us);
+            shard.add(timer);
+        } else if(timer->m_reusable) {
+            cbs.push_back(timer->m_cb);
         } else {
+            // 一次性定时器的回调不会再用，直接移走，省一次拷贝
+            cbs.push_back(std::move(timer->m_cb));
             timer->m_cb = nullptr;
         }
     }
 }
 
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if(at_front) {
-        m_tickled = true;
-    }
-    lock.unlock();
-
-    if(at_front) {
-        onTimerInsertedAtFront();
+bool TimerManager::hasTimer() {
+    if(!m_owned) {
+        RWMutexType::ReadLock lock(m_shards[0]->mutex);
+        return !m_shards[0]->empty();
     }
-}
-
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if(now_ms < m_previouseTime &&
-            now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-        rollover = true;
+    for(auto& shard : m_shards) {
+        if(!shard->empty() || shard->hasMessages()) {
+            return true;
+        }
     }
-    m_previouseTime = now_ms;
-    return rollover;
-}
-
-bool TimerManager::hasTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    return false;
 }
 
 }
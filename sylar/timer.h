@@ -9,6 +9,7 @@
 #ifndef __SYLAR_TIMER_H__
 #define __SYLAR_TIMER_H__
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <set>
@@ -17,11 +18,13 @@
 namespace sylar {
 
 class TimerManager;
+class TimerShard;
 /**
  * @brief 定时器
  */
 class Timer : public std::enable_shared_from_this<Timer> {
 friend class TimerManager;
+friend class TimerShard;
 public:
     /// 定时器的智能指针类型
     typedef std::shared_ptr<Timer> ptr;
@@ -42,32 +45,74 @@ public:
      * @param[in] from_now 是否从当前时间开始计算
      */
     bool reset(uint64_t ms, bool from_now);
+
+    /**
+     * @brief 启动createTimer()创建的定时器，ms毫秒后触发一次
+     * @details 定时器还在等待时重新计时，触发或者取消之后可以再次启动，不会分配内存
+     * @param[in] ms 从现在开始的超时时间(毫秒)
+     */
+    void start(uint64_t ms);
 private:
     /**
      * @brief 构造函数
-     * @param[in] ms 定时器执行间隔时间
+     * @param[in] us 定时器执行间隔时间(微秒)
      * @param[in] cb 回调函数
      * @param[in] recurring 是否循环
      * @param[in] manager 定时器管理器
+     * @param[in] slack 允许推迟的时间(微秒)
      */
-    Timer(uint64_t ms, std::function<void()> cb,
-          bool recurring, TimerManager* manager);
+    Timer(uint64_t us, std::function<void()> cb,
+          bool recurring, TimerManager* manager, uint64_t slack = 0);
     /**
      * @brief 构造函数
-     * @param[in] next 执行的时间戳(毫秒)
+     * @param[in] next 执行的时间戳(微秒)
      */
     Timer(uint64_t next);
+
+    /**
+     * @brief 设置到期时间，有slack时向上取整到slack的整数倍，同一个窗口里的定时器到期时间相同，一起触发
+     * @param[in] due 不考虑slack的到期时间(微秒)
+     */
+    void setDue(uint64_t due);
+
+    /**
+     * @brief 按新的间隔重新计算到期时间
+     * @param[in] us 新的执行间隔(微秒)
+     * @param[in] from_now 是否从当前时间开始计算，否则从上次开始计时的时间算起
+     */
+    void resetDue(uint64_t us, bool from_now);
 private:
     /// 是否循环定时器
     bool m_recurring = false;
-    /// 执行周期
-    uint64_t m_ms = 0;
-    /// 精确的执行时间
+    /// 执行周期(微秒)
+    uint64_t m_us = 0;
+    /// 精确的执行时间(微秒)
     uint64_t m_next = 0;
+    /// 不考虑slack的到期时间(微秒)
+    uint64_t m_due = 0;
+    /// 允许推迟的时间(微秒)，0表示不推迟
+    uint64_t m_slack = 0;
     /// 回调函数
     std::function<void()> m_cb;
     /// 定时器管理器
     TimerManager* m_manager = nullptr;
+    /// 所属的分片
+    size_t m_shard = 0;
+    /// 定时器是否已经取消或者已经触发(一次性定时器)，分片模式下其他线程只能通过这个标志判断
+    std::atomic<bool> m_done = {false};
+    /// 每次start()和cancel()加1，分片模式下用来区分其他线程的启动是哪一次
+    std::atomic<uint32_t> m_generation = {0};
+    /// 挂进分片时对应的m_generation，和m_generation不同说明之后又被重新启动或者取消过，到期时忽略，只有归属线程访问
+    uint32_t m_armedGeneration = 0;
+    /// 是否可以反复启动，可以的话取消和触发之后都保留回调函数
+    bool m_reusable = false;
+    /// 时间轮模式下所在槽位链表的前后节点
+    Timer* m_wheelPrev = nullptr;
+    Timer* m_wheelNext = nullptr;
+    /// 时间轮模式下所在的槽位，-1表示不在时间轮里
+    int m_wheelSlot = -1;
+    /// 在时间轮里时持有自己的引用，槽位链表只存裸指针
+    Timer::ptr m_self;
 private:
     /**
      * @brief 定时器比较仿函数
@@ -84,6 +129,13 @@ private:
 
 /**
  * @brief 定时器管理器
+ * @details 默认用按到期时间排序的std::set保存定时器，增删都是O(logN)
+ *          配置项timer.wheel为true时改用分层时间轮：精度1微秒，第0层256个槽，往上4层各64个槽，
+ *          每个槽是一个侵入式双向链表，增删都是O(1)，上层的槽到期时整体下放到下层
+ *
+ *          默认所有定时器在一个分片里，所有线程加锁访问。子类可以用setTimerShards()把定时器分成多个分片，
+ *          每个分片只归一个线程所有，归属线程不加锁直接操作，其他线程的添加/取消/刷新/重置
+ *          通过分片的无锁消息队列交给归属线程处理
  */
 class TimerManager {
 friend class Timer;
@@ -106,9 +158,21 @@ public:
      * @param[in] ms 定时器执行间隔时间
      * @param[in] cb 定时器回调函数
      * @param[in] recurring 是否循环定时器
+     * @param[in] slack 允许推迟触发的时间(毫秒)，到期时间向上取整到slack的整数倍，
+     *                  同一个窗口里的定时器一起触发，减少唤醒次数。适合大量精度要求不高的超时
      */
     Timer::ptr addTimer(uint64_t ms, std::function<void()> cb
-                        ,bool recurring = false);
+                        ,bool recurring = false, uint64_t slack = 0);
+
+    /**
+     * @brief 添加微秒精度的定时器
+     * @details 内部统一按微秒计时，addTimer()只是换算了单位；IOManager用timerfd等待，能按微秒唤醒
+     * @param[in] us 定时器执行间隔时间(微秒)
+     * @param[in] cb 定时器回调函数
+     * @param[in] recurring 是否循环定时器
+     */
+    Timer::ptr addTimerUS(uint64_t us, std::function<void()> cb
+                          ,bool recurring = false);
 
     /**
      * @brief 添加条件定时器
@@ -116,26 +180,70 @@ public:
      * @param[in] cb 定时器回调函数
      * @param[in] weak_cond 条件
      * @param[in] recurring 是否循环
+     * @param[in] slack 允许推迟触发的时间(毫秒)，见addTimer()
      */
     Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
                         ,std::weak_ptr<void> weak_cond
-                        ,bool recurring = false);
+                        ,bool recurring = false, uint64_t slack = 0);
+
+    /**
+     * @brief 创建一个先不启动的一次性定时器
+     * @details 用Timer::start()启动，触发或取消之后可以再次启动，适合反复设置的超时，
+     *          每次启动/取消都不用重新创建定时器和回调
+     * @param[in] cb 定时器回调函数，一直保留到定时器析构
+     * @param[in] slack 允许推迟触发的时间(毫秒)，见addTimer()
+     */
+    Timer::ptr createTimer(std::function<void()> cb, uint64_t slack = 0);
 
     /**
-     * @brief 到最近一个定时器执行的时间间隔(毫秒)
+     * @brief 到最近一个定时器执行的时间间隔(毫秒)，不足1毫秒的向上取整
+     * @details 分片模式下只看当前线程拥有的分片，不拥有分片的线程返回~0ull
      */
     uint64_t getNextTimer();
 
+    /**
+     * @brief 到最近一个定时器执行的时间间隔(微秒)
+     * @details 分片模式下同getNextTimer()，只看当前线程拥有的分片
+     */
+    uint64_t getNextTimerUS();
+
     /**
      * @brief 获取需要执行的定时器的回调函数列表
+     * @details 分片模式下只处理当前线程拥有的分片
      * @param[out] cbs 回调函数数组
      */
     void listExpiredCb(std::vector<std::function<void()> >& cbs);
 
     /**
-     * @brief 是否有定时器
+     * @brief 是否有定时器，分片模式下看所有分片
      */
     bool hasTimer();
+
+    /**
+     * @brief 是否使用时间轮
+     */
+    bool isTimingWheel() const { return m_useWheel; }
+
+    /**
+     * @brief 是否是分片模式
+     */
+    bool isTimerSharded() const { return m_owned; }
+
+    /**
+     * @brief 累计到期的定时器数
+     */
+    uint64_t getTimerFiredCount() const { return m_firedCount; }
+
+    /**
+     * @brief 累计有定时器触发的批次数，每批对应一次因定时器而起的唤醒
+     */
+    uint64_t getTimerBatchCount() const { return m_batchCount; }
+
+    /**
+     * @brief 因为slack合并而省下的唤醒次数
+     * @details 每批里按不考虑slack的到期时间去重，多出来的时间点在没有slack时各需要一次唤醒
+     */
+    uint64_t getSlackSavedCount() const { return m_slackSaved; }
 protected:
 
     /**
@@ -144,23 +252,68 @@ protected:
     virtual void onTimerInsertedAtFront() = 0;
 
     /**
-     * @brief 将定时器添加到管理器中
+     * @brief 分片模式下其他线程给分片投递了消息，通知归属线程处理
+     * @param[in] shard 分片下标
+     */
+    virtual void onShardMessage(size_t shard) { onTimerInsertedAtFront(); }
+
+    /**
+     * @brief 返回当前线程拥有的分片，不拥有分片返回-1
+     */
+    virtual int getTimerShard() { return -1; }
+
+    /**
+     * @brief 返回新定时器应该放入的分片，默认当前线程拥有的分片，不拥有分片时轮流分配
      */
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
+    virtual size_t selectTimerShard();
+
+    /**
+     * @brief 把定时器分成shards个分片，每个分片归一个线程所有
+     * @attention 只能在添加定时器之前调用
+     */
+    void setTimerShards(size_t shards);
+
 private:
     /**
-     * @brief 检测服务器时间是否被调后了
+     * @brief 把定时器放入分片
+     * @param[in] tickle 定时器成为最早的定时器时是否通知
+     */
+    void insertTimer(const Timer::ptr& timer, bool tickle);
+
+    /**
+     * @brief 取消/刷新/重置定时器，Timer的同名函数转到这里
+     */
+    bool cancelTimer(const Timer::ptr& timer);
+    bool refreshTimer(const Timer::ptr& timer);
+    bool resetTimer(const Timer::ptr& timer, uint64_t us, bool from_now);
+    void startTimer(const Timer::ptr& timer, uint64_t us);
+
+    /**
+     * @brief 归属线程处理分片的消息队列
+     */
+    void handleShardMessages(TimerShard& shard);
+
+    /**
+     * @brief 收集到期定时器的回调，循环定时器重新放回分片
      */
-    bool detectClockRollover(uint64_t now_ms);
+    void fireExpired(TimerShard& shard, uint64_t now_us
+                     ,std::vector<Timer::ptr>& expired
+                     ,std::vector<std::function<void()> >& cbs);
 private:
-    /// Mutex
-    RWMutexType m_mutex;
-    /// 定时器集合
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    /// 是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
-    /// 上次执行时间
-    uint64_t m_previouseTime = 0;
+    /// 是否使用时间轮
+    bool m_useWheel = false;
+    /// 是否是分片模式，否则只有一个加锁访问的分片
+    bool m_owned = false;
+    /// 定时器分片
+    std::vector<std::unique_ptr<TimerShard> > m_shards;
+    /// 不拥有分片的线程添加定时器时，下一个分配的分片
+    std::atomic<size_t> m_nextShard = {0};
+    /// 触发的定时器数
+    std::atomic<uint64_t> m_firedCount = {0};
+    /// 有定时器触发的批次数
+    std::atomic<uint64_t> m_batchCount = {0};
+    /// slack省下的唤醒次数
+    std::atomic<uint64_t> m_slackSaved = {0};
 };
 
 }
@@ -37,6 +37,18 @@ uint64_t GetElapsedMS() {
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+uint64_t GetElapsedUS() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+uint64_t GetElapsedNS() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 std::string GetThreadName() {
     char thread_name[16] = {0};
     pthread_getname_np(pthread_self(), thread_name, 16);
@@ -94,6 +106,20 @@ std::string BacktraceToString(int size, int skip, const std::string &prefix) {
     return ss.str();
 }
 
+std::string BacktraceToString(void *const *frames, int size, int skip, const std::string &prefix) {
+    char **strings = backtrace_symbols(frames, size);
+    if (strings == NULL) {
+        SYLAR_LOG_ERROR(g_logger) << "backtrace_synbols error";
+        return "";
+    }
+    std::stringstream ss;
+    for (int i = skip; i < size; ++i) {
+        ss << prefix << demangle(strings[i]) << std::endl;
+    }
+    free(strings);
+    return ss.str();
+}
+
 uint64_t GetCurrentMS() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
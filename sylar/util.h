@@ -35,6 +35,16 @@ uint64_t GetFiberId();
  */
 uint64_t GetElapsedMS();
 
+/**
+ * @brief 获取当前启动的微秒数，时钟同GetElapsedMS()
+ */
+uint64_t GetElapsedUS();
+
+/**
+ * @brief 获取当前启动的纳秒数，时钟同GetElapsedMS()
+ */
+uint64_t GetElapsedNS();
+
 /**
  * @brief 获取线程名称，参考pthread_getname_np(3)
  */
@@ -62,6 +72,16 @@ void Backtrace(std::vector<std::string> &bt, int size = 64, int skip = 1);
  */
 std::string BacktraceToString(int size = 64, int skip = 2, const std::string &prefix = "");
 
+/**
+ * @brief 把已经用::backtrace()取到的地址解析成栈信息字符串
+ * @details 用于在信号处理函数里只采集地址、回到普通线程再做符号解析的场景
+ * @param[in] frames 地址数组
+ * @param[in] size 地址个数
+ * @param[in] skip 跳过栈顶的层数
+ * @param[in] prefix 栈信息前输出的内容
+ */
+std::string BacktraceToString(void *const *frames, int size, int skip = 0, const std::string &prefix = "");
+
 /**
  * @brief 获取当前时间的毫秒
  */
@@ -0,0 +1,282 @@
+/**
+ * @file watchdog.cc
+ * @brief 调度线程卡顿检测实现
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "watchdog.h"
+#include <execinfo.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sstream>
+#include <algorithm>
+#include "config.h"
+#include "log.h"
+#include "scheduler.h"
+#include "util.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_stall_budget =
+    Config::Lookup<uint32_t>("scheduler.stall_budget_ms", 0, "log the backtrace of a fiber running longer than this without yielding, 0 means disabled");
+
+static ConfigVar<bool>::ptr g_slice_timing =
+    Config::Lookup<bool>("scheduler.slice_timing", false, "record run slice and queue wait durations even when the stall watchdog is disabled");
+
+/// 调度线程每个任务都要检查，缓存成原子变量，不用每次去读ConfigVar
+static std::atomic<bool> s_slice_timing = {g_stall_budget->getValue() > 0 || g_slice_timing->getValue()};
+
+struct _WatchdogIniter {
+    _WatchdogIniter() {
+        g_stall_budget->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+            s_slice_timing = new_value > 0 || g_slice_timing->getValue();
+        });
+        g_slice_timing->addListener([](const bool &old_value, const bool &new_value) {
+            s_slice_timing = new_value || g_stall_budget->getValue() > 0;
+        });
+    }
+};
+
+static _WatchdogIniter s_watchdog_initer;
+
+RunSliceHistogram::RunSliceHistogram(const RunSliceHistogram &rhs) {
+    reset();
+    merge(rhs);
+}
+
+RunSliceHistogram &RunSliceHistogram::operator=(const RunSliceHistogram &rhs) {
+    if (this != &rhs) {
+        reset();
+        merge(rhs);
+    }
+    return *this;
+}
+
+size_t RunSliceHistogram::BucketOf(uint64_t us) {
+    if (!us) {
+        return 0;
+    }
+    return std::min<size_t>(64 - __builtin_clzll(us), BUCKETS - 1);
+}
+
+uint64_t RunSliceHistogram::BucketUpper(size_t idx) {
+    return idx + 1 < BUCKETS ? (1ull << idx) : UINT64_MAX;
+}
+
+void RunSliceHistogram::add(uint64_t us) {
+    // 只有所属线程写，读-改-写不需要原子指令
+    std::atomic<uint64_t> &count = m_counts[BucketOf(us)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_sum.store(m_sum.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    if (us > m_max.load(std::memory_order_relaxed)) {
+        m_max.store(us, std::memory_order_relaxed);
+    }
+}
+
+void RunSliceHistogram::merge(const RunSliceHistogram &rhs) {
+    for (size_t i = 0; i < BUCKETS; i++) {
+        m_counts[i] += rhs.getCount(i);
+    }
+    m_sum += rhs.getSum();
+    m_max = std::max(getMax(), rhs.getMax());
+}
+
+void RunSliceHistogram::reset() {
+    for (auto &i : m_counts) {
+        i = 0;
+    }
+    m_sum = 0;
+    m_max = 0;
+}
+
+uint64_t RunSliceHistogram::getTotal() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        total += getCount(i);
+    }
+    return total;
+}
+
+uint64_t RunSliceHistogram::percentile(double p) const {
+    uint64_t total = getTotal();
+    if (!total) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)(total * p + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += getCount(i);
+        if (seen >= rank) {
+            // 上界不会超过实际的最大值
+            return std::min(BucketUpper(i), getMax());
+        }
+    }
+    return getMax();
+}
+
+std::string RunSliceHistogram::toString() const {
+    std::stringstream ss;
+    uint64_t total = getTotal();
+    ss << "count=" << total << " avg=" << (total ? getSum() / total : 0) << "us"
+       << " p50<=" << percentile(0.5) << "us p99<=" << percentile(0.99) << "us"
+       << " p999<=" << percentile(0.999) << "us max=" << getMax() << "us";
+    for (size_t i = 0; i < BUCKETS; i++) {
+        uint64_t count = getCount(i);
+        if (!count) {
+            continue;
+        }
+        ss << std::endl
+           << "  " << (i ? (1ull << (i - 1)) : 0) << "us~";
+        if (i + 1 < BUCKETS) {
+            ss << BucketUpper(i) << "us";
+        }
+        ss << " " << count;
+    }
+    return ss.str();
+}
+
+/**
+ * @brief 信号处理函数和检测线程之间传递调用栈
+ * @details 检测线程一次只采集一个线程，信号处理函数里只调用::backtrace()保存地址，符号解析回到检测线程再做
+ */
+struct StackCapture {
+    /// 要采集的线程id，信号处理函数核对后才写，超时放弃后迟到的信号不会覆盖下一次的结果
+    std::atomic<int> thread = {0};
+    /// 采集到的层数，-1表示还没采集到
+    std::atomic<int> size = {-1};
+    /// 调用栈地址
+    void *frames[64];
+};
+
+static StackCapture s_capture;
+
+/// 采集调用栈用的信号，避开SIGRTMIN附近容易被其他库占用的几个
+static int capture_signal() {
+    return SIGRTMIN + 3;
+}
+
+static void on_capture_signal(int) {
+    int saved = errno;
+    if (s_capture.thread == (int)syscall(SYS_gettid)) {
+        s_capture.size = ::backtrace(s_capture.frames, 64);
+    }
+    errno = saved;
+}
+
+bool StallWatchdog::IsSliceTimingEnabled() {
+    return s_slice_timing.load(std::memory_order_relaxed);
+}
+
+StallWatchdog::StallWatchdog() {
+    g_stall_budget->addListener([this](const uint32_t &old_value, const uint32_t &new_value) {
+        SYLAR_LOG_INFO(g_logger) << "scheduler.stall_budget_ms changed from " << old_value << " to " << new_value;
+        MutexType::Lock lock(m_mutex);
+        if (new_value && !m_schedulers.empty()) {
+            startThread();
+        }
+    });
+}
+
+StallWatchdog::~StallWatchdog() {
+    m_stop = true;
+    if (m_thread) {
+        m_thread->join();
+    }
+}
+
+void StallWatchdog::add(Scheduler *sc) {
+    MutexType::Lock lock(m_mutex);
+    m_schedulers.push_back(sc);
+    if (g_stall_budget->getValue()) {
+        startThread();
+    }
+}
+
+void StallWatchdog::del(Scheduler *sc) {
+    MutexType::Lock lock(m_mutex);
+    auto it = std::find(m_schedulers.begin(), m_schedulers.end(), sc);
+    if (it != m_schedulers.end()) {
+        m_schedulers.erase(it);
+    }
+}
+
+std::string StallWatchdog::getLastReport() {
+    MutexType::Lock lock(m_mutex);
+    return m_lastReport;
+}
+
+void StallWatchdog::startThread() {
+    if (m_thread) {
+        return;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &on_capture_signal;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(capture_signal(), &sa, nullptr);
+    // ::backtrace()第一次调用时会加载libgcc_s并分配内存，先在这里调用一次，信号处理函数里就不会再分配
+    void *frames[1];
+    ::backtrace(frames, 1);
+    m_thread.reset(new Thread(std::bind(&StallWatchdog::run, this), "watchdog"));
+}
+
+void StallWatchdog::run() {
+    while (!m_stop) {
+        uint64_t budget = g_stall_budget->getValue();
+        // 扫描间隔取预算的1/4，超时最多晚报告1/4个预算
+        usleep(budget ? std::min<uint64_t>(std::max<uint64_t>(budget * 250, 1000), 100000) : 100000);
+        if (!budget) {
+            continue;
+        }
+        uint64_t now = GetElapsedUS();
+        MutexType::Lock lock(m_mutex);
+        for (auto sc : m_schedulers) {
+            sc->checkStalls(now, budget * 1000, [this, sc](int thread, uint64_t fiber_id, uint64_t used_us) {
+                report(sc, thread, fiber_id, used_us);
+            });
+        }
+    }
+}
+
+void StallWatchdog::report(Scheduler *sc, int thread, uint64_t fiber_id, uint64_t used_us) {
+    ++m_stallCount;
+    std::stringstream ss;
+    ss << "fiber stall: scheduler=" << sc->getName() << " thread=" << thread << " fiber_id=" << fiber_id
+       << " running for " << used_us / 1000 << "ms without yielding";
+    std::string bt;
+    if (capture(thread, bt)) {
+        ss << ", backtrace:" << std::endl
+           << bt;
+    } else {
+        ss << ", backtrace unavailable";
+    }
+    m_lastReport = ss.str();
+    SYLAR_LOG_WARN(g_logger) << m_lastReport;
+}
+
+bool StallWatchdog::capture(int thread, std::string &bt) {
+    s_capture.size   = -1;
+    s_capture.thread = thread;
+    if (syscall(SYS_tgkill, getpid(), thread, capture_signal())) {
+        s_capture.thread = 0;
+        return false;
+    }
+    for (int i = 0; i < 100 && s_capture.size < 0; i++) {
+        usleep(1000);
+    }
+    s_capture.thread = 0;
+    int size         = s_capture.size;
+    if (size < 0) {
+        return false;
+    }
+    // 跳过信号处理函数和内核的信号返回桩
+    bt = BacktraceToString(s_capture.frames, size, 2, "    ");
+    return true;
+}
+
+} // namespace sylar
@@ -0,0 +1,193 @@
+/**
+ * @file watchdog.h
+ * @brief 调度线程卡顿检测
+ * @details 协程里调用了没有hook的阻塞函数(getaddrinfo、互斥锁)或者长时间占用CPU时，同一个调度线程上的其他协程都跟着停住。
+ *          打开检测时调度器在每次resume协程前后记录开始时间和运行时长，检测线程定期扫描，
+ *          发现某个线程上的协程连续运行超过配置项scheduler.stall_budget_ms时，
+ *          向该线程发信号在它自己的栈上采集调用栈，再由检测线程解析后连同协程id一起打到日志里
+ * @version 0.1
+ * @date 2026-10-17
+ */
+
+#ifndef __SYLAR_WATCHDOG_H__
+#define __SYLAR_WATCHDOG_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "mutex.h"
+#include "thread.h"
+#include "singleton.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 协程单次运行时长的分布
+ * @details 按2的幂分桶，第0桶是不到1微秒的，第i桶是[2^(i-1), 2^i)微秒，最后一桶包含所有更长的；
+ *          每个调度线程一份，只有所属线程写，其他线程随时可以读
+ */
+class RunSliceHistogram {
+public:
+    /// 桶数，最后一桶从2^26微秒(约67秒)开始
+    static const size_t BUCKETS = 28;
+
+    RunSliceHistogram() { reset(); }
+    RunSliceHistogram(const RunSliceHistogram &rhs);
+    RunSliceHistogram &operator=(const RunSliceHistogram &rhs);
+
+    /**
+     * @brief 微秒数所在的桶
+     */
+    static size_t BucketOf(uint64_t us);
+
+    /**
+     * @brief 桶的上界(不含)，单位微秒，最后一桶返回UINT64_MAX
+     */
+    static uint64_t BucketUpper(size_t idx);
+
+    /**
+     * @brief 记录一次运行时长，只能由所属线程调用
+     */
+    void add(uint64_t us);
+
+    /**
+     * @brief 把rhs的计数累加进来
+     */
+    void merge(const RunSliceHistogram &rhs);
+
+    /**
+     * @brief 清零
+     */
+    void reset();
+
+    /**
+     * @brief 某个桶的次数
+     */
+    uint64_t getCount(size_t idx) const { return m_counts[idx].load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 总次数
+     */
+    uint64_t getTotal() const;
+
+    /**
+     * @brief 运行时长之和，微秒
+     */
+    uint64_t getSum() const { return m_sum.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 最长的一次，微秒
+     */
+    uint64_t getMax() const { return m_max.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 百分位数p(0~1)落在的桶的上界，微秒，没有数据时返回0
+     */
+    uint64_t percentile(double p) const;
+
+    /**
+     * @brief 汇总信息和非空的桶，每个桶一行
+     */
+    std::string toString() const;
+
+private:
+    /// 每个桶的次数
+    std::atomic<uint64_t> m_counts[BUCKETS];
+    /// 运行时长之和
+    std::atomic<uint64_t> m_sum;
+    /// 最长的一次
+    std::atomic<uint64_t> m_max;
+};
+
+/**
+ * @brief 卡顿检测线程
+ * @details 调度器start时登记，stop时注销；scheduler.stall_budget_ms大于0时才创建检测线程和安装信号处理函数。
+ *          采集调用栈的信号会打断目标线程上正在进行的nanosleep/poll这类系统调用(返回EINTR)，
+ *          每段超时的运行只打断一次
+ */
+class StallWatchdog : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    StallWatchdog();
+
+    /**
+     * @brief 析构函数，停止检测线程
+     */
+    ~StallWatchdog();
+
+    /**
+     * @brief 调度线程是否记录每段运行的开始时间、时长和任务的排队时长
+     * @details scheduler.stall_budget_ms大于0或者scheduler.slice_timing打开时才记录，
+     *          关闭时调度和运行任务都不读时钟，Scheduler::getRunSliceHistogram()和getWaitHistogram()也就没有数据
+     */
+    static bool IsSliceTimingEnabled();
+
+    /**
+     * @brief 登记调度器
+     */
+    void add(Scheduler *sc);
+
+    /**
+     * @brief 注销调度器，返回后检测线程不会再访问它
+     */
+    void del(Scheduler *sc);
+
+    /**
+     * @brief 累计发现的卡顿次数
+     */
+    uint64_t getStallCount() const { return m_stallCount; }
+
+    /**
+     * @brief 最近一次卡顿的报告，和日志里的内容相同
+     */
+    std::string getLastReport();
+
+private:
+    /**
+     * @brief 安装信号处理函数，创建检测线程，调用方加锁
+     */
+    void startThread();
+
+    /**
+     * @brief 检测线程主函数
+     */
+    void run();
+
+    /**
+     * @brief 报告一次卡顿
+     * @param[in] sc 卡住的调度器
+     * @param[in] thread 卡住的线程id
+     * @param[in] fiber_id 正在运行的协程id
+     * @param[in] used_us 已经运行的微秒数
+     */
+    void report(Scheduler *sc, int thread, uint64_t fiber_id, uint64_t used_us);
+
+    /**
+     * @brief 向线程发信号采集它当前的调用栈，等待最多100毫秒
+     */
+    bool capture(int thread, std::string &bt);
+
+private:
+    /// 保护调度器列表和检测线程
+    MutexType m_mutex;
+    /// 登记的调度器
+    std::vector<Scheduler *> m_schedulers;
+    /// 检测线程，第一次需要时才创建
+    Thread::ptr m_thread;
+    /// 是否停止检测线程
+    std::atomic<bool> m_stop = {false};
+    /// 累计卡顿次数
+    std::atomic<uint64_t> m_stallCount = {0};
+    /// 最近一次的报告
+    std::string m_lastReport;
+};
+
+/// 卡顿检测单例
+typedef Singleton<StallWatchdog> StallWatchdogMgr;
+
+} // namespace sylar
+
+#endif
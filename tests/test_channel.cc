@@ -0,0 +1,297 @@
+/**
+ * @file test_channel.cc
+ * @brief 协程channel和select
+ * @details 检查满/空时的收发、关闭语义、select(包括default分支和发送case)、线程和协程之间收发；
+ *          单线程IOManager上生产者消费者在小缓冲区上来回挂起，ticker协程照常运行；
+ *          最后测SPSC和MPMC在多线程IOManager上的吞吐，和每条消息schedule一个回调对比
+ *          参数：-n 吞吐测试的消息条数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_messages = 200000;
+
+static std::atomic<bool> s_running = {true};
+static std::atomic<uint64_t> s_ticks = {0};
+
+static void ticker() {
+    while (s_running) {
+        usleep(1000);
+        ++s_ticks;
+    }
+}
+
+/**
+ * @brief 等待所有协程结束，期间当前协程也让出
+ */
+static void wait_done(std::atomic<int> &done, int count) {
+    while (done != count) {
+        usleep(1000);
+    }
+}
+
+static void check_basic() {
+    sylar::Channel<std::string> ch(2);
+    SYLAR_ASSERT(ch.trySend("a") && ch.trySend(std::string("b")));
+    SYLAR_ASSERT(!ch.trySend("c") && ch.size() == 2);
+
+    std::string v;
+    SYLAR_ASSERT(ch.tryRecv(v) && v == "a");
+
+    // 都没就绪时走default
+    sylar::Channel<int> empty(1);
+    int i = 0;
+    sylar::SelectCase cases[] = {empty.recvCase(i)};
+    SYLAR_ASSERT(sylar::Select(cases, 1, false) == -1);
+
+    // 关闭后发送失败，剩下的数据还能取出来
+    ch.close();
+    SYLAR_ASSERT(ch.isClosed() && !ch.send("d"));
+    SYLAR_ASSERT(ch.recv(v) && v == "b");
+    SYLAR_ASSERT(!ch.recv(v) && !ch.tryRecv(v));
+
+    // 无界的不会满
+    sylar::Channel<int> unbounded;
+    for (int j = 0; j < 10000; j++) {
+        SYLAR_ASSERT(unbounded.trySend(j));
+    }
+    SYLAR_ASSERT(unbounded.size() == 10000);
+}
+
+static void check_single_thread() {
+    sylar::Channel<int> ch(4);
+    std::atomic<int> done(0);
+    int64_t sum = 0;
+    sylar::IOManager::GetThis()->schedule([&ch, &sum, &done]() {
+        int v;
+        while (ch.recv(v)) {
+            sum += v;
+            // 消费慢，生产者会在满的缓冲区上挂起，一直等到ticker跑过一次
+            if (v % 100 == 0) {
+                uint64_t ticks = s_ticks;
+                while (s_ticks == ticks) {
+                    usleep(1000);
+                }
+            }
+        }
+        ++done;
+    });
+    // 两次send之间不会让出，ticker只能在send挂起的时候跑；
+    // 消费者每停下来一次，生产者都要在某一次send里等到ticker跑过，最后一次停下时生产者可能已经发完了
+    int overlapped = 0;
+    for (int i = 1; i <= 2000; i++) {
+        uint64_t ticks = s_ticks;
+        SYLAR_ASSERT(ch.send(i));
+        if (s_ticks != ticks) {
+            ++overlapped;
+        }
+    }
+    ch.close();
+    wait_done(done, 1);
+    SYLAR_LOG_INFO(g_logger) << "single thread sum=" << sum << " sends overlapped by ticker=" << overlapped;
+    SYLAR_ASSERT(sum == 2000 * 2001 / 2 && overlapped >= 19);
+}
+
+static void check_close_wakes(sylar::IOManager &iom) {
+    sylar::Channel<int> ch(1);
+    std::atomic<int> done(0);
+    for (int i = 0; i < 5; i++) {
+        iom.schedule([&ch, &done]() {
+            int v;
+            SYLAR_ASSERT(!ch.recv(v));
+            ++done;
+        });
+    }
+    // 发送方在满的缓冲区上等，关闭后返回false
+    sylar::Channel<int> full(1);
+    full.trySend(0);
+    iom.schedule([&full, &done]() {
+        SYLAR_ASSERT(!full.send(1));
+        ++done;
+    });
+    usleep(10 * 1000);
+    SYLAR_ASSERT(done == 0);
+    ch.close();
+    full.close();
+    wait_done(done, 6);
+}
+
+static void check_select(sylar::IOManager &iom) {
+    sylar::Channel<int> ints(8);
+    sylar::Channel<std::string> strs(8);
+    sylar::Channel<bool> quit(1);
+    std::atomic<int> done(0);
+    int64_t int_sum = 0;
+    size_t str_len  = 0;
+    iom.schedule([&]() {
+        int i;
+        std::string s;
+        bool q;
+        sylar::SelectCase cases[] = {ints.recvCase(i), strs.recvCase(s), quit.recvCase(q)};
+        while (true) {
+            int idx = sylar::Select(cases, 3);
+            if (idx == 0) {
+                int_sum += i;
+            } else if (idx == 1) {
+                str_len += s.size();
+            } else {
+                break;
+            }
+        }
+        ++done;
+    });
+    const int count = 1000;
+    std::atomic<int> produced(0);
+    iom.schedule([&]() {
+        for (int j = 1; j <= count; j++) {
+            ints.send(j);
+        }
+        ++produced;
+    });
+    iom.schedule([&]() {
+        for (int j = 1; j <= count; j++) {
+            strs.send("xx");
+        }
+        ++produced;
+    });
+    wait_done(produced, 2);
+    while (ints.size() || strs.size()) {
+        usleep(1000);
+    }
+    quit.send(true);
+    wait_done(done, 1);
+    SYLAR_LOG_INFO(g_logger) << "select int_sum=" << int_sum << " str_len=" << str_len;
+    SYLAR_ASSERT(int_sum == count * (count + 1) / 2 && str_len == 2 * count);
+
+    // 发送case：out满了之后只能从in收
+    sylar::Channel<int> in(1), out(1);
+    out.trySend(0);
+    int send_v = 7, recv_v = 0;
+    iom.schedule([&in]() {
+        usleep(5 * 1000);
+        in.send(42);
+    });
+    sylar::SelectCase cases[] = {out.sendCase(send_v), in.recvCase(recv_v)};
+    SYLAR_ASSERT(sylar::Select(cases, 2) == 1 && cases[1].ok && recv_v == 42);
+    // 空出位置后发送case完成
+    int v;
+    out.recv(v);
+    SYLAR_ASSERT(sylar::Select(cases, 2) == 0 && cases[0].ok && out.size() == 1);
+
+    // 被关闭的channel唤醒，ok为false
+    sylar::Channel<int> closing(1);
+    iom.schedule([&closing]() {
+        usleep(5 * 1000);
+        closing.close();
+    });
+    sylar::SelectCase closing_case = closing.recvCase(v);
+    SYLAR_ASSERT(sylar::Select(&closing_case, 1) == 0 && !closing_case.ok);
+}
+
+static void check_thread(sylar::IOManager &iom) {
+    sylar::Channel<int> to_fiber(16), to_thread(16);
+    std::thread thr([&]() {
+        int v;
+        for (int i = 1; i <= 1000; i++) {
+            to_fiber.send(i);
+            SYLAR_ASSERT(to_thread.recv(v) && v == i * 2);
+        }
+        to_fiber.close();
+    });
+    int v;
+    while (to_fiber.recv(v)) {
+        to_thread.send(v * 2);
+    }
+    thr.join();
+}
+
+/**
+ * @brief producers个协程发，consumers个协程收，返回每秒消息数
+ */
+static uint64_t bench_channel(sylar::IOManager &iom, int producers, int consumers, size_t capacity) {
+    sylar::Channel<int64_t> ch(capacity);
+    std::atomic<int> done(0), produced(0);
+    std::atomic<int64_t> sum(0);
+    int per_producer = s_messages / producers;
+    uint64_t start   = sylar::GetElapsedUS();
+    for (int i = 0; i < consumers; i++) {
+        iom.schedule([&]() {
+            int64_t v, local = 0;
+            while (ch.recv(v)) {
+                local += v;
+            }
+            sum += local;
+            ++done;
+        });
+    }
+    for (int i = 0; i < producers; i++) {
+        iom.schedule([&]() {
+            for (int j = 1; j <= per_producer; j++) {
+                ch.send(j);
+            }
+            ++produced;
+        });
+    }
+    wait_done(produced, producers);
+    ch.close();
+    wait_done(done, consumers);
+    uint64_t used = sylar::GetElapsedUS() - start;
+    int64_t n     = per_producer;
+    SYLAR_ASSERT(sum == producers * (n * (n + 1) / 2));
+    return (uint64_t)producers * per_producer * 1000000 / std::max<uint64_t>(used, 1);
+}
+
+/**
+ * @brief 对比：每条消息schedule一个回调
+ */
+static uint64_t bench_schedule(sylar::IOManager &iom) {
+    std::atomic<int64_t> sum(0);
+    std::atomic<int> done(0);
+    uint64_t start = sylar::GetElapsedUS();
+    for (int i = 1; i <= s_messages; i++) {
+        iom.schedule([&sum, &done, i]() {
+            sum += i;
+            ++done;
+        });
+    }
+    wait_done(done, s_messages);
+    uint64_t used = sylar::GetElapsedUS() - start;
+    return (uint64_t)s_messages * 1000000 / std::max<uint64_t>(used, 1);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_messages = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+
+    check_basic();
+    {
+        sylar::IOManager iom(1, false, "single");
+        iom.schedule(&ticker);
+        iom.schedule([]() {
+            check_single_thread();
+            s_running = false;
+        });
+    }
+    {
+        sylar::IOManager iom(4, false, "multi");
+        iom.schedule([&iom]() {
+            check_close_wakes(iom);
+            check_select(iom);
+            check_thread(iom);
+            SYLAR_LOG_INFO(g_logger) << "SPSC cap=1024 " << bench_channel(iom, 1, 1, 1024) << " msg/s";
+            SYLAR_LOG_INFO(g_logger) << "SPSC cap=1 " << bench_channel(iom, 1, 1, 1) << " msg/s";
+            SYLAR_LOG_INFO(g_logger) << "MPMC 4x4 cap=1024 " << bench_channel(iom, 4, 4, 1024) << " msg/s";
+            SYLAR_LOG_INFO(g_logger) << "MPMC 4x4 unbounded " << bench_channel(iom, 4, 4, sylar::Channel<int64_t>::UNBOUNDED) << " msg/s";
+            SYLAR_LOG_INFO(g_logger) << "schedule per message " << bench_schedule(iom) << " msg/s";
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file test_fd_lookup.cc
+ * @brief 多线程下fd上下文查找的开销
+ * @details 第一部分：多个普通线程同时对同一批fd调用FdManager::get()，只测查找本身；
+ *          第二部分：IOManager的每个调度线程上一个协程，反复在自己的socketpair上做立即成功的非阻塞write/read，
+ *          测do_io快速路径的总吞吐；最后检查close之后fd号复用时上下文被重新初始化
+ *          参数：-t 线程数，-ops 每个线程的操作次数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <time.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_threads = 32;
+static int s_ops     = 100000;
+
+static std::atomic<int> s_done = {0};
+
+static void lookup(const std::vector<int> &fds) {
+    auto mgr     = sylar::FdMgr::GetInstance();
+    uint64_t hit = 0;
+    for (int i = 0; i < s_ops; i++) {
+        auto ctx = mgr->get(fds[i % fds.size()]);
+        hit += ctx && ctx->isSocket();
+    }
+    SYLAR_ASSERT(hit == (uint64_t)s_ops);
+}
+
+static void bench_lookup() {
+    std::vector<int> fds;
+    for (int i = 0; i < 64; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sylar::FdMgr::GetInstance()->get(fd, true);
+        fds.push_back(fd);
+    }
+
+    std::vector<sylar::Thread::ptr> thrs;
+    uint64_t start = sylar::GetElapsedNS();
+    for (int i = 0; i < s_threads; i++) {
+        thrs.push_back(std::make_shared<sylar::Thread>(std::bind(&lookup, std::cref(fds)),
+                                                       "lookup_" + std::to_string(i)));
+    }
+    for (auto &thr : thrs) {
+        thr->join();
+    }
+    uint64_t used = sylar::GetElapsedNS() - start;
+    SYLAR_LOG_INFO(g_logger) << "FdManager::get threads=" << s_threads << " ops=" << s_threads * s_ops
+                             << " used=" << used / 1000000 << "ms"
+                             << " ns/op=" << used / ((uint64_t)s_threads * s_ops);
+
+    for (int fd : fds) {
+        sylar::FdMgr::GetInstance()->del(fd);
+        close(fd);
+    }
+}
+
+/**
+ * @brief 每个协程一对socket，写一个字节马上读回来，两次调用都不会EAGAIN
+ */
+static void pingpong() {
+    int sv[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    // socketpair没有hook，手动登记，让read/write走do_io
+    sylar::FdMgr::GetInstance()->get(sv[0], true);
+    sylar::FdMgr::GetInstance()->get(sv[1], true);
+    char c = 'x';
+    for (int i = 0; i < s_ops; i++) {
+        SYLAR_ASSERT(write(sv[0], &c, 1) == 1);
+        SYLAR_ASSERT(read(sv[1], &c, 1) == 1);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    ++s_done;
+}
+
+static void bench_io() {
+    s_done = 0;
+    uint64_t used;
+    {
+        sylar::IOManager iom(s_threads, false, "io");
+        // 先让调度线程都进入idle，协程分到每个线程上
+        usleep(100 * 1000);
+        uint64_t start = sylar::GetElapsedNS();
+        for (int i = 0; i < s_threads; i++) {
+            iom.schedule(&pingpong);
+        }
+        while (s_done < s_threads) {
+            usleep(1000);
+        }
+        used = sylar::GetElapsedNS() - start;
+    }
+    SYLAR_LOG_INFO(g_logger) << "do_io threads=" << s_threads << " ops=" << 2ull * s_threads * s_ops
+                             << " used=" << used / 1000000 << "ms"
+                             << " io/s=" << (uint64_t)(2.0 * s_threads * s_ops * 1e9 / used);
+}
+
+/**
+ * @brief close之后同一个fd号重新登记，拿到的上下文应该是新的状态
+ */
+static void check_reuse() {
+    sylar::IOManager iom(1, false, "reuse");
+    iom.schedule([]() {
+        int fd   = socket(AF_INET, SOCK_STREAM, 0);
+        auto ctx = sylar::FdMgr::GetInstance()->get(fd);
+        SYLAR_ASSERT(ctx && ctx->isSocket() && !ctx->isClose());
+        ctx->setTimeout(SO_RCVTIMEO, 100);
+        close(fd);
+        SYLAR_ASSERT(ctx->isClose());
+        SYLAR_ASSERT(!sylar::FdMgr::GetInstance()->get(fd));
+
+        int fd2 = socket(AF_INET, SOCK_STREAM, 0);
+        SYLAR_ASSERT(fd2 == fd);
+        auto ctx2 = sylar::FdMgr::GetInstance()->get(fd2);
+        SYLAR_ASSERT(ctx2 && ctx2->isSocket() && !ctx2->isClose());
+        SYLAR_ASSERT(ctx2->getTimeout(SO_RCVTIMEO) == (uint64_t)-1);
+        close(fd2);
+        SYLAR_LOG_INFO(g_logger) << "fd reuse ok";
+    });
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_threads = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("ops")) {
+        s_ops = atoi(sylar::EnvMgr::GetInstance()->get("ops").c_str());
+    }
+
+    check_reuse();
+    bench_lookup();
+    bench_io();
+    return 0;
+}
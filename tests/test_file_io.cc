@@ -0,0 +1,98 @@
+/**
+ * @file test_file_io.cc
+ * @brief 协程里读写普通文件时调度线程的响应性
+ * @details 单线程IOManager上一个协程大块写文件、fsync再读回校验，另一个协程每隔1毫秒醒来一次，
+ *          记录两次醒来之间的最大间隔；分别在fileio.threads=0(直接在调度线程上阻塞)和线程池两种情况下运行
+ *          参数：-n 写入的块数，每块4MB
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_blocks                = 16;
+static const size_t BLOCK_SIZE     = 4 * 1024 * 1024;
+static const char *s_path          = "/tmp/sylar_test_file_io.dat";
+static std::atomic<bool> s_running = {false};
+
+static void writer(uint64_t &used) {
+    uint64_t start = sylar::GetElapsedUS();
+    std::string block(BLOCK_SIZE, 0);
+    int fd = open(s_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    SYLAR_ASSERT(fd >= 0);
+    auto ctx = sylar::FdMgr::GetInstance()->get(fd);
+    SYLAR_ASSERT(ctx && ctx->isFile());
+    for (int i = 0; i < s_blocks; i++) {
+        memset(&block[0], 'a' + i % 26, block.size());
+        SYLAR_ASSERT(write(fd, block.data(), block.size()) == (ssize_t)block.size());
+    }
+    SYLAR_ASSERT(fsync(fd) == 0);
+
+    // 随机位置pread，再从头read一遍
+    for (int i = 0; i < s_blocks; i++) {
+        int idx = rand() % s_blocks;
+        char c  = 0;
+        SYLAR_ASSERT(pread(fd, &c, 1, (off_t)idx * BLOCK_SIZE + rand() % BLOCK_SIZE) == 1);
+        SYLAR_ASSERT(c == 'a' + idx % 26);
+    }
+    SYLAR_ASSERT(pwrite(fd, "z", 1, 0) == 1);
+    SYLAR_ASSERT(lseek(fd, 0, SEEK_SET) == 0);
+    for (int i = 0; i < s_blocks; i++) {
+        SYLAR_ASSERT(read(fd, &block[0], block.size()) == (ssize_t)block.size());
+        SYLAR_ASSERT(block[1] == 'a' + i % 26 && block[BLOCK_SIZE - 1] == 'a' + i % 26);
+        SYLAR_ASSERT(i || block[0] == 'z');
+    }
+    char c;
+    SYLAR_ASSERT(read(fd, &c, 1) == 0);
+    close(fd);
+
+    // 出错时errno要带回协程里
+    errno = 0;
+    SYLAR_ASSERT(open("/tmp/sylar_test_file_io_not_exist/x", O_RDONLY) == -1 && errno == ENOENT);
+    unlink(s_path);
+    used      = sylar::GetElapsedUS() - start;
+    s_running = false;
+}
+
+static void ticker(uint64_t &max_gap) {
+    uint64_t last = sylar::GetElapsedUS();
+    while (s_running) {
+        usleep(1000);
+        uint64_t now = sylar::GetElapsedUS();
+        max_gap      = std::max(max_gap, now - last);
+        last         = now;
+    }
+}
+
+static void bench(uint32_t threads) {
+    sylar::Config::Lookup<uint32_t>("fileio.threads")->setValue(threads);
+    uint64_t tasks   = sylar::FileIoMgr::GetInstance()->getTaskCount();
+    uint64_t used    = 0;
+    uint64_t max_gap = 0;
+    s_running        = true;
+    {
+        sylar::IOManager iom(1, false, "file");
+        iom.schedule(std::bind(&ticker, std::ref(max_gap)));
+        iom.schedule(std::bind(&writer, std::ref(used)));
+    }
+    tasks = sylar::FileIoMgr::GetInstance()->getTaskCount() - tasks;
+    SYLAR_LOG_INFO(g_logger) << "fileio.threads=" << threads << " size=" << s_blocks * BLOCK_SIZE / 1024 / 1024 << "MB"
+                             << " used=" << used / 1000 << "ms offloaded=" << tasks
+                             << " ticker max_gap=" << max_gap / 1000.0 << "ms";
+    SYLAR_ASSERT(threads ? tasks > 0 : tasks == 0);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_blocks = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+
+    bench(0);
+    bench(2);
+    return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * @file test_future.cc
+ * @brief Future/Promise、when_all/when_any和WaitGroup
+ * @details 单线程IOManager上等Future只挂起当前协程，ticker照常运行；检查返回值、void、异常、broken_promise、
+ *          when_all/when_any、WaitGroup和普通线程等待；最后起一个每个请求耗时-t毫秒的HTTP服务，
+ *          用Scheduler::async并发-n个HttpConnectionPool::doGet，总耗时应该接近单个请求而不是所有请求之和
+ *          参数：-n 并发请求数 -t 每个请求的毫秒数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_fanout     = 8;
+static int s_latency_ms = 50;
+
+static std::atomic<bool> s_running = {true};
+static std::atomic<uint64_t> s_ticks = {0};
+
+static void ticker() {
+    while (s_running) {
+        usleep(1000);
+        ++s_ticks;
+    }
+}
+
+static void check_basic() {
+    sylar::IOManager *iom = sylar::IOManager::GetThis();
+    uint64_t ticks        = s_ticks;
+
+    auto f = iom->async([]() {
+        usleep(20 * 1000);
+        return std::string("hello");
+    });
+    SYLAR_ASSERT(f.valid() && !f.isReady());
+    SYLAR_ASSERT(f.get() == "hello" && f.isReady());
+    // 等的时候ticker还在跑
+    ticks = s_ticks - ticks;
+    SYLAR_LOG_INFO(g_logger) << "async ticks=" << ticks;
+    SYLAR_ASSERT(ticks >= 5);
+
+    std::atomic<bool> ran(false);
+    sylar::Future<void> v = iom->async([&ran]() {
+        ran = true;
+    });
+    v.get();
+    SYLAR_ASSERT(ran);
+
+    // 异常通过get()抛回来
+    auto e = iom->async([]() -> int {
+        throw std::runtime_error("boom");
+    });
+    bool caught = false;
+    try {
+        e.get();
+    } catch (const std::runtime_error &ex) {
+        caught = std::string(ex.what()) == "boom";
+    }
+    SYLAR_ASSERT(caught);
+
+    // Promise没设置结果就没了
+    sylar::Future<int> broken;
+    {
+        sylar::Promise<int> p;
+        broken = p.getFuture();
+        sylar::Promise<int> copy(p);
+    }
+    caught = false;
+    try {
+        broken.get();
+    } catch (const std::future_error &ex) {
+        caught = ex.code() == std::future_errc::broken_promise;
+    }
+    SYLAR_ASSERT(caught);
+
+    // 重复设置失败
+    sylar::Promise<int> p;
+    SYLAR_ASSERT(p.setValue(1) && !p.setValue(2) && p.getFuture().get() == 1);
+}
+
+static void check_combinators(sylar::IOManager &iom) {
+    std::vector<sylar::Future<int>> futures;
+    uint64_t start = sylar::GetElapsedMS();
+    for (int i = 0; i < 5; i++) {
+        futures.push_back(iom.async([i]() {
+            usleep((5 - i) * 20 * 1000);
+            return i;
+        }));
+    }
+    auto any = sylar::when_any(futures).get();
+    SYLAR_LOG_INFO(g_logger) << "when_any index=" << any.index << " used=" << sylar::GetElapsedMS() - start << "ms";
+    SYLAR_ASSERT(any.index == 4 && any.futures[4].get() == 4);
+
+    auto all = sylar::when_all(futures).get();
+    uint64_t used = sylar::GetElapsedMS() - start;
+    int sum       = 0;
+    for (auto &i : all) {
+        sum += i.get();
+    }
+    SYLAR_LOG_INFO(g_logger) << "when_all sum=" << sum << " used=" << used << "ms";
+    SYLAR_ASSERT(sum == 10 && used < 200);
+
+    // 已经就绪的和空的
+    SYLAR_ASSERT(sylar::when_all(all).isReady());
+    SYLAR_ASSERT(sylar::when_all(std::vector<sylar::Future<int>>()).get().empty());
+
+    sylar::WaitGroup wg;
+    std::atomic<int> count(0);
+    for (int i = 0; i < 20; i++) {
+        wg.add();
+        iom.schedule([&wg, &count]() {
+            usleep(1000);
+            ++count;
+            wg.done();
+        });
+    }
+    wg.wait();
+    SYLAR_ASSERT(count == 20 && wg.getCount() == 0);
+
+    // 普通线程等协程的结果
+    auto f = iom.async([]() {
+        usleep(5 * 1000);
+        return 7;
+    });
+    int got = 0;
+    std::thread thr([&f, &got]() {
+        got = f.get();
+    });
+    thr.join();
+    SYLAR_ASSERT(got == 7);
+}
+
+static void check_fanout(sylar::IOManager &iom) {
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true));
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8032");
+    SYLAR_ASSERT(server->bind(addr));
+    server->getServletDispatch()->addServlet("/slow", [](sylar::http::HttpRequest::ptr req, sylar::http::HttpResponse::ptr rsp, sylar::http::HttpSession::ptr session) {
+        usleep(s_latency_ms * 1000);
+        rsp->setBody("ok");
+        return 0;
+    });
+    server->start();
+
+    sylar::http::HttpConnectionPool::ptr pool(new sylar::http::HttpConnectionPool(
+        "127.0.0.1", "", 8032, s_fanout, 30 * 1000, 100));
+    uint64_t start = sylar::GetElapsedMS();
+    std::vector<sylar::Future<sylar::http::HttpResult::ptr>> futures;
+    for (int i = 0; i < s_fanout; i++) {
+        futures.push_back(iom.async([pool]() {
+            return pool->doGet("/slow", 5000);
+        }));
+    }
+    auto all = sylar::when_all(futures);
+    for (auto &i : all.get()) {
+        auto r = i.get();
+        SYLAR_ASSERT(r->result == (int)sylar::http::HttpResult::Error::OK && r->response->getBody() == "ok");
+    }
+    uint64_t used = sylar::GetElapsedMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "fan-out " << s_fanout << " requests of " << s_latency_ms << "ms used " << used << "ms";
+    SYLAR_ASSERT(used < (uint64_t)s_latency_ms * s_fanout / 2);
+    server->stop();
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_fanout = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_latency_ms = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+
+    {
+        sylar::IOManager iom(1, false, "single");
+        iom.schedule(&ticker);
+        iom.schedule([]() {
+            check_basic();
+            s_running = false;
+        });
+    }
+    {
+        sylar::IOManager iom(4, false, "multi");
+        iom.schedule([&iom]() {
+            check_combinators(iom);
+            check_fanout(iom);
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file test_http_reactor.cc
+ * @brief 共享epoll和每线程一个epoll(多reactor)两种模式下http echo服务的吞吐对比
+ * @details 客户端是普通线程，每个线程一条长连接，同步发请求收响应，固定时长内统计总请求数和IOManager调用epoll_ctl的次数；
+ *          带-persistent时改为对比每次事件增删epoll和fd持久注册两种模式，持久注册的epoll_ctl次数要少得多
+ *          参数：-t 服务端IO线程数，-conn 客户端连接数，-s 每种模式的压测秒数，-persistent 对比持久注册
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <time.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_threads = 4;
+static int s_clients = 16;
+static int s_seconds = 3;
+
+static std::atomic<bool> s_running      = {false};
+static std::atomic<uint64_t> s_requests = {0};
+
+static const char s_request[] =
+    "POST /echo HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 5\r\n"
+    "\r\n"
+    "hello";
+
+/**
+ * @brief 读一个完整的响应，按Content-Length判断body是否读完
+ */
+static bool recv_response(int fd, std::string &buf) {
+    char tmp[4096];
+    while (true) {
+        size_t pos = buf.find("\r\n\r\n");
+        if (pos != std::string::npos) {
+            size_t len = 0;
+            size_t cl  = buf.find("content-length: ");
+            if (cl != std::string::npos && cl < pos) {
+                len = atoi(buf.c_str() + cl + 16);
+            }
+            if (buf.size() >= pos + 4 + len) {
+                SYLAR_ASSERT(buf.compare(pos + 4, len, "hello") == 0);
+                buf.erase(0, pos + 4 + len);
+                return true;
+            }
+        }
+        int rt = recv(fd, tmp, sizeof(tmp), 0);
+        if (rt <= 0) {
+            return false;
+        }
+        buf.append(tmp, rt);
+    }
+}
+
+static void client(sylar::Address::ptr addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, addr->getAddr(), addr->getAddrLen())) {
+        SYLAR_LOG_ERROR(g_logger) << "connect fail errno=" << errno << " errstr=" << strerror(errno);
+        close(fd);
+        return;
+    }
+    std::string buf;
+    while (s_running) {
+        if (send(fd, s_request, sizeof(s_request) - 1, 0) != sizeof(s_request) - 1) {
+            break;
+        }
+        if (!recv_response(fd, buf)) {
+            break;
+        }
+        ++s_requests;
+    }
+    close(fd);
+}
+
+/**
+ * @brief 按当前配置压测一轮
+ * @return 平均每个请求调用epoll_ctl的次数
+ */
+static double bench(const std::string &host) {
+    sylar::IOManager iom(s_threads, false, "http");
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(host);
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true, &iom, &iom, &iom));
+    server->getServletDispatch()->addServlet("/echo", [](sylar::http::HttpRequest::ptr req, sylar::http::HttpResponse::ptr rsp, sylar::http::HttpSession::ptr session) {
+        rsp->setBody(req->getBody());
+        return 0;
+    });
+    // 监听socket要在hook线程里创建
+    iom.schedule([server, addr]() {
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+    });
+    sleep(1);
+
+    s_requests = 0;
+    s_running  = true;
+    std::vector<sylar::Thread::ptr> clients;
+    uint64_t ctl_start = iom.getEpollCtlCount();
+    uint64_t start     = sylar::GetElapsedNS();
+    for (int i = 0; i < s_clients; i++) {
+        clients.push_back(std::make_shared<sylar::Thread>(std::bind(&client, addr), "client_" + std::to_string(i)));
+    }
+    sleep(s_seconds);
+    s_running = false;
+    for (auto &i : clients) {
+        i->join();
+    }
+    uint64_t used = sylar::GetElapsedNS() - start;
+    uint64_t ctls = iom.getEpollCtlCount() - ctl_start;
+
+    SYLAR_ASSERT(s_requests > 0);
+    SYLAR_LOG_INFO(g_logger) << "multi_reactor=" << iom.isMultiReactor() << " persistent=" << iom.isPersistentRegistration()
+                             << " threads=" << s_threads << " clients=" << s_clients << " requests=" << s_requests
+                             << " req/s=" << (uint64_t)(s_requests * 1e9 / used)
+                             << " epoll_ctl=" << ctls << " epoll_ctl/req=" << (double)ctls / s_requests;
+    server->stop();
+    return (double)ctls / s_requests;
+}
+
+static void bench_reactor() {
+    sylar::ConfigVar<bool>::ptr multi_reactor = sylar::Config::Lookup<bool>("iomanager.multi_reactor");
+    multi_reactor->setValue(false);
+    bench("127.0.0.1:8022");
+    multi_reactor->setValue(true);
+    bench("127.0.0.1:8023");
+}
+
+static void bench_persistent() {
+    sylar::ConfigVar<bool>::ptr persistent = sylar::Config::Lookup<bool>("iomanager.persistent_registration");
+    persistent->setValue(false);
+    double per_event = bench("127.0.0.1:8026");
+    persistent->setValue(true);
+    double per_fd = bench("127.0.0.1:8027");
+    // 默认模式下recv读不到数据就要注册读事件，触发后再删掉；持久注册只在连接建立和关闭时调用
+    SYLAR_ASSERT(per_fd * 10 < per_event);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_threads = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("conn")) {
+        s_clients = atoi(sylar::EnvMgr::GetInstance()->get("conn").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("s")) {
+        s_seconds = atoi(sylar::EnvMgr::GetInstance()->get("s").c_str());
+    }
+
+    if (sylar::EnvMgr::GetInstance()->has("persistent")) {
+        bench_persistent();
+    } else {
+        bench_reactor();
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file test_io_uring.cc
+ * @brief io_uring后端测试
+ * @details 覆盖accept/connect/recv/send、接收超时、close取消阻塞中的recv，
+ *          最后对比epoll和io_uring两种模式下单连接ping-pong的吞吐
+ *          参数：-n 每个连接的ping-pong次数，-conn 连接数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <time.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_rounds  = 20000;
+static int s_clients = 4;
+
+static std::atomic<int> s_done = {0};
+
+static void echo(sylar::Socket::ptr client) {
+    char buf[64];
+    while (true) {
+        int rt = client->recv(buf, sizeof(buf));
+        if (rt <= 0) {
+            break;
+        }
+        if (client->send(buf, rt) != rt) {
+            break;
+        }
+    }
+    client->close();
+}
+
+static void serve(sylar::Socket::ptr sock) {
+    while (true) {
+        sylar::Socket::ptr client = sock->accept();
+        if (!client) {
+            break;
+        }
+        sylar::IOManager::GetThis()->schedule(std::bind(&echo, client));
+    }
+}
+
+static void ping(sylar::Address::ptr addr) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    char buf[8];
+    for (int i = 0; i < s_rounds; i++) {
+        SYLAR_ASSERT(sock->send("ping", 4) == 4);
+        int n = 0;
+        while (n < 4) {
+            int rt = sock->recv(buf + n, 4 - n);
+            SYLAR_ASSERT(rt > 0);
+            n += rt;
+        }
+        SYLAR_ASSERT(memcmp(buf, "ping", 4) == 0);
+    }
+    ++s_done;
+}
+
+/**
+ * @brief 服务端只读不写，客户端的recv应该按SO_RCVTIMEO超时
+ */
+static void test_timeout(sylar::Address::ptr addr) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    sock->setRecvTimeout(100);
+    char buf[8];
+    uint64_t start = sylar::GetElapsedNS();
+    int rt         = sock->recv(buf, sizeof(buf));
+    uint64_t used  = (sylar::GetElapsedNS() - start) / 1000000;
+    SYLAR_LOG_INFO(g_logger) << "recv timeout rt=" << rt << " errno=" << errno << " used=" << used << "ms";
+    SYLAR_ASSERT(rt == -1 && errno == ETIMEDOUT && used >= 90);
+    ++s_done;
+}
+
+/**
+ * @brief 一个协程阻塞在recv上，另一个协程关闭socket，recv应该返回失败而不是一直挂着
+ */
+static void test_close(sylar::Address::ptr addr) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    sylar::IOManager::GetThis()->addTimer(50, [sock]() {
+        sock->close();
+    });
+    char buf[8];
+    int rt = sock->recv(buf, sizeof(buf));
+    SYLAR_LOG_INFO(g_logger) << "recv after close rt=" << rt << " errno=" << errno;
+    SYLAR_ASSERT(rt <= 0);
+    ++s_done;
+}
+
+void run(bool io_uring, const char *ip) {
+    sylar::Config::Lookup<bool>("iomanager.io_uring")->setValue(io_uring);
+    s_done = 0;
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(ip);
+    uint64_t used            = 0;
+    {
+        sylar::IOManager iom(2, false, "uring");
+        SYLAR_LOG_INFO(g_logger) << "io_uring=" << io_uring << " enabled=" << iom.isIoUring();
+
+        sylar::Socket::ptr sock;
+        iom.schedule([&sock, addr]() {
+            sock = sylar::Socket::CreateTCP(addr);
+            SYLAR_ASSERT(sock->bind(addr) && sock->listen());
+            sylar::IOManager::GetThis()->schedule(std::bind(&serve, sock));
+        });
+        sleep(1);
+
+        iom.schedule(std::bind(&test_timeout, addr));
+        iom.schedule(std::bind(&test_close, addr));
+        while (s_done < 2) {
+            usleep(10000);
+        }
+
+        uint64_t start = sylar::GetElapsedNS();
+        for (int i = 0; i < s_clients; i++) {
+            iom.schedule(std::bind(&ping, addr));
+        }
+        while (s_done < 2 + s_clients) {
+            usleep(1000);
+        }
+        used = sylar::GetElapsedNS() - start;
+        iom.schedule([sock]() {
+            sock->close();
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "io_uring=" << io_uring << " clients=" << s_clients << " rounds=" << s_rounds
+                             << " used=" << used / 1000000 << "ms"
+                             << " rtt/s=" << (uint64_t)(s_clients * s_rounds * 1e9 / used);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_rounds = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("conn")) {
+        s_clients = atoi(sylar::EnvMgr::GetInstance()->get("conn").c_str());
+    }
+
+    run(false, "127.0.0.1:8024");
+    run(true, "127.0.0.1:8025");
+    return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * @file test_parallel.cc
+ * @brief parallel_for、parallel_reduce和parallel_sort
+ * @details 检查结果和串行一致：空区间、不带调度器、普通线程里调用、并行里嵌套并行；
+ *          然后在-t个线程的IOManager上和串行版本对比耗时：按行解析日志统计状态码(map-reduce)、逐元素计算(for)、排序
+ *          参数：-t 调度线程数，默认为CPU数 -n 数据量
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <cmath>
+#include <map>
+#include <random>
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static size_t s_threads = std::max(1u, std::thread::hardware_concurrency());
+static size_t s_count   = 1000000;
+
+typedef std::map<int, size_t> StatusCount;
+
+static StatusCount merge_count(StatusCount a, const StatusCount &b) {
+    for (auto &i : b) {
+        a[i.first] += i.second;
+    }
+    return a;
+}
+
+static StatusCount count_status(const std::vector<std::string> &lines, size_t b, size_t e) {
+    StatusCount count;
+    for (size_t i = b; i < e; i++) {
+        // GET /path HTTP/1.1 200 1234
+        const std::string &line = lines[i];
+        size_t pos              = line.find("HTTP/1.1 ");
+        if (pos != std::string::npos) {
+            count[atoi(line.c_str() + pos + 9)]++;
+        }
+    }
+    return count;
+}
+
+static std::vector<std::string> make_lines(size_t n) {
+    static const int statuses[] = {200, 200, 200, 301, 404, 500};
+    std::mt19937 rng(1);
+    std::vector<std::string> lines(n);
+    for (size_t i = 0; i < n; i++) {
+        lines[i] = "GET /api/item/" + std::to_string(rng() % 100000) + " HTTP/1.1 " + std::to_string(statuses[rng() % 6]) + " " + std::to_string(rng() % 10000);
+    }
+    return lines;
+}
+
+static void check_correctness(sylar::Scheduler *sc) {
+    // 空区间和单个元素
+    sylar::parallel_for(sc, 5, 5, [](int) { SYLAR_ASSERT(false); });
+    SYLAR_ASSERT(sylar::parallel_reduce(sc, 0, 0, 7, [](int, int) { return 1; }, std::plus<int>()) == 7);
+    std::vector<int> one = {1};
+    sylar::parallel_sort(sc, one.begin(), one.end());
+
+    std::vector<int> marks(100000, 0);
+    sylar::parallel_for(sc, (size_t)0, marks.size(), [&marks](size_t i) {
+        marks[i]++;
+    }, 64);
+    for (auto i : marks) {
+        SYLAR_ASSERT(i == 1);
+    }
+
+    int64_t sum = sylar::parallel_reduce(sc, (int64_t)1, (int64_t)100001, (int64_t)0, [](int64_t b, int64_t e) {
+        int64_t s = 0;
+        for (int64_t i = b; i < e; i++) {
+            s += i;
+        }
+        return s;
+    }, std::plus<int64_t>(), 100);
+    SYLAR_ASSERT(sum == (int64_t)100000 * 100001 / 2);
+
+    std::mt19937 rng(2);
+    std::vector<int> v(100000);
+    for (auto &i : v) {
+        i = rng() % 1000;
+    }
+    std::vector<int> expect = v;
+    std::sort(expect.begin(), expect.end(), std::greater<int>());
+    sylar::parallel_sort(sc, v.begin(), v.end(), std::greater<int>(), 1000);
+    SYLAR_ASSERT(v == expect);
+
+    std::vector<std::string> strs;
+    for (int i = 0; i < 20000; i++) {
+        strs.push_back(std::to_string(rng()));
+    }
+    std::vector<std::string> sorted = strs;
+    std::sort(sorted.begin(), sorted.end());
+    sylar::parallel_sort(sc, strs.begin(), strs.end());
+    SYLAR_ASSERT(strs == sorted);
+
+    // 并行里再并行，外层的协程等待时不占线程
+    std::atomic<int> inner(0);
+    sylar::parallel_for(sc, 0, 8, [sc, &inner](int) {
+        sylar::parallel_for(sc, 0, 100, [&inner](int) {
+            ++inner;
+        });
+    });
+    SYLAR_ASSERT(inner == 800);
+}
+
+static void bench(sylar::Scheduler *sc) {
+    std::vector<std::string> lines = make_lines(s_count);
+
+    uint64_t start     = sylar::GetElapsedUS();
+    StatusCount serial = count_status(lines, 0, lines.size());
+    uint64_t serial_us = sylar::GetElapsedUS() - start;
+    start              = sylar::GetElapsedUS();
+    StatusCount par    = sylar::parallel_reduce(sc, (size_t)0, lines.size(), StatusCount(), [&lines](size_t b, size_t e) {
+        return count_status(lines, b, e);
+    }, merge_count, 1024);
+    uint64_t par_us = sylar::GetElapsedUS() - start;
+    SYLAR_ASSERT(serial == par);
+    SYLAR_LOG_INFO(g_logger) << "log map-reduce lines=" << s_count << " serial=" << serial_us / 1000 << "ms parallel=" << par_us / 1000
+                             << "ms speedup=" << (double)serial_us / std::max<uint64_t>(par_us, 1);
+
+    std::vector<double> out(s_count);
+    auto heavy = [&out](size_t i) {
+        double x = i;
+        for (int k = 0; k < 20; k++) {
+            x = std::sqrt(x + k) * 1.5;
+        }
+        out[i] = x;
+    };
+    start = sylar::GetElapsedUS();
+    for (size_t i = 0; i < s_count; i++) {
+        heavy(i);
+    }
+    serial_us = sylar::GetElapsedUS() - start;
+    start     = sylar::GetElapsedUS();
+    sylar::parallel_for(sc, (size_t)0, s_count, heavy, 1024);
+    par_us = sylar::GetElapsedUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "for n=" << s_count << " serial=" << serial_us / 1000 << "ms parallel=" << par_us / 1000
+                             << "ms speedup=" << (double)serial_us / std::max<uint64_t>(par_us, 1);
+
+    std::mt19937 rng(3);
+    std::vector<uint32_t> data(s_count);
+    for (auto &i : data) {
+        i = rng();
+    }
+    std::vector<uint32_t> copy = data;
+    start                      = sylar::GetElapsedUS();
+    std::sort(copy.begin(), copy.end());
+    serial_us = sylar::GetElapsedUS() - start;
+    start     = sylar::GetElapsedUS();
+    sylar::parallel_sort(sc, data.begin(), data.end());
+    par_us = sylar::GetElapsedUS() - start;
+    SYLAR_ASSERT(data == copy);
+    SYLAR_LOG_INFO(g_logger) << "sort n=" << s_count << " serial=" << serial_us / 1000 << "ms parallel=" << par_us / 1000
+                             << "ms speedup=" << (double)serial_us / std::max<uint64_t>(par_us, 1);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_threads = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_count = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+
+    check_correctness(nullptr);
+    {
+        sylar::IOManager iom(s_threads, false, "parallel");
+        // 普通线程里调用，调用方等待时阻塞的是自己的线程
+        check_correctness(&iom);
+        iom.schedule([&iom]() {
+            check_correctness(&iom);
+            bench(&iom);
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "threads=" << s_threads << " all ok";
+    return 0;
+}
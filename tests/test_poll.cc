@@ -0,0 +1,330 @@
+/**
+ * @file test_poll.cc
+ * @brief hook后的poll/select/ppoll/epoll_wait，以及accept4/dup/pipe/eventfd
+ * @details 单线程IOManager上另起一个每毫秒醒一次的协程，等待期间它还在跑，说明调度线程没有被阻塞；
+ *          检查就绪、超时、select写回剩余时间、dup之后FdCtx的状态一致、dup2覆盖时唤醒等在旧fd上的协程，
+ *          以及同一个fd重复出现或者已经有协程在等时不会断言退出；
+ *          除了check_pipe_blocking，其余检查都打开hook.pipe_nonblock，管道和eventfd的读写也挂起协程
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<bool> s_running = {true};
+static std::atomic<uint64_t> s_ticks = {0};
+
+static void ticker() {
+    while (s_running) {
+        usleep(1000);
+        ++s_ticks;
+    }
+}
+
+/**
+ * @brief 执行cb，检查用时在[min_ms, max_ms)之间，并且期间ticker一直在跑
+ */
+template <class Func>
+static void timed(const char *name, uint64_t min_ms, uint64_t max_ms, Func cb) {
+    uint64_t ticks = s_ticks;
+    uint64_t start = sylar::GetElapsedMS();
+    cb();
+    uint64_t used = sylar::GetElapsedMS() - start;
+    ticks         = s_ticks - ticks;
+    SYLAR_LOG_INFO(g_logger) << name << " used=" << used << "ms ticks=" << ticks;
+    SYLAR_ASSERT(used >= min_ms && used < max_ms);
+    SYLAR_ASSERT(min_ms < 20 || ticks >= min_ms / 4);
+}
+
+static void write_later(int fd, uint64_t ms) {
+    sylar::IOManager::GetThis()->addTimer(ms, [fd]() {
+        uint64_t one = 1;
+        SYLAR_ASSERT(write(fd, &one, sizeof(one)) == sizeof(one));
+    });
+}
+
+/**
+ * @brief 默认不给管道和eventfd设非阻塞，fork出去的子进程拿到的还是阻塞的，poll它们仍然只挂起协程
+ */
+static void check_pipe_blocking() {
+    int fds[2];
+    SYLAR_ASSERT(pipe(fds) == 0);
+    int efd = eventfd(0, 0);
+    for (int fd : {fds[0], fds[1], efd}) {
+        auto ctx = sylar::FdMgr::GetInstance()->get(fd);
+        SYLAR_ASSERT(ctx && !ctx->isPollable());
+        SYLAR_ASSERT(!(fcntl_f(fd, F_GETFL) & O_NONBLOCK));
+    }
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    write_later(fds[1], 30);
+    timed("poll blocking pipe", 30, 80, [&]() {
+        SYLAR_ASSERT(poll(&pfd, 1, 1000) == 1 && (pfd.revents & POLLIN));
+    });
+    uint64_t v;
+    SYLAR_ASSERT(read(fds[0], &v, sizeof(v)) == sizeof(v));
+    for (int fd : {fds[0], fds[1], efd}) {
+        close(fd);
+    }
+    sylar::Config::Lookup<bool>("hook.pipe_nonblock")->setValue(true);
+}
+
+static void check_poll() {
+    int fds[2];
+    SYLAR_ASSERT(pipe(fds) == 0);
+    auto ctx = sylar::FdMgr::GetInstance()->get(fds[0]);
+    SYLAR_ASSERT(ctx && ctx->isPollable() && !ctx->getUserNonblock());
+
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    timed("poll timeout", 100, 150, [&]() {
+        SYLAR_ASSERT(poll(&pfd, 1, 100) == 0);
+    });
+    write_later(fds[1], 30);
+    timed("poll ready", 30, 80, [&]() {
+        SYLAR_ASSERT(poll(&pfd, 1, -1) == 1 && (pfd.revents & POLLIN));
+    });
+    uint64_t v;
+    SYLAR_ASSERT(read(fds[0], &v, sizeof(v)) == sizeof(v));
+
+    // 写端关闭，读端POLLHUP
+    struct pollfd hup = {fds[0], 0, 0};
+    sylar::IOManager::GetThis()->addTimer(20, [fds]() {
+        close(fds[1]);
+    });
+    timed("poll hup", 20, 70, [&]() {
+        SYLAR_ASSERT(poll(&hup, 1, 1000) == 1 && (hup.revents & POLLHUP));
+    });
+    close(fds[0]);
+
+    struct timespec ts = {0, 2500000};
+    timed("ppoll 2.5ms", 2, 20, [&]() {
+        SYLAR_ASSERT(ppoll(nullptr, 0, &ts, nullptr) == 0);
+    });
+}
+
+/**
+ * @brief 同一个fd在数组里出现多次，或者已经有别的协程在等它
+ * @details 重复的项合并后挂起协程等；已经有人在等的事件用followEvent排在后面，超时和就绪时都只挂起协程
+ */
+static void check_poll_shared() {
+    int fds[2];
+    SYLAR_ASSERT(pipe(fds) == 0);
+    struct pollfd same[3] = {{fds[0], POLLIN, 0}, {fds[0], POLLOUT, 0}, {fds[0], POLLPRI, 0}};
+    write_later(fds[1], 30);
+    timed("poll same fd", 30, 80, [&]() {
+        SYLAR_ASSERT(poll(same, 3, 1000) == 1 && (same[0].revents & POLLIN));
+    });
+    uint64_t v;
+    SYLAR_ASSERT(read(fds[0], &v, sizeof(v)) == sizeof(v));
+
+    // 两个协程poll同一个fd，后来的那个排在先来的后面，超时和就绪时都不阻塞线程
+    std::atomic<int> done(0);
+    sylar::IOManager::GetThis()->schedule([fds, &done]() {
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+        SYLAR_ASSERT(poll(&pfd, 1, -1) == 1 && (pfd.revents & POLLIN));
+        ++done;
+    });
+    usleep(10000);
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    timed("poll follower timeout", 50, 100, [&]() {
+        SYLAR_ASSERT(poll(&pfd, 1, 50) == 0);
+    });
+    write_later(fds[1], 30);
+    timed("poll follower ready", 30, 80, [&]() {
+        SYLAR_ASSERT(poll(&pfd, 1, 1000) == 1 && (pfd.revents & POLLIN));
+    });
+    usleep(10000);
+    SYLAR_ASSERT(done == 1);
+    SYLAR_ASSERT(read(fds[0], &v, sizeof(v)) == sizeof(v));
+    close(fds[0]);
+    close(fds[1]);
+
+    // hook的recv和poll等同一个socket，后来的排在先来的后面，recv按SO_RCVTIMEO超时
+    int sv[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    sylar::FdMgr::GetInstance()->get(sv[0], true);
+    sylar::IOManager::GetThis()->schedule([sv, &done]() {
+        char c;
+        SYLAR_ASSERT(recv(sv[0], &c, 1, 0) == 1);
+        ++done;
+    });
+    usleep(10000);
+    pfd = {sv[0], POLLIN, 0};
+    timed("poll behind recv timeout", 50, 100, [&]() {
+        SYLAR_ASSERT(poll(&pfd, 1, 50) == 0);
+    });
+    // 发两个字节，recv读走一个，poll醒来还能看到剩下的
+    sylar::IOManager::GetThis()->addTimer(30, [sv]() {
+        SYLAR_ASSERT(send(sv[1], "ab", 2, 0) == 2);
+    });
+    timed("poll behind recv ready", 30, 80, [&]() {
+        SYLAR_ASSERT(poll(&pfd, 1, 1000) == 1 && (pfd.revents & POLLIN));
+    });
+    usleep(10000);
+    SYLAR_ASSERT(done == 2);
+    char c;
+    SYLAR_ASSERT(recv(sv[0], &c, 1, 0) == 1 && c == 'b');
+
+    sylar::IOManager::GetThis()->schedule([sv, &done]() {
+        struct pollfd pfd = {sv[0], POLLIN, 0};
+        SYLAR_ASSERT(poll(&pfd, 1, -1) == 1);
+        ++done;
+    });
+    usleep(10000);
+    struct timeval tv = {0, 50000};
+    SYLAR_ASSERT(setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+    timed("recv behind poll timeout", 50, 100, [&]() {
+        SYLAR_ASSERT(recv(sv[0], &c, 1, 0) == -1 && errno == ETIMEDOUT);
+    });
+    sylar::IOManager::GetThis()->addTimer(30, [sv]() {
+        SYLAR_ASSERT(send(sv[1], "c", 1, 0) == 1);
+    });
+    timed("recv behind poll ready", 30, 80, [&]() {
+        SYLAR_ASSERT(recv(sv[0], &c, 1, 0) == 1 && c == 'c');
+    });
+    usleep(10000);
+    SYLAR_ASSERT(done == 3);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void check_select() {
+    int fds[2];
+    SYLAR_ASSERT(pipe(fds) == 0);
+    fd_set rset;
+    FD_ZERO(&rset);
+    FD_SET(fds[0], &rset);
+    struct timeval tv = {0, 100000};
+    timed("select timeout", 100, 150, [&]() {
+        SYLAR_ASSERT(select(fds[0] + 1, &rset, nullptr, nullptr, &tv) == 0);
+    });
+    SYLAR_ASSERT(tv.tv_sec == 0 && tv.tv_usec == 0 && !FD_ISSET(fds[0], &rset));
+
+    write_later(fds[1], 30);
+    FD_SET(fds[0], &rset);
+    fd_set wset;
+    FD_ZERO(&wset);
+    tv = {1, 0};
+    timed("select ready", 30, 80, [&]() {
+        SYLAR_ASSERT(select(fds[0] + 1, &rset, &wset, nullptr, &tv) == 1);
+    });
+    SYLAR_ASSERT(FD_ISSET(fds[0], &rset) && tv.tv_sec == 0 && tv.tv_usec > 900000);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void check_epoll_wait() {
+    int efd = eventfd(0, 0);
+    int ep  = epoll_create1(0);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = efd;
+    SYLAR_ASSERT(epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev) == 0);
+    timed("epoll_wait timeout", 50, 100, [&]() {
+        SYLAR_ASSERT(epoll_wait(ep, &ev, 1, 50) == 0);
+    });
+    write_later(efd, 30);
+    timed("epoll_wait ready", 30, 80, [&]() {
+        SYLAR_ASSERT(epoll_wait(ep, &ev, 1, -1) == 1 && ev.data.fd == efd);
+    });
+    uint64_t v = 0;
+    SYLAR_ASSERT(read(efd, &v, sizeof(v)) == sizeof(v) && v == 1);
+
+    // eventfd的read在没有计数时挂起协程
+    write_later(efd, 30);
+    timed("eventfd read", 30, 80, [&]() {
+        SYLAR_ASSERT(read(efd, &v, sizeof(v)) == sizeof(v) && v == 1);
+    });
+    close(ep);
+    close(efd);
+
+    // 用户要的非阻塞直接返回EAGAIN
+    efd = eventfd(0, EFD_NONBLOCK);
+    SYLAR_ASSERT(sylar::FdMgr::GetInstance()->get(efd)->getUserNonblock());
+    SYLAR_ASSERT(read(efd, &v, sizeof(v)) == -1 && errno == EAGAIN);
+    close(efd);
+}
+
+static void check_accept4_dup() {
+    sylar::Address::ptr addr  = sylar::Address::LookupAnyIPAddress("127.0.0.1:8031");
+    sylar::Socket::ptr server = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(server->bind(addr) && server->listen());
+    sylar::Socket::ptr client = sylar::Socket::CreateTCP(addr);
+    sylar::IOManager::GetThis()->addTimer(30, [client, addr]() {
+        SYLAR_ASSERT(client->connect(addr));
+    });
+    int fd = -1;
+    timed("accept4", 30, 80, [&]() {
+        fd = accept4(server->getSocket(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    });
+    SYLAR_ASSERT(fd >= 0);
+    auto ctx = sylar::FdMgr::GetInstance()->get(fd);
+    SYLAR_ASSERT(ctx && ctx->isSocket() && ctx->getUserNonblock());
+    char c;
+    SYLAR_ASSERT(recv(fd, &c, 1, 0) == -1 && errno == EAGAIN);
+
+    // dup出来的fd继承非阻塞和超时设置
+    SYLAR_ASSERT(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == 0);
+    struct timeval tv = {0, 50000};
+    SYLAR_ASSERT(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+    int fd2 = dup(fd);
+    int fd3 = fcntl(fd, F_DUPFD_CLOEXEC, 100);
+    SYLAR_ASSERT(fd3 >= 100);
+    for (int d : {fd2, fd3}) {
+        auto c2 = sylar::FdMgr::GetInstance()->get(d);
+        SYLAR_ASSERT(c2 && !c2->getUserNonblock() && c2->getTimeout(SO_RCVTIMEO) == 50);
+        SYLAR_ASSERT(!(fcntl(d, F_GETFL) & O_NONBLOCK));
+    }
+    timed("recv timeout on dup", 50, 100, [&]() {
+        SYLAR_ASSERT(recv(fd2, &c, 1, 0) == -1 && errno == ETIMEDOUT);
+    });
+
+    // dup2覆盖一个正有协程在等的fd，等待的协程被唤醒并返回EBADF
+    int fds[2];
+    SYLAR_ASSERT(pipe(fds) == 0);
+    std::atomic<bool> woken(false);
+    sylar::IOManager::GetThis()->schedule([fd3, &woken]() {
+        char c;
+        SYLAR_ASSERT(read(fd3, &c, 1) == -1 && errno == EBADF);
+        woken = true;
+    });
+    usleep(10000);
+    SYLAR_ASSERT(dup2(fds[0], fd3) == fd3);
+    usleep(10000);
+    SYLAR_ASSERT(woken);
+    auto c3 = sylar::FdMgr::GetInstance()->get(fd3);
+    SYLAR_ASSERT(c3 && !c3->isSocket() && c3->isPollable());
+
+    for (int d : {fd, fd2, fd3, fds[0], fds[1]}) {
+        close(d);
+    }
+    client->close();
+    server->close();
+}
+
+static void run() {
+    sylar::IOManager::GetThis()->schedule(&ticker);
+    check_pipe_blocking();
+    check_poll();
+    check_poll_shared();
+    check_select();
+    check_epoll_wait();
+    check_accept4_dup();
+    s_running = false;
+    SYLAR_LOG_INFO(g_logger) << "all ok";
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    sylar::IOManager iom(1, false, "poll");
+    iom.schedule(&run);
+    return 0;
+}
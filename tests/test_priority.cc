@@ -0,0 +1,209 @@
+/**
+ * @file test_priority.cc
+ * @brief 调度器的任务优先级
+ * @details 单线程IOManager上：检查取任务的顺序和低优先级不会饿死；外部线程塞满-n个各忙-t微秒的普通任务，
+ *          对比这时高优先级和普通优先级的健康检查要排多久；打了高优先级标记的监听socket在积压下照样及时accept和回包；
+ *          最后输出各优先级的队列长度和排队时长
+ *          参数：-n 积压的任务数 -t 每个任务忙多少微秒
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_backlog     = 2000;
+static uint64_t s_busy_us = 100;
+
+/**
+ * @brief 占着线程忙等，不让出
+ */
+static void busy(uint64_t us) {
+    uint64_t end = sylar::GetElapsedUS() + us;
+    while (sylar::GetElapsedUS() < end) {
+    }
+}
+
+static void wait_flag(std::atomic<bool> &flag) {
+    while (!flag) {
+        usleep(1000);
+    }
+}
+
+/**
+ * @brief 从外部线程塞满积压的普通任务
+ */
+static void flood(sylar::IOManager &iom, std::atomic<int> &done) {
+    for (int i = 0; i < s_backlog; i++) {
+        iom.schedule([&done]() {
+            busy(s_busy_us);
+            ++done;
+        }, -1, sylar::Scheduler::PRIORITY_NORMAL);
+    }
+}
+
+static void wait_flood(std::atomic<int> &done) {
+    while (done != s_backlog) {
+        usleep(1000);
+    }
+    done = 0;
+}
+
+static void check_order() {
+    sylar::IOManager *iom = sylar::IOManager::GetThis();
+    std::vector<int> order;
+    sylar::WaitGroup wg;
+    const int count = 100;
+    for (int i = 0; i < count; i++) {
+        for (int p : {sylar::Scheduler::PRIORITY_LOW, sylar::Scheduler::PRIORITY_NORMAL}) {
+            wg.add();
+            iom->schedule([&order, &wg, p]() {
+                order.push_back(p);
+                wg.done();
+            }, -1, p);
+        }
+    }
+    wg.add();
+    iom->schedule([&order, &wg]() {
+        order.push_back(sylar::Scheduler::PRIORITY_HIGH);
+        wg.done();
+    }, -1, sylar::Scheduler::PRIORITY_HIGH);
+    SYLAR_ASSERT(iom->getQueueDepth(sylar::Scheduler::PRIORITY_LOW) == count);
+    wg.wait();
+
+    // 最后加的高优先级最先运行，之后普通优先级每连续16个插一个低优先级
+    SYLAR_ASSERT(order.size() == count * 2 + 1 && order[0] == sylar::Scheduler::PRIORITY_HIGH);
+    size_t first_low = std::find(order.begin(), order.end(), (int)sylar::Scheduler::PRIORITY_LOW) - order.begin();
+    size_t lows      = std::count(order.begin(), order.begin() + count, (int)sylar::Scheduler::PRIORITY_LOW);
+    SYLAR_LOG_INFO(g_logger) << "order first_low=" << first_low << " lows in first " << count << "=" << lows;
+    SYLAR_ASSERT(first_low == 16 && lows >= 5);
+}
+
+static void check_starvation(sylar::IOManager &iom) {
+    // 两条高优先级的链一直派生新任务，高优先级队列始终不空
+    std::atomic<bool> stop(false), low_ran(false);
+    std::atomic<int> chains(0);
+    std::function<void()> chain = [&]() {
+        busy(50);
+        if (stop) {
+            ++chains;
+            return;
+        }
+        iom.schedule(chain);
+    };
+    iom.schedule(chain, -1, sylar::Scheduler::PRIORITY_HIGH);
+    iom.schedule(chain, -1, sylar::Scheduler::PRIORITY_HIGH);
+    usleep(10 * 1000);
+    uint64_t start = sylar::GetElapsedUS();
+    uint64_t used  = 0;
+    iom.schedule([&low_ran, &used, start]() {
+        used    = sylar::GetElapsedUS() - start;
+        low_ran = true;
+    }, -1, sylar::Scheduler::PRIORITY_LOW);
+    usleep(100 * 1000);
+    stop = true;
+    wait_flag(low_ran);
+    while (chains != 2) {
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "low task under high load waited " << used << "us";
+    SYLAR_ASSERT(used < 50 * 1000);
+}
+
+/**
+ * @brief 积压下调度一个健康检查，返回它排了多少微秒
+ */
+static uint64_t health_check(sylar::IOManager &iom, int priority) {
+    std::atomic<int> done(0);
+    std::atomic<bool> checked(false);
+    flood(iom, done);
+    uint64_t start = sylar::GetElapsedUS();
+    uint64_t used  = 0;
+    iom.schedule([&checked, &used, start]() {
+        used    = sylar::GetElapsedUS() - start;
+        checked = true;
+    }, -1, priority);
+    wait_flag(checked);
+    wait_flood(done);
+    return used;
+}
+
+static void check_admin_socket(sylar::IOManager &iom) {
+    std::atomic<bool> listening(false), served(false);
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8033");
+    int listen_fd            = -1;
+    iom.schedule([&]() {
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCPSocket();
+        SYLAR_ASSERT(sock->bind(addr) && sock->listen());
+        listen_fd = sock->getSocket();
+        SYLAR_ASSERT(iom.setFdPriority(listen_fd, sylar::Scheduler::PRIORITY_HIGH));
+        listening = true;
+        // 被监听socket的事件唤醒后，这个协程一直是高优先级，客户端socket没打标记也一样
+        sylar::Socket::ptr client = sock->accept();
+        SYLAR_ASSERT(client && sylar::Fiber::GetThis()->getPriority() == sylar::Scheduler::PRIORITY_HIGH);
+        char buf[16];
+        SYLAR_ASSERT(client->recv(buf, sizeof(buf)) == 4 && client->send("pong", 4) == 4);
+        client->close();
+        sock->close();
+        served = true;
+    });
+    wait_flag(listening);
+
+    std::atomic<int> done(0);
+    flood(iom, done);
+    uint64_t start             = sylar::GetElapsedUS();
+    sylar::Socket::ptr client = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(client->connect(addr) && client->send("ping", 4) == 4);
+    char buf[16];
+    SYLAR_ASSERT(client->recv(buf, sizeof(buf)) == 4 && memcmp(buf, "pong", 4) == 0);
+    uint64_t used = sylar::GetElapsedUS() - start;
+    wait_flag(served);
+    wait_flood(done);
+    SYLAR_LOG_INFO(g_logger) << "admin socket ping-pong behind " << s_backlog * s_busy_us / 1000 << "ms backlog took " << used << "us";
+    SYLAR_ASSERT(used < s_backlog * s_busy_us / 4);
+    // hook的close清掉了标记
+    SYLAR_ASSERT(iom.getFdPriority(listen_fd) == sylar::Scheduler::PRIORITY_AUTO);
+}
+
+static void dump_metrics(sylar::IOManager &iom) {
+    static const char *names[] = {"high", "normal", "low"};
+    for (int p = 0; p < sylar::Scheduler::PRIORITY_COUNT; p++) {
+        sylar::RunSliceHistogram h = iom.getWaitHistogram(p);
+        SYLAR_LOG_INFO(g_logger) << names[p] << " depth=" << iom.getQueueDepth(p) << " tasks=" << h.getTotal()
+                                 << " wait p50=" << h.percentile(0.5) << "us p99=" << h.percentile(0.99) << "us max=" << h.getMax() << "us";
+        SYLAR_ASSERT(iom.getQueueDepth(p) == 0 && h.getTotal() > 0);
+    }
+    SYLAR_ASSERT(iom.getWaitHistogram(sylar::Scheduler::PRIORITY_HIGH).getMax() < iom.getWaitHistogram(sylar::Scheduler::PRIORITY_NORMAL).getMax());
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_backlog = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_busy_us = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+
+    // 排队时长默认不统计
+    sylar::Config::Lookup<bool>("scheduler.slice_timing")->setValue(true);
+    sylar::IOManager iom(1, false, "priority");
+    std::atomic<bool> ordered(false);
+    iom.schedule([&ordered]() {
+        check_order();
+        ordered = true;
+    });
+    wait_flag(ordered);
+    check_starvation(iom);
+
+    uint64_t normal = health_check(iom, sylar::Scheduler::PRIORITY_NORMAL);
+    uint64_t high   = health_check(iom, sylar::Scheduler::PRIORITY_HIGH);
+    SYLAR_LOG_INFO(g_logger) << "health check behind " << s_backlog << " tasks of " << s_busy_us << "us: normal=" << normal << "us high=" << high << "us";
+    SYLAR_ASSERT(high * 4 < normal);
+
+    check_admin_socket(iom);
+    dump_metrics(iom);
+    SYLAR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
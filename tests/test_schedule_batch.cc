@@ -0,0 +1,229 @@
+/**
+ * @file test_schedule_batch.cc
+ * @brief 批量调度测试
+ * @details 检查schedule(begin, end)和scheduleBatch：每个任务正好执行一次，元素被移走，
+ *          指定线程的任务在指定的线程上执行并且只唤醒那个线程，唤醒的空闲线程数只按进了全局或本地队列的任务算
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <set>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_threads = 4;
+
+/// 只统计这个线程发出的唤醒，调度线程自己取任务时的唤醒不算
+static std::atomic<int> s_caller = {-1};
+static std::atomic<int> s_tickles = {0};
+static std::atomic<int> s_worker_tickles = {0};
+static thread_local bool t_in_tickle_worker = false;
+
+/**
+ * @brief 统计唤醒次数的调度器
+ * @details idle每毫秒回到调度循环看一次有没有任务，不用真的唤醒也能跑完
+ */
+class BatchScheduler : public sylar::Scheduler {
+public:
+    BatchScheduler()
+        : sylar::Scheduler(s_threads, false, "batch") {
+    }
+
+protected:
+    void tickle() override {
+        if (!t_in_tickle_worker && sylar::GetThreadId() == s_caller) {
+            ++s_tickles;
+        }
+    }
+
+    void tickleWorker(size_t idx) override {
+        if (sylar::GetThreadId() == s_caller) {
+            ++s_worker_tickles;
+        }
+        t_in_tickle_worker = true;
+        sylar::Scheduler::tickleWorker(idx);
+        t_in_tickle_worker = false;
+    }
+
+    void idle() override {
+        while (!stopping()) {
+            usleep(1000);
+            sylar::Fiber::GetThis()->yield();
+        }
+    }
+};
+
+static std::atomic<int> s_runs[64];
+static std::atomic<int> s_wrong_thread = {0};
+static std::atomic<int> s_done = {0};
+
+static void wait_done(int n) {
+    while (s_done < n) {
+        usleep(1000);
+    }
+    s_done = 0;
+}
+
+static void check_runs(int n) {
+    for (int i = 0; i < n; i++) {
+        SYLAR_ASSERT2(s_runs[i] == 1, "task " << i << " runs=" << s_runs[i]);
+        s_runs[i] = 0;
+    }
+    SYLAR_ASSERT(s_wrong_thread == 0);
+}
+
+static void reset_counters() {
+    s_caller         = sylar::GetThreadId();
+    s_tickles        = 0;
+    s_worker_tickles = 0;
+}
+
+/**
+ * @brief 拿到每个调度线程的线程id：每个任务占住自己的线程，直到所有线程都各拿到一个
+ */
+static std::vector<int> worker_ids(sylar::Scheduler &sc) {
+    sylar::Mutex mutex;
+    std::set<int> ids;
+    for (int i = 0; i < s_threads; i++) {
+        sc.schedule([&]() {
+            {
+                sylar::Mutex::Lock lock(mutex);
+                ids.insert(sylar::GetThreadId());
+            }
+            while (true) {
+                {
+                    sylar::Mutex::Lock lock(mutex);
+                    if ((int)ids.size() == s_threads) {
+                        break;
+                    }
+                }
+                usleep(1000);
+            }
+            ++s_done;
+        });
+    }
+    wait_done(s_threads);
+    return std::vector<int>(ids.begin(), ids.end());
+}
+
+/**
+ * @brief schedule(begin, end)跨越多个32个一组的批次，元素被移走，每个任务执行一次
+ */
+static void test_range(sylar::Scheduler &sc) {
+    usleep(20000);
+    reset_counters();
+    std::vector<std::function<void()>> cbs;
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 40; i++) {
+        cbs.push_back([i]() {
+            ++s_runs[i];
+            ++s_done;
+        });
+    }
+    for (int i = 40; i < 60; i++) {
+        fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber([i]() {
+            ++s_runs[i];
+            ++s_done;
+        })));
+    }
+    sc.schedule(cbs.begin(), cbs.end());
+    sc.schedule(fibers.begin(), fibers.end());
+    int tickles = s_tickles;
+    for (auto &i : cbs) {
+        SYLAR_ASSERT(!i);
+    }
+    for (auto &i : fibers) {
+        SYLAR_ASSERT(!i);
+    }
+    wait_done(60);
+    check_runs(60);
+    // 三批，每批最多唤醒全部空闲线程
+    SYLAR_LOG_INFO(g_logger) << "range tasks=60 tickles=" << tickles;
+    SYLAR_ASSERT(tickles <= 3 * s_threads);
+    SYLAR_ASSERT(s_worker_tickles == 0);
+}
+
+/**
+ * @brief 外部线程调度一批混合了指定线程的任务，指定线程的任务只唤醒自己的线程
+ */
+static void test_mixed_external(sylar::Scheduler &sc, const std::vector<int> &ids) {
+    usleep(20000);
+    reset_counters();
+    sylar::Scheduler::ScheduleTask tasks[5];
+    for (int i = 0; i < 5; i++) {
+        int thread = i < 3 ? ids[i] : -1;
+        tasks[i]   = sylar::Scheduler::ScheduleTask([i, thread]() {
+            if (thread != -1 && sylar::GetThreadId() != thread) {
+                ++s_wrong_thread;
+            }
+            ++s_runs[i];
+            ++s_done;
+        }, thread);
+    }
+    sc.scheduleBatch(tasks, 5);
+    int tickles        = s_tickles;
+    int worker_tickles = s_worker_tickles;
+    for (auto &i : tasks) {
+        SYLAR_ASSERT(!i.fiber && !i.cb);
+    }
+    wait_done(5);
+    check_runs(5);
+    SYLAR_LOG_INFO(g_logger) << "external pinned=3 shared=2 tickles=" << tickles
+                             << " worker_tickles=" << worker_tickles;
+    SYLAR_ASSERT(worker_tickles == 3);
+    SYLAR_ASSERT(tickles == 2);
+}
+
+/**
+ * @brief 调度线程里调度一批任务：指定给自己的不唤醒，指定给别人的唤醒那个线程，未指定的放本地队列按个数唤醒
+ */
+static void test_mixed_worker(sylar::Scheduler &sc, const std::vector<int> &ids) {
+    usleep(20000);
+    std::atomic<int> tickles        = {-1};
+    std::atomic<int> worker_tickles = {-1};
+    sc.schedule([&]() {
+        reset_counters();
+        int self = sylar::GetThreadId();
+        int other = ids[0] == self ? ids[1] : ids[0];
+        sylar::Scheduler::ScheduleTask tasks[3];
+        int threads[3] = {self, other, -1};
+        for (int i = 0; i < 3; i++) {
+            int thread = threads[i];
+            tasks[i]   = sylar::Scheduler::ScheduleTask([i, thread]() {
+                if (thread != -1 && sylar::GetThreadId() != thread) {
+                    ++s_wrong_thread;
+                }
+                ++s_runs[i];
+                ++s_done;
+            }, thread);
+        }
+        sylar::Scheduler::GetThis()->scheduleBatch(tasks, 3);
+        tickles        = s_tickles.load();
+        worker_tickles = s_worker_tickles.load();
+        ++s_done;
+    }, ids[0]);
+    wait_done(4);
+    check_runs(3);
+    SYLAR_LOG_INFO(g_logger) << "worker pinned=2 shared=1 tickles=" << tickles
+                             << " worker_tickles=" << worker_tickles;
+    SYLAR_ASSERT(worker_tickles == 1);
+    SYLAR_ASSERT(tickles == 1);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    BatchScheduler sc;
+    sc.start();
+    std::vector<int> ids = worker_ids(sc);
+    SYLAR_ASSERT((int)ids.size() == s_threads);
+
+    test_range(sc);
+    test_mixed_external(sc, ids);
+    test_mixed_worker(sc, ids);
+    sc.stop();
+
+    SYLAR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
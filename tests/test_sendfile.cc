@@ -0,0 +1,301 @@
+/**
+ * @file test_sendfile.cc
+ * @brief hook后的sendfile/splice/tee/copy_file_range
+ * @details 服务端协程用Socket::sendFile把文件的一段发给客户端，客户端协程收下来逐字节校验，
+ *          同时和read+send的方式对比吞吐；再检查对端不读时sendFile按发送超时返回，
+ *          以及socket->管道->文件的splice、管道间的tee、文件间的copy_file_range，
+ *          管道->socket的splice遇到慢的对端时挂起等待而不是空转
+ *          参数：-s 文件大小(MB)
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <fcntl.h>
+#include <sys/sendfile.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_size_mb      = 64;
+static const char *s_path = "/tmp/sylar_test_sendfile.dat";
+static const char *s_copy = "/tmp/sylar_test_sendfile.copy";
+
+static char pattern(uint64_t pos) {
+    return (char)(pos * 131 + pos / 4096);
+}
+
+static void make_file(size_t size) {
+    std::string buf(1024 * 1024, 0);
+    int fd = open(s_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    SYLAR_ASSERT(fd >= 0);
+    for (size_t pos = 0; pos < size; pos += buf.size()) {
+        for (size_t i = 0; i < buf.size(); i++) {
+            buf[i] = pattern(pos + i);
+        }
+        SYLAR_ASSERT(write(fd, buf.data(), buf.size()) == (ssize_t)buf.size());
+    }
+    close(fd);
+}
+
+static sylar::Socket::ptr connect_pair(sylar::Socket::ptr server, sylar::Address::ptr addr, sylar::Socket::ptr &client) {
+    client = sylar::Socket::CreateTCP(addr);
+    sylar::IOManager::GetThis()->schedule([client, addr]() {
+        SYLAR_ASSERT(client->connect(addr));
+    });
+    sylar::Socket::ptr peer = server->accept();
+    SYLAR_ASSERT(peer);
+    while (!client->isConnected()) {
+        usleep(100);
+    }
+    return peer;
+}
+
+/**
+ * @brief 收length字节，校验内容是文件从offset开始的数据
+ */
+static void receive(sylar::Socket::ptr sock, uint64_t offset, size_t length, std::atomic<bool> &done) {
+    std::vector<char> buf(256 * 1024);
+    size_t total = 0;
+    while (total < length) {
+        int rt = sock->recv(&buf[0], buf.size());
+        SYLAR_ASSERT(rt > 0);
+        for (int i = 0; i < rt; i++) {
+            SYLAR_ASSERT(buf[i] == pattern(offset + total + i));
+        }
+        total += rt;
+    }
+    SYLAR_ASSERT(total == length);
+    done = true;
+}
+
+static void check_sendfile(sylar::Socket::ptr server, sylar::Address::ptr addr) {
+    size_t size = (size_t)s_size_mb * 1024 * 1024;
+    int fd      = open(s_path, O_RDONLY);
+    SYLAR_ASSERT(fd >= 0);
+
+    // sendFile和read+send各发一遍，偏移不对齐
+    for (int zero_copy = 1; zero_copy >= 0; zero_copy--) {
+        sylar::Socket::ptr client;
+        sylar::Socket::ptr peer = connect_pair(server, addr, client);
+        // 发送缓冲区小，保证sendfile一定会EAGAIN挂起
+        peer->setOption(SOL_SOCKET, SO_SNDBUF, 64 * 1024);
+        uint64_t offset = 12345;
+        size_t length   = size - offset - 999;
+        std::atomic<bool> done(false);
+        sylar::IOManager::GetThis()->schedule(std::bind(&receive, client, offset, length, std::ref(done)));
+
+        uint64_t start = sylar::GetElapsedUS();
+        int64_t sent   = 0;
+        if (zero_copy) {
+            sent = peer->sendFile(fd, offset, length);
+        } else {
+            std::vector<char> buf(256 * 1024);
+            while ((size_t)sent < length) {
+                size_t n = std::min(buf.size(), length - sent);
+                SYLAR_ASSERT(pread(fd, &buf[0], n, offset + sent) == (ssize_t)n);
+                for (size_t i = 0; i < n;) {
+                    int rt = peer->send(&buf[i], n - i);
+                    SYLAR_ASSERT(rt > 0);
+                    i += rt;
+                }
+                sent += n;
+            }
+        }
+        while (!done) {
+            usleep(1000);
+        }
+        uint64_t used = sylar::GetElapsedUS() - start;
+        SYLAR_ASSERT(sent == (int64_t)length);
+        SYLAR_LOG_INFO(g_logger) << (zero_copy ? "sendFile" : "read+send") << " " << length / 1024 / 1024 << "MB"
+                                 << " used=" << used / 1000 << "ms " << length / (double)used << "MB/s";
+        client->close();
+        peer->close();
+    }
+
+    // 超出文件末尾时只发到文件结束
+    {
+        sylar::Socket::ptr client;
+        sylar::Socket::ptr peer = connect_pair(server, addr, client);
+        std::atomic<bool> done(false);
+        sylar::IOManager::GetThis()->schedule(std::bind(&receive, client, size - 100, 100, std::ref(done)));
+        SYLAR_ASSERT(peer->sendFile(fd, size - 100, 1000) == 100);
+        while (!done) {
+            usleep(1000);
+        }
+        client->close();
+        peer->close();
+    }
+
+    // 对端不读，发送超时，返回超时前已经填进发送缓冲区的字节数
+    {
+        sylar::Socket::ptr client;
+        sylar::Socket::ptr peer = connect_pair(server, addr, client);
+        peer->setSendTimeout(100);
+        uint64_t start = sylar::GetElapsedMS();
+        int64_t rt     = peer->sendFile(fd, 0, size);
+        uint64_t used  = sylar::GetElapsedMS() - start;
+        SYLAR_LOG_INFO(g_logger) << "sendFile timeout rt=" << rt << " errno=" << errno << " used=" << used << "ms";
+        SYLAR_ASSERT(rt > 0 && rt < (int64_t)size && errno == ETIMEDOUT && used >= 100 && used < 300);
+        client->close();
+        peer->close();
+    }
+    close(fd);
+}
+
+static void check_splice(sylar::Socket::ptr server, sylar::Address::ptr addr) {
+    const size_t length = 4 * 1024 * 1024;
+    sylar::Socket::ptr client;
+    sylar::Socket::ptr peer = connect_pair(server, addr, client);
+    int pipefd[2];
+    SYLAR_ASSERT(pipe(pipefd) == 0);
+    int out = open(s_copy, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    SYLAR_ASSERT(out >= 0);
+
+    // 客户端慢慢发，服务端splice会在socket上EAGAIN挂起
+    sylar::IOManager::GetThis()->schedule([client]() {
+        std::vector<char> buf(64 * 1024);
+        for (size_t pos = 0; pos < length; pos += buf.size()) {
+            for (size_t i = 0; i < buf.size(); i++) {
+                buf[i] = pattern(pos + i);
+            }
+            SYLAR_ASSERT(client->send(&buf[0], buf.size()) == (int)buf.size());
+            usleep(1000);
+        }
+    });
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = splice(peer->getSocket(), nullptr, pipefd[1], nullptr, 64 * 1024, SPLICE_F_MOVE);
+        SYLAR_ASSERT(n > 0);
+        // 管道里的先复制一份到另一个管道再丢掉，检查tee
+        int dup_pipe[2];
+        SYLAR_ASSERT(pipe(dup_pipe) == 0);
+        SYLAR_ASSERT(tee(pipefd[0], dup_pipe[1], n, 0) == n);
+        close(dup_pipe[0]);
+        close(dup_pipe[1]);
+        for (ssize_t left = n; left > 0;) {
+            ssize_t m = splice(pipefd[0], nullptr, out, nullptr, left, SPLICE_F_MOVE);
+            SYLAR_ASSERT(m > 0);
+            left -= m;
+        }
+        total += n;
+    }
+    close(out);
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    // 文件间复制，再读回校验
+    int in = open(s_copy, O_RDONLY);
+    out    = open(s_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    SYLAR_ASSERT(in >= 0 && out >= 0);
+    loff_t off_in = 0;
+    while (off_in < (loff_t)length) {
+        ssize_t n = copy_file_range(in, &off_in, out, nullptr, length - off_in, 0);
+        SYLAR_ASSERT(n > 0);
+    }
+    std::vector<char> buf(length);
+    SYLAR_ASSERT(pread(out, &buf[0], length, 0) == (ssize_t)length);
+    for (size_t i = 0; i < length; i++) {
+        SYLAR_ASSERT(buf[i] == pattern(i));
+    }
+    close(in);
+    close(out);
+    SYLAR_LOG_INFO(g_logger) << "splice/tee/copy_file_range " << length / 1024 / 1024 << "MB ok";
+    client->close();
+    peer->close();
+}
+
+static uint64_t thread_cpu_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 管道->socket的splice遇到慢吞吞的对端：管道一直可读，卡住的是socket，
+ *        应该挂起等socket可写，而不是在管道的可读事件上空转
+ */
+static void check_splice_slow_reader(sylar::Socket::ptr server, sylar::Address::ptr addr) {
+    const size_t length = 4 * 1024 * 1024;
+    const int chunk     = 64 * 1024;
+    sylar::Socket::ptr client;
+    sylar::Socket::ptr peer = connect_pair(server, addr, client);
+    int bufsize             = chunk;
+    SYLAR_ASSERT(setsockopt(peer->getSocket(), SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize)) == 0);
+    SYLAR_ASSERT(setsockopt(client->getSocket(), SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize)) == 0);
+
+    // 管道的读端要能放进epoll才会走到两端都能等待的路径
+    auto pipe_nonblock = sylar::Config::Lookup<bool>("hook.pipe_nonblock");
+    pipe_nonblock->setValue(true);
+    int pipefd[2];
+    SYLAR_ASSERT(pipe(pipefd) == 0);
+    pipe_nonblock->setValue(false);
+    SYLAR_ASSERT(sylar::FdMgr::GetInstance()->get(pipefd[0])->isPollable());
+
+    std::atomic<bool> done(false);
+    sylar::IOManager::GetThis()->schedule([client, length, &done]() {
+        std::vector<char> buf(chunk);
+        size_t total = 0;
+        while (total < length) {
+            int rt = client->recv(&buf[0], buf.size());
+            SYLAR_ASSERT(rt > 0);
+            for (int i = 0; i < rt; i++) {
+                SYLAR_ASSERT(buf[i] == pattern(total + i));
+            }
+            total += rt;
+            usleep(10000);
+        }
+        done = true;
+    });
+
+    uint64_t start = sylar::GetElapsedMS();
+    uint64_t cpu   = thread_cpu_ms();
+    std::vector<char> buf(chunk);
+    for (size_t pos = 0; pos < length; pos += chunk) {
+        for (int i = 0; i < chunk; i++) {
+            buf[i] = pattern(pos + i);
+        }
+        SYLAR_ASSERT(write(pipefd[1], &buf[0], chunk) == chunk);
+        for (ssize_t left = chunk; left > 0;) {
+            ssize_t n = splice(pipefd[0], nullptr, peer->getSocket(), nullptr, left, SPLICE_F_MOVE);
+            SYLAR_ASSERT(n > 0);
+            left -= n;
+        }
+    }
+    while (!done) {
+        usleep(1000);
+    }
+    uint64_t used = sylar::GetElapsedMS() - start;
+    cpu           = thread_cpu_ms() - cpu;
+    SYLAR_LOG_INFO(g_logger) << "splice pipe->slow socket " << length / 1024 / 1024 << "MB used=" << used
+                             << "ms cpu=" << cpu << "ms";
+    // 空转时CPU时间和墙上时间差不多，挂起等待时只剩下填充和校验数据的时间
+    SYLAR_ASSERT(cpu * 3 < used);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    client->close();
+    peer->close();
+}
+
+static void run() {
+    sylar::Address::ptr addr  = sylar::Address::LookupAnyIPAddress("127.0.0.1:8030");
+    sylar::Socket::ptr server = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(server->bind(addr) && server->listen());
+    check_sendfile(server, addr);
+    check_splice(server, addr);
+    check_splice_slow_reader(server, addr);
+    server->close();
+    unlink(s_path);
+    unlink(s_copy);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("s")) {
+        s_size_mb = atoi(sylar::EnvMgr::GetInstance()->get("s").c_str());
+    }
+
+    make_file((size_t)s_size_mb * 1024 * 1024);
+    sylar::IOManager iom(1, false, "sendfile");
+    iom.schedule(&run);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file test_shared_stack.cc
+ * @brief 共享栈协程测试，对比独立栈和共享栈模式下每个挂起连接占用的内存
+ * @details 启动一个长连接的HttpServer，建立大量空闲连接，让服务端的处理协程全部挂起在HttpSession::recvRequest上，
+ *          统计连接建立前后进程的RSS和虚拟内存的增量
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_count = 2000;
+
+/**
+ * @brief 获取进程的虚拟内存和常驻内存大小(字节)
+ */
+static void GetMemory(uint64_t &vsz, uint64_t &rss) {
+    vsz = rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp) {
+        return;
+    }
+    unsigned long pages_vsz = 0, pages_rss = 0;
+    if (fscanf(fp, "%lu %lu", &pages_vsz, &pages_rss) == 2) {
+        vsz = pages_vsz * sysconf(_SC_PAGESIZE);
+        rss = pages_rss * sysconf(_SC_PAGESIZE);
+    }
+    fclose(fp);
+}
+
+static int s_parked = 0;
+
+/**
+ * @brief 消耗一些栈空间之后挂起，模拟一个栈上有数据的空闲协程
+ */
+static void park_fiber() {
+    char buf[4096];
+    memset(buf, 0, sizeof(buf));
+    ++s_parked;
+    sylar::Fiber::GetThis()->yield();
+    SYLAR_ASSERT(buf[100] == 0);
+}
+
+/**
+ * @brief 不经过调度器，直接创建并挂起大量协程
+ */
+void bench_fiber(bool shared) {
+    sylar::Fiber::GetThis();
+    std::vector<sylar::Fiber::ptr> fibers;
+    uint64_t vsz0, rss0, vsz1, rss1;
+    GetMemory(vsz0, rss0);
+    for (int i = 0; i < s_count; i++) {
+        fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber(park_fiber, 0, false, shared)));
+        fibers.back()->resume();
+    }
+    GetMemory(vsz1, rss1);
+
+    SYLAR_LOG_INFO(g_logger) << "parked fibers=" << s_count << " shared_stack=" << shared
+                             << " vsz/fiber=" << (vsz1 - vsz0) / s_count
+                             << " rss/fiber=" << (rss1 - rss0) / s_count;
+
+    for (auto &i : fibers) {
+        i->resume();
+    }
+}
+
+/**
+ * @brief 共享栈协程比创建它的线程活得久，线程退出后再析构协程
+ */
+void check_outlive_thread() {
+    std::vector<sylar::Fiber::ptr> fibers;
+    sylar::Thread::ptr thread(new sylar::Thread([&fibers]() {
+        sylar::Fiber::GetThis();
+        for (int i = 0; i < 8; i++) {
+            fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber([]() {}, 0, false, true)));
+            fibers.back()->resume();
+        }
+    }, "outlive"));
+    pid_t tid = thread->getId();
+    thread->join();
+    // 线程的共享栈池已经析构，共享栈要等这些协程释放
+    for (auto &i : fibers) {
+        SYLAR_ASSERT(i->getState() == sylar::Fiber::TERM && i->getBoundThread() == tid);
+    }
+    fibers.clear();
+}
+
+/**
+ * @brief 建立大量空闲的http长连接，统计服务端每个连接的内存占用
+ */
+void bench_http(bool shared) {
+    sylar::IOManager iom(1, false, "http");
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(shared ? "127.0.0.1:8021" : "127.0.0.1:8020");
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true, &iom, &iom, &iom));
+    server->setSharedStack(shared);
+    // 监听socket要在hook线程里创建，否则不会被设置成非阻塞，accept会阻塞住整个IO线程
+    iom.schedule([server, addr]() {
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+    });
+    sleep(1);
+
+    uint64_t vsz0, rss0, vsz1, rss1;
+    GetMemory(vsz0, rss0);
+
+    std::vector<int> clients;
+    for (int i = 0; i < s_count; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, addr->getAddr(), addr->getAddrLen())) {
+            SYLAR_LOG_ERROR(g_logger) << "connect fail errno=" << errno << " errstr=" << strerror(errno);
+            close(fd);
+            break;
+        }
+        clients.push_back(fd);
+    }
+    // 等服务端把所有连接都accept并挂起
+    sleep(2);
+    GetMemory(vsz1, rss1);
+
+    SYLAR_LOG_INFO(g_logger) << "parked http connections=" << clients.size() << " shared_stack=" << shared
+                             << " vsz/conn=" << (vsz1 - vsz0) / std::max(clients.size(), (size_t)1)
+                             << " rss/conn=" << (rss1 - rss0) / std::max(clients.size(), (size_t)1);
+
+    for (auto fd : clients) {
+        close(fd);
+    }
+    server->stop();
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_count = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+
+    bench_fiber(false);
+    bench_fiber(true);
+    SYLAR_ASSERT(s_parked == s_count * 2);
+    check_outlive_thread();
+
+    bench_http(false);
+    bench_http(true);
+    return 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file test_sleep_jitter.cc
+ * @brief hook后的usleep/nanosleep的精度和抖动
+ * @details 协程里反复睡50微秒到5毫秒，统计实际睡眠时间相对请求时间的误差分布，
+ *          误差不应该为负(不能早醒)，分别测有序集合和时间轮两种定时器
+ *          参数：-n 每种睡眠时间的次数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <time.h>
+#include <algorithm>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_rounds = 200;
+
+static void measure(uint64_t us, bool nano) {
+    std::vector<int64_t> errors;
+    errors.reserve(s_rounds);
+    for (int i = 0; i < s_rounds; i++) {
+        uint64_t start = sylar::GetElapsedNS();
+        if (nano) {
+            struct timespec req = {(time_t)(us / 1000000), (long)(us % 1000000 * 1000)};
+            nanosleep(&req, nullptr);
+        } else {
+            usleep(us);
+        }
+        errors.push_back((int64_t)(sylar::GetElapsedNS() - start) / 1000 - (int64_t)us);
+    }
+    std::sort(errors.begin(), errors.end());
+    int64_t sum = 0;
+    for (auto e : errors) {
+        sum += e;
+    }
+    SYLAR_LOG_INFO(g_logger) << (nano ? "nanosleep" : "usleep") << "(" << us << "us)"
+                             << " error min=" << errors.front() << "us"
+                             << " avg=" << sum / (int64_t)errors.size() << "us"
+                             << " p50=" << errors[errors.size() / 2] << "us"
+                             << " p99=" << errors[errors.size() * 99 / 100] << "us"
+                             << " max=" << errors.back() << "us";
+    SYLAR_ASSERT(errors.front() >= 0);
+}
+
+static void run() {
+    static const uint64_t s_sleeps[] = {50, 100, 200, 500, 1000, 2000, 5000};
+    for (auto us : s_sleeps) {
+        measure(us, false);
+    }
+    measure(50, true);
+    measure(1500, true);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_rounds = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+
+    for (bool wheel : {false, true}) {
+        sylar::Config::Lookup<bool>("timer.wheel")->setValue(wheel);
+        SYLAR_LOG_INFO(g_logger) << "timer.wheel=" << wheel;
+        sylar::IOManager iom(1, false, "sleep");
+        iom.schedule(&run);
+    }
+    return 0;
+}
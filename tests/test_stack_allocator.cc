@@ -0,0 +1,100 @@
+/**
+ * @file test_stack_allocator.cc
+ * @brief 协程栈分配器测试，对比不同分配器下协程创建/销毁的吞吐量
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<std::string>::ptr g_stack_allocator =
+    sylar::Config::Lookup<std::string>("fiber.stack_allocator");
+
+static void empty_fiber() {
+}
+
+/**
+ * @brief 只测分配器本身的分配/释放开销
+ */
+void bench_alloc(const std::string &name, int count) {
+    sylar::StackAllocator *allocator = sylar::StackAllocator::Lookup(name);
+    const size_t size = 128 * 1024;
+
+    uint64_t start = sylar::GetCurrentUS();
+    for (int i = 0; i < count; i++) {
+        void *vp = allocator->alloc(size);
+        allocator->dealloc(vp, size);
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+
+    SYLAR_LOG_INFO(g_logger) << "alloc/dealloc allocator=" << name
+                             << " count=" << count
+                             << " used=" << used << "us"
+                             << " ops=" << (used ? count * 1000000ull / used : 0) << "/s";
+}
+
+/**
+ * @brief 测试协程创建，运行，销毁的整体开销
+ */
+void bench_fiber(const std::string &name, int count) {
+    g_stack_allocator->setValue(name);
+    sylar::Fiber::GetThis();
+
+    uint64_t start = sylar::GetCurrentUS();
+    for (int i = 0; i < count; i++) {
+        sylar::Fiber::ptr fiber(new sylar::Fiber(empty_fiber, 0, false));
+        fiber->resume();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+
+    SYLAR_LOG_INFO(g_logger) << "fiber create/destroy allocator=" << name
+                             << " count=" << count
+                             << " used=" << used << "us"
+                             << " ops=" << (used ? count * 1000000ull / used : 0) << "/s"
+                             << " stats=" << sylar::StackAllocator::StatsToString();
+}
+
+/**
+ * @brief 同时存在大量协程时，观察live/cached/peak的变化
+ */
+void test_stats() {
+    g_stack_allocator->setValue("pooled");
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 100; i++) {
+        fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber(empty_fiber, 0, false)));
+    }
+    SYLAR_LOG_INFO(g_logger) << "100 fibers alive: " << sylar::StackAllocator::StatsToString();
+    for (auto &i : fibers) {
+        i->resume();
+    }
+    fibers.clear();
+    SYLAR_LOG_INFO(g_logger) << "100 fibers destroyed: " << sylar::StackAllocator::StatsToString();
+    sylar::PooledStackAllocator::Trim();
+    SYLAR_LOG_INFO(g_logger) << "after trim: " << sylar::StackAllocator::StatsToString();
+    SYLAR_ASSERT(sylar::StackAllocator::GetStats().cached == 0);
+
+    // 不是fiber.stack_size大小的栈直接释放，不进缓存
+    sylar::StackAllocator *pooled = sylar::StackAllocator::Lookup("pooled");
+    void *vp                      = pooled->alloc(256 * 1024);
+    pooled->dealloc(vp, 256 * 1024);
+    vp = pooled->alloc(128 * 1024);
+    pooled->dealloc(vp, 128 * 1024);
+    SYLAR_ASSERT(sylar::StackAllocator::GetStats().cached == 1);
+    sylar::PooledStackAllocator::Trim();
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    const int count = 100000;
+    for (auto &name : {"malloc", "mmap", "pooled"}) {
+        bench_alloc(name, count);
+    }
+    for (auto &name : {"malloc", "mmap", "pooled"}) {
+        bench_fiber(name, count);
+    }
+    test_stats();
+    return 0;
+}
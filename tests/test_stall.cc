@@ -0,0 +1,99 @@
+/**
+ * @file test_stall.cc
+ * @brief 调度线程卡顿检测
+ * @details 单线程IOManager上的协程分别空转占用CPU、等一把被普通线程长时间持有的互斥锁，
+ *          检查卡顿被报告了一次、报告里有协程id和卡住的位置；正常频繁让出的协程不会被报告；
+ *          最后打印协程单次运行时长的分布
+ *          参数：-t 卡顿的毫秒数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <mutex>
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t s_stall_ms  = 200;
+static const uint32_t s_budget_ms = 50;
+
+/**
+ * @brief 空转ms毫秒，不让出协程，不能是static的，否则调用栈里看不到名字
+ */
+void stall_busy_loop(uint64_t ms) __attribute__((noinline));
+void stall_busy_loop(uint64_t ms) {
+    uint64_t end = sylar::GetElapsedMS() + ms;
+    while (sylar::GetElapsedMS() < end) {
+    }
+}
+
+static void expect_stall(uint64_t count, uint64_t fiber_id, const char *where) {
+    auto watchdog = sylar::StallWatchdogMgr::GetInstance();
+    std::string report = watchdog->getLastReport();
+    SYLAR_LOG_INFO(g_logger) << "stalls=" << watchdog->getStallCount() << " last report:\n" << report;
+    SYLAR_ASSERT(watchdog->getStallCount() == count);
+    SYLAR_ASSERT(report.find("fiber_id=" + std::to_string(fiber_id) + " ") != std::string::npos);
+    SYLAR_ASSERT(report.find(where) != std::string::npos);
+}
+
+static void run() {
+    auto watchdog  = sylar::StallWatchdogMgr::GetInstance();
+    uint64_t count = watchdog->getStallCount();
+
+    // 频繁让出的协程不算卡顿
+    for (int i = 0; i < 1000; i++) {
+        usleep(100);
+    }
+    SYLAR_ASSERT(watchdog->getStallCount() == count);
+
+    stall_busy_loop(s_stall_ms);
+    expect_stall(++count, sylar::Fiber::GetFiberId(), "stall_busy_loop");
+
+    // 让出一次，开始新的一段运行，同一段运行只报告一次
+    usleep(1000);
+
+    // 普通线程持有互斥锁，协程阻塞在加锁上
+    std::mutex mutex;
+    std::atomic<bool> locked(false);
+    std::thread holder([&mutex, &locked]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        locked = true;
+        usleep(s_stall_ms * 1000);
+    });
+    while (!locked) {
+        usleep(1000);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    holder.join();
+    expect_stall(++count, sylar::Fiber::GetFiberId(), "pthread_mutex_lock");
+
+    // 关掉之后不再报告
+    sylar::Config::Lookup<uint32_t>("scheduler.stall_budget_ms")->setValue(0);
+    stall_busy_loop(s_stall_ms);
+    usleep(100 * 1000);
+    SYLAR_ASSERT(watchdog->getStallCount() == count);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_stall_ms = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+    SYLAR_ASSERT(s_stall_ms >= s_budget_ms * 2);
+    sylar::Config::Lookup<uint32_t>("scheduler.stall_budget_ms")->setValue(s_budget_ms);
+    // 中途关掉检测之后运行时长照样统计
+    sylar::Config::Lookup<bool>("scheduler.slice_timing")->setValue(true);
+
+    sylar::RunSliceHistogram slices;
+    {
+        sylar::IOManager iom(1, false, "stall");
+        iom.schedule(&run);
+        iom.stop();
+        slices = iom.getRunSliceHistogram();
+    }
+    SYLAR_LOG_INFO(g_logger) << "run slices: " << slices.toString();
+    SYLAR_ASSERT(slices.getTotal() >= 1000 && slices.getMax() >= s_stall_ms * 1000);
+    SYLAR_ASSERT(slices.percentile(0.9) < s_budget_ms * 1000);
+    return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file test_task_alloc.cc
+ * @brief 调度任务的内存分配测试
+ * @details 重载全局operator new统计分配次数，调度器预热之后，反复调度小的函数任务，稳定状态下应该一次分配都没有
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <stdlib.h>
+
+static std::atomic<uint64_t> s_alloc_count = {0};
+
+void *operator new(size_t size) {
+    ++s_alloc_count;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_rounds   = 100;
+static const int s_per_round = 1000;
+
+static int s_run = 0;
+static uint64_t s_alloc_begin = 0;
+static uint64_t s_alloc_end   = 0;
+
+/**
+ * @brief 每轮调度一批捕获了几个变量的lambda，然后把自己重新加入调度并yield，等这一批都执行完再进入下一轮
+ * @details 第一轮用来预热，队列扩容、复用的任务协程都在第一轮完成，从第二轮开始统计
+ */
+void driver() {
+    sylar::Scheduler *sc = sylar::Scheduler::GetThis();
+    for (int round = 0; round < s_rounds; round++) {
+        if (round == 1) {
+            s_alloc_begin = s_alloc_count;
+        }
+        for (int i = 0; i < s_per_round; i++) {
+            int *counter = &s_run;
+            int a = i, b = round;
+            sc->schedule([counter, a, b]() {
+                *counter += (a + b) ? 1 : 1;
+            });
+        }
+        sc->schedule(sylar::Fiber::GetThis());
+        sylar::Fiber::GetThis()->yield();
+    }
+    s_alloc_end = s_alloc_count;
+}
+
+void test_task() {
+    int x = 0;
+    sylar::Task small([&x]() { ++x; });
+    SYLAR_ASSERT(small.isInline());
+    sylar::Task moved(std::move(small));
+    SYLAR_ASSERT(!small && moved);
+    moved();
+    SYLAR_ASSERT(x == 1);
+
+    char big[128] = {0};
+    sylar::Task large([big, &x]() { x += big[0] + 1; });
+    SYLAR_ASSERT(!large.isInline());
+    large();
+    SYLAR_ASSERT(x == 2);
+
+    std::function<void()> empty;
+    SYLAR_ASSERT(!sylar::Task(empty));
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    test_task();
+
+    {
+        sylar::Scheduler sc(1, true, "alloc");
+        sc.schedule(&driver);
+        sc.start();
+        sc.stop();
+    }
+
+    SYLAR_ASSERT(s_run == s_rounds * s_per_round);
+    uint64_t tasks = (uint64_t)(s_rounds - 1) * s_per_round;
+    SYLAR_LOG_INFO(g_logger) << "tasks=" << tasks << " allocations=" << (s_alloc_end - s_alloc_begin)
+                             << " allocations/task=" << (double)(s_alloc_end - s_alloc_begin) / tasks;
+    SYLAR_ASSERT2(s_alloc_end == s_alloc_begin, "steady state scheduling should not allocate");
+    return 0;
+}
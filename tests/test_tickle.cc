@@ -0,0 +1,68 @@
+/**
+ * @file test_tickle.cc
+ * @brief 调度风暴下tickle的合并效果
+ * @details 外部线程逐个schedule大量空任务，同时调度线程里的任务不断给自己续任务，
+ *          统计tickle请求次数和真正写eventfd的次数
+ *          参数：-t 调度线程数，-n 外部线程投递的任务数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <time.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_threads = 4;
+static int s_tasks   = 200000;
+
+static std::atomic<int> s_done = {0};
+
+/**
+ * @brief 调度线程内部投递的任务链，每一环再schedule下一环
+ */
+static void chain(int left) {
+    ++s_done;
+    if (left > 0) {
+        sylar::IOManager::GetThis()->schedule(std::bind(&chain, left - 1));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_threads = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_tasks = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+
+    sylar::IOManager iom(s_threads, false, "storm");
+    // 先让调度线程都进入idle
+    usleep(100000);
+
+    uint64_t tickles = iom.getTickleCount();
+    uint64_t wakeups = iom.getWakeupCount();
+    uint64_t start   = sylar::GetElapsedNS();
+    int chain_len  = s_tasks / 10;
+    iom.schedule(std::bind(&chain, chain_len - 1));
+    for (int i = 0; i < s_tasks; i++) {
+        iom.schedule([]() {
+            ++s_done;
+        });
+    }
+    while (s_done < s_tasks + chain_len) {
+        usleep(1000);
+    }
+    uint64_t used = sylar::GetElapsedNS() - start;
+
+    tickles = iom.getTickleCount() - tickles;
+    wakeups = iom.getWakeupCount() - wakeups;
+    SYLAR_LOG_INFO(g_logger) << "threads=" << s_threads << " tasks=" << s_done
+                             << " used=" << used / 1000000 << "ms"
+                             << " tickles=" << tickles << " wakeups=" << wakeups
+                             << " coalesced=" << tickles - wakeups;
+    // 风暴期间线程一直有活干，很少回到idle，绝大部分tickle都应该被合并掉
+    SYLAR_ASSERT(tickles >= (uint64_t)s_tasks / 2 && wakeups * 10 < tickles);
+    return 0;
+}
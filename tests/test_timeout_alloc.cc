@@ -0,0 +1,123 @@
+/**
+ * @file test_timeout_alloc.cc
+ * @brief 带SO_RCVTIMEO的recv在挂起等待路径上的内存分配次数
+ * @details 发送方是普通线程，每隔1毫秒发一个字节，接收方协程每次recv都会先EAGAIN再挂起等待，
+ *          统计调度线程在recv期间的operator new次数，分别测不设超时和设置超时两种情况，
+ *          最后检查超时仍然返回ETIMEDOUT
+ *          参数：-n 每种情况recv的次数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <new>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_rounds = 2000;
+
+/// 只统计打开了开关的线程
+static thread_local bool t_counting = false;
+static std::atomic<uint64_t> s_allocs = {0};
+
+void *operator new(size_t size) {
+    if (t_counting) {
+        s_allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+static void sender(int fd, int n) {
+    for (int i = 0; i < n; i++) {
+        usleep(1000);
+        SYLAR_ASSERT(send(fd, "x", 1, 0) == 1);
+    }
+}
+
+/**
+ * @brief 收n个字节，返回这期间调度线程上的分配次数
+ */
+static uint64_t measure(sylar::Socket::ptr sock, int peer, int n, uint64_t timeout_ms) {
+    sock->setRecvTimeout(timeout_ms);
+    sylar::Thread::ptr thr = std::make_shared<sylar::Thread>(std::bind(&sender, peer, n), "sender");
+    char c;
+    s_allocs   = 0;
+    t_counting = true;
+    for (int i = 0; i < n; i++) {
+        int rt = sock->recv(&c, 1);
+        SYLAR_ASSERT(rt == 1);
+    }
+    t_counting     = false;
+    uint64_t count = s_allocs;
+    thr->join();
+    return count;
+}
+
+static void run() {
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8028");
+    sylar::Socket::ptr server = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(server->bind(addr) && server->listen());
+
+    // 发送方在普通线程里同步连接
+    int peer = -1;
+    sylar::Thread::ptr thr = std::make_shared<sylar::Thread>([&peer, addr]() {
+        peer = socket(AF_INET, SOCK_STREAM, 0);
+        SYLAR_ASSERT(connect(peer, addr->getAddr(), addr->getAddrLen()) == 0);
+    }, "connect");
+    sylar::Socket::ptr sock = server->accept();
+    SYLAR_ASSERT(sock);
+    thr->join();
+
+    // 先预热一轮，让调度器和定时器内部的容器长到稳定大小
+    measure(sock, peer, 100, 1000);
+    uint64_t no_timeout   = measure(sock, peer, s_rounds, (uint64_t)-1);
+    uint64_t with_timeout = measure(sock, peer, s_rounds, 1000);
+    bool wheel            = sylar::IOManager::GetThis()->isTimingWheel();
+    SYLAR_LOG_INFO(g_logger) << "wheel=" << wheel << " rounds=" << s_rounds
+                             << " allocs/recv no_timeout=" << (double)no_timeout / s_rounds
+                             << " with_timeout=" << (double)with_timeout / s_rounds;
+    // 时间轮是侵入式的，设置超时不应该多出分配；有序集合每次插入要分配一个节点
+    if (wheel) {
+        SYLAR_ASSERT(with_timeout <= no_timeout + s_rounds / 100);
+    }
+
+    // 超时语义不变
+    sock->setRecvTimeout(50);
+    uint64_t start = sylar::GetElapsedMS();
+    char c;
+    int rt        = sock->recv(&c, 1);
+    uint64_t used = sylar::GetElapsedMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "recv timeout rt=" << rt << " errno=" << errno << " used=" << used << "ms";
+    SYLAR_ASSERT(rt == -1 && errno == ETIMEDOUT && used >= 50 && used < 150);
+
+    close(peer);
+    sock->close();
+    server->close();
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_rounds = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+
+    sylar::Config::Lookup<bool>("timer.wheel")->setValue(false);
+    {
+        sylar::IOManager iom(1, false, "alloc");
+        iom.schedule(&run);
+    }
+    sylar::Config::Lookup<bool>("timer.wheel")->setValue(true);
+    {
+        sylar::IOManager iom(1, false, "alloc");
+        iom.schedule(&run);
+    }
+    return 0;
+}
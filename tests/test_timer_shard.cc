@@ -0,0 +1,146 @@
+/**
+ * @file test_timer_shard.cc
+ * @brief 共享定时器和每个调度线程一个定时器分片两种模式的对比
+ * @details 先检查其他线程添加/取消/重置分片里的定时器的正确性，再让每个调度线程并发地
+ *          做do_io那样的"加一个超时定时器再取消"，同时带一些真正到期的短定时器，统计总吞吐
+ *          参数：-t 调度线程数，-ops 每个调度线程添加/取消的次数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+#include <time.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_threads = 4;
+static int s_ops     = 200000;
+
+static std::atomic<int> s_fired = {0};
+static std::atomic<int> s_done  = {0};
+
+/**
+ * @brief 调度线程之外的线程操作定时器，定时器都落在调度线程的分片里，要通过消息交给归属线程
+ */
+static void check(sylar::IOManager &iom) {
+    const int N = 1000;
+    s_fired     = 0;
+    std::vector<sylar::Timer::ptr> timers;
+    for (int i = 0; i < N; i++) {
+        timers.push_back(iom.addTimer(50 + rand() % 100, []() {
+            ++s_fired;
+        }));
+    }
+    // 一半取消，取消过的再取消/刷新/重置都应该失败
+    for (int i = 0; i < N; i += 2) {
+        SYLAR_ASSERT(timers[i]->cancel());
+        SYLAR_ASSERT(!timers[i]->cancel());
+        SYLAR_ASSERT(!timers[i]->refresh());
+        SYLAR_ASSERT(!timers[i]->reset(10, true));
+    }
+    // 先推迟很远再改回来，只应该触发一次
+    std::atomic<int> reset = {0};
+    sylar::Timer::ptr once = iom.addTimer(100000, [&reset]() {
+        ++reset;
+    });
+    SYLAR_ASSERT(once->reset(100, true));
+
+    std::atomic<int> recurring = {0};
+    sylar::Timer::ptr rec      = iom.addTimer(50, [&recurring]() {
+        ++recurring;
+    }, true);
+    usleep(500 * 1000);
+    SYLAR_ASSERT(rec->cancel());
+    SYLAR_ASSERT(!rec->cancel());
+    usleep(100 * 1000);
+
+    SYLAR_LOG_INFO(g_logger) << "sharded=" << iom.isTimerSharded() << " fired=" << s_fired
+                             << " reset=" << reset << " recurring=" << recurring;
+    SYLAR_ASSERT(s_fired == N / 2 && reset == 1 && recurring >= 7 && recurring <= 11);
+    SYLAR_ASSERT(!iom.hasTimer());
+}
+
+/**
+ * @brief 其他线程取消后马上重新启动可复用的定时器，旧的那次到期不能吞掉新的这次
+ */
+static void check_restart(sylar::IOManager &iom) {
+    std::atomic<uint64_t> last = {0};
+    sylar::Timer::ptr timer    = iom.createTimer([&last]() {
+        last = sylar::GetElapsedUS();
+    });
+    int lost = 0;
+    for (int i = 0; i < 200; i++) {
+        timer->start(0);
+        usleep(rand() % 200);
+        timer->cancel();
+        uint64_t start = sylar::GetElapsedUS();
+        timer->start(5);
+        usleep(30 * 1000);
+        // 新的这次最早也要5毫秒后才到期
+        if (last < start + 4000) {
+            ++lost;
+        }
+    }
+    timer->cancel();
+    SYLAR_LOG_INFO(g_logger) << "sharded=" << iom.isTimerSharded() << " restart lost=" << lost;
+    SYLAR_ASSERT(lost == 0);
+}
+
+/**
+ * @brief 每个调度线程上的压测任务，每100次添加/取消里有一个1毫秒后真正到期的定时器
+ */
+static void churn() {
+    sylar::IOManager *iom = sylar::IOManager::GetThis();
+    for (int i = 0; i < s_ops; i++) {
+        sylar::Timer::ptr t = iom->addTimer(5000, []() {});
+        t->cancel();
+        if (i % 100 == 0) {
+            iom->addTimer(1, []() {
+                ++s_fired;
+            });
+        }
+    }
+    ++s_done;
+}
+
+void bench(bool multi_reactor) {
+    sylar::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(multi_reactor);
+    uint64_t used = 0;
+    {
+        sylar::IOManager iom(s_threads, false, "timer");
+        SYLAR_ASSERT(iom.isTimerSharded() == (multi_reactor && s_threads > 1));
+        check(iom);
+        check_restart(iom);
+
+        s_fired = 0;
+        s_done  = 0;
+        // 先让调度线程都进入idle，压测任务分到每个线程上
+        usleep(100 * 1000);
+        uint64_t start = sylar::GetElapsedNS();
+        for (int i = 0; i < s_threads; i++) {
+            iom.schedule(&churn);
+        }
+        while (s_done < s_threads) {
+            usleep(1000);
+        }
+        used = sylar::GetElapsedNS() - start;
+    }
+    SYLAR_ASSERT(s_fired == s_threads * ((s_ops + 99) / 100));
+    SYLAR_LOG_INFO(g_logger) << "multi_reactor=" << multi_reactor << " threads=" << s_threads
+                             << " ops=" << s_threads * s_ops << " used=" << used / 1000000 << "ms"
+                             << " add+cancel/s=" << (uint64_t)(s_threads * s_ops * 1e9 / used);
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("t")) {
+        s_threads = atoi(sylar::EnvMgr::GetInstance()->get("t").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("ops")) {
+        s_ops = atoi(sylar::EnvMgr::GetInstance()->get("ops").c_str());
+    }
+
+    bench(false);
+    bench(true);
+    return 0;
+}
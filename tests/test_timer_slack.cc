@@ -0,0 +1,131 @@
+/**
+ * @file test_timer_slack.cc
+ * @brief 定时器slack的合并效果
+ * @details 模拟大量keep-alive连接的读超时：到期时间分散在一段时间里，一半在到期前被取消，
+ *          对比不同slack下因定时器而起的唤醒批次数、省下的唤醒次数和最大推迟时间；
+ *          最后打开iomanager.timeout_slack，检查一批读超时的socket仍然按时返回ETIMEDOUT
+ *          参数：-n 定时器数量，-conn 读超时测试的连接数
+ * @version 0.1
+ * @date 2026-10-17
+ */
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_timers  = 100000;
+static int s_clients = 100;
+
+static std::atomic<int> s_fired         = {0};
+static std::atomic<uint64_t> s_max_late = {0};
+static std::atomic<int> s_done          = {0};
+
+/**
+ * @brief 返回唤醒批次数
+ */
+static uint64_t bench(uint64_t slack) {
+    s_fired    = 0;
+    s_max_late = 0;
+    sylar::IOManager iom(1, false, "slack");
+    std::vector<sylar::Timer::ptr> timers;
+    timers.reserve(s_timers);
+    uint64_t min_due = UINT64_MAX, max_due = 0;
+    iom.schedule([&iom, &timers, &min_due, &max_due, slack]() {
+        for (int i = 0; i < s_timers; i++) {
+            uint64_t ms  = 500 + rand() % 1000;
+            uint64_t due = sylar::GetElapsedMS() + ms;
+            min_due      = std::min(min_due, due);
+            max_due      = std::max(max_due, due);
+            timers.push_back(iom.addTimer(ms, [due]() {
+                uint64_t late = sylar::GetElapsedMS() - due;
+                if (late > s_max_late) {
+                    s_max_late = late;
+                }
+                ++s_fired;
+            }, false, slack));
+        }
+        // 一半连接在超时前有数据到达，超时被取消
+        for (int i = 0; i < s_timers; i += 2) {
+            timers[i]->cancel();
+        }
+    });
+    while (s_fired < s_timers / 2) {
+        usleep(10000);
+    }
+    uint64_t fired   = iom.getTimerFiredCount();
+    uint64_t batches = iom.getTimerBatchCount();
+    uint64_t saved   = iom.getSlackSavedCount();
+    // 推迟多少取决于机器负载，只输出不检查
+    SYLAR_LOG_INFO(g_logger) << "slack=" << slack << "ms timers=" << s_timers
+                             << " fired=" << fired << " batches=" << batches
+                             << " saved=" << saved << " max_late=" << s_max_late << "ms";
+    // 每批里去重后的到期时间点不会比触发的定时器多
+    SYLAR_ASSERT(fired == (uint64_t)s_timers / 2 && batches + saved <= fired);
+    if (slack == 0) {
+        SYLAR_ASSERT(saved == 0);
+    } else {
+        // 到期时间都取整到slack的整数倍，批次数不会超过这段时间里的窗口数
+        SYLAR_ASSERT(saved > 0 && batches <= (max_due - min_due + 1) / slack + 2);
+    }
+    return batches;
+}
+
+static void client(sylar::Address::ptr addr) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    sock->setRecvTimeout(200 + rand() % 100);
+    char buf[8];
+    uint64_t start = sylar::GetElapsedMS();
+    int rt         = sock->recv(buf, sizeof(buf));
+    uint64_t used  = sylar::GetElapsedMS() - start;
+    SYLAR_ASSERT(rt == -1 && errno == ETIMEDOUT && used >= 200 && used < 400);
+    ++s_done;
+}
+
+static void check_io_slack() {
+    sylar::Config::Lookup<uint64_t>("iomanager.timeout_slack")->setValue(50);
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8029");
+    // 要比iom后析构，iom析构时才等accept协程退出
+    std::vector<sylar::Socket::ptr> peers;
+    sylar::Socket::ptr server;
+    sylar::IOManager iom(1, false, "io_slack");
+    iom.schedule([&server, &peers, addr]() {
+        server = sylar::Socket::CreateTCP(addr);
+        SYLAR_ASSERT(server->bind(addr) && server->listen());
+        // 服务端只接受连接不发数据，客户端的recv全部超时
+        while (sylar::Socket::ptr peer = server->accept()) {
+            peers.push_back(peer);
+        }
+    });
+    usleep(100 * 1000);
+    uint64_t batches = iom.getTimerBatchCount();
+    for (int i = 0; i < s_clients; i++) {
+        iom.schedule(std::bind(&client, addr));
+    }
+    while (s_done < s_clients) {
+        usleep(10000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "io timeout_slack=50ms clients=" << s_clients
+                             << " batches=" << iom.getTimerBatchCount() - batches
+                             << " saved=" << iom.getSlackSavedCount();
+    iom.schedule([&server]() {
+        server->close();
+    });
+}
+
+int main(int argc, char *argv[]) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    if (sylar::EnvMgr::GetInstance()->has("n")) {
+        s_timers = atoi(sylar::EnvMgr::GetInstance()->get("n").c_str());
+    }
+    if (sylar::EnvMgr::GetInstance()->has("conn")) {
+        s_clients = atoi(sylar::EnvMgr::GetInstance()->get("conn").c_str());
+    }
+
+    bench(0);
+    uint64_t batches10  = bench(10);
+    uint64_t batches100 = bench(100);
+    SYLAR_ASSERT(batches100 < batches10);
+    check_io_slack();
+    return 0;
+}